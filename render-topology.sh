@@ -1,9 +1,18 @@
+# The topology is served by the metrics server, pass its port as
+# the first argument if it is not 9100
+url="http://localhost:${1:-9100}/topology"
+
+curl -s "$url" > topo.dot;
 cat topo.dot;
 dot -Tpng topo.dot -o topo.png;
 
 xdg-open topo.png&
 
-while inotifywait -e close_write topo.dot; do
-	cat topo.dot;
-	dot -Tpng topo.dot -o topo.png;
+while sleep 1; do
+	curl -s "$url" > topo.new;
+	if ! cmp -s topo.new topo.dot; then
+		mv topo.new topo.dot;
+		cat topo.dot;
+		dot -Tpng topo.dot -o topo.png;
+	fi
 done
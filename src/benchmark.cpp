@@ -0,0 +1,311 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+
+#include "id_allocator.hpp"
+#include "routing_engine.hpp"
+#include "rule_accounting.hpp"
+#include "tag.hpp"
+#include "xid_table.hpp"
+#include "physical_switch.hpp"
+#include "packet_in_view.hpp"
+#include "buffer_table.hpp"
+#include "bidirectional_map.hpp"
+#include "byte_order.hpp"
+
+/**
+ * Benchmarks of the parts of the hypervisor that run for every
+ * message or topology change. Every benchmark is repeated until
+ * it ran long enough to give a stable time per iteration.
+ *
+ * Usage: delftvisor_bench [filter]
+ * Only the benchmarks whose name contains the filter are run.
+ */
+
+namespace {
+	/// The minimum time a benchmark runs in milliseconds
+	constexpr int min_duration = 200;
+
+	/// The filter on the benchmark names
+	std::string filter;
+
+	/// Keep the compiler from optimizing a computed value away
+	template<class T>
+	void keep(const T& value) {
+		asm volatile("" : : "g"(&value) : "memory");
+	}
+
+	/// Run a benchmark and print the time per iteration
+	template<class Function>
+	void run_benchmark(const std::string& name, Function function) {
+		if( name.find(filter) == std::string::npos ) return;
+
+		// Double the iterations until the benchmark runs long enough
+		for( size_t iterations=1;; iterations*=2 ) {
+			auto start = std::chrono::steady_clock::now();
+			for( size_t i=0; i<iterations; ++i ) function();
+			auto duration = std::chrono::steady_clock::now() - start;
+
+			if( duration >= std::chrono::milliseconds(min_duration) ) {
+				double nanoseconds = std::chrono::duration_cast<
+					std::chrono::duration<double,std::nano>>(duration).count();
+				std::cout << std::left << std::setw(40) << name
+					<< std::right << std::setw(12) << iterations
+					<< std::setw(14) << std::fixed << std::setprecision(1)
+					<< nanoseconds/iterations << " ns" << std::endl;
+				return;
+			}
+		}
+	}
+
+	/// A link in a synthetic topology
+	struct Link {
+		int switch_1;
+		uint32_t port_1;
+		int switch_2;
+		uint32_t port_2;
+	};
+
+	/// Create a ring with random chords, like the topologies in configuration/
+	std::vector<Link> make_topology(int num_switches) {
+		std::vector<Link> links;
+		std::vector<uint32_t> next_port(num_switches, 1);
+		auto add = [&](int switch_1, int switch_2) {
+			links.push_back({
+				switch_1, next_port[switch_1]++,
+				switch_2, next_port[switch_2]++});
+		};
+
+		for( int i=0; i<num_switches; ++i ) add(i, (i+1)%num_switches);
+
+		std::minstd_rand random(num_switches);
+		std::uniform_int_distribution<int> distribution(0, num_switches-1);
+		for( int i=0; i<num_switches/4; ++i ) {
+			int switch_1 = distribution(random);
+			int switch_2 = distribution(random);
+			if( switch_1 != switch_2 ) add(switch_1, switch_2);
+		}
+		return links;
+	}
+
+	/// Create a routing engine with a synthetic topology
+	void setup_routing_engine(RoutingEngine& routing_engine, const std::vector<Link>& links) {
+		for( int i=0; i<routing_engine.get_num_switches(); ++i ) {
+			routing_engine.set_active(i, true);
+		}
+		for( const Link& link : links ) {
+			routing_engine.add_link(link.switch_1, link.port_1, link.switch_2, link.port_2);
+		}
+	}
+
+	void benchmark_id_allocator() {
+		IdAllocator<1,65535> allocator;
+		std::vector<unsigned long long> ids;
+		for( int i=0; i<1000; ++i ) ids.push_back(allocator.new_id());
+
+		size_t i = 0;
+		run_benchmark("id_allocator/churn", [&] {
+			size_t index = (i++*7919) % ids.size();
+			allocator.free_id(ids[index]);
+			ids[index] = allocator.new_id();
+		});
+	}
+
+	void benchmark_xid_table() {
+		XidTable<uint64_t> table(1024);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+		auto ignore = [](uint32_t, uint64_t&) {};
+		for( uint32_t xid=0; xid<512; ++xid ) table.insert(xid, xid, deadline, ignore);
+
+		// Answer the oldest request and send a new one
+		uint32_t xid = 512;
+		run_benchmark("xid_table/insert_erase", [&] {
+			uint64_t value;
+			bool found = table.erase(xid-512, value);
+			keep(found);
+			table.insert(xid, xid, deadline, ignore);
+			++xid;
+		});
+	}
+
+	void benchmark_tags() {
+		unsigned int i = 0;
+		run_benchmark("vlan_tag/encode", [&] {
+			VLANTag tag;
+			tag.set_switch(i % VLANTag::max_switch_id);
+			tag.set_port(i % VLANTag::max_port_id);
+			tag.set_slice(i % VLANTag::max_slice_id);
+			uint16_t raw = tag.make_raw();
+			keep(raw);
+			++i;
+		});
+		run_benchmark("vlan_tag/decode", [&] {
+			VLANTag tag(uint16_t(i++));
+			unsigned int switch_id = tag.get_switch();
+			keep(switch_id);
+		});
+		run_benchmark("pbb_tag/encode", [&] {
+			PBBTag tag;
+			tag.set_switch(i % PBBTag::max_switch_id);
+			tag.set_port(i % PBBTag::max_port_id);
+			tag.set_slice(i % PBBTag::max_slice_id);
+			uint32_t raw = tag.make_raw();
+			keep(raw);
+			++i;
+		});
+
+		fluid_msg::of13::FlowMod flow_mod;
+		flow_mod.add_oxm_field(new fluid_msg::of13::InPort(1));
+		run_benchmark("metadata_tag/add_to_match", [&] {
+			fluid_msg::of13::FlowMod tagged(flow_mod);
+			MetadataTag tag;
+			tag.set_group(i & 1);
+			tag.set_virtual_switch(i++ % MetadataTag::max_virtual_switch_id);
+			bool added = tag.add_to_match(tagged);
+			keep(added);
+		});
+	}
+
+	void benchmark_rule_accounting() {
+		fluid_msg::of13::Match match;
+		match.add_oxm_field(new fluid_msg::of13::InPort(1));
+		match.add_oxm_field(new fluid_msg::of13::Metadata(2, 0x3fff));
+		run_benchmark("rule_accounting/make_key", [&] {
+			RuleAccounting::Key key = RuleAccounting::make_key(2, 100, match);
+			keep(key);
+		});
+	}
+
+	void benchmark_prepare_instruction_set() {
+		// The instructions of a typical forwarding rule
+		fluid_msg::of13::InstructionSet instruction_set;
+		instruction_set.add_instruction(new fluid_msg::of13::GoToTable(1));
+		instruction_set.add_instruction(new fluid_msg::of13::WriteMetadata(0x12, 0xff));
+		fluid_msg::of13::ApplyActions* apply_actions = new fluid_msg::of13::ApplyActions();
+		apply_actions->add_action(new fluid_msg::of13::OutputAction(1, 0xffff));
+		apply_actions->add_action(new fluid_msg::of13::OutputAction(2, 0xffff));
+		instruction_set.add_instruction(apply_actions);
+		fluid_msg::of13::WriteActions* write_actions = new fluid_msg::of13::WriteActions();
+		write_actions->add_action(new fluid_msg::of13::OutputAction(3, 0xffff));
+		instruction_set.add_instruction(write_actions);
+
+		run_benchmark("physical_switch/prepare_instruction_set", [&] {
+			fluid_msg::of13::InstructionSet prepared_instruction_set;
+			bool has_write_action_group, has_write_action_output;
+			bool prepared = PhysicalSwitch::prepare_instruction_set(
+				instruction_set,
+				prepared_instruction_set,
+				has_write_action_group,
+				has_write_action_output);
+			keep(prepared);
+		});
+	}
+
+	/// Create a packed PacketIn of a rule of virtual switch 1
+	std::vector<uint8_t> make_packet_in() {
+		// The header, a match with in_port and masked metadata,
+		// 2 bytes of padding and a 64 byte packet
+		constexpr size_t match_length = 4 + 8 + 20;
+		std::vector<uint8_t> buffer(24 + match_length + 2 + 64, 0);
+		buffer[0] = fluid_msg::of13::OFP_VERSION;
+		buffer[1] = fluid_msg::of13::OFPT_PACKET_IN;
+		write_uint16(&buffer[2], buffer.size());
+		write_uint32(&buffer[8], 7);
+		write_uint16(&buffer[12], 64);
+
+		uint8_t* match = &buffer[24];
+		write_uint16(match,   fluid_msg::of13::OFPMT_OXM);
+		write_uint16(match+2, match_length);
+		write_uint16(match+4, fluid_msg::of13::OFPXMC_OPENFLOW_BASIC);
+		match[6] = fluid_msg::of13::OFPXMT_OFB_IN_PORT << 1;
+		match[7] = 4;
+		write_uint32(match+8, 1);
+		write_uint16(match+12, fluid_msg::of13::OFPXMC_OPENFLOW_BASIC);
+		match[14] = (fluid_msg::of13::OFPXMT_OFB_METADATA << 1) | 1;
+		match[15] = 16;
+		write_uint64(match+16, uint64_t(1) << 1);
+		write_uint64(match+24, (uint64_t(MetadataTag::max_virtual_switch_id) << 1) | 1);
+		return buffer;
+	}
+
+	void benchmark_packet_in_relay() {
+		std::vector<uint8_t> buffer = make_packet_in();
+		BufferTable buffer_table;
+		bidirectional_map<uint32_t,uint32_t> port_map;
+		port_map.insert(1, 1);
+		port_map.insert(2, 2);
+
+		// The work done per PacketIn on the strand of the physical
+		// switch before it is handed to the scheduler
+		uint32_t in_port = 1;
+		run_benchmark("packet_in/view_relay", [&] {
+			PacketInView packet_in(&buffer[0], buffer.size());
+			if( !packet_in.is_valid() || !packet_in.has_metadata() || !packet_in.has_in_port() ) return;
+
+			MetadataTag metadata_tag(
+				packet_in.get_metadata(),
+				packet_in.get_metadata_mask());
+			int virtual_switch_id = metadata_tag.get_virtual_switch();
+			boost::optional<uint32_t> virtual_in_port =
+				port_map.find_virtual(packet_in.get_in_port());
+			if( !virtual_in_port ) return;
+
+			// Alternate the port so the next iteration reads a changed buffer
+			in_port = 3 - in_port;
+			packet_in.set_in_port(in_port);
+			packet_in.set_buffer_id(
+				buffer_table.add(
+					virtual_switch_id,
+					1,
+					packet_in.get_buffer_id()));
+			keep(packet_in.size());
+		});
+
+		// The full unpack the view replaces
+		run_benchmark("packet_in/unpack", [&] {
+			fluid_msg::of13::PacketIn packet_in;
+			packet_in.unpack(&buffer[0]);
+			fluid_msg::of13::InPort* in_port_tlv =
+				(fluid_msg::of13::InPort*) packet_in.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_IN_PORT);
+			keep(in_port_tlv);
+		});
+	}
+
+	void benchmark_routing_engine() {
+		for( int num_switches : {10, 32, 64, 128} ) {
+			std::string suffix = "/" + std::to_string(num_switches);
+			std::vector<Link> links = make_topology(num_switches);
+
+			RoutingEngine routing_engine(num_switches);
+			setup_routing_engine(routing_engine, links);
+			run_benchmark("routing_engine/recalculate_all" + suffix, [&] {
+				routing_engine.recalculate_all();
+			});
+
+			// A link failure followed by the link coming back
+			size_t i = 0;
+			run_benchmark("routing_engine/link_flap" + suffix, [&] {
+				const Link& link = links[i++ % links.size()];
+				routing_engine.remove_link(link.switch_1, link.port_1, link.switch_2, link.port_2);
+				routing_engine.add_link(link.switch_1, link.port_1, link.switch_2, link.port_2);
+			});
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if( argc > 1 ) filter = argv[1];
+
+	benchmark_id_allocator();
+	benchmark_xid_table();
+	benchmark_tags();
+	benchmark_rule_accounting();
+	benchmark_prepare_instruction_set();
+	benchmark_packet_in_relay();
+	benchmark_routing_engine();
+
+	return 0;
+}
@@ -1,45 +1,136 @@
 #pragma once
 
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/optional.hpp>
+
 /// A generic class to store a bidirectional map between virtual and physical
+/**
+ * The maps are only changed when ports and groups are configured
+ * but translated for every PacketIn, PacketOut and FlowMod. Both
+ * directions are therefore stored sorted in 1 vector, the first
+ * half sorted on the virtual id and the second half on the physical
+ * id, lookups are a binary search in contiguous memory. Inserting
+ * and erasing are linear in the size of the map.
+ */
 template<typename VirtualType, typename PhysicalType>
 class bidirectional_map {
-	std::unordered_map<VirtualType,PhysicalType> virtual_to_physical;
-	std::unordered_map<PhysicalType,VirtualType> physical_to_virtual;
+public:
+	typedef std::pair<VirtualType,PhysicalType> value_type;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+private:
+	/// The pairs sorted on virtual and then on physical
+	std::vector<value_type> entries;
+
+	/// The begin of the pairs sorted on physical
+	const_iterator physical_begin() const {
+		return entries.begin() + entries.size()/2;
+	}
+
+	/// Find the pair with a virtual id or where it should be inserted
+	const_iterator lower_bound_virtual(VirtualType virtual_var) const {
+		return std::lower_bound(
+			entries.begin(),
+			physical_begin(),
+			virtual_var,
+			[](const value_type& entry, VirtualType key) {
+				return entry.first < key;
+			});
+	}
+	/// Find the pair with a physical id or where it should be inserted
+	const_iterator lower_bound_physical(PhysicalType physical_var) const {
+		return std::lower_bound(
+			physical_begin(),
+			entries.end(),
+			physical_var,
+			[](const value_type& entry, PhysicalType key) {
+				return entry.second < key;
+			});
+	}
 
 public:
+	/// Insert a pair, existing pairs with either id are replaced
 	void insert(VirtualType virtual_var, PhysicalType physical_var) {
-		virtual_to_physical[virtual_var]  = physical_var;
-		physical_to_virtual[physical_var] = virtual_var;
+		erase(virtual_var);
+		boost::optional<VirtualType> existing = find_virtual(physical_var);
+		if( existing ) erase(*existing);
+
+		// Insert the pair in the physical half first so the
+		// index in the virtual half stays valid
+		const_iterator physical_it = lower_bound_physical(physical_var);
+		size_t physical_index = physical_it - entries.cbegin();
+		const_iterator virtual_it  = lower_bound_virtual(virtual_var);
+		size_t virtual_index  = virtual_it - entries.cbegin();
+
+		entries.insert(
+			entries.begin() + physical_index,
+			value_type(virtual_var, physical_var));
+		entries.insert(
+			entries.begin() + virtual_index,
+			value_type(virtual_var, physical_var));
 	}
 
+	/// Erase the pair with a virtual id if it exists
 	void erase(VirtualType virtual_var) {
-		auto it = virtual_to_physical.find(virtual_var);
-		physical_to_virtual.erase(it->second);
-		virtual_to_physical.erase(it);
+		const_iterator virtual_it = lower_bound_virtual(virtual_var);
+		if( virtual_it == physical_begin() || virtual_it->first != virtual_var ) return;
+
+		PhysicalType physical_var = virtual_it->second;
+		size_t virtual_index = virtual_it - entries.cbegin();
+		size_t physical_index = lower_bound_physical(physical_var) - entries.cbegin();
+
+		// Erase the one in the second half first so the
+		// index of the first one stays valid
+		entries.erase(entries.begin() + physical_index);
+		entries.erase(entries.begin() + virtual_index);
 	}
 
 	size_t size() const {
-		return virtual_to_physical.size();
+		return entries.size()/2;
+	}
+
+	/// Find the virtual id belonging to a physical id
+	boost::optional<VirtualType> find_virtual(PhysicalType physical_var) const {
+		const_iterator it = lower_bound_physical(physical_var);
+		if( it == entries.end() || it->second != physical_var ) return boost::none;
+		return it->first;
+	}
+	/// Find the physical id belonging to a virtual id
+	boost::optional<PhysicalType> find_physical(VirtualType virtual_var) const {
+		const_iterator it = lower_bound_virtual(virtual_var);
+		if( it == physical_begin() || it->first != virtual_var ) return boost::none;
+		return it->second;
 	}
 
 	bool has_virtual(VirtualType virtual_var) const {
-		return virtual_to_physical.find(virtual_var) != virtual_to_physical.end();
+		return static_cast<bool>(find_physical(virtual_var));
 	}
 	bool has_physical(PhysicalType physical_var) const {
-		return physical_to_virtual.find(physical_var) != physical_to_virtual.end();
+		return static_cast<bool>(find_virtual(physical_var));
 	}
 
+	/// Get the virtual id belonging to a physical id, throws if it doesn't exist
 	VirtualType get_virtual(PhysicalType physical_var) const {
-		return physical_to_virtual.at(physical_var);
+		boost::optional<VirtualType> virtual_var = find_virtual(physical_var);
+		if( !virtual_var ) throw std::out_of_range("Physical id is not mapped");
+		return *virtual_var;
 	}
+	/// Get the physical id belonging to a virtual id, throws if it doesn't exist
 	PhysicalType get_physical(VirtualType virtual_var) const {
-		return virtual_to_physical.at(virtual_var);
+		boost::optional<PhysicalType> physical_var = find_physical(virtual_var);
+		if( !physical_var ) throw std::out_of_range("Virtual id is not mapped");
+		return *physical_var;
 	}
 
-	const std::unordered_map<VirtualType,PhysicalType>& get_virtual_to_physical() const {
-		return virtual_to_physical;
+	/// Iterate over the pairs sorted on virtual id
+	const_iterator begin() const {
+		return entries.begin();
 	}
-	const std::unordered_map<PhysicalType,VirtualType>& get_physical_to_virtual() const {
-		return physical_to_virtual;
+	const_iterator end() const {
+		return physical_begin();
 	}
 };
@@ -0,0 +1,78 @@
+#include "buffer_table.hpp"
+
+#include <fluid/of13msg.hh>
+
+constexpr uint32_t BufferTable::size;
+constexpr int BufferTable::timeout;
+
+BufferTable::BufferTable() :
+	entries(size),
+	next_virtual_buffer_id(0) {
+	// Mark all entries as unused
+	for( Entry& entry : entries ) {
+		entry.virtual_buffer_id = OFP_NO_BUFFER;
+	}
+}
+
+uint32_t BufferTable::get_size() const {
+	return size;
+}
+
+uint32_t BufferTable::add(
+		int virtual_switch_id,
+		uint64_t physical_datapath_id,
+		uint32_t physical_buffer_id) {
+	boost::mutex::scoped_lock lock(mutex);
+
+	// OFP_NO_BUFFER can not be used as buffer id
+	uint32_t virtual_buffer_id = next_virtual_buffer_id++;
+	if( virtual_buffer_id == OFP_NO_BUFFER ) {
+		virtual_buffer_id = next_virtual_buffer_id++;
+	}
+
+	Entry& entry               = entries[virtual_buffer_id%size];
+	entry.virtual_buffer_id    = virtual_buffer_id;
+	entry.virtual_switch_id    = virtual_switch_id;
+	entry.physical_datapath_id = physical_datapath_id;
+	entry.physical_buffer_id   = physical_buffer_id;
+	entry.expires              = clock::now() + std::chrono::milliseconds(timeout);
+
+	return virtual_buffer_id;
+}
+
+bool BufferTable::usable(
+		const Entry& entry,
+		uint32_t virtual_buffer_id,
+		int virtual_switch_id) const {
+	return
+		virtual_buffer_id != OFP_NO_BUFFER &&
+		entry.virtual_buffer_id == virtual_buffer_id &&
+		entry.virtual_switch_id == virtual_switch_id &&
+		entry.expires >= clock::now();
+}
+
+bool BufferTable::contains(
+		uint32_t virtual_buffer_id,
+		int virtual_switch_id) {
+	boost::mutex::scoped_lock lock(mutex);
+
+	return usable(entries[virtual_buffer_id%size], virtual_buffer_id, virtual_switch_id);
+}
+
+bool BufferTable::take(
+		uint32_t virtual_buffer_id,
+		int virtual_switch_id,
+		uint64_t& physical_datapath_id,
+		uint32_t& physical_buffer_id) {
+	boost::mutex::scoped_lock lock(mutex);
+
+	Entry& entry = entries[virtual_buffer_id%size];
+	if( !usable(entry, virtual_buffer_id, virtual_switch_id) ) {
+		return false;
+	}
+
+	physical_datapath_id    = entry.physical_datapath_id;
+	physical_buffer_id      = entry.physical_buffer_id;
+	entry.virtual_buffer_id = OFP_NO_BUFFER;
+	return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <chrono>
+
+#include <boost/thread/mutex.hpp>
+
+/// Translates virtual buffer id's to buffers in the physical switches
+/**
+ * When a physical switch buffers a packet it sends to the
+ * controller the buffer id is replaced with a virtual buffer
+ * id. When the controller refers to this virtual buffer id
+ * in a PacketOut or FlowMod it can be translated back to the
+ * physical switch and buffer id that holds the packet.
+ *
+ * The entries are stored in a fixed size ring indexed by the
+ * virtual buffer id, new entries overwrite the oldest. Entries
+ * also expire after a timeout since the physical switch will
+ * eventually reuse the buffer. PacketIns are relayed from the
+ * strands of the physical switches, so the ring is protected
+ * by a mutex.
+ */
+class BufferTable {
+private:
+	typedef std::chrono::steady_clock clock;
+
+	/// A packet buffered in a physical switch
+	struct Entry {
+		/// The virtual buffer id given to the controller
+		uint32_t virtual_buffer_id;
+		/// The virtual switch the PacketIn was relayed to
+		int virtual_switch_id;
+		/// The physical switch the packet is buffered in
+		uint64_t physical_datapath_id;
+		/// The buffer id in the physical switch
+		uint32_t physical_buffer_id;
+		/// When this entry can no longer be used
+		clock::time_point expires;
+	};
+
+	/// If an entry holds a buffer the virtual switch can use
+	bool usable(
+		const Entry& entry,
+		uint32_t virtual_buffer_id,
+		int virtual_switch_id) const;
+
+	/// The amount of entries in the ring
+	static constexpr uint32_t size = 4096;
+	/// The time in ms a buffer can be used after the PacketIn
+	static constexpr int timeout = 2000;
+
+	/// Protects everything below
+	boost::mutex mutex;
+	/// The ring of entries
+	std::vector<Entry> entries;
+	/// The next virtual buffer id to give out
+	uint32_t next_virtual_buffer_id;
+
+public:
+	/// Create an empty buffer table
+	BufferTable();
+
+	/// Get the amount of buffers that can be referred to
+	uint32_t get_size() const;
+
+	/// Store a buffer of a physical switch
+	/**
+	 * \return The virtual buffer id to give to the virtual switch
+	 */
+	uint32_t add(
+		int virtual_switch_id,
+		uint64_t physical_datapath_id,
+		uint32_t physical_buffer_id);
+
+	/// Check if a buffer can be taken without removing it
+	bool contains(
+		uint32_t virtual_buffer_id,
+		int virtual_switch_id);
+
+	/// Find and remove a buffer, a buffer can only be used once
+	/**
+	 * The lookup fails if the virtual buffer id is not known,
+	 * expired or given to another virtual switch.
+	 * \return If the buffer was found
+	 */
+	bool take(
+		uint32_t virtual_buffer_id,
+		int virtual_switch_id,
+		uint64_t& physical_datapath_id,
+		uint32_t& physical_buffer_id);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * This header defines helper functions to read and write
+ * the big-endian integers used in packed openflow messages.
+ */
+
+inline uint16_t read_uint16(const uint8_t* buffer) {
+	return (uint16_t(buffer[0])<<8) | buffer[1];
+}
+
+inline uint32_t read_uint32(const uint8_t* buffer) {
+	return (uint32_t(read_uint16(buffer))<<16) | read_uint16(buffer+2);
+}
+
+inline uint64_t read_uint64(const uint8_t* buffer) {
+	return (uint64_t(read_uint32(buffer))<<32) | read_uint32(buffer+4);
+}
+
+inline void write_uint16(uint8_t* buffer, uint16_t value) {
+	buffer[0] = (value>>8) & 0xff;
+	buffer[1] = value & 0xff;
+}
+
+inline void write_uint32(uint8_t* buffer, uint32_t value) {
+	write_uint16(buffer,   (value>>16) & 0xffff);
+	write_uint16(buffer+2, value & 0xffff);
+}
+
+inline void write_uint64(uint8_t* buffer, uint64_t value) {
+	write_uint32(buffer,   (value>>32) & 0xffffffff);
+	write_uint32(buffer+4, value & 0xffffffff);
+}
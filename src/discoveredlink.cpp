@@ -43,6 +43,14 @@ void DiscoveredLink::timeout(const boost::system::error_code& error) {
 	stop();
 }
 
+int DiscoveredLink::get_switch_id_1() const {
+	return switch_id_1;
+}
+
+int DiscoveredLink::get_switch_id_2() const {
+	return switch_id_2;
+}
+
 int DiscoveredLink::get_other_switch_id(int switch_id) const {
 	if( switch_id == switch_id_1 ) {
 		return switch_id_2;
@@ -62,16 +70,17 @@ int DiscoveredLink::get_port_number(int switch_id) const {
 }
 
 void DiscoveredLink::reset_timer() {
-	// Reset the expiry date to further in the future
+	// Reset the expiry date to further in the future, both sides
+	// probe the link at least every max_period
 	liveness_timer.expires_from_now(
-		boost::posix_time::milliseconds(550));
+		boost::posix_time::milliseconds(topology::link_timeout));
 	// When the expiration changes the handler is called
 	// with error code operation_aborted
 	liveness_timer.async_wait(
-		boost::bind(
+		hypervisor->get_control_strand().wrap(boost::bind(
 			&DiscoveredLink::timeout,
 			shared_from_this(),
-			boost::asio::placeholders::error));
+			boost::asio::placeholders::error)));
 }
 
 void DiscoveredLink::start() {
@@ -95,8 +104,8 @@ void DiscoveredLink::stop() {
 		switch_2_ptr->reset_link(shared_from_this());
 	}
 
-	// Recalculate the routes
-	hypervisor->calculate_routes();
+	// Only recalculate the routes that used this link
+	hypervisor->link_removed(*this);
 }
 
 void DiscoveredLink::print_to_stream(std::ostream& os) const {
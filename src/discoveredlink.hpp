@@ -25,6 +25,10 @@ public:
 		int switch_id_2,
 		uint32_t port_number_2);
 
+	/// Return the switch id of the first side of this link
+	int get_switch_id_1() const;
+	/// Return the switch id of the second side of this link
+	int get_switch_id_2() const;
 	/// Return the other switch id of this link
 	int get_other_switch_id(int switch_id) const;
 	/// Return the port on the switch connected to this link
@@ -0,0 +1,270 @@
+#include "flow_table_shadow.hpp"
+#include "openflow_connection.hpp"
+#include "byte_order.hpp"
+
+#include <algorithm>
+
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// Offsets in a packed flowmod
+	constexpr size_t flow_mod_table_offset     = 24;
+	constexpr size_t flow_mod_command_offset   = 25;
+	constexpr size_t flow_mod_priority_offset  = 30;
+	constexpr size_t flow_mod_out_port_offset  = 36;
+	constexpr size_t flow_mod_out_group_offset = 40;
+	constexpr size_t flow_mod_match_offset     = 48;
+	/// The length of the header of a match and an oxm field
+	constexpr size_t match_header_length       = 4;
+	constexpr size_t oxm_header_length         = 4;
+	/// Offsets in a packed groupmod
+	constexpr size_t group_mod_command_offset  = 8;
+	constexpr size_t group_mod_header_length   = 16;
+
+	/// Pack a message with a zero xid
+	std::vector<uint8_t> pack_message(fluid_msg::OFMsg& message) {
+		uint8_t* buffer = message.pack();
+		std::vector<uint8_t> packed(buffer, buffer+message.length());
+		fluid_msg::OFMsg::free_buffer(buffer);
+
+		// The xid is given when the message is send
+		write_uint32(&packed[4], 0);
+		return packed;
+	}
+
+	/// Make the key of a packed flowmod
+	/**
+	 * The key is the table, the priority and the fields of the
+	 * match. The fields are sorted since a switch doesn't have to
+	 * report the match in the order it was installed.
+	 */
+	std::vector<uint8_t> make_flow_key(const std::vector<uint8_t>& packed) {
+		const uint8_t* message = &packed[0];
+		const uint8_t* match   = message+flow_mod_match_offset;
+		size_t match_length    = read_uint16(match+2);
+
+		std::vector<std::pair<const uint8_t*,const uint8_t*>> fields;
+		for( size_t offset=match_header_length; offset+oxm_header_length<=match_length; ) {
+			size_t field_length = oxm_header_length + match[offset+3];
+			fields.emplace_back(match+offset, match+offset+field_length);
+			offset += field_length;
+		}
+		std::sort(
+			fields.begin(),
+			fields.end(),
+			[](const std::pair<const uint8_t*,const uint8_t*>& a,
+			   const std::pair<const uint8_t*,const uint8_t*>& b) {
+				return std::lexicographical_compare(
+					a.first, a.second,
+					b.first, b.second);
+			});
+
+		std::vector<uint8_t> key;
+		key.reserve(3+match_length);
+		key.push_back(message[flow_mod_table_offset]);
+		key.push_back(message[flow_mod_priority_offset]);
+		key.push_back(message[flow_mod_priority_offset+1]);
+		for( const auto& field : fields ) {
+			key.insert(key.end(), field.first, field.second);
+		}
+		return key;
+	}
+}
+
+FlowTableShadow::FlowTableShadow() :
+	next_sequence(0) {
+}
+
+void FlowTableShadow::clear_section(int section) {
+	for( auto it=desired_flows.begin(); it!=desired_flows.end(); ) {
+		if( it->second.section == section ) it = desired_flows.erase(it);
+		else ++it;
+	}
+	for( auto it=desired_groups.begin(); it!=desired_groups.end(); ) {
+		if( it->second.section == section ) it = desired_groups.erase(it);
+		else ++it;
+	}
+}
+
+FlowTableShadow::Entry FlowTableShadow::make_flow_entry(
+		int section,
+		fluid_msg::of13::FlowMod& flow_mod,
+		std::vector<uint8_t>& key) {
+	Entry entry;
+	entry.message  = pack_message(flow_mod);
+	entry.section  = section;
+	entry.sequence = next_sequence++;
+	entry.message[flow_mod_command_offset] = fluid_msg::of13::OFPFC_ADD;
+
+	// The output filter is ignored when adding, it is cleared
+	// so rules read back from the switch compare equal
+	write_uint32(&entry.message[flow_mod_out_port_offset], fluid_msg::of13::OFPP_ANY);
+	write_uint32(&entry.message[flow_mod_out_group_offset], fluid_msg::of13::OFPG_ANY);
+
+	key = make_flow_key(entry.message);
+	return entry;
+}
+
+void FlowTableShadow::add_flow(int section, fluid_msg::of13::FlowMod& flow_mod) {
+	std::vector<uint8_t> key;
+	Entry entry = make_flow_entry(section, flow_mod, key);
+	desired_flows[key] = std::move(entry);
+}
+
+void FlowTableShadow::add_group(int section, fluid_msg::of13::GroupMod& group_mod) {
+	Entry entry;
+	entry.message  = pack_message(group_mod);
+	entry.section  = section;
+	entry.sequence = next_sequence++;
+	write_uint16(
+		&entry.message[group_mod_command_offset],
+		fluid_msg::of13::OFPGC_ADD);
+
+	desired_groups[group_mod.group_id()] = std::move(entry);
+}
+
+void FlowTableShadow::add_installed_flow(fluid_msg::of13::FlowMod& flow_mod) {
+	std::vector<uint8_t> key;
+	Entry entry = make_flow_entry(-1, flow_mod, key);
+	installed_flows[key] = std::move(entry);
+}
+
+void FlowTableShadow::add_installed_group(fluid_msg::of13::GroupMod& group_mod) {
+	Entry entry;
+	entry.message  = pack_message(group_mod);
+	entry.section  = -1;
+	entry.sequence = next_sequence++;
+	write_uint16(
+		&entry.message[group_mod_command_offset],
+		fluid_msg::of13::OFPGC_ADD);
+
+	installed_groups[group_mod.group_id()] = std::move(entry);
+}
+
+void FlowTableShadow::send_packed(
+		OpenflowConnection& connection,
+		const std::vector<uint8_t>& message,
+		size_t command_offset,
+		size_t command_size,
+		uint16_t command) {
+	std::vector<uint8_t> copy(message);
+	if( command_size == 1 ) {
+		copy[command_offset] = command;
+	}
+	else {
+		write_uint16(&copy[command_offset], command);
+	}
+	connection.send_raw_message(&copy[0], copy.size());
+}
+
+size_t FlowTableShadow::commit(OpenflowConnection& connection, bool additions_only) {
+	size_t amount_send = 0;
+
+	// Add and modify the groups first since the rules can point
+	// to them, in the order they were added
+	std::vector<std::pair<uint64_t,uint32_t>> group_order;
+	for( const auto& group_pair : desired_groups ) {
+		group_order.emplace_back(group_pair.second.sequence, group_pair.first);
+	}
+	std::sort(group_order.begin(), group_order.end());
+	for( const auto& order_pair : group_order ) {
+		const Entry& desired = desired_groups.at(order_pair.second);
+		auto installed_it = installed_groups.find(order_pair.second);
+		if( installed_it == installed_groups.end() ) {
+			send_packed(
+				connection, desired.message,
+				group_mod_command_offset, 2,
+				fluid_msg::of13::OFPGC_ADD);
+			installed_groups[order_pair.second] = desired;
+			++amount_send;
+		}
+		else if( !additions_only && installed_it->second.message != desired.message ) {
+			send_packed(
+				connection, desired.message,
+				group_mod_command_offset, 2,
+				fluid_msg::of13::OFPGC_MODIFY);
+			installed_it->second = desired;
+			++amount_send;
+		}
+		else {
+			installed_it->second.sequence = desired.sequence;
+		}
+	}
+
+	// Add and modify the rules
+	for( const auto& flow_pair : desired_flows ) {
+		const Entry& desired = flow_pair.second;
+		auto installed_it = installed_flows.find(flow_pair.first);
+		if( installed_it == installed_flows.end() ) {
+			send_packed(
+				connection, desired.message,
+				flow_mod_command_offset, 1,
+				fluid_msg::of13::OFPFC_ADD);
+			installed_flows[flow_pair.first] = desired;
+			++amount_send;
+		}
+		else if( !additions_only && installed_it->second.message != desired.message ) {
+			send_packed(
+				connection, desired.message,
+				flow_mod_command_offset, 1,
+				fluid_msg::of13::OFPFC_MODIFY_STRICT);
+			installed_it->second = desired;
+			++amount_send;
+		}
+	}
+
+	// Delete the rules that are no longer desired
+	for( auto it=installed_flows.begin(); it!=installed_flows.end(); ) {
+		if( additions_only || desired_flows.count(it->first) ) {
+			++it;
+			continue;
+		}
+
+		// The output filter is already cleared so the delete
+		// isn't filtered on output port or group
+		send_packed(
+			connection, it->second.message,
+			flow_mod_command_offset, 1,
+			fluid_msg::of13::OFPFC_DELETE_STRICT);
+
+		it = installed_flows.erase(it);
+		++amount_send;
+	}
+
+	// Delete the groups that are no longer desired, groups added
+	// last are deleted first
+	group_order.clear();
+	for( const auto& group_pair : installed_groups ) {
+		if( additions_only || desired_groups.count(group_pair.first) ) continue;
+		group_order.emplace_back(group_pair.second.sequence, group_pair.first);
+	}
+	std::sort(group_order.rbegin(), group_order.rend());
+	for( const auto& order_pair : group_order ) {
+		// Only the header with the group id is needed
+		std::vector<uint8_t> message(
+			installed_groups.at(order_pair.second).message.begin(),
+			installed_groups.at(order_pair.second).message.begin()+group_mod_header_length);
+		write_uint16(&message[2], group_mod_header_length);
+		write_uint16(&message[group_mod_command_offset], fluid_msg::of13::OFPGC_DELETE);
+		connection.send_raw_message(&message[0], message.size());
+
+		installed_groups.erase(order_pair.second);
+		++amount_send;
+	}
+
+	// Make sure all changes are executed before anything that follows
+	if( amount_send != 0 ) {
+		fluid_msg::of13::BarrierRequest barrier;
+		connection.send_message(barrier);
+	}
+
+	BOOST_LOG_TRIVIAL(trace) << connection
+		<< " committed flow table shadow, messages send: " << amount_send;
+
+	return amount_send;
+}
+
+void FlowTableShadow::reset() {
+	installed_flows.clear();
+	installed_groups.clear();
+}
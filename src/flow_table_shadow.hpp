@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <map>
+
+#include <fluid/of13msg.hh>
+
+class OpenflowConnection;
+
+/// A copy of the hypervisor rules and groups installed in a switch
+/**
+ * The desired rules and groups are collected in sections, a
+ * section can be refilled without touching the others. When
+ * committed the desired state is compared with what has been
+ * installed and only the differences are send to the switch,
+ * followed by a single barrier. Rules are identified by their
+ * (table, priority, match), groups by their group id. Rules
+ * and groups that are never added to the shadow, like the
+ * rules of the virtual switches, are never touched.
+ *
+ * After a restart of the hypervisor the installed state can be
+ * seeded with what the switch reports, the first commit then
+ * only sends what changed since the previous run.
+ */
+class FlowTableShadow {
+private:
+	/// A packed flowmod or groupmod
+	struct Entry {
+		/// The packed message with an add command
+		std::vector<uint8_t> message;
+		/// The section this entry belongs to
+		int section;
+		/// The order in which the entries were added
+		uint64_t sequence;
+	};
+
+	/// The next sequence number to give out
+	uint64_t next_sequence;
+
+	/// The rules that should be installed, keyed by (table, priority, match)
+	std::map<std::vector<uint8_t>,Entry> desired_flows;
+	/// The rules that are installed
+	std::map<std::vector<uint8_t>,Entry> installed_flows;
+	/// The groups that should be installed, keyed by group id
+	std::map<uint32_t,Entry> desired_groups;
+	/// The groups that are installed
+	std::map<uint32_t,Entry> installed_groups;
+
+	/// Make the entry and key of a flowmod
+	Entry make_flow_entry(
+		int section,
+		fluid_msg::of13::FlowMod& flow_mod,
+		std::vector<uint8_t>& key);
+
+	/// Send a copy of a packed message with a different command
+	static void send_packed(
+		OpenflowConnection& connection,
+		const std::vector<uint8_t>& message,
+		size_t command_offset,
+		size_t command_size,
+		uint16_t command);
+
+public:
+	/// Create an empty shadow
+	FlowTableShadow();
+
+	/// Remove all desired entries in a section
+	void clear_section(int section);
+
+	/// Add a rule to the desired state, the command is ignored
+	void add_flow(int section, fluid_msg::of13::FlowMod& flow_mod);
+	/// Add a group to the desired state, the command is ignored
+	/**
+	 * Groups are added to the switch in the order they are
+	 * added here and deleted in the opposite order, so groups
+	 * pointing to other groups should be added after them.
+	 */
+	void add_group(int section, fluid_msg::of13::GroupMod& group_mod);
+
+	/// Add a rule that is already in the switch to the installed state
+	void add_installed_flow(fluid_msg::of13::FlowMod& flow_mod);
+	/// Add a group that is already in the switch to the installed state
+	/**
+	 * Groups that were not desired are deleted in the opposite
+	 * order they are added here.
+	 */
+	void add_installed_group(fluid_msg::of13::GroupMod& group_mod);
+
+	/// Send the difference between desired and installed state
+	/**
+	 * When only additions are allowed the installed rules and
+	 * groups are left alone, even when they differ from the
+	 * desired state.
+	 * \return The amount of messages send, excluding the barrier
+	 */
+	size_t commit(OpenflowConnection& connection, bool additions_only=false);
+
+	/// Forget everything that was installed
+	void reset();
+};
@@ -5,6 +5,8 @@
 #include "tag.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -12,9 +14,37 @@
 #include <boost/log/trivial.hpp>
 #include <boost/make_shared.hpp>
 
+namespace {
+	/// The time between checkpoints of the restart snapshot in ms
+	constexpr int checkpoint_period = 10000;
+	/// The time between sweeps of the overdue requests in ms
+	constexpr int request_sweep_period = 1000;
+
+	/// The default echo settings, the intervals in ms
+	constexpr int default_echo_interval     = 1000;
+	constexpr int default_max_echo_interval = 5000;
+	constexpr int default_max_missed_echoes = 3;
+}
+
 Hypervisor::Hypervisor( boost::asio::io_service& io ) :
-	signals(io, SIGINT, SIGTERM),
-	switch_acceptor(io) {
+	control_strand(io),
+	signals(io, SIGINT, SIGTERM, SIGHUP),
+	switch_acceptor(io),
+	stopping(false),
+	shard(0),
+	routing_engine(NetworkTag::max_switch_id+1),
+	packet_in_scheduler(io),
+	metrics_server(io, this),
+	checkpoint_timer(io),
+	request_sweep_timer(io) {
+}
+
+void Hypervisor::wait_for_signals() {
+	signals.async_wait(control_strand.wrap(boost::bind(
+		&Hypervisor::handle_signals,
+		this,
+		boost::asio::placeholders::error,
+		boost::asio::placeholders::signal_number)));
 }
 
 void Hypervisor::handle_signals(
@@ -23,9 +53,15 @@ void Hypervisor::handle_signals(
 ) {
 	if( !error ) {
 		BOOST_LOG_TRIVIAL(info) << "Received signal " << signal_number;
-		stop();
+		if( signal_number == SIGHUP ) {
+			reload_configuration();
+			wait_for_signals();
+		}
+		else {
+			stop();
+		}
 	}
-	else {
+	else if( error != boost::asio::error::operation_aborted ) {
 		BOOST_LOG_TRIVIAL(error) << "Error while receiving signal: " << error.message();
 	}
 }
@@ -37,11 +73,11 @@ void Hypervisor::start_accept() {
 
 	switch_acceptor.async_accept(
 		*new_socket,
-		boost::bind(
+		control_strand.wrap(boost::bind(
 			&Hypervisor::handle_accept,
 			this,
 			boost::asio::placeholders::error,
-			new_socket));
+			new_socket)));
 }
 
 void Hypervisor::handle_accept(
@@ -123,31 +159,151 @@ const std::list<Slice>& Hypervisor::get_slices() const {
 	return slices;
 }
 
+const RoutingEngine& Hypervisor::get_routing_engine() const {
+	return routing_engine;
+}
+
+boost::asio::io_service::strand& Hypervisor::get_control_strand() {
+	return control_strand;
+}
+
+PacketInScheduler& Hypervisor::get_packet_in_scheduler() {
+	return packet_in_scheduler;
+}
+
+BufferTable& Hypervisor::get_buffer_table() {
+	return buffer_table;
+}
+
+Hypervisor::Metrics& Hypervisor::get_metrics() {
+	return metrics;
+}
+
 bool Hypervisor::get_use_meters() const {
 	return use_meters;
 }
 
+bool Hypervisor::is_stopping() const {
+	return stopping;
+}
+
+const OpenflowConnection::EchoConfiguration& Hypervisor::get_echo_configuration() const {
+	return echo_configuration;
+}
+
+void Hypervisor::set_shard(int shard) {
+	this->shard = shard;
+}
+
+int Hypervisor::get_shard() const {
+	return shard;
+}
+
+bool Hypervisor::is_local_switch(uint64_t datapath_id) const {
+	if( switch_shards.empty() ) return true;
+
+	auto it = switch_shards.find(datapath_id);
+	return it != switch_shards.end() && it->second == shard;
+}
+
+const RestartSnapshot::SwitchState* Hypervisor::get_restart_state(uint64_t datapath_id) const {
+	if( restart_snapshot_filename.empty() ) return nullptr;
+	return restart_snapshot.get(datapath_id);
+}
+
+void Hypervisor::save_restart_state(
+		uint64_t datapath_id,
+		const RestartSnapshot::SwitchState& state) {
+	if( restart_snapshot_filename.empty() ) return;
+	restart_snapshot.set(datapath_id, state);
+}
+
+void Hypervisor::schedule_checkpoint() {
+	checkpoint_timer.expires_from_now(
+		boost::posix_time::milliseconds(checkpoint_period));
+	checkpoint_timer.async_wait(
+		control_strand.wrap(boost::bind(
+			&Hypervisor::handle_checkpoint_timer,
+			this,
+			boost::asio::placeholders::error)));
+}
+
+void Hypervisor::handle_checkpoint_timer(const boost::system::error_code& error) {
+	if( error == boost::asio::error::operation_aborted ) return;
+
+	write_checkpoint();
+	schedule_checkpoint();
+}
+
+void Hypervisor::schedule_request_sweep() {
+	request_sweep_timer.expires_from_now(
+		boost::posix_time::milliseconds(request_sweep_period));
+	request_sweep_timer.async_wait(
+		control_strand.wrap(boost::bind(
+			&Hypervisor::handle_request_sweep_timer,
+			this,
+			boost::asio::placeholders::error)));
+}
+
+void Hypervisor::handle_request_sweep_timer(const boost::system::error_code& error) {
+	if( error == boost::asio::error::operation_aborted ) return;
+
+	auto now = std::chrono::steady_clock::now();
+	for( const auto& physical_switch : physical_switches ) {
+		physical_switch.second->expire_requests(now);
+	}
+	schedule_request_sweep();
+}
+
+void Hypervisor::write_checkpoint() {
+	// Switches that are not connected keep the state of the
+	// last checkpoint, they can still reconnect
+	for( const auto& datapath_id_pair : datapath_id_to_switch_id ) {
+		restart_snapshot.set(
+			datapath_id_pair.first,
+			physical_switches.at(datapath_id_pair.second)->get_restart_state());
+	}
+	restart_snapshot.save(restart_snapshot_filename);
+}
+
 void Hypervisor::start() {
 	// Register the handler for signals
-	signals.async_wait(boost::bind(
-		&Hypervisor::handle_signals,
-		this,
-		boost::asio::placeholders::error,
-		boost::asio::placeholders::signal_number));
+	wait_for_signals();
 
 	// Register the acceptor for switch connections
 	start_accept();
 
+	// Checkpoint the state of the switches if it is kept over restarts
+	if( !restart_snapshot_filename.empty() ) schedule_checkpoint();
+
+	// Give up on the requests the switches don't answer
+	schedule_request_sweep();
+
 	// Start all of the slices
 	for( Slice& s : slices ) s.start();
 }
 
 void Hypervisor::stop() {
 	BOOST_LOG_TRIVIAL(trace) << "Stopping Hypervisor";
+	stopping = true;
 
 	// Cancel the signal handler if it is still running
 	signals.cancel();
 
+	// Stop relaying queued PacketIns
+	packet_in_scheduler.stop();
+
+	// Stop serving metrics
+	metrics_server.stop();
+
+	// Checkpoint before the switches are stopped, stopping them
+	// takes the virtual switches down which removes their state
+	checkpoint_timer.cancel();
+	if( !restart_snapshot_filename.empty() ) write_checkpoint();
+
+	// Stop expiring requests
+	request_sweep_timer.cancel();
+
 	// Stop accepting new switch connections, this also
 	// cancels all pending operations on the acceptor
 	switch_acceptor.close();
@@ -174,39 +330,74 @@ void Hypervisor::stop() {
 }
 
 void Hypervisor::calculate_routes() {
-	// Reset all switches to start values
-	for( auto& phy_switch : physical_switches ) {
-		phy_switch.second->reset_distances();
-	}
-
-	// Execute the floyd-warshall algorithm, naming convention taken
-	// from https://en.wikipedia.org/wiki/Floyd%E2%80%93Warshall_algorithm
-	for( auto &k : physical_switches ) {
-		for( auto &i : physical_switches ) {
-			for( auto &j : physical_switches ) {
-				int dist_i_k = i.second->get_distance(k.first);
-				int dist_k_j = k.second->get_distance(j.first);
-				int dist_i_j = i.second->get_distance(j.first);
-				if( dist_i_k + dist_k_j < dist_i_j ) {
-					i.second->set_distance( j.first, dist_i_k + dist_k_j );
-					i.second->set_next( j.first, i.second->get_next(k.first) );
-				}
-			}
-		}
+	// Only the switches that are connected take part in routing
+	std::set<int> all_switches;
+	for( int switch_id=0; switch_id<=NetworkTag::max_switch_id; ++switch_id ) {
+		bool is_active = physical_switches.count(switch_id)!=0;
+		routing_engine.set_active(switch_id, is_active);
+		if( is_active ) all_switches.insert(switch_id);
 	}
 
-	// Let all the virtual switches check if they should go online/down
-	for( Slice& s : slices ) s.check_online();
+	// Rebuild the routes from every switch
+	{
+		metrics::ScopedTimer timer(metrics.route_computation_time);
+		routing_engine.recalculate_all();
+	}
+
+	apply_routes(all_switches, all_switches);
+}
+
+void Hypervisor::link_added(const DiscoveredLink& link) {
+	std::set<int> changed_sources;
+	{
+		metrics::ScopedTimer timer(metrics.route_computation_time);
+		changed_sources = routing_engine.add_link(
+			link.get_switch_id_1(),
+			link.get_port_number(link.get_switch_id_1()),
+			link.get_switch_id_2(),
+			link.get_port_number(link.get_switch_id_2()));
+	}
+
+	apply_routes(
+		changed_sources,
+		{link.get_switch_id_1(), link.get_switch_id_2()});
+}
 
-	// Let all physical switches check if the dynamic forwarding rules need to update
-	for( auto &ps : physical_switches ) ps.second->update_dynamic_rules();
+void Hypervisor::link_removed(const DiscoveredLink& link) {
+	std::set<int> changed_sources;
+	{
+		metrics::ScopedTimer timer(metrics.route_computation_time);
+		changed_sources = routing_engine.remove_link(
+			link.get_switch_id_1(),
+			link.get_port_number(link.get_switch_id_1()),
+			link.get_switch_id_2(),
+			link.get_port_number(link.get_switch_id_2()));
+	}
+
+	apply_routes(
+		changed_sources,
+		{link.get_switch_id_1(), link.get_switch_id_2()});
+}
+
+void Hypervisor::apply_routes(
+		const std::set<int>& changed_sources,
+		const std::set<int>& changed_switches) {
+	// Let all the virtual switches check if they should go online/down
+	bool virtual_switch_changed = false;
+	for( Slice& s : slices ) {
+		virtual_switch_changed |= s.check_online();
+	}
 
-	// Write the new topology in dot format to a file
-	// TODO Remove this debugging info
-	std::ofstream topo_file("topo.dot");
-	print_topology(topo_file);
-	std::ofstream distance_file("distances.dat");
-	print_switch_distances(distance_file);
+	// If a virtual switch changed state every physical switch it spans
+	// has to update its rules, otherwise only the switches whose routes
+	// or links changed have to.
+	for( auto &ps : physical_switches ) {
+		if( virtual_switch_changed ||
+				changed_sources.count(ps.first) ||
+				changed_switches.count(ps.first) ) {
+			ps.second->update_dynamic_rules();
+		}
+	}
 }
 
 void Hypervisor::print_topology(std::ostream& os) {
@@ -236,8 +427,8 @@ void Hypervisor::print_switch_distances(std::ostream& os) {
 		for( const auto &ps2 : physical_switches ) {
 			int id2 = ps2.second->get_id();
 			os << "\t\t{ id: " << id2 << ", dist: "
-				<< ps1.second->get_distance(id2) << ", next: "
-				<< ps1.second->get_next(id2) << " },\n";
+				<< routing_engine.get_distance(id1,id2) << ", next: "
+				<< routing_engine.get_next(id1,id2) << " },\n";
 		}
 		os << "\t],\n";
 	}
@@ -254,10 +445,122 @@ void Hypervisor::start_listening( int port ) {
 	switch_acceptor.listen();
 }
 
+OpenflowConnection::EchoConfiguration Hypervisor::read_echo_configuration(
+		const boost::property_tree::ptree& config_tree) {
+	OpenflowConnection::EchoConfiguration configuration;
+	configuration.interval =
+		std::max(1, config_tree.get<int>("echo_interval", default_echo_interval));
+	configuration.max_interval = std::max(
+		configuration.interval,
+		config_tree.get<int>("max_echo_interval", default_max_echo_interval));
+	configuration.max_missed =
+		std::max(1, config_tree.get<int>("max_missed_echoes", default_max_missed_echoes));
+	return configuration;
+}
+
+std::unordered_map<uint64_t,int> Hypervisor::read_shards(
+		const boost::property_tree::ptree& config_tree) {
+	std::unordered_map<uint64_t,int> shards;
+	boost::optional<const boost::property_tree::ptree&> shards_ptree =
+		config_tree.get_child_optional("shards");
+	if( !shards_ptree ) return shards;
+
+	// Every shard is a list of datapath id's
+	int shard_id = 0;
+	for( const auto& shard_pair : *shards_ptree ) {
+		for( const auto& switch_pair : shard_pair.second ) {
+			shards[switch_pair.second.get_value<uint64_t>()] = shard_id;
+		}
+		++shard_id;
+	}
+	return shards;
+}
+
+void Hypervisor::remove_foreign_virtual_switches(
+		std::vector<SliceConfiguration>& slice_configurations) const {
+	if( switch_shards.empty() ) return;
+
+	for( SliceConfiguration& slice_configuration : slice_configurations ) {
+		std::vector<VirtualSwitchConfiguration>& virtual_switches =
+			slice_configuration.virtual_switches;
+		for( auto it=virtual_switches.begin(); it!=virtual_switches.end(); ) {
+			// All the physical switches have to be in 1 shard
+			int owner = -1;
+			for( const auto& port_pair : it->ports ) {
+				auto shard_it = switch_shards.find(port_pair.second.physical_datapath_id);
+				if( shard_it == switch_shards.end() || (owner != -1 && shard_it->second != owner) ) {
+					throw std::invalid_argument(
+						"Virtual switch with datapath_id=" + std::to_string(it->datapath_id) +
+						" depends on physical switches that are not in 1 shard");
+				}
+				owner = shard_it->second;
+			}
+
+			if( owner != shard ) {
+				it = virtual_switches.erase(it);
+				continue;
+			}
+			++it;
+		}
+	}
+}
+
+std::vector<Hypervisor::SliceConfiguration> Hypervisor::read_slices(
+		const boost::property_tree::ptree& config_tree) {
+	std::vector<SliceConfiguration> slice_configurations;
+	for( const auto &slice_pair : config_tree.get_child("slices") ) {
+		auto& slice_ptree = slice_pair.second;
+
+		SliceConfiguration slice_configuration;
+		slice_configuration.max_rate = slice_ptree.get<int>("max_rate");
+		slice_configuration.ip       = slice_ptree.get_child("controller").get<std::string>("ip");
+		slice_configuration.port     = slice_ptree.get_child("controller").get<int>("port");
+		slice_configuration.controller_endpoint = boost::asio::ip::tcp::endpoint(
+			boost::asio::ip::address_v4::from_string(slice_configuration.ip),
+			slice_configuration.port);
+		// The rule quota is optional, by default there is none
+		slice_configuration.max_flow_rules =
+			slice_ptree.get<unsigned int>("max_flow_rules", 0);
+		// The PacketIn limit is optional, by default there is none
+		slice_configuration.packet_in_rate   =
+			slice_ptree.get<unsigned int>("max_packet_in_rate", 0);
+		slice_configuration.switch_packet_in_rate =
+			slice_ptree.get<unsigned int>("max_switch_packet_in_rate", 0);
+		slice_configuration.packet_in_weight =
+			slice_ptree.get<unsigned int>("packet_in_weight", 1);
+
+		for( const auto &virtual_switch_pair : slice_ptree.get_child("virtual_switches") ) {
+			auto& virtual_switch_ptree = virtual_switch_pair.second;
+
+			VirtualSwitchConfiguration virtual_switch_configuration;
+			virtual_switch_configuration.datapath_id =
+				virtual_switch_ptree.get<uint64_t>("datapath_id");
+
+			for( const auto &port_pair : virtual_switch_ptree.get_child("ports") ) {
+				auto& port_ptree = port_pair.second;
+
+				uint32_t virtual_port = port_ptree.get<uint32_t>("virtual_port");
+				VirtualSwitch::PortConfiguration& port =
+					virtual_switch_configuration.ports[virtual_port];
+				port.physical_datapath_id =
+					port_ptree.get<uint64_t>("physical_datapath_id");
+				port.physical_port_number =
+					port_ptree.get<uint32_t>("physical_port");
+			}
+
+			slice_configuration.virtual_switches.push_back(virtual_switch_configuration);
+		}
+
+		slice_configurations.push_back(slice_configuration);
+	}
+	return slice_configurations;
+}
+
 void Hypervisor::load_configuration( std::string filename ) {
 	// Read the configuration file into memory
 	boost::property_tree::ptree config_tree;
 	boost::property_tree::json_parser::read_json( filename, config_tree );
+	configuration_filename = filename;
 
 	// Start listening for physical switches
 	start_listening(config_tree.get<int>("switch_endpoint_port"));
@@ -265,21 +568,59 @@ void Hypervisor::load_configuration( std::string filename ) {
 	// Retrieve if meters are used
 	use_meters = config_tree.get<bool>("use_meters");
 
-	// Create the internal structure
-	for( const auto &slice_pair : config_tree.get_child("slices") ) {
-		auto& slice_ptree = slice_pair.second;
+	// Retrieve how the connections are kept alive
+	echo_configuration = read_echo_configuration(config_tree);
+
+	// Retrieve what physical switches the shards serve
+	switch_shards = read_shards(config_tree);
+	if( !switch_shards.empty() ) {
+		int num_shards = config_tree.get_child("shards").size();
+		if( shard < 0 || shard >= num_shards ) {
+			throw std::invalid_argument(
+				"Shard " + std::to_string(shard) + " is not one of the " +
+				std::to_string(num_shards) + " configured shards");
+		}
+	}
 
-		int max_rate   = slice_ptree.get<int>("max_rate");
-		std::string ip = slice_ptree.get_child("controller").get<std::string>("ip");
-		int port       = slice_ptree.get_child("controller").get<int>("port");
-		slices.emplace_back( slices.size()+1, max_rate, ip, port, this );
+	// Serve the metrics if a port is given
+	boost::optional<int> metrics_port = config_tree.get_optional<int>("metrics_port");
+	if( metrics_port ) {
+		metrics_server.start(*metrics_port);
+	}
+
+	// Reconcile the switches with a previous run if a snapshot file is given
+	boost::optional<std::string> snapshot_filename =
+		config_tree.get_optional<std::string>("restart_snapshot");
+	if( snapshot_filename ) {
+		restart_snapshot_filename = *snapshot_filename;
+		restart_snapshot.load(restart_snapshot_filename);
+	}
+
+	// Create the internal structure, only the virtual switches
+	// of this shard are created
+	std::vector<SliceConfiguration> slice_configurations = read_slices(config_tree);
+	remove_foreign_virtual_switches(slice_configurations);
+	for( const SliceConfiguration& slice_configuration : slice_configurations ) {
+		slices.emplace_back(
+			switch_acceptor.get_io_service(),
+			slices.size()+1,
+			slice_configuration.max_rate,
+			slice_configuration.max_flow_rules,
+			slice_configuration.ip,
+			slice_configuration.port,
+			this );
 
 		Slice& slice = slices.back();
 
-		for( const auto &virtual_switch_pair : slice_ptree.get_child("virtual_switches") ) {
-			auto& virtual_switch_ptree = virtual_switch_pair.second;
+		packet_in_scheduler.add_slice(
+			slice.get_id(),
+			slice_configuration.packet_in_rate,
+			slice_configuration.switch_packet_in_rate,
+			slice_configuration.packet_in_weight);
 
-			uint64_t datapath_id = virtual_switch_ptree.get<uint64_t>("datapath_id");
+		for( const VirtualSwitchConfiguration& virtual_switch_configuration :
+				slice_configuration.virtual_switches ) {
+			uint64_t datapath_id = virtual_switch_configuration.datapath_id;
 			slice.add_new_virtual_switch(
 					switch_acceptor.get_io_service(),
 					datapath_id);
@@ -289,21 +630,135 @@ void Hypervisor::load_configuration( std::string filename ) {
 
 			virtual_switches[virtual_switch->get_id()] = virtual_switch;
 
-			for( const auto &port_pair : virtual_switch_ptree.get_child("ports") ) {
-				auto& port_ptree = port_pair.second;
-
-				uint32_t virtual_port         =
-					port_ptree.get<uint32_t>("virtual_port");
-				uint64_t physical_datapath_id =
-					port_ptree.get<uint64_t>("physical_datapath_id");
-				uint32_t physical_port        =
-					port_ptree.get<uint32_t>("physical_port");
-
+			for( const auto& port_pair : virtual_switch_configuration.ports ) {
 				virtual_switch->add_port(
-					virtual_port,
-					physical_datapath_id,
-					physical_port);
+					port_pair.first,
+					port_pair.second.physical_datapath_id,
+					port_pair.second.physical_port_number);
 			}
 		}
 	}
 }
+
+void Hypervisor::reload_configuration() {
+	BOOST_LOG_TRIVIAL(info) << "Reloading the configuration from " << configuration_filename;
+
+	boost::property_tree::ptree config_tree;
+	std::vector<SliceConfiguration> slice_configurations;
+	std::unordered_map<uint64_t,int> new_switch_shards;
+	bool new_use_meters;
+	OpenflowConnection::EchoConfiguration new_echo_configuration;
+	// Read everything before changing anything, an invalid
+	// configuration keeps the running configuration
+	try {
+		boost::property_tree::json_parser::read_json( configuration_filename, config_tree );
+		slice_configurations   = read_slices(config_tree);
+		new_switch_shards      = read_shards(config_tree);
+		new_use_meters         = config_tree.get<bool>("use_meters", use_meters);
+		new_echo_configuration = read_echo_configuration(config_tree);
+		remove_foreign_virtual_switches(slice_configurations);
+	}
+	catch( const boost::property_tree::ptree_error& error ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not reload the configuration, keeping the running configuration: " << error.what();
+		return;
+	}
+	catch( const boost::system::system_error& error ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not reload the configuration, keeping the running configuration: " << error.what();
+		return;
+	}
+	catch( const std::invalid_argument& error ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not reload the configuration, keeping the running configuration: " << error.what();
+		return;
+	}
+	if( new_switch_shards != switch_shards ) {
+		BOOST_LOG_TRIVIAL(warning) << "The shards can only be changed by restarting";
+	}
+
+	// The slice id's are in the tags of every rule and the meters are
+	// created when a switch connects, so the slices themselves stay
+	if( slice_configurations.size() != slices.size() ) {
+		BOOST_LOG_TRIVIAL(warning) << "Slices can only be added or removed by restarting, only the existing slices are reconfigured";
+	}
+	if( new_use_meters != use_meters ) {
+		BOOST_LOG_TRIVIAL(warning) << "use_meters can only be changed by restarting";
+	}
+	if(
+		new_echo_configuration.interval     != echo_configuration.interval ||
+		new_echo_configuration.max_interval != echo_configuration.max_interval ||
+		new_echo_configuration.max_missed   != echo_configuration.max_missed
+	) {
+		BOOST_LOG_TRIVIAL(warning) << "The echo settings can only be changed by restarting";
+	}
+
+	auto slice_it = slices.begin();
+	for(
+		auto configuration_it = slice_configurations.begin();
+		configuration_it != slice_configurations.end() && slice_it != slices.end();
+		++configuration_it, ++slice_it
+	) {
+		reconfigure_slice(*slice_it, *configuration_it);
+	}
+
+	BOOST_LOG_TRIVIAL(info) << "Reloaded the configuration";
+}
+
+void Hypervisor::reconfigure_slice(
+		Slice& slice,
+		const SliceConfiguration& slice_configuration) {
+	if( slice_configuration.max_rate != slice.get_max_rate() ) {
+		BOOST_LOG_TRIVIAL(warning) << "The max_rate of slice " << slice.get_id() << " can only be changed by restarting";
+	}
+	if( slice_configuration.controller_endpoint != slice.get_controller_endpoint() ) {
+		BOOST_LOG_TRIVIAL(warning) << "The controller of slice " << slice.get_id() << " can only be changed by restarting";
+	}
+
+	slice.set_max_flow_rules(slice_configuration.max_flow_rules);
+	packet_in_scheduler.update_slice(
+		slice.get_id(),
+		slice_configuration.packet_in_rate,
+		slice_configuration.switch_packet_in_rate,
+		slice_configuration.packet_in_weight);
+
+	// Remove the virtual switches that are no longer configured
+	std::set<uint64_t> configured_datapath_ids;
+	for( const VirtualSwitchConfiguration& virtual_switch_configuration :
+			slice_configuration.virtual_switches ) {
+		configured_datapath_ids.insert(virtual_switch_configuration.datapath_id);
+	}
+	std::vector<uint64_t> removed_datapath_ids;
+	for( const auto& virtual_switch_pair : slice.get_virtual_switches() ) {
+		if( configured_datapath_ids.count(virtual_switch_pair.first) == 0 ) {
+			removed_datapath_ids.push_back(virtual_switch_pair.first);
+		}
+	}
+	for( uint64_t datapath_id : removed_datapath_ids ) {
+		int virtual_switch_id = slice.get_virtual_switch_by_datapath_id(datapath_id)->get_id();
+		BOOST_LOG_TRIVIAL(info) << "Removing virtual switch dpid=" << datapath_id << " from slice " << slice.get_id();
+		slice.remove_virtual_switch(datapath_id);
+		packet_in_scheduler.remove_virtual_switch(slice.get_id(), virtual_switch_id);
+		virtual_switches.erase(virtual_switch_id);
+	}
+
+	// Add the new virtual switches and change the ports of the others
+	for( const VirtualSwitchConfiguration& virtual_switch_configuration :
+			slice_configuration.virtual_switches ) {
+		uint64_t datapath_id = virtual_switch_configuration.datapath_id;
+		VirtualSwitch::pointer virtual_switch =
+			slice.get_virtual_switch_by_datapath_id(datapath_id);
+
+		bool is_new = virtual_switch == nullptr;
+		if( is_new ) {
+			BOOST_LOG_TRIVIAL(info) << "Adding virtual switch dpid=" << datapath_id << " to slice " << slice.get_id();
+			slice.add_new_virtual_switch(
+				switch_acceptor.get_io_service(),
+				datapath_id);
+			virtual_switch = slice.get_virtual_switch_by_datapath_id(datapath_id);
+			virtual_switches[virtual_switch->get_id()] = virtual_switch;
+		}
+
+		virtual_switch->reconfigure_ports(virtual_switch_configuration.ports);
+
+		// A new switch without ports is not checked by reconfigure_ports
+		if( is_new ) virtual_switch->check_online();
+	}
+}
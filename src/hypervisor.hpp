@@ -3,30 +3,74 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <set>
+#include <map>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 #include "physical_switch.hpp"
+#include "virtual_switch.hpp"
+#include "routing_engine.hpp"
+#include "packet_in_scheduler.hpp"
+#include "buffer_table.hpp"
+#include "metrics_server.hpp"
+#include "metrics.hpp"
 #include "id_allocator.hpp"
+#include "restart_snapshot.hpp"
 #include "tag.hpp"
 
 class Slice;
+class DiscoveredLink;
 
 /// The top-level class
 class Hypervisor {
+public:
+	/// The metrics measured by the hypervisor itself
+	struct Metrics {
+		/// The time it takes to rewrite and relay a PacketIn
+		metrics::Histogram packet_in_relay_time;
+		/// The time it takes to rewrite a FlowMod for all physical switches
+		metrics::Histogram flow_mod_rewrite_time;
+		/// The time it takes to update the routes
+		metrics::Histogram route_computation_time;
+	};
+
 private:
+	/// The strand all handlers changing hypervisor state run on
+	/**
+	 * The registries, topology and flow rule state are only
+	 * touched on this strand. The per connection work like
+	 * socket operations and PacketIn relaying runs on the
+	 * strands of the connections themselves.
+	 */
+	boost::asio::io_service::strand control_strand;
+
 	boost::asio::signal_set signals;
 	boost::asio::ip::tcp::acceptor switch_acceptor;
+	/// If the hypervisor is stopping, the switches then keep their state
+	bool stopping;
 
 	/// The slices in this hypervisor
 	std::list<Slice> slices;
 
 	/// If meters are used in this instance
 	bool use_meters;
+	/// The settings of the echo requests of all connections
+	OpenflowConnection::EchoConfiguration echo_configuration;
+
+	/// The shard of the physical switches this hypervisor serves
+	int shard;
+	/// The shard of every physical switch, datapath id -> shard
+	/**
+	 * This is empty if the switches are not sharded, this
+	 * hypervisor then serves all switches.
+	 */
+	std::unordered_map<uint64_t,int> switch_shards;
 
 	/// The allocator for physical switch id's
-	IdAllocator<0,VLANTag::max_switch_id> physical_switch_id_allocator;
+	IdAllocator<0,NetworkTag::max_switch_id> physical_switch_id_allocator;
 	/// The physical switches registered at this hypervisor
 	std::unordered_map<int,PhysicalSwitch::pointer> physical_switches;
 	/// A map from datapath id to switch id
@@ -34,11 +78,112 @@ private:
 	/// The virtual switches registered at this hypervisor
 	std::unordered_map<int,boost::shared_ptr<VirtualSwitch>> virtual_switches;
 
+	/// The shortest paths between the physical switches
+	RoutingEngine routing_engine;
+	/// Limits the PacketIns relayed to the controllers per slice
+	PacketInScheduler packet_in_scheduler;
+	/// The packets buffered in the physical switches
+	BufferTable buffer_table;
+
+	/// The metrics measured by the hypervisor
+	Metrics metrics;
+	/// Serves the metrics if a port is configured
+	MetricsServer metrics_server;
+
+	/// The file the restart snapshot is kept in, empty if not used
+	std::string restart_snapshot_filename;
+	/// The state of the physical switches as of the last checkpoint
+	RestartSnapshot restart_snapshot;
+	/// The timer that when fired checkpoints the restart snapshot
+	boost::asio::deadline_timer checkpoint_timer;
+	/// Schedule writing the next checkpoint
+	void schedule_checkpoint();
+	/// Write the state of all registered switches to the snapshot file
+	void write_checkpoint();
+	/// The checkpoint timer fired
+	void handle_checkpoint_timer(const boost::system::error_code& error);
+
+	/// The timer that when fired expires the overdue requests
+	/**
+	 * One timer sweeps the requests of all physical switches,
+	 * the requests of a switch are ordered on their deadline so
+	 * a sweep only looks at the overdue ones.
+	 */
+	boost::asio::deadline_timer request_sweep_timer;
+	/// Schedule the next sweep of the overdue requests
+	void schedule_request_sweep();
+	/// The request sweep timer fired
+	void handle_request_sweep_timer(const boost::system::error_code& error);
+	/// Apply changed routes to the switches
+	/**
+	 * \param changed_sources The switches whose routes changed
+	 * \param changed_switches The switches whose links changed
+	 */
+	void apply_routes(
+		const std::set<int>& changed_sources,
+		const std::set<int>& changed_switches);
+
+	/// Wait for the next signal
+	void wait_for_signals();
 	/// A signal has been received
+	/**
+	 * SIGHUP reloads the configuration, the other signals
+	 * stop the hypervisor.
+	 */
 	void handle_signals(
 		const boost::system::error_code& error,
 		int signal_number);
 
+	/// The configuration of a virtual switch
+	struct VirtualSwitchConfiguration {
+		uint64_t datapath_id;
+		/// virtual port number -> PortConfiguration
+		std::map<uint32_t,VirtualSwitch::PortConfiguration> ports;
+	};
+	/// The configuration of a slice
+	struct SliceConfiguration {
+		int max_rate;
+		std::string ip;
+		int port;
+		/// The ip and port parsed, an invalid ip is caught while reading
+		boost::asio::ip::tcp::endpoint controller_endpoint;
+		unsigned int max_flow_rules;
+		unsigned int packet_in_rate;
+		unsigned int switch_packet_in_rate;
+		unsigned int packet_in_weight;
+		std::vector<VirtualSwitchConfiguration> virtual_switches;
+	};
+	/// Read the slices from a configuration tree
+	/**
+	 * Everything is read before anything is applied, so an
+	 * invalid configuration doesn't get applied halfway.
+	 */
+	static std::vector<SliceConfiguration> read_slices(
+		const boost::property_tree::ptree& config_tree);
+	/// Read the optional echo settings, missing settings get their defaults
+	static OpenflowConnection::EchoConfiguration read_echo_configuration(
+		const boost::property_tree::ptree& config_tree);
+	/// Read the optional shards, datapath id -> shard
+	static std::unordered_map<uint64_t,int> read_shards(
+		const boost::property_tree::ptree& config_tree);
+	/// Remove the virtual switches another shard serves from the configuration
+	/**
+	 * The shards don't forward messages to each other, so all the
+	 * physical switches of a virtual switch have to be in the
+	 * shard that serves it.
+	 * \throws std::invalid_argument If a virtual switch depends on
+	 * physical switches of several shards or of no shard
+	 */
+	void remove_foreign_virtual_switches(
+		std::vector<SliceConfiguration>& slice_configurations) const;
+
+	/// The file the configuration was loaded from
+	std::string configuration_filename;
+	/// Load the configuration file again and apply the changes
+	void reload_configuration();
+	/// Apply the changed configuration of a running slice
+	void reconfigure_slice(Slice& slice, const SliceConfiguration& slice_configuration);
+
 	/// Registers the handle_accept callback
 	void start_accept();
 
@@ -67,8 +212,48 @@ public:
 	/// Loopkup a virtual switch by switch id
 	VirtualSwitch* get_virtual_switch(int switch_id) const;
 
+	/// Get the routes between the physical switches
+	const RoutingEngine& get_routing_engine() const;
+
+	/// Get the scheduler the PacketIns are relayed through
+	PacketInScheduler& get_packet_in_scheduler();
+	/// Get the translation of virtual to physical buffer id's
+	BufferTable& get_buffer_table();
+	/// Get the metrics measured by the hypervisor
+	Metrics& get_metrics();
+
+	/// Get the strand that protects the hypervisor state
+	boost::asio::io_service::strand& get_control_strand();
+
 	/// Return if this hypervisor uses meters
 	bool get_use_meters() const;
+	/// Get the settings of the echo requests of all connections
+	const OpenflowConnection::EchoConfiguration& get_echo_configuration() const;
+
+	/// Set the shard this hypervisor serves, before loading the configuration
+	void set_shard(int shard);
+	/// Get the shard this hypervisor serves
+	int get_shard() const;
+	/// Check if a physical switch is served by this hypervisor
+	bool is_local_switch(uint64_t datapath_id) const;
+	/// Check if the hypervisor is stopping
+	/**
+	 * The virtual switches that go down while stopping leave
+	 * their rules and groups in the physical switches, they are
+	 * reconciled when the hypervisor is started again.
+	 */
+	bool is_stopping() const;
+
+	/// Get the state a physical switch had in a previous run
+	/**
+	 * \return nullptr if there is no restart snapshot or the
+	 * switch is not in it, the switch is then started empty
+	 */
+	const RestartSnapshot::SwitchState* get_restart_state(uint64_t datapath_id) const;
+	/// Store the state of a physical switch in the restart snapshot
+	void save_restart_state(
+		uint64_t datapath_id,
+		const RestartSnapshot::SwitchState& state);
 
 	/// Get the physical switches in the hypervisor
 	const std::unordered_map<int,PhysicalSwitch::pointer>& get_physical_switches() const;
@@ -81,13 +266,22 @@ public:
 	void unregister_physical_switch(int switch_id);
 	void unregister_physical_switch(uint64_t datapath_id,int switch_id);
 
-	/// Run the floyd-warshall algorithm on the known topology in dot format
+	/// Recalculate all routes, used when the set of switches changes
 	void calculate_routes();
+	/// Update the routes after a link has been discovered
+	void link_added(const DiscoveredLink& link);
+	/// Update the routes after a link has been removed
+	void link_removed(const DiscoveredLink& link);
 	/// Print the found topology to an ostream
 	void print_topology(std::ostream& os);
 	/// Print the found distance vector to an ostream
 	void print_switch_distances(std::ostream& os);
 
 	/// Load configuration from file
+	/**
+	 * The file is read again when the hypervisor receives
+	 * SIGHUP, the virtual switches and their ports are then
+	 * changed while running.
+	 */
 	void load_configuration( std::string filename );
 };
@@ -1,60 +1,159 @@
 #pragma once
 
-#include <set>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
 
 /// Keep track and allocate id's
 /**
  * A lot of virtual features need to be assigned
  * id's. This class keeps track of what id's are
  * used and what are still available.
+ *
+ * The id's below next that have been returned are kept
+ * in a bitmap, on top of it is a summary bitmap telling
+ * which words of the bitmap contain a returned id. Both
+ * allocating and freeing are a few bit operations, the
+ * lowest returned id is always handed out first. The
+ * bitmaps only grow when next passes a multiple of 64 id's,
+ * for small ranges they are reserved up front.
+ *
+ * An IdAllocator is not thread safe, all allocators are
+ * only used on the control strand.
  */
 template<unsigned long long min,unsigned long long max>
 class IdAllocator {
-	/// The next id to be released
-	int next;
+	static_assert(min <= max, "IdAllocator needs at least 1 id");
 
-	/// The set of id's that have been returned
-	std::set<int> returned_ids;
+	/// The amount of id's in a word of the bitmap
+	static constexpr int word_bits = 64;
+	/// Ranges up to this size reserve their bitmaps up front
+	static constexpr unsigned long long reserve_limit = 1<<16;
+
+	/// The next id to be released that was never returned
+	unsigned long long next;
+
+	/// Bit i of word w is set if id min+w*64+i is returned
+	std::vector<uint64_t> returned_ids;
+	/// Bit i of word w is set if returned_ids[w*64+i] is not empty
+	std::vector<uint64_t> returned_words;
+	/// The lowest word in returned_words that can be non empty
+	size_t first_returned_word;
+	/// The amount of returned id's
+	unsigned long long num_returned;
+
+	/// Get the amount of words needed for an amount of bits
+	static size_t num_words(unsigned long long bits) {
+		return (bits+word_bits-1)/word_bits;
+	}
+
+	/// Check if a returned id is in the bitmap
+	bool is_returned(unsigned long long index) const {
+		return index/word_bits < returned_ids.size() &&
+			(returned_ids[index/word_bits]>>(index%word_bits)) & 1;
+	}
+	/// Remove a returned id from the bitmap
+	void clear_returned(unsigned long long index) {
+		size_t word = index/word_bits;
+		returned_ids[word] &= ~(uint64_t(1)<<(index%word_bits));
+		if( returned_ids[word] == 0 ) {
+			returned_words[word/word_bits] &= ~(uint64_t(1)<<(word%word_bits));
+		}
+		--num_returned;
+	}
 
 public:
 	/// Create a new id allocator
-	IdAllocator() {
-		next = min;
+	IdAllocator() :
+		next(min),
+		first_returned_word(0),
+		num_returned(0) {
+		if( max-min < reserve_limit ) {
+			returned_ids.reserve(num_words(max-min+1));
+			returned_words.reserve(num_words(num_words(max-min+1)));
+		}
 	}
 
 	/// Allocate a new id
-	int new_id() {
-		int id;
-		if( returned_ids.empty() ) {
-			id = next;
-			if( id > max ) {
-				throw new std::out_of_range(
+	unsigned long long new_id() {
+		if( num_returned == 0 ) {
+			if( next > max ) {
+				throw std::out_of_range(
 					"Cannot allocate new id, out of valid ids");
 			}
-			++next;
+			return next++;
 		}
-		else {
-			auto it = returned_ids.begin();
-			id = *it;
-			returned_ids.erase(it);
+
+		// Find the lowest returned id via the summary
+		while( returned_words[first_returned_word] == 0 ) {
+			++first_returned_word;
 		}
-		return id;
+		size_t word =
+			first_returned_word*word_bits +
+			__builtin_ctzll(returned_words[first_returned_word]);
+		unsigned long long index =
+			word*word_bits +
+			__builtin_ctzll(returned_ids[word]);
+
+		clear_returned(index);
+		return min + index;
 	}
 
 	/// Free a reserved id
-	void free_id(int id) {
-		returned_ids.insert(id);
+	void free_id(unsigned long long id) {
+		unsigned long long index = id - min;
+		if( id < min || id >= next || is_returned(index) ) return;
 
-		// Clear id's from the returned id's
-		std::set<int>::iterator it;
-		while((it=returned_ids.find(next-1))!=returned_ids.end()) {
-			returned_ids.erase(it);
+		// Release the id directly if it is the last one
+		// handed out, together with the returned id's
+		// below it
+		if( id == next-1 ) {
 			--next;
+			while( next > min && is_returned(next-1-min) ) {
+				clear_returned(next-1-min);
+				--next;
+			}
+			return;
+		}
+
+		// Grow the bitmaps to contain the id
+		size_t word = index/word_bits;
+		if( word >= returned_ids.size() ) {
+			returned_ids.resize(word+1, 0);
+			returned_words.resize(num_words(word+1), 0);
+		}
+
+		returned_ids[word]             |= uint64_t(1)<<(index%word_bits);
+		returned_words[word/word_bits] |= uint64_t(1)<<(word%word_bits);
+		if( word/word_bits < first_returned_word ) {
+			first_returned_word = word/word_bits;
 		}
+		++num_returned;
+	}
+
+	/// Reserve a specific id, used to restore earlier allocations
+	/**
+	 * The id's skipped over are kept as returned id's.
+	 * \return False if the id is invalid or already in use
+	 */
+	bool reserve_id(unsigned long long id) {
+		if( id < min || id > max ) return false;
+		unsigned long long index = id - min;
+
+		if( id < next ) {
+			if( !is_returned(index) ) return false;
+			clear_returned(index);
+			return true;
+		}
+
+		unsigned long long skipped = next;
+		next = id+1;
+		for( ; skipped<id; ++skipped ) free_id(skipped);
+		return true;
 	}
 
 	/// Return how many id's can still be allocated
-	int amount_left() {
-		return returned_ids.size() + (max - next + 1);
+	unsigned long long amount_left() const {
+		return num_returned + (max - next + 1);
 	}
 };
@@ -0,0 +1,96 @@
+#include "log.hpp"
+
+#include <iostream>
+
+#include <boost/make_shared.hpp>
+#include <boost/core/null_deleter.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
+#include <boost/log/sinks/drop_on_overflow.hpp>
+#include <boost/log/sinks/text_file_backend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/log/support/date_time.hpp>
+#include <boost/log/utility/setup/common_attributes.hpp>
+
+namespace {
+	/// The amount of records queued before new records are dropped
+	constexpr size_t max_queued_records = 65536;
+
+	/// The queue between the io threads and the logging thread, a
+	/// full queue drops records instead of blocking the io threads
+	typedef boost::log::sinks::bounded_fifo_queue<
+		max_queued_records,
+		boost::log::sinks::drop_on_overflow> Queue;
+
+	typedef boost::log::sinks::asynchronous_sink<
+		boost::log::sinks::text_file_backend,
+		Queue> FileSink;
+	typedef boost::log::sinks::asynchronous_sink<
+		boost::log::sinks::text_ostream_backend,
+		Queue> ConsoleSink;
+
+	/// The running sinks, only one of them is used
+	boost::shared_ptr<FileSink> file_sink;
+	boost::shared_ptr<ConsoleSink> console_sink;
+
+	/// Write a timestamp before every record
+	template<class Sink>
+	void set_format(Sink& sink) {
+		sink.set_formatter(
+			boost::log::expressions::stream
+				<< "["
+				<< boost::log::expressions::attr<boost::posix_time::ptime>("TimeStamp")
+				<< "]: "
+				<< boost::log::expressions::smessage);
+	}
+}
+
+boost::atomic<int> logging::runtime_level(boost::log::trivial::trace);
+
+void logging::start(boost::log::trivial::severity_level level, const std::string& file_name) {
+	runtime_level.store(level, boost::memory_order_relaxed);
+	boost::log::core::get()->set_filter(
+		boost::log::trivial::severity >= level
+	);
+
+	// Tell the logger to store timestamps and the like
+	boost::log::add_common_attributes();
+
+	// The records are written on the thread of the sink, flushing
+	// after every record doesn't slow down the io threads
+	if( file_name != "" ) {
+		auto backend = boost::make_shared<boost::log::sinks::text_file_backend>(
+			boost::log::keywords::file_name = file_name);
+		backend->auto_flush(true);
+		file_sink = boost::make_shared<FileSink>(backend);
+		set_format(*file_sink);
+		boost::log::core::get()->add_sink(file_sink);
+	}
+	else {
+		auto backend = boost::make_shared<boost::log::sinks::text_ostream_backend>();
+		backend->add_stream(
+			boost::shared_ptr<std::ostream>(&std::clog, boost::null_deleter()));
+		backend->auto_flush(true);
+		console_sink = boost::make_shared<ConsoleSink>(backend);
+		set_format(*console_sink);
+		boost::log::core::get()->add_sink(console_sink);
+	}
+}
+
+void logging::stop() {
+	if( file_sink != nullptr ) {
+		boost::log::core::get()->remove_sink(file_sink);
+		file_sink->stop();
+		file_sink->flush();
+		file_sink.reset();
+	}
+	if( console_sink != nullptr ) {
+		boost::log::core::get()->remove_sink(console_sink);
+		console_sink->stop();
+		console_sink->flush();
+		console_sink.reset();
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/log/trivial.hpp>
+
+/**
+ * This header defines the logging macros for the per message paths
+ * of the hypervisor. The records are handed to an asynchronous sink
+ * that formats and writes them on its own thread, so the io threads
+ * never block on the log file.
+ *
+ * Levels below DELFTVISOR_LOG_MIN_LEVEL are removed at compile time,
+ * the other levels are checked against the level passed on the
+ * command line before a record is opened.
+ */
+
+/// The lowest level compiled in, set with -DDELFTVISOR_LOG_MIN_LEVEL
+#ifndef DELFTVISOR_LOG_MIN_LEVEL
+#define DELFTVISOR_LOG_MIN_LEVEL trace
+#endif
+
+namespace logging {
+
+/// Log one in this many records of every message received by a switch
+constexpr uint64_t packet_sample = 100;
+
+/// The lowest level that is logged, set by start
+extern boost::atomic<int> runtime_level;
+
+/// Check if a level is logged without opening a record
+inline bool enabled(boost::log::trivial::severity_level level) {
+	return
+		level >= boost::log::trivial::DELFTVISOR_LOG_MIN_LEVEL &&
+		level >= runtime_level.load(boost::memory_order_relaxed);
+}
+
+/// Count an occurrence, true for every n-th occurrence in this thread
+inline bool sample(uint64_t& counter, uint64_t n) {
+	return counter++ % n == 0;
+}
+
+/// Start logging to a file or to the console if the filename is empty
+void start(boost::log::trivial::severity_level level, const std::string& file_name);
+/// Write the queued records and stop the logging thread
+void stop();
+
+}
+
+/// Log a record on a per message path
+#define DELFTVISOR_LOG(level) \
+	if( \
+		boost::log::trivial::level < boost::log::trivial::DELFTVISOR_LOG_MIN_LEVEL || \
+		!logging::enabled(boost::log::trivial::level) \
+	) {} \
+	else BOOST_LOG_TRIVIAL(level)
+
+/// Log one in every n records of a call site per thread
+#define DELFTVISOR_LOG_EVERY_N(level, n) \
+	if( \
+		boost::log::trivial::level < boost::log::trivial::DELFTVISOR_LOG_MIN_LEVEL || \
+		!logging::enabled(boost::log::trivial::level) || \
+		!logging::sample([]() -> uint64_t& { \
+			static thread_local uint64_t counter = 0; \
+			return counter; \
+		}(), n) \
+	) {} \
+	else BOOST_LOG_TRIVIAL(level) << "[1 in " << (n) << "] "
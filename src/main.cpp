@@ -5,16 +5,10 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
-#include <boost/log/core.hpp>
-#include <boost/log/expressions.hpp>
 #include <boost/log/trivial.hpp>
-#include <boost/log/sinks/text_file_backend.hpp>
-#include <boost/log/utility/setup/file.hpp>
-#include <boost/log/utility/setup/common_attributes.hpp>
-#include <boost/log/sources/severity_logger.hpp>
-#include <boost/log/sources/record_ostream.hpp>
 
 #include "hypervisor.hpp"
+#include "log.hpp"
 #include "slice.hpp"
 
 /// The amount of threads to spawn
@@ -25,6 +19,8 @@ std::string configuration_file;
 std::string log_level;
 /// The log filename
 std::string log_file;
+/// The shard of the physical switches to serve
+int shard;
 
 /// Parse the command line arguments
 /**
@@ -41,7 +37,8 @@ bool parse_arguments(int argc, char* argv[]) {
 		("config_file,f", boost::program_options::value<std::string>(&configuration_file), "Configuration file path")
 		("num_threads,t", boost::program_options::value<int>(&num_threads)->default_value(1), "Amount of threads to spawn")
 		("log_level,l", boost::program_options::value<std::string>(&log_level)->default_value("error"))
-		("log_file", boost::program_options::value<std::string>(&log_file));
+		("log_file", boost::program_options::value<std::string>(&log_file))
+		("shard,s", boost::program_options::value<int>(&shard)->default_value(0), "Shard of the physical switches to serve");
 
 	// A positional option is used so you don't have to specify
 	// explicitly that the first argument is the config file
@@ -107,29 +104,14 @@ bool parse_arguments(int argc, char* argv[]) {
 		std::cerr << "Unknown log level \"" << log_level << "\"" << std::endl;
 		return false;
 	}
-	boost::log::core::get()->set_filter(
-		boost::log::trivial::severity >= level
-	);
-
-	// Tell the logger to store timestamps and the like
-	boost::log::add_common_attributes();
-
-	// Tell the logger to write to file if needed
-	if( log_file != "" ) {
-		boost::log::add_file_log(
-			boost::log::keywords::file_name = log_file,
-			boost::log::keywords::format = "[%TimeStamp%]: %Message%"
-		);
-	}
-
 	// Check that the amount of threads is valid
 	if( num_threads < 1 ) {
 		std::cerr << "Amount of threads must be positive" << std::endl;
 		return false;
 	}
-	else if( num_threads > 1 ) {
-		std::cerr << "Using more than 1 threads is still experimental" << std::endl;
-	}
+
+	// Log on a separate thread to the file or the console
+	logging::start(level, log_file);
 
 	// Everything went ok
 	return true;
@@ -151,15 +133,18 @@ int main(int argc, char* argv[]) {
 
 	// Startup the hypervisor
 	Hypervisor h( io );
+	h.set_shard( shard );
 	try {
 		h.load_configuration( configuration_file );
 	}
 	catch( const std::exception& e ) {
 		std::cerr << e.what() << std::endl;
+		logging::stop();
 		return 1;
 	}
 	catch( ... ) {
 		std::cerr << "Problem in configuration file " << configuration_file << std::endl;
+		logging::stop();
 		return 1;
 	}
 	h.start();
@@ -183,5 +168,8 @@ int main(int argc, char* argv[]) {
 
 	BOOST_LOG_TRIVIAL(info) << "Joined " << num_threads << " threads";
 
+	// Write the records that are still queued
+	logging::stop();
+
 	return 0;
 }
@@ -0,0 +1,56 @@
+#include "metrics.hpp"
+
+namespace metrics {
+
+constexpr int Histogram::num_buckets;
+
+Histogram::Histogram() {
+	for( auto& bucket : buckets ) {
+		bucket.store(0, boost::memory_order_relaxed);
+	}
+}
+
+void Histogram::observe(uint64_t microseconds) {
+	// Find the first bucket bound that fits this duration
+	int bucket = 0;
+	while( bucket<num_buckets && (uint64_t(1)<<bucket) < microseconds ) {
+		++bucket;
+	}
+	if( bucket < num_buckets ) {
+		buckets[bucket].fetch_add(1, boost::memory_order_relaxed);
+	}
+
+	count.add();
+	sum.add(microseconds);
+}
+
+void Histogram::write(
+		std::ostream& os,
+		const std::string& name,
+		const std::string& labels) const {
+	std::string separator = labels.empty() ? "" : ",";
+
+	// Prometheus buckets are cumulative and in seconds
+	uint64_t cumulative = 0;
+	for( int bucket=0; bucket<num_buckets; ++bucket ) {
+		cumulative += buckets[bucket].load(boost::memory_order_relaxed);
+		os << name << "_bucket{" << labels << separator
+			<< "le=\"" << (uint64_t(1)<<bucket)/1e6 << "\"} "
+			<< cumulative << "\n";
+	}
+	os << name << "_bucket{" << labels << separator
+		<< "le=\"+Inf\"} " << count.get() << "\n";
+
+	os << name << "_sum{" << labels << "} " << sum.get()/1e6 << "\n";
+	os << name << "_count{" << labels << "} " << count.get() << "\n";
+}
+
+void write_value(
+		std::ostream& os,
+		const std::string& name,
+		const std::string& labels,
+		uint64_t value) {
+	os << name << "{" << labels << "} " << value << "\n";
+}
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <ostream>
+#include <chrono>
+
+#include <boost/atomic.hpp>
+
+/**
+ * This header defines the counters and histograms used to
+ * instrument the hypervisor. They are updated with relaxed
+ * atomic operations so they can be used from any strand
+ * without locking, the values are only read when they are
+ * exported by the MetricsServer.
+ */
+namespace metrics {
+
+/// A value that only goes up
+class Counter {
+private:
+	boost::atomic<uint64_t> value;
+
+public:
+	Counter() : value(0) {}
+
+	/// Add to the counter
+	void add(uint64_t amount=1) {
+		value.fetch_add(amount, boost::memory_order_relaxed);
+	}
+	/// Get the current value
+	uint64_t get() const {
+		return value.load(boost::memory_order_relaxed);
+	}
+};
+
+/// A value that goes up and down
+class Gauge {
+private:
+	boost::atomic<int64_t> value;
+
+public:
+	Gauge() : value(0) {}
+
+	/// Set the value
+	void set(int64_t new_value) {
+		value.store(new_value, boost::memory_order_relaxed);
+	}
+	/// Get the current value
+	int64_t get() const {
+		return value.load(boost::memory_order_relaxed);
+	}
+};
+
+/// A histogram of durations
+/**
+ * The bucket boundaries are powers of 2 microseconds, from
+ * 1us to about 8s. Longer durations are only counted in the
+ * sum and count.
+ */
+class Histogram {
+private:
+	/// The amount of buckets
+	static constexpr int num_buckets = 24;
+
+	/// The amount of durations per bucket, not cumulative
+	boost::atomic<uint64_t> buckets[num_buckets];
+	/// The amount of durations observed
+	Counter count;
+	/// The sum of the durations in microseconds
+	Counter sum;
+
+public:
+	Histogram();
+
+	/// Add a duration in microseconds
+	void observe(uint64_t microseconds);
+	/// Add a duration
+	template<class Duration>
+	void observe_duration(Duration duration) {
+		observe(std::chrono::duration_cast<std::chrono::microseconds>(
+			duration).count());
+	}
+
+	/// Write this histogram in the Prometheus text format
+	/**
+	 * \param labels The labels without braces, can be empty
+	 */
+	void write(
+		std::ostream& os,
+		const std::string& name,
+		const std::string& labels) const;
+};
+
+/// Observe the time a scope takes in a histogram
+class ScopedTimer {
+private:
+	/// The histogram to observe the duration in
+	Histogram& histogram;
+	/// The time the scope was entered
+	std::chrono::steady_clock::time_point start;
+
+public:
+	ScopedTimer(Histogram& histogram) :
+		histogram(histogram),
+		start(std::chrono::steady_clock::now()) {
+	}
+	~ScopedTimer() {
+		histogram.observe_duration(
+			std::chrono::steady_clock::now() - start);
+	}
+};
+
+/// Write a counter or gauge value in the Prometheus text format
+void write_value(
+	std::ostream& os,
+	const std::string& name,
+	const std::string& labels,
+	uint64_t value);
+
+}
@@ -0,0 +1,196 @@
+#include "metrics_server.hpp"
+#include "hypervisor.hpp"
+#include "slice.hpp"
+
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/make_shared.hpp>
+
+namespace {
+	/// The maximum size of a request
+	constexpr size_t max_request_size = 8192;
+}
+
+MetricsServer::MetricsServer(
+		boost::asio::io_service& io,
+		Hypervisor* hypervisor) :
+	hypervisor(hypervisor),
+	acceptor(io) {
+}
+
+void MetricsServer::start(int port) {
+	acceptor.open(boost::asio::ip::tcp::v4());
+	acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+	acceptor.bind(
+		boost::asio::ip::tcp::endpoint(
+			boost::asio::ip::tcp::v4(),
+			port));
+	acceptor.listen();
+
+	start_accept();
+
+	BOOST_LOG_TRIVIAL(info) << "Serving metrics on port " << port;
+}
+
+void MetricsServer::stop() {
+	if( acceptor.is_open() ) acceptor.close();
+}
+
+void MetricsServer::start_accept() {
+	boost::shared_ptr<boost::asio::ip::tcp::socket> socket =
+		boost::make_shared<boost::asio::ip::tcp::socket>(
+			acceptor.get_io_service());
+
+	acceptor.async_accept(
+		*socket,
+		hypervisor->get_control_strand().wrap(boost::bind(
+			&MetricsServer::handle_accept,
+			this,
+			boost::asio::placeholders::error,
+			socket)));
+}
+
+void MetricsServer::handle_accept(
+		const boost::system::error_code& error,
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+	if( error == boost::asio::error::operation_aborted ) return;
+	if( error ) {
+		BOOST_LOG_TRIVIAL(error) << "Error accepting metrics connection: " << error.message();
+	}
+	else {
+		// Read the request headers, the body is ignored
+		boost::shared_ptr<boost::asio::streambuf> request =
+			boost::make_shared<boost::asio::streambuf>(max_request_size);
+		boost::asio::async_read_until(
+			*socket,
+			*request,
+			"\r\n\r\n",
+			hypervisor->get_control_strand().wrap(boost::bind(
+				&MetricsServer::handle_request,
+				this,
+				boost::asio::placeholders::error,
+				socket,
+				request)));
+	}
+
+	start_accept();
+}
+
+void MetricsServer::handle_request(
+		const boost::system::error_code& error,
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+		boost::shared_ptr<boost::asio::streambuf> request) {
+	if( error ) return;
+
+	// Only the path in the request line matters
+	std::istream request_stream(request.get());
+	std::string method, path;
+	request_stream >> method >> path;
+
+	std::ostringstream body;
+	std::string status       = "200 OK";
+	std::string content_type = "text/plain; version=0.0.4";
+	if( method != "GET" ) {
+		status = "405 Method Not Allowed";
+	}
+	else if( path == "/metrics" ) {
+		write_metrics(body);
+	}
+	else if( path == "/topology" ) {
+		content_type = "text/vnd.graphviz";
+		hypervisor->print_topology(body);
+	}
+	else if( path == "/distances" ) {
+		hypervisor->print_switch_distances(body);
+	}
+	else if( path == "/switches" ) {
+		for( const auto& ps : hypervisor->get_physical_switches() ) {
+			ps.second->print_detailed(body);
+		}
+	}
+	else {
+		status = "404 Not Found";
+	}
+
+	std::string body_string = body.str();
+	boost::shared_ptr<std::string> response = boost::make_shared<std::string>(
+		"HTTP/1.0 " + status + "\r\n"
+		"Content-Type: " + content_type + "\r\n"
+		"Content-Length: " + std::to_string(body_string.size()) + "\r\n"
+		"Connection: close\r\n"
+		"\r\n" + body_string);
+
+	boost::asio::async_write(
+		*socket,
+		boost::asio::buffer(*response),
+		boost::bind(
+			&MetricsServer::handle_response,
+			this,
+			socket,
+			response));
+}
+
+void MetricsServer::handle_response(
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+		boost::shared_ptr<std::string>) {
+	boost::system::error_code ignored;
+	socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+	socket->close(ignored);
+}
+
+void MetricsServer::write_metrics(std::ostream& os) {
+	// The metrics of the hypervisor itself
+	const Hypervisor::Metrics& hypervisor_metrics = hypervisor->get_metrics();
+	hypervisor_metrics.packet_in_relay_time.write(os,
+		"delftvisor_packet_in_relay_seconds", "");
+	hypervisor_metrics.flow_mod_rewrite_time.write(os,
+		"delftvisor_flow_mod_rewrite_seconds", "");
+	hypervisor_metrics.route_computation_time.write(os,
+		"delftvisor_route_computation_seconds", "");
+
+	// The metrics of every connection
+	for( const auto& ps : hypervisor->get_physical_switches() ) {
+		std::string labels =
+			"kind=\"physical\",switch_id=\"" + std::to_string(ps.first) +
+			"\",dpid=\"" + std::to_string(ps.second->get_features().datapath_id) + "\"";
+		ps.second->write_metrics(os, labels);
+
+		// The rules of the virtual switches per slice in this switch
+		for( const auto& slice_rules : ps.second->get_rule_accounting().get_slice_rules() ) {
+			metrics::write_value(os,
+				"delftvisor_flow_rules",
+				labels + ",slice=\"" + std::to_string(slice_rules.first) + "\"",
+				slice_rules.second);
+		}
+	}
+	for( const Slice& slice : hypervisor->get_slices() ) {
+		std::string slice_labels = "slice=\"" + std::to_string(slice.get_id()) + "\"";
+
+		for( const auto& vs : slice.get_virtual_switches() ) {
+			if( !vs.second->is_connected() ) continue;
+			std::string labels =
+				"kind=\"virtual\"," + slice_labels +
+				",dpid=\"" + std::to_string(vs.first) + "\"";
+			vs.second->write_metrics(os, labels);
+		}
+
+		// The PacketIn scheduling per slice
+		PacketInScheduler& scheduler = hypervisor->get_packet_in_scheduler();
+		metrics::write_value(os,
+			"delftvisor_packet_ins_relayed_total",
+			slice_labels,
+			scheduler.get_relayed(slice.get_id()));
+		metrics::write_value(os,
+			"delftvisor_packet_ins_dropped_total",
+			slice_labels,
+			scheduler.get_dropped(slice.get_id()));
+
+		// The rule quota per physical switch, 0 is no limit
+		metrics::write_value(os,
+			"delftvisor_flow_rule_quota",
+			slice_labels,
+			slice.get_max_flow_rules());
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+class Hypervisor;
+
+/// A minimal HTTP server exporting the state of the hypervisor
+/**
+ * The following paths are served:
+ *  - /metrics in the Prometheus text format
+ *  - /topology the discovered topology in dot format
+ *  - /distances the distances between the physical switches
+ *  - /switches the detailed state of every physical switch
+ * Every request is answered on the control strand after which
+ * the connection is closed.
+ */
+class MetricsServer {
+private:
+	/// The hypervisor whose state is exported
+	Hypervisor* hypervisor;
+
+	/// The acceptor for HTTP connections
+	boost::asio::ip::tcp::acceptor acceptor;
+
+	/// Wait for the next connection
+	void start_accept();
+	/// Handle a new connection
+	void handle_accept(
+		const boost::system::error_code& error,
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket);
+	/// Answer a received request
+	void handle_request(
+		const boost::system::error_code& error,
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+		boost::shared_ptr<boost::asio::streambuf> request);
+	/// Close the connection when the response is written
+	/**
+	 * The connection is closed whether the write failed or not,
+	 * the response is passed along to keep it alive until then.
+	 */
+	void handle_response(
+		boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+		boost::shared_ptr<std::string>);
+
+	/// Write all metrics in the Prometheus text format
+	void write_metrics(std::ostream& os);
+
+public:
+	/// Create a metrics server that is not listening yet
+	MetricsServer(boost::asio::io_service& io, Hypervisor* hypervisor);
+
+	/// Start listening on a port
+	void start(int port);
+	/// Stop listening
+	void stop();
+};
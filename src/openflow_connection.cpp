@@ -1,24 +1,135 @@
 #include "openflow_connection.hpp"
+#include "byte_order.hpp"
+#include "log.hpp"
 
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <iterator>
 
 #include <boost/bind.hpp>
 #include <boost/log/trivial.hpp>
 
-OpenflowConnection::OpenflowConnection( boost::asio::ip::tcp::socket& socket ) :
+namespace {
+	/// The length of the fixed part of every message type in OpenFlow 1.3
+	constexpr uint16_t min_message_lengths[] = {
+		8,  // OFPT_HELLO
+		12, // OFPT_ERROR
+		8,  // OFPT_ECHO_REQUEST
+		8,  // OFPT_ECHO_REPLY
+		16, // OFPT_EXPERIMENTER
+		8,  // OFPT_FEATURES_REQUEST
+		32, // OFPT_FEATURES_REPLY
+		8,  // OFPT_GET_CONFIG_REQUEST
+		12, // OFPT_GET_CONFIG_REPLY
+		12, // OFPT_SET_CONFIG
+		32, // OFPT_PACKET_IN
+		56, // OFPT_FLOW_REMOVED
+		80, // OFPT_PORT_STATUS
+		24, // OFPT_PACKET_OUT
+		56, // OFPT_FLOW_MOD
+		16, // OFPT_GROUP_MOD
+		40, // OFPT_PORT_MOD
+		16, // OFPT_TABLE_MOD
+		16, // OFPT_MULTIPART_REQUEST
+		16, // OFPT_MULTIPART_REPLY
+		8,  // OFPT_BARRIER_REQUEST
+		8,  // OFPT_BARRIER_REPLY
+		16, // OFPT_QUEUE_GET_CONFIG_REQUEST
+		16, // OFPT_QUEUE_GET_CONFIG_REPLY
+		24, // OFPT_ROLE_REQUEST
+		24, // OFPT_ROLE_REPLY
+		8,  // OFPT_GET_ASYNC_REQUEST
+		32, // OFPT_GET_ASYNC_REPLY
+		32, // OFPT_SET_ASYNC
+		16  // OFPT_METER_MOD
+	};
+	/// The amount of bytes of a rejected message send back in the error
+	constexpr size_t error_data_length = 64;
+	/// The length of the send time in the payload of an echo request
+	constexpr size_t echo_payload_length = 8;
+	/// The shortest time to wait for an echo reply in milliseconds
+	constexpr int min_echo_timeout = 500;
+}
+
+constexpr int OpenflowConnection::num_message_types;
+constexpr int OpenflowConnection::num_multipart_types;
+
+OpenflowConnection::DispatchTable::DispatchTable() {
+	static_assert(
+		sizeof(min_message_lengths)/sizeof(min_message_lengths[0]) == num_message_types,
+		"Every message type needs a minimum length");
+
+	std::fill(std::begin(messages), std::end(messages), nullptr);
+	std::fill(std::begin(multipart_requests), std::end(multipart_requests), nullptr);
+	std::fill(std::begin(multipart_replies), std::end(multipart_replies), nullptr);
+
+	set_message<
+		OpenflowConnection,
+		fluid_msg::of13::Hello,
+		&OpenflowConnection::handle_hello>(fluid_msg::of13::OFPT_HELLO);
+	set_message<
+		OpenflowConnection,
+		fluid_msg::of13::EchoRequest,
+		&OpenflowConnection::handle_echo_request>(fluid_msg::of13::OFPT_ECHO_REQUEST);
+	set_message<
+		OpenflowConnection,
+		fluid_msg::of13::EchoReply,
+		&OpenflowConnection::handle_echo_reply>(fluid_msg::of13::OFPT_ECHO_REPLY);
+	set_message<
+		OpenflowConnection,
+		fluid_msg::of13::Experimenter,
+		&OpenflowConnection::handle_experimenter>(fluid_msg::of13::OFPT_EXPERIMENTER);
+}
+
+int OpenflowConnection::multipart_index(uint16_t multipart_type) {
+	if( multipart_type == fluid_msg::of13::OFPMP_EXPERIMENTER ) return num_multipart_types-1;
+	if( multipart_type < num_multipart_types-1 ) return multipart_type;
+	return -1;
+}
+
+OpenflowConnection::OpenflowConnection(
+		boost::asio::ip::tcp::socket& socket,
+		boost::asio::io_service::strand& control_strand,
+		const DispatchTable& dispatch_table,
+		const EchoConfiguration& echo_configuration) :
+	dispatch_table(dispatch_table),
+	received_handler(nullptr),
+	sending(false),
+	echo_configuration(echo_configuration),
+	echo_timer(socket.get_io_service(),boost::posix_time::milliseconds(0)),
+	echo_outstanding(false),
+	missed_echoes(0),
+	echo_interval(echo_configuration.interval),
+	smoothed_rtt(0),
+	rtt_variation(0),
+	next_xid(0),
 	// Construct the socket of this connection from an existing socket
 	socket(std::move(socket)),
-	echo_timer(socket.get_io_service(),boost::posix_time::milliseconds(0)),
-	echo_received(true),
-	next_xid(0) {
+	strand(socket.get_io_service()),
+	control_strand(control_strand) {
 }
 
-OpenflowConnection::OpenflowConnection( boost::asio::io_service& io ) :
+OpenflowConnection::OpenflowConnection(
+		boost::asio::io_service& io,
+		boost::asio::io_service::strand& control_strand,
+		const DispatchTable& dispatch_table,
+		const EchoConfiguration& echo_configuration) :
+	dispatch_table(dispatch_table),
+	received_handler(nullptr),
+	sending(false),
+	echo_configuration(echo_configuration),
+	echo_timer(io,boost::posix_time::milliseconds(0)),
+	echo_outstanding(false),
+	missed_echoes(0),
+	echo_interval(echo_configuration.interval),
+	smoothed_rtt(0),
+	rtt_variation(0),
+	next_xid(0),
 	// Construct a new socket
 	socket(io),
-	echo_timer(io,boost::posix_time::milliseconds(0)),
-	echo_received(true),
-	next_xid(0) {
+	strand(io),
+	control_strand(control_strand) {
 }
 
 void OpenflowConnection::handle_network_error(
@@ -32,32 +143,67 @@ void OpenflowConnection::handle_network_error(
 	case boost::asio::error::connection_aborted:
 	case boost::asio::error::connection_reset:
 	case boost::asio::error::eof:
-		// If the other side gives up stop this connection
-		stop();
+		// If the other side gives up stop this connection,
+		// stopping changes hypervisor state so it is done
+		// on the control strand.
+		control_strand.dispatch(
+			boost::bind(
+				&OpenflowConnection::stop,
+				shared_from_this()));
 		BOOST_LOG_TRIVIAL(trace) << *this <<
 			" connection was " << error.message();
 		break;
 	default:
-		stop();
+		control_strand.dispatch(
+			boost::bind(
+				&OpenflowConnection::stop,
+				shared_from_this()));
 		BOOST_LOG_TRIVIAL(error) << *this <<
 			" has network problem: " << error.message();
 	}
 }
 
 void OpenflowConnection::start() {
-	// Start listening for openflow messages
-	start_receive_message();
-
-	// Start sending echo messages over this connection
-	schedule_echo_message();
-
 	// Send a hello message to the other side,
-	// the hello element bitmap is not mandatory
+	// the hello element bitmap is not mandatory.
+	// This is queued directly so it is the first
+	// message send over this connection.
 	fluid_msg::of13::Hello hello_msg;
 	send_message(hello_msg);
+
+	// The socket and echo timer are only touched
+	// on the connection strand
+	strand.post(
+		boost::bind(
+			&OpenflowConnection::start_connection,
+			shared_from_this()));
 }
 
 void OpenflowConnection::stop() {
+	strand.post(
+		boost::bind(
+			&OpenflowConnection::close_connection,
+			shared_from_this()));
+}
+
+void OpenflowConnection::start_connection() {
+	// Start listening for openflow messages
+	start_receive_message();
+
+	// Start sending echo messages over this connection, a virtual
+	// switch reuses its connection when it connects again
+	echo_outstanding  = false;
+	missed_echoes     = 0;
+	echo_interval     = echo_configuration.interval;
+	smoothed_rtt      = 0;
+	rtt_variation     = 0;
+	smoothed_rtt_gauge.set(0);
+	rtt_variation_gauge.set(0);
+	last_receive_time = std::chrono::steady_clock::now();
+	schedule_echo_timer(std::chrono::milliseconds(echo_interval));
+}
+
+void OpenflowConnection::close_connection() {
 	// socket.shutdown() should be called for graceful closure according to
 	// http://www.boost.org/doc/libs/1_58_0/doc/html/boost_asio/reference/basic_stream_socket/close/overload1.html
 	// Closing the socket stops all socket actions
@@ -75,11 +221,11 @@ void OpenflowConnection::start_receive_message() {
 	boost::asio::async_read(
 		socket,
 		boost::asio::buffer(&message_buffer[0], 8),
-		boost::bind(
+		strand.wrap(boost::bind(
 			&OpenflowConnection::receive_header,
 			shared_from_this(),
 			boost::asio::placeholders::error,
-			boost::asio::placeholders::bytes_transferred));
+			boost::asio::placeholders::bytes_transferred)));
 }
 
 void OpenflowConnection::receive_header(
@@ -89,6 +235,17 @@ void OpenflowConnection::receive_header(
 		// Extract the length of the total packet from the received header
 		size_t length = message_buffer[2]*256+message_buffer[3];
 
+		// A message shorter than its header can't be framed, the
+		// rest of the stream can't be trusted anymore
+		if( length < 8 ) {
+			BOOST_LOG_TRIVIAL(error) << *this << " received message with invalid length " << length;
+			control_strand.dispatch(
+				boost::bind(
+					&OpenflowConnection::stop,
+					shared_from_this()));
+			return;
+		}
+
 		// Make sure the message buffer is large enough
 		if( message_buffer.size() < length ) message_buffer.resize(length);
 
@@ -96,39 +253,81 @@ void OpenflowConnection::receive_header(
 		boost::asio::async_read(
 			socket,
 			boost::asio::buffer(&message_buffer[8], length-8),
-			boost::bind(
+			strand.wrap(boost::bind(
 				&OpenflowConnection::receive_body,
 				shared_from_this(),
 				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
+				boost::asio::placeholders::bytes_transferred)));
 	}
 	else {
 		handle_network_error(error);
 	}
 }
 
-template<
-	class libfluid_message,
-	void (OpenflowConnection::*handle_function)(libfluid_message&)>
-void OpenflowConnection::receive_message() {
-	// Try to unpack the message
-	libfluid_message message;
-	fluid_msg::of_error error = message.unpack(&message_buffer[0]);
+OpenflowConnection::MessageHandler OpenflowConnection::find_handler(size_t length) {
+	uint8_t version = message_buffer[0];
+	uint8_t type    = message_buffer[1];
 
-	// If an error occured just forward it to
-	if( error ) {
-		fluid_msg::of13::Error error_message(
-			message.xid(),
-			fluid_msg::of_error_type(error),
-			fluid_msg::of_error_code(error));
-		this->send_message_response(error_message);
+	// The version is negotiated with the hello messages, all
+	// other messages have to be OpenFlow 1.3
+	if(
+		version != fluid_msg::of13::OFP_VERSION &&
+		type != fluid_msg::of13::OFPT_HELLO
+	) {
+		reject_message(fluid_msg::of13::OFPBRC_BAD_VERSION, length);
+		return nullptr;
+	}
+	if( type >= num_message_types ) {
+		reject_message(fluid_msg::of13::OFPBRC_BAD_TYPE, length);
+		return nullptr;
+	}
+	// The fixed part of the message has to be there before it
+	// can be unpacked
+	if( length < min_message_lengths[type] ) {
+		reject_message(fluid_msg::of13::OFPBRC_BAD_LEN, length);
+		return nullptr;
+	}
 
-		BOOST_LOG_TRIVIAL(error) << *this << " had an error parsing a message";
+	if(
+		type == fluid_msg::of13::OFPT_MULTIPART_REQUEST ||
+		type == fluid_msg::of13::OFPT_MULTIPART_REPLY
+	) {
+		int index = multipart_index(read_uint16(&message_buffer[8]));
+		MessageHandler handler = nullptr;
+		if( index >= 0 ) {
+			handler = type == fluid_msg::of13::OFPT_MULTIPART_REQUEST ?
+				dispatch_table.multipart_requests[index] :
+				dispatch_table.multipart_replies[index];
+		}
+		if( handler == nullptr ) {
+			reject_message(fluid_msg::of13::OFPBRC_BAD_MULTIPART, length);
+		}
+		return handler;
 	}
-	else {
-		// Handle the correctly parsed message
-		(this->*handle_function)(message);
+
+	MessageHandler handler = dispatch_table.messages[type];
+	if( handler == nullptr ) {
+		reject_message(fluid_msg::of13::OFPBRC_BAD_TYPE, length);
 	}
+	return handler;
+}
+
+void OpenflowConnection::reject_message(uint16_t code, size_t length) {
+	uint8_t type = message_buffer[1];
+	BOOST_LOG_TRIVIAL(error) << *this << " rejected message with type "
+		<< int(type) << ", error code " << code;
+
+	// Never answer an error with an error, both sides could
+	// keep rejecting each others errors
+	if( type == fluid_msg::of13::OFPT_ERROR ) return;
+
+	fluid_msg::of13::Error error_message(
+		read_uint32(&message_buffer[4]),
+		fluid_msg::of13::OFPET_BAD_REQUEST,
+		code,
+		&message_buffer[0],
+		std::min(length, error_data_length));
+	send_message_response(error_message);
 }
 
 void OpenflowConnection::receive_body(
@@ -140,362 +339,59 @@ void OpenflowConnection::receive_body(
 		return;
 	}
 
-	// Extract the type of the message
-	uint8_t type = message_buffer[1];
+	// Every message shows the other side is alive
+	last_receive_time = std::chrono::steady_clock::now();
 
-	// Unpack the message into a libfluid object and
-	// call the handle function. This switch statement
-	// is stupid long but I couldn't find an function
-	// in libfluid_msg that did it for me.
-	switch( type ) {
-	case fluid_msg::of13::OFPT_MULTIPART_REQUEST:
-		{
-			uint16_t multi_type = 256*message_buffer[8] + message_buffer[9];
-			switch( multi_type ) {
-			case fluid_msg::of13::OFPMP_DESC:
-				receive_message<
-					fluid_msg::of13::MultipartRequestDesc,
-					&OpenflowConnection::handle_multipart_request_desc>();
-				break;
-			case fluid_msg::of13::OFPMP_FLOW:
-				receive_message<
-					fluid_msg::of13::MultipartRequestFlow,
-					&OpenflowConnection::handle_multipart_request_flow>();
-				break;
-			case fluid_msg::of13::OFPMP_AGGREGATE:
-				receive_message<
-					fluid_msg::of13::MultipartRequestAggregate,
-					&OpenflowConnection::handle_multipart_request_aggregate>();
-				break;
-			case fluid_msg::of13::OFPMP_TABLE:
-				receive_message<
-					fluid_msg::of13::MultipartRequestTable,
-					&OpenflowConnection::handle_multipart_request_table>();
-				break;
-			case fluid_msg::of13::OFPMP_PORT_STATS:
-				receive_message<
-					fluid_msg::of13::MultipartRequestPortStats,
-					&OpenflowConnection::handle_multipart_request_port_stats>();
-				break;
-			case fluid_msg::of13::OFPMP_QUEUE:
-				receive_message<
-					fluid_msg::of13::MultipartRequestQueue,
-					&OpenflowConnection::handle_multipart_request_queue>();
-				break;
-			case fluid_msg::of13::OFPMP_GROUP:
-				receive_message<
-					fluid_msg::of13::MultipartRequestGroup,
-					&OpenflowConnection::handle_multipart_request_group>();
-				break;
-			case fluid_msg::of13::OFPMP_GROUP_DESC:
-				receive_message<
-					fluid_msg::of13::MultipartRequestGroupDesc,
-					&OpenflowConnection::handle_multipart_request_group_desc>();
-				break;
-			case fluid_msg::of13::OFPMP_GROUP_FEATURES:
-				receive_message<
-					fluid_msg::of13::MultipartRequestGroupFeatures,
-					&OpenflowConnection::handle_multipart_request_group_features>();
-				break;
-			case fluid_msg::of13::OFPMP_METER:
-				receive_message<
-					fluid_msg::of13::MultipartRequestMeter,
-					&OpenflowConnection::handle_multipart_request_meter>();
-				break;
-			case fluid_msg::of13::OFPMP_METER_CONFIG:
-				receive_message<
-					fluid_msg::of13::MultipartRequestMeterConfig,
-					&OpenflowConnection::handle_multipart_request_meter_config>();
-				break;
-			case fluid_msg::of13::OFPMP_METER_FEATURES:
-				receive_message<
-					fluid_msg::of13::MultipartRequestMeterFeatures,
-					&OpenflowConnection::handle_multipart_request_meter_features>();
-				break;
-			case fluid_msg::of13::OFPMP_TABLE_FEATURES:
-				receive_message<
-					fluid_msg::of13::MultipartRequestTableFeatures,
-					&OpenflowConnection::handle_multipart_request_table_features>();
-				break;
-			case fluid_msg::of13::OFPMP_PORT_DESC:
-				receive_message<
-					fluid_msg::of13::MultipartRequestPortDescription,
-					&OpenflowConnection::handle_multipart_request_port_desc>();
-				break;
-			case fluid_msg::of13::OFPMP_EXPERIMENTER:
-				receive_message<
-					fluid_msg::of13::MultipartRequestExperimenter,
-					&OpenflowConnection::handle_multipart_request_experimenter>();
-				break;
-			default:
-				BOOST_LOG_TRIVIAL(error) << *this << " received unknown multipart request with type " << multi_type;
-				break;
-			}
-		}
-		break;
+	// Extract the type of the message
+	uint8_t type  = message_buffer[1];
+	size_t length = bytes_transferred+8;
+	if( type < num_message_types ) received_messages[type].add();
+
+	// Rejected messages are answered on the connection strand
+	received_handler = find_handler(length);
+	if( received_handler == nullptr ) {
+		start_receive_message();
+		return;
+	}
 
-	case fluid_msg::of13::OFPT_MULTIPART_REPLY:
-		{
-			uint16_t multi_type = 256*message_buffer[8] + message_buffer[9];
-			switch( multi_type ) {
-			case fluid_msg::of13::OFPMP_DESC:
-				receive_message<
-					fluid_msg::of13::MultipartReplyDesc,
-					&OpenflowConnection::handle_multipart_reply_desc>();
-				break;
-			case fluid_msg::of13::OFPMP_FLOW:
-				receive_message<
-					fluid_msg::of13::MultipartReplyFlow,
-					&OpenflowConnection::handle_multipart_reply_flow>();
-				break;
-			case fluid_msg::of13::OFPMP_AGGREGATE:
-				receive_message<
-					fluid_msg::of13::MultipartReplyAggregate,
-					&OpenflowConnection::handle_multipart_reply_aggregate>();
-				break;
-			case fluid_msg::of13::OFPMP_TABLE:
-				receive_message<
-					fluid_msg::of13::MultipartReplyTable,
-					&OpenflowConnection::handle_multipart_reply_table>();
-				break;
-			case fluid_msg::of13::OFPMP_PORT_STATS:
-				receive_message<
-					fluid_msg::of13::MultipartReplyPortStats,
-					&OpenflowConnection::handle_multipart_reply_port_stats>();
-				break;
-			case fluid_msg::of13::OFPMP_QUEUE:
-				receive_message<
-					fluid_msg::of13::MultipartReplyQueue,
-					&OpenflowConnection::handle_multipart_reply_queue>();
-				break;
-			case fluid_msg::of13::OFPMP_GROUP:
-				receive_message<
-					fluid_msg::of13::MultipartReplyGroup,
-					&OpenflowConnection::handle_multipart_reply_group>();
-				break;
-			case fluid_msg::of13::OFPMP_GROUP_DESC:
-				receive_message<
-					fluid_msg::of13::MultipartReplyGroupDesc,
-					&OpenflowConnection::handle_multipart_reply_group_desc>();
-				break;
-			case fluid_msg::of13::OFPMP_GROUP_FEATURES:
-				receive_message<
-					fluid_msg::of13::MultipartReplyGroupFeatures,
-					&OpenflowConnection::handle_multipart_reply_group_features>();
-				break;
-			case fluid_msg::of13::OFPMP_METER:
-				receive_message<
-					fluid_msg::of13::MultipartReplyMeter,
-					&OpenflowConnection::handle_multipart_reply_meter>();
-				break;
-			case fluid_msg::of13::OFPMP_METER_CONFIG:
-				receive_message<
-					fluid_msg::of13::MultipartReplyMeterConfig,
-					&OpenflowConnection::handle_multipart_reply_meter_config>();
-				break;
-			case fluid_msg::of13::OFPMP_METER_FEATURES:
-				receive_message<
-					fluid_msg::of13::MultipartReplyMeterFeatures,
-					&OpenflowConnection::handle_multipart_reply_meter_features>();
-				break;
-			case fluid_msg::of13::OFPMP_TABLE_FEATURES:
-				// This segfaults at fluid/of13/of13common.cc:1185 because prop==NULL
-				//receive_message<
-				//	fluid_msg::of13::MultipartReplyTableFeatures,
-				//	&OpenflowConnection::handle_multipart_reply_table_features>();
-				break;
-			case fluid_msg::of13::OFPMP_PORT_DESC:
-				receive_message<
-					fluid_msg::of13::MultipartReplyPortDescription,
-					&OpenflowConnection::handle_multipart_reply_port_desc>();
-				break;
-			case fluid_msg::of13::OFPMP_EXPERIMENTER:
-				receive_message<
-					fluid_msg::of13::MultipartReplyExperimenter,
-					&OpenflowConnection::handle_multipart_reply_experimenter>();
-				break;
-			default:
-				BOOST_LOG_TRIVIAL(error) << *this << " received unknown multipart request with type " << multi_type;
-				break;
-			}
+	// Echos and relayed PacketIns don't touch any hypervisor
+	// state, they are handled directly on the connection strand
+	if(
+		type == fluid_msg::of13::OFPT_ECHO_REQUEST ||
+		type == fluid_msg::of13::OFPT_ECHO_REPLY
+	) {
+		received_handler(*this);
+		start_receive_message();
+		return;
+	}
+	else if( type == fluid_msg::of13::OFPT_PACKET_IN ) {
+		// Try to handle the PacketIn straight from the buffer
+		// first, only unpack it if that is not possible
+		PacketInView packet_in(&message_buffer[0], length);
+		if( packet_in.is_valid() && handle_packet_in_view(packet_in) ) {
+			start_receive_message();
+			return;
 		}
-		break;
-
-	case fluid_msg::of13::OFPT_HELLO:
-		receive_message<
-			fluid_msg::of13::Hello,
-			&OpenflowConnection::handle_hello>();
-		break;
-
-	case fluid_msg::of13::OFPT_ERROR:
-		receive_message<
-			fluid_msg::of13::Error,
-			&OpenflowConnection::handle_error>();
-		break;
-
-	case fluid_msg::of13::OFPT_ECHO_REQUEST:
-		receive_message<
-			fluid_msg::of13::EchoRequest,
-			&OpenflowConnection::handle_echo_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_ECHO_REPLY:
-		receive_message<
-			fluid_msg::of13::EchoReply,
-			&OpenflowConnection::handle_echo_reply>();
-		break;
-
-	case fluid_msg::of13::OFPT_EXPERIMENTER:
-		receive_message<
-			fluid_msg::of13::Experimenter,
-			&OpenflowConnection::handle_experimenter>();
-		break;
-
-	case fluid_msg::of13::OFPT_FEATURES_REQUEST:
-		receive_message<
-			fluid_msg::of13::FeaturesRequest,
-			&OpenflowConnection::handle_features_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_FEATURES_REPLY:
-		receive_message<
-			fluid_msg::of13::FeaturesReply,
-			&OpenflowConnection::handle_features_reply>();
-		break;
-
-	case fluid_msg::of13::OFPT_GET_CONFIG_REQUEST:
-		receive_message<
-			fluid_msg::of13::GetConfigRequest,
-			&OpenflowConnection::handle_config_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_GET_CONFIG_REPLY:
-		receive_message<
-			fluid_msg::of13::GetConfigReply,
-			&OpenflowConnection::handle_config_reply>();
-		break;
-
-	case fluid_msg::of13::OFPT_SET_CONFIG:
-		receive_message<
-			fluid_msg::of13::SetConfig,
-			&OpenflowConnection::handle_set_config>();
-		break;
-
-	case fluid_msg::of13::OFPT_BARRIER_REQUEST:
-		receive_message<
-			fluid_msg::of13::BarrierRequest,
-			&OpenflowConnection::handle_barrier_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_BARRIER_REPLY:
-		receive_message<
-			fluid_msg::of13::BarrierReply,
-			&OpenflowConnection::handle_barrier_reply>();
-		break;
-
-	case fluid_msg::of13::OFPT_PACKET_IN:
-		receive_message<
-			fluid_msg::of13::PacketIn,
-			&OpenflowConnection::handle_packet_in>();
-		break;
-
-	case fluid_msg::of13::OFPT_PACKET_OUT:
-		receive_message<
-			fluid_msg::of13::PacketOut,
-			&OpenflowConnection::handle_packet_out>();
-		break;
-
-	case fluid_msg::of13::OFPT_FLOW_REMOVED:
-		receive_message<
-			fluid_msg::of13::FlowRemoved,
-			&OpenflowConnection::handle_flow_removed>();
-		break;
-
-	case fluid_msg::of13::OFPT_PORT_STATUS:
-		receive_message<
-			fluid_msg::of13::PortStatus,
-			&OpenflowConnection::handle_port_status>();
-		break;
-
-	case fluid_msg::of13::OFPT_FLOW_MOD:
-		receive_message<
-			fluid_msg::of13::FlowMod,
-			&OpenflowConnection::handle_flow_mod>();
-		break;
-
-	case fluid_msg::of13::OFPT_GROUP_MOD:
-		receive_message<
-			fluid_msg::of13::GroupMod,
-			&OpenflowConnection::handle_group_mod>();
-		break;
-
-	case fluid_msg::of13::OFPT_PORT_MOD:
-		receive_message<
-			fluid_msg::of13::PortMod,
-			&OpenflowConnection::handle_port_mod>();
-		break;
-
-	case fluid_msg::of13::OFPT_TABLE_MOD:
-		receive_message<
-			fluid_msg::of13::TableMod,
-			&OpenflowConnection::handle_table_mod>();
-		break;
-
-	case fluid_msg::of13::OFPT_METER_MOD:
-		receive_message<
-			fluid_msg::of13::MeterMod,
-			&OpenflowConnection::handle_meter_mod>();
-		break;
-
-	case fluid_msg::of13::OFPT_QUEUE_GET_CONFIG_REQUEST:
-		receive_message<
-			fluid_msg::of13::QueueGetConfigRequest,
-			&OpenflowConnection::handle_queue_config_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_QUEUE_GET_CONFIG_REPLY:
-		receive_message<
-			fluid_msg::of13::QueueGetConfigReply,
-			&OpenflowConnection::handle_queue_config_reply>();
-		break;
-
-	case fluid_msg::of13::OFPT_ROLE_REQUEST:
-		receive_message<
-			fluid_msg::of13::RoleRequest,
-			&OpenflowConnection::handle_role_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_ROLE_REPLY:
-		receive_message<
-			fluid_msg::of13::RoleReply,
-			&OpenflowConnection::handle_role_reply>();
-		break;
-
-	case fluid_msg::of13::OFPT_GET_ASYNC_REQUEST:
-		receive_message<
-			fluid_msg::of13::GetAsyncRequest,
-			&OpenflowConnection::handle_get_async_request>();
-		break;
-
-	case fluid_msg::of13::OFPT_GET_ASYNC_REPLY:
-		receive_message<
-			fluid_msg::of13::GetAsyncReply,
-			&OpenflowConnection::handle_get_async_reply>();
-		break;
+	}
 
-	case fluid_msg::of13::OFPT_SET_ASYNC:
-		receive_message<
-			fluid_msg::of13::SetAsync,
-			&OpenflowConnection::handle_set_async>();
-		break;
+	// All other messages are handled on the control strand, the
+	// next message is only read after it has been handled.
+	control_strand.dispatch(
+		boost::bind(
+			&OpenflowConnection::handle_received_message,
+			shared_from_this()));
+}
 
-	default:
-		BOOST_LOG_TRIVIAL(error) << *this << " received unknown message with type " << type;
-		break;
-	}
+void OpenflowConnection::handle_received_message() {
+	// Unpack the message and call the handle function of the
+	// inheriting class
+	received_handler(*this);
 
-	// Start waiting for the next message
-	start_receive_message();
+	// Start waiting for the next message on the connection strand
+	strand.post(
+		boost::bind(
+			&OpenflowConnection::start_receive_message,
+			shared_from_this()));
 }
 
 uint32_t OpenflowConnection::send_message(fluid_msg::OFMsg& message) {
@@ -506,27 +402,41 @@ uint32_t OpenflowConnection::send_message(fluid_msg::OFMsg& message) {
 }
 
 void OpenflowConnection::send_message_response(fluid_msg::OFMsg& message) {
-	// Get the lock for the message queue
-	boost::lock_guard<boost::mutex> guard(send_queue_mutex);
-
-	// Check if this connection is currently sending a message, if it
-	// is not we need to start up the chain of send message calls
-	// otherwise it will automatically send. If a message is currently
-	// being send there will be a message in the queue.
-	bool startup_send_chain = (send_queue.size()==0);
-
-	// Create the buffer from the message, copy it into a
-	// vector and free the buffer again.
+	// Create the buffer from the message, queue it and
+	// free the buffer again.
 	uint8_t* buffer = message.pack();
-	std::vector<uint8_t> msg( message.length() );
-	for( size_t i=0; i<msg.size(); ++i ) msg[i]=buffer[i];
+	queue_packed_message( buffer, message.length() );
 	fluid_msg::OFMsg::free_buffer( buffer );
+}
 
-	// Add the message to the queue
-	send_queue.push( std::move(msg) );
+uint32_t OpenflowConnection::send_raw_message(uint8_t* buffer, size_t length) {
+	uint32_t xid = next_xid++;
+	write_uint32(buffer+4, xid);
+	queue_packed_message(buffer, length);
+	return xid;
+}
 
-	// Startup the send chain if needed
-	if( startup_send_chain ) send_message_queue_head();
+void OpenflowConnection::queue_packed_message(const uint8_t* buffer, size_t length) {
+	// Get the lock for the send buffers
+	boost::lock_guard<boost::mutex> guard(send_queue_mutex);
+
+	// Count the message by type
+	if( buffer[1] < num_message_types ) sent_messages[buffer[1]].add();
+
+	// Append the message to the messages waiting to be send
+	send_buffer.insert( send_buffer.end(), buffer, buffer+length );
+	send_queue_bytes.set(send_buffer.size()+sending_buffer.size());
+
+	// If no write is scheduled or in progress schedule one. The
+	// write is posted so all messages queued by the current
+	// handler, such as a burst of flowmods, go out in one write.
+	if( !sending ) {
+		sending = true;
+		strand.post(
+			boost::bind(
+				&OpenflowConnection::send_queued_messages,
+				shared_from_this()));
+	}
 }
 
 void OpenflowConnection::send_error_response(uint16_t err_type, uint16_t code, fluid_msg::OFMsg& message) {
@@ -540,57 +450,86 @@ void OpenflowConnection::send_error_response(uint16_t err_type, uint16_t code, f
 	send_message_response(error_message);
 }
 
-void OpenflowConnection::send_message_queue_head() {
-	BOOST_LOG_TRIVIAL(trace) << *this << " sending message, current queue length: " << send_queue.size();
+void OpenflowConnection::send_queued_messages() {
+	// Get the lock for the send buffers
+	boost::lock_guard<boost::mutex> guard(send_queue_mutex);
+
+	DELFTVISOR_LOG(trace) << *this << " sending messages, bytes queued: " << send_buffer.size();
+
+	// Move all waiting messages to the sending buffer, the swap
+	// keeps the allocated memory of both buffers for reuse. The
+	// sending buffer is not touched until the write completes.
+	sending_buffer.swap(send_buffer);
+	send_buffer.clear();
 
-	// The function calling this function should own the
-	// message_queue_mutex. Send the entirety of the message
-	// in the front of the queue. Pointer and references
-	// to elements of the queue should stay valid while
-	// pushing and popping elements..
 	boost::asio::async_write(
 		socket,
-		boost::asio::buffer(send_queue.front()),
-		boost::bind(
+		boost::asio::buffer(sending_buffer),
+		strand.wrap(boost::bind(
 			&OpenflowConnection::handle_send_message,
 			shared_from_this(),
 			boost::asio::placeholders::error,
-			boost::asio::placeholders::bytes_transferred));
+			boost::asio::placeholders::bytes_transferred)));
 }
 
 void OpenflowConnection::handle_send_message(
 		const boost::system::error_code& error,
 		std::size_t bytes_transferred) {
-	// Get the lock for the message queue
+	// Get the lock for the send buffers
 	boost::lock_guard<boost::mutex> guard(send_queue_mutex);
 
-	// Remove the element of the queue that was just sent
-	send_queue.pop();
+	// The messages that were just written are done
+	sending_buffer.clear();
+	send_queue_bytes.set(send_buffer.size());
 
 	if( !error ) {
-		// If there are more elements in the queue to send,
-		// send them
-		if( send_queue.size() != 0 ) {
-			send_message_queue_head();
+		// If more messages were queued while writing, send
+		// them all at once
+		if( send_buffer.size() != 0 ) {
+			strand.post(
+				boost::bind(
+					&OpenflowConnection::send_queued_messages,
+					shared_from_this()));
+		}
+		else {
+			sending = false;
 		}
 	}
 	else {
+		sending = false;
 		handle_network_error(error);
 	}
 }
 
-void OpenflowConnection::schedule_echo_message() {
-	// Set the echo timer to fire after a small period
+void OpenflowConnection::schedule_echo_timer(
+		std::chrono::steady_clock::duration duration) {
 	echo_timer.expires_from_now(
-		boost::posix_time::milliseconds(1000));
+		boost::posix_time::microseconds(
+			std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
 	echo_timer.async_wait(
-		boost::bind(
-			&OpenflowConnection::send_echo_message,
+		strand.wrap(boost::bind(
+			&OpenflowConnection::handle_echo_timer,
 			shared_from_this(),
-			boost::asio::placeholders::error));
+			boost::asio::placeholders::error)));
+}
+
+std::chrono::steady_clock::duration OpenflowConnection::echo_timeout() const {
+	std::chrono::steady_clock::duration interval =
+		std::chrono::milliseconds(echo_configuration.interval);
+
+	// Wait the whole interval until a round trip time is measured
+	if( smoothed_rtt == 0 ) return interval;
+
+	std::chrono::steady_clock::duration timeout =
+		std::chrono::microseconds(smoothed_rtt + 4*rtt_variation);
+	if( timeout < std::chrono::milliseconds(min_echo_timeout) ) {
+		timeout = std::chrono::milliseconds(min_echo_timeout);
+	}
+	if( timeout > interval ) timeout = interval;
+	return timeout;
 }
 
-void OpenflowConnection::send_echo_message(const boost::system::error_code& error) {
+void OpenflowConnection::handle_echo_timer(const boost::system::error_code& error) {
 	// If this connection is closed don't send the message
 	// and don't schedule the next message. This connection
 	// has likely been closed.
@@ -603,19 +542,60 @@ void OpenflowConnection::send_echo_message(const boost::system::error_code& erro
 		return;
 	}
 
-	// TODO What to do if the echo wasn't answered?
-	if( !echo_received ) {
-		BOOST_LOG_TRIVIAL(error) << *this << " missed echo message";
+	// The echo timed out if nothing was received since it was send
+	if( echo_outstanding && last_receive_time < echo_send_time ) {
+		++missed_echoes;
+		missed_echoes_counter.add();
+		BOOST_LOG_TRIVIAL(warning) << *this << " missed echo reply "
+			<< missed_echoes << " of " << echo_configuration.max_missed;
+
+		// Stopping changes hypervisor state so it is done
+		// on the control strand
+		if( missed_echoes >= echo_configuration.max_missed ) {
+			BOOST_LOG_TRIVIAL(error) << *this << " is not answering echo requests, closing the connection";
+			control_strand.dispatch(
+				boost::bind(
+					&OpenflowConnection::stop,
+					shared_from_this()));
+			return;
+		}
+
+		// Try again right away and go back to the shortest interval
+		echo_interval = echo_configuration.interval;
+		send_echo_request();
+		schedule_echo_timer(echo_timeout());
+		return;
+	}
+	echo_outstanding = false;
+	missed_echoes    = 0;
+
+	// Skip the echo if a message was received within the interval
+	std::chrono::steady_clock::duration idle_time =
+		std::chrono::steady_clock::now() - last_receive_time;
+	std::chrono::steady_clock::duration interval =
+		std::chrono::milliseconds(echo_interval);
+	if( idle_time < interval ) {
+		schedule_echo_timer(interval - idle_time);
+		return;
 	}
 
-	// Send the echo message
+	send_echo_request();
+	schedule_echo_timer(echo_timeout());
+}
+
+void OpenflowConnection::send_echo_request() {
+	// The send time is echoed back, so the round trip time
+	// can be measured from the reply alone
+	echo_send_time = std::chrono::steady_clock::now();
+	uint8_t payload[echo_payload_length];
+	write_uint64(payload, std::chrono::duration_cast<std::chrono::nanoseconds>(
+		echo_send_time.time_since_epoch()).count());
+
 	fluid_msg::of13::EchoRequest echo_msg;
+	echo_msg.data(payload, echo_payload_length);
 	send_message(echo_msg);
-	echo_received = false;
-	BOOST_LOG_TRIVIAL(trace) << *this << " send echo request";
-
-	// Schedule the next echo message to be send
-	schedule_echo_message();
+	echo_outstanding = true;
+	DELFTVISOR_LOG(trace) << *this << " send echo request";
 }
 
 void OpenflowConnection::handle_hello(fluid_msg::of13::Hello& hello_message) {
@@ -659,8 +639,44 @@ void OpenflowConnection::handle_echo_request(
 
 void OpenflowConnection::handle_echo_reply(
 		fluid_msg::of13::EchoReply& echo_reply_message) {
-	echo_received = true;
-	BOOST_LOG_TRIVIAL(trace) << *this << " received echo reply";
+	echo_outstanding = false;
+
+	// Replies without the send time can't be measured
+	if( echo_reply_message.data_len() == echo_payload_length ) {
+		std::chrono::steady_clock::time_point send_time(
+			std::chrono::nanoseconds(read_uint64(
+				(const uint8_t*) echo_reply_message.data())));
+		std::chrono::steady_clock::duration rtt =
+			std::chrono::steady_clock::now() - send_time;
+
+		if( rtt >= std::chrono::steady_clock::duration::zero() ) {
+			echo_rtt.observe_duration(rtt);
+
+			// Smooth the round trip time and its variation like the
+			// retransmission timer of TCP does
+			int64_t rtt_microseconds = std::max<int64_t>(1,
+				std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+			if( smoothed_rtt == 0 ) {
+				smoothed_rtt  = rtt_microseconds;
+				rtt_variation = rtt_microseconds/2;
+			}
+			else {
+				rtt_variation = (3*rtt_variation + std::abs(smoothed_rtt-rtt_microseconds))/4;
+				smoothed_rtt  = (7*smoothed_rtt + rtt_microseconds)/8;
+			}
+			smoothed_rtt_gauge.set(smoothed_rtt);
+			rtt_variation_gauge.set(rtt_variation);
+		}
+	}
+
+	// Echo less often while the connection is idle
+	echo_interval = std::min(2*echo_interval, echo_configuration.max_interval);
+	DELFTVISOR_LOG(trace) << *this << " received echo reply";
+}
+
+bool OpenflowConnection::handle_packet_in_view(PacketInView&) {
+	// By default every PacketIn is unpacked by libfluid
+	return false;
 }
 
 void OpenflowConnection::handle_experimenter(
@@ -675,6 +691,43 @@ void OpenflowConnection::handle_experimenter(
 	send_message_response( error_msg );
 }
 
+void OpenflowConnection::write_metrics(
+		std::ostream& os,
+		const std::string& labels) const {
+	for( int type=0; type<num_message_types; ++type ) {
+		std::string type_labels = labels + ",type=\"" + std::to_string(type) + "\"";
+		if( received_messages[type].get() != 0 ) {
+			metrics::write_value(os,
+				"delftvisor_messages_received_total",
+				type_labels,
+				received_messages[type].get());
+		}
+		if( sent_messages[type].get() != 0 ) {
+			metrics::write_value(os,
+				"delftvisor_messages_sent_total",
+				type_labels,
+				sent_messages[type].get());
+		}
+	}
+	metrics::write_value(os,
+		"delftvisor_send_queue_bytes",
+		labels,
+		send_queue_bytes.get());
+	echo_rtt.write(os, "delftvisor_echo_rtt_seconds", labels);
+	metrics::write_value(os,
+		"delftvisor_echo_smoothed_rtt_microseconds",
+		labels,
+		smoothed_rtt_gauge.get());
+	metrics::write_value(os,
+		"delftvisor_echo_rtt_variation_microseconds",
+		labels,
+		rtt_variation_gauge.get());
+	metrics::write_value(os,
+		"delftvisor_echo_missed_total",
+		labels,
+		missed_echoes_counter.get());
+}
+
 std::ostream& operator<<(std::ostream& os, const OpenflowConnection& con) {
 	con.print_to_stream(os);
 	return os;
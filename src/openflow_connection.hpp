@@ -1,22 +1,113 @@
 #pragma once
 
 #include <vector>
-#include <queue>
 #include <string>
+#include <chrono>
 
 #include <boost/asio.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/log/trivial.hpp>
 
 #include <fluid/of13msg.hh>
 
+#include "packet_in_view.hpp"
+#include "metrics.hpp"
+
 class OpenflowConnection : public boost::enable_shared_from_this<OpenflowConnection> {
+public:
+	/// The settings of the echo requests every connection sends
+	struct EchoConfiguration {
+		/// The time between echo requests on an idle connection in milliseconds
+		int interval;
+		/// The interval grows up to this while the echos are answered
+		int max_interval;
+		/// The amount of echos in a row that are not answered before
+		/// the connection is closed
+		int max_missed;
+	};
+
+protected:
+	/// The amount of message types in OpenFlow 1.3
+	static constexpr int num_message_types = fluid_msg::of13::OFPT_METER_MOD+1;
+	/// The amount of multipart types in OpenFlow 1.3, the last one is the experimenter
+	static constexpr int num_multipart_types = fluid_msg::of13::OFPMP_PORT_DESC+2;
+
+	/// Unpack the message in the message buffer of a connection and handle it
+	typedef void (*MessageHandler)(OpenflowConnection& connection);
+
+	/// The handlers of the messages a kind of connection accepts
+	/**
+	 * Every inheriting class creates 1 table with only the messages
+	 * it handles, messages without a handler are rejected with an
+	 * error before they are unpacked. The handlers call the handle
+	 * functions of the inheriting class directly, there is no
+	 * virtual call per message.
+	 */
+	struct DispatchTable {
+		/// The handlers per message type
+		MessageHandler messages[num_message_types];
+		/// The handlers per multipart request type
+		MessageHandler multipart_requests[num_multipart_types];
+		/// The handlers per multipart reply type
+		MessageHandler multipart_replies[num_multipart_types];
+
+		/// Create a table with the symmetric messages every connection handles
+		DispatchTable();
+
+		/// Handle a message type with a handle function of a connection
+		template<
+			class Connection,
+			class libfluid_message,
+			void (Connection::*handle_function)(libfluid_message&)>
+		void set_message(uint8_t type) {
+			messages[type] =
+				&dispatch_message<Connection,libfluid_message,handle_function>;
+		}
+		/// Handle a multipart request type with a handle function of a connection
+		template<
+			class Connection,
+			class libfluid_message,
+			void (Connection::*handle_function)(libfluid_message&)>
+		void set_multipart_request(uint16_t multipart_type) {
+			multipart_requests[multipart_index(multipart_type)] =
+				&dispatch_message<Connection,libfluid_message,handle_function>;
+		}
+		/// Handle a multipart reply type with a handle function of a connection
+		template<
+			class Connection,
+			class libfluid_message,
+			void (Connection::*handle_function)(libfluid_message&)>
+		void set_multipart_reply(uint16_t multipart_type) {
+			multipart_replies[multipart_index(multipart_type)] =
+				&dispatch_message<Connection,libfluid_message,handle_function>;
+		}
+	};
+
+	/// Get the index of a multipart type in a dispatch table, -1 if it is unknown
+	static int multipart_index(uint16_t multipart_type);
+
 private:
+	/// The messages this connection accepts
+	const DispatchTable& dispatch_table;
+	/// The handler of the message in the message buffer
+	MessageHandler received_handler;
+
 	/// Handle errors during network operations
 	void handle_network_error( const boost::system::error_code& error );
 
 	/// The vector that stores new messages
+	/**
+	 * While a message is being handled on the control strand
+	 * no new message is read, so the buffer can be used by the
+	 * handler without copying it.
+	 */
 	std::vector<uint8_t> message_buffer;
+	/// Start receiving and pinging on the connection strand
+	void start_connection();
+	/// Close the socket on the connection strand
+	void close_connection();
 	/// Setup the wait to receive a message
 	void start_receive_message();
 	/// Receive the header of the openflow message
@@ -27,42 +118,116 @@ private:
 	void receive_body(
 		const boost::system::error_code& error,
 		std::size_t bytes_transferred);
-	/// Parse a specific libfluid message
+	/// Handle the received message on the control strand
+	void handle_received_message();
+	/// Find the handler of the received message
+	/**
+	 * The length, version and type of the message are checked
+	 * once here, a message that is invalid or has no handler is
+	 * answered with an error right away.
+	 * \return The handler, nullptr if the message was rejected
+	 */
+	MessageHandler find_handler(size_t length);
+	/// Answer the received message with an error without unpacking it
+	void reject_message(uint16_t code, size_t length);
+	/// Unpack the received message and call a handle function of a connection
 	template<
+		class Connection,
 		class libfluid_message,
-		void (OpenflowConnection::*handle_function)(libfluid_message&)>
-	inline void receive_message();
+		void (Connection::*handle_function)(libfluid_message&)>
+	static void dispatch_message(OpenflowConnection& connection);
 
-	// TODO Look at http://www.boost.org/doc/libs/1_58_0/doc/html/atomic/usage_examples.html#boost_atomic.usage_examples.mp_queue , it does multi-producer 1 consumer queue without locks
-	/// The mutex that protects the message queue
+	/// The mutex that protects the send buffers
 	boost::mutex send_queue_mutex;
-	/// The queue of messages that need to be send
+	/// The packed messages that are waiting to be send
 	/**
-	 * The element at the front is the message currently
-	 * being send.
+	 * Messages are appended to this buffer, all messages in it
+	 * are written to the socket at once when the current write
+	 * completes.
 	 */
-	std::queue<std::vector<uint8_t>> send_queue;
-	/// Send a message over this connection
-	void send_message_queue_head();
-	/// Handle a send message
+	std::vector<uint8_t> send_buffer;
+	/// The packed messages that are currently being written
+	std::vector<uint8_t> sending_buffer;
+	/// If a write of the sending_buffer is scheduled or in progress
+	bool sending;
+	/// Add a packed message to the send buffer
+	void queue_packed_message(const uint8_t* buffer, size_t length);
+	/// Write all messages in the send buffer over this connection
+	void send_queued_messages();
+	/// Handle a finished write
 	void handle_send_message(const boost::system::error_code& error, std::size_t bytes_transferred);
 
-	/// A boolean to check if the echo request was answered
-	bool echo_received;
-	/// The timer that expires when an echo is due
+	/// The settings of the echo requests of this connection
+	const EchoConfiguration echo_configuration;
+	/// The timer that expires when an echo is due or timed out
 	boost::asio::deadline_timer echo_timer;
-	/// Schedule sending an echo message
-	void schedule_echo_message();
-	/// Send an echo request over this connection
-	void send_echo_message(const boost::system::error_code& error);
+	/// If the last echo request is not answered yet
+	bool echo_outstanding;
+	/// The time the last echo request was send
+	std::chrono::steady_clock::time_point echo_send_time;
+	/// The time the last message was received
+	std::chrono::steady_clock::time_point last_receive_time;
+	/// The amount of echo requests in a row that were not answered
+	int missed_echoes;
+	/// The current time between echo requests in milliseconds
+	int echo_interval;
+	/// The smoothed round trip time and its variation in microseconds
+	int64_t smoothed_rtt;
+	int64_t rtt_variation;
+	/// Wait on the echo timer
+	void schedule_echo_timer(std::chrono::steady_clock::duration duration);
+	/// Send an echo request or handle a missed echo
+	/**
+	 * No echo is send when a message was received within the
+	 * echo interval, the other side is alive. The interval grows
+	 * while the connection is idle and the echos are answered.
+	 */
+	void handle_echo_timer(const boost::system::error_code& error);
+	/// Send an echo request with the current time as payload
+	void send_echo_request();
+	/// Get how long to wait for an echo reply
+	/**
+	 * This adapts to the round trip times measured on this
+	 * connection like a TCP retransmission timeout.
+	 */
+	std::chrono::steady_clock::duration echo_timeout() const;
 
 	/// The next xid to be used
-	uint32_t next_xid;
+	boost::atomic<uint32_t> next_xid;
+
+	/// The amount of messages received per type
+	metrics::Counter received_messages[num_message_types];
+	/// The amount of messages send per type
+	metrics::Counter sent_messages[num_message_types];
+	/// The amount of bytes waiting in the send buffer
+	metrics::Gauge send_queue_bytes;
+	/// The round trip times of the echo requests
+	metrics::Histogram echo_rtt;
+	/// The smoothed round trip time and its variation in microseconds
+	metrics::Gauge smoothed_rtt_gauge;
+	metrics::Gauge rtt_variation_gauge;
+	/// The amount of echo requests that were not answered in time
+	metrics::Counter missed_echoes_counter;
 
 protected:
 	/// The boost socket object
 	boost::asio::ip::tcp::socket socket;
 
+	/// The strand all socket and echo operations run on
+	/**
+	 * Every connection has its own strand so connections
+	 * are serviced in parallel when multiple threads run
+	 * the io_service.
+	 */
+	boost::asio::io_service::strand strand;
+	/// The strand shared by all handlers that touch hypervisor state
+	/**
+	 * All messages except echos and relayed PacketIns are
+	 * handled on this strand, as well as the timers of
+	 * inheriting classes.
+	 */
+	boost::asio::io_service::strand& control_strand;
+
 	/// Add handlers for each message to handle, the symmetric messages
 	/// are handled in this class
 	void handle_hello       (fluid_msg::of13::Hello& hello_message);
@@ -70,96 +235,90 @@ protected:
 	void handle_echo_reply  (fluid_msg::of13::EchoReply& echo_reply_message);
 	void handle_experimenter(fluid_msg::of13::Experimenter& experimenter_message);
 
-	/// The handle functions that should be implemented by inheriting
-	/// classes
-	virtual void handle_error(fluid_msg::of13::Error& error_message) = 0;
-	virtual void handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message) = 0;
-	virtual void handle_features_reply  (fluid_msg::of13::FeaturesReply& features_reply_message) = 0;
-
-	virtual void handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message) = 0;
-	virtual void handle_config_reply  (fluid_msg::of13::GetConfigReply& config_reply_message) = 0;
-	virtual void handle_set_config    (fluid_msg::of13::SetConfig& set_config_message) = 0;
-
-	virtual void handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message) = 0;
-	virtual void handle_barrier_reply  (fluid_msg::of13::BarrierReply& barrier_reply_message) = 0;
-
-	virtual void handle_packet_in (fluid_msg::of13::PacketIn& packet_in_message) = 0;
-	virtual void handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message) = 0;
-
-	virtual void handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message) = 0;
-	virtual void handle_port_status(fluid_msg::of13::PortStatus& port_status_message) = 0;
-
-	virtual void handle_flow_mod (fluid_msg::of13::FlowMod& flow_mod_message) = 0;
-	virtual void handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message) = 0;
-	virtual void handle_port_mod (fluid_msg::of13::PortMod& port_mod_message) = 0;
-	virtual void handle_table_mod(fluid_msg::of13::TableMod& table_mod_message) = 0;
-	virtual void handle_meter_mod(fluid_msg::of13::MeterMod& meter_mod_message) = 0;
-
-	virtual void handle_multipart_request_desc          (fluid_msg::of13::MultipartRequestDesc& multipart_request_message) = 0;
-	virtual void handle_multipart_request_flow          (fluid_msg::of13::MultipartRequestFlow& multipart_request_message) = 0;
-	virtual void handle_multipart_request_aggregate     (fluid_msg::of13::MultipartRequestAggregate& multipart_request_message) = 0;
-	virtual void handle_multipart_request_table         (fluid_msg::of13::MultipartRequestTable& multipart_request_message) = 0;
-	virtual void handle_multipart_request_port_stats    (fluid_msg::of13::MultipartRequestPortStats& multipart_request_message) = 0;
-	virtual void handle_multipart_request_queue         (fluid_msg::of13::MultipartRequestQueue& multipart_request_message) = 0;
-	virtual void handle_multipart_request_group         (fluid_msg::of13::MultipartRequestGroup& multipart_request_message) = 0;
-	virtual void handle_multipart_request_group_desc    (fluid_msg::of13::MultipartRequestGroupDesc& multipart_request_message) = 0;
-	virtual void handle_multipart_request_group_features(fluid_msg::of13::MultipartRequestGroupFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message) = 0;
-	virtual void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message) = 0;
-	virtual void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message) = 0;
-	virtual void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_flow          (fluid_msg::of13::MultipartReplyFlow& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_aggregate     (fluid_msg::of13::MultipartReplyAggregate& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_table         (fluid_msg::of13::MultipartReplyTable& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_port_stats    (fluid_msg::of13::MultipartReplyPortStats& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_queue         (fluid_msg::of13::MultipartReplyQueue& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_group         (fluid_msg::of13::MultipartReplyGroup& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_group_desc    (fluid_msg::of13::MultipartReplyGroupDesc& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_group_features(fluid_msg::of13::MultipartReplyGroupFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message) = 0;
-
-	virtual void handle_queue_config_request(fluid_msg::of13::QueueGetConfigRequest& queue_config_request) = 0;
-	virtual void handle_queue_config_reply  (fluid_msg::of13::QueueGetConfigReply& queue_config_reply) = 0;
-
-	virtual void handle_role_request(fluid_msg::of13::RoleRequest& role_request_message) = 0;
-	virtual void handle_role_reply  (fluid_msg::of13::RoleReply& role_reply_message) = 0;
-
-	virtual void handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message) = 0;
-	virtual void handle_get_async_reply  (fluid_msg::of13::GetAsyncReply& async_reply_message) = 0;
-	virtual void handle_set_async        (fluid_msg::of13::SetAsync& set_async_message) = 0;
+	/// Handle a PacketIn without unpacking it into a libfluid object
+	/**
+	 * This is called before the full libfluid unpack, inheriting
+	 * classes can handle the message directly from the receive
+	 * buffer. The view may be changed in place. This runs on the
+	 * connection strand, not the control strand.
+	 * \return If the message was handled, if false the message
+	 * is unpacked and passed to handle_packet_in
+	 */
+	virtual bool handle_packet_in_view(PacketInView& packet_in);
 
 	/// Construct a new openflow connection
-	OpenflowConnection(boost::asio::io_service& io);
+	OpenflowConnection(
+		boost::asio::io_service& io,
+		boost::asio::io_service::strand& control_strand,
+		const DispatchTable& dispatch_table,
+		const EchoConfiguration& echo_configuration);
 	/// Construct a new openflow connection from an existing socket
-	OpenflowConnection(boost::asio::ip::tcp::socket& socket);
+	OpenflowConnection(
+		boost::asio::ip::tcp::socket& socket,
+		boost::asio::io_service::strand& control_strand,
+		const DispatchTable& dispatch_table,
+		const EchoConfiguration& echo_configuration);
 
 public:
 	/// Start receiving and pinging this connection
+	/**
+	 * This and stop should be called on the control strand.
+	 */
 	virtual void start();
 	/// Stop receiving and pinging this connection
 	virtual void stop();
 
 	/// Send an openflow message over this connection with a correct xid
 	/**
+	 * The send functions may be called from any thread.
 	 * \return The xid given to the message
 	 */
 	uint32_t send_message(fluid_msg::OFMsg& message);
 	/// Send a message over this connection without rewriting xid
 	void send_message_response(fluid_msg::OFMsg& message);
+	/// Send an already packed message over this connection with a correct xid
+	/**
+	 * The xid is rewritten in place in the buffer.
+	 * \return The xid given to the message
+	 */
+	uint32_t send_raw_message(uint8_t* buffer, size_t length);
 	/// Send an error message as a response
 	void send_error_response(uint16_t err_type, uint16_t code, fluid_msg::OFMsg& message);
 
+	/// Write the metrics of this connection in the Prometheus text format
+	/**
+	 * \param labels The labels identifying this connection
+	 */
+	void write_metrics(std::ostream& os, const std::string& labels) const;
+
 	/// Print this connection to a stream
 	virtual void print_to_stream(std::ostream& os) const = 0;
 };
 
 /// Explain how to print these objects
 std::ostream& operator<<(std::ostream& os, const OpenflowConnection& con);
+
+template<
+	class Connection,
+	class libfluid_message,
+	void (Connection::*handle_function)(libfluid_message&)>
+void OpenflowConnection::dispatch_message(OpenflowConnection& connection) {
+	// Try to unpack the message
+	libfluid_message message;
+	fluid_msg::of_error error = message.unpack(&connection.message_buffer[0]);
+
+	// If an error occured just forward it to
+	if( error ) {
+		fluid_msg::of13::Error error_message(
+			message.xid(),
+			fluid_msg::of_error_type(error),
+			fluid_msg::of_error_code(error));
+		connection.send_message_response(error_message);
+
+		BOOST_LOG_TRIVIAL(error) << connection << " had an error parsing a message";
+	}
+	else {
+		// Handle the correctly parsed message
+		(static_cast<Connection&>(connection).*handle_function)(message);
+	}
+}
@@ -0,0 +1,303 @@
+#include "packet_in_scheduler.hpp"
+#include "virtual_switch.hpp"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+constexpr size_t PacketInScheduler::max_queue_length;
+constexpr int PacketInScheduler::drain_period;
+
+namespace {
+	/// The maximum amount of queued PacketIns relayed per drain
+	constexpr unsigned int drain_batch = 256;
+}
+
+PacketInScheduler::PacketInScheduler(boost::asio::io_service& io) :
+	drain_timer(io),
+	drain_scheduled(false) {
+}
+
+void PacketInScheduler::TokenBucket::reset(unsigned int new_rate, clock::time_point now) {
+	rate        = new_rate;
+	// Allow bursts of a tenth of a second
+	burst       = std::max(1.0, rate/10);
+	tokens      = burst;
+	last_refill = now;
+}
+
+void PacketInScheduler::TokenBucket::set_rate(unsigned int new_rate) {
+	rate   = new_rate;
+	burst  = std::max(1.0, rate/10);
+	tokens = std::min(tokens, burst);
+}
+
+void PacketInScheduler::TokenBucket::refill(clock::time_point now) {
+	std::chrono::duration<double> elapsed = now - last_refill;
+	tokens      = std::min(burst, tokens + elapsed.count()*rate);
+	last_refill = now;
+}
+
+bool PacketInScheduler::TokenBucket::has_tokens() const {
+	return rate == 0 || tokens >= 1;
+}
+
+void PacketInScheduler::TokenBucket::take_token() {
+	if( rate != 0 ) tokens -= 1;
+}
+
+void PacketInScheduler::add_slice(
+		int slice_id,
+		unsigned int rate,
+		unsigned int switch_rate,
+		unsigned int weight) {
+	boost::mutex::scoped_lock lock(mutex);
+
+	SliceState& slice = slices[slice_id];
+	slice.bucket.reset(rate, clock::now());
+	slice.switch_rate = switch_rate;
+	slice.weight      = std::max(1u, weight);
+	slice.deficit     = 0;
+	slice.relayed     = 0;
+	slice.dropped     = 0;
+	slice.unreported_dropped = 0;
+}
+
+void PacketInScheduler::update_slice(
+		int slice_id,
+		unsigned int rate,
+		unsigned int switch_rate,
+		unsigned int weight) {
+	boost::mutex::scoped_lock lock(mutex);
+
+	SliceState& slice = slices.at(slice_id);
+	slice.bucket.set_rate(rate);
+	slice.switch_rate = switch_rate;
+	for( auto& queue_pair : slice.queues ) {
+		queue_pair.second.bucket.set_rate(switch_rate);
+	}
+	slice.weight      = std::max(1u, weight);
+}
+
+PacketInScheduler::SwitchQueue& PacketInScheduler::get_queue(
+		SliceState& slice,
+		int virtual_switch_id,
+		clock::time_point now) {
+	auto inserted = slice.queues.emplace(virtual_switch_id, SwitchQueue());
+	if( inserted.second ) {
+		inserted.first->second.bucket.reset(slice.switch_rate, now);
+	}
+	return inserted.first->second;
+}
+
+void PacketInScheduler::remove_virtual_switch(int slice_id, int virtual_switch_id) {
+	boost::mutex::scoped_lock lock(mutex);
+
+	SliceState& slice = slices.at(slice_id);
+	auto it = slice.queues.find(virtual_switch_id);
+	if( it == slice.queues.end() ) return;
+
+	slice.dropped            += it->second.messages.size();
+	slice.unreported_dropped += it->second.messages.size();
+	slice.queues.erase(it);
+	slice.active_queues.erase(
+		std::remove(
+			slice.active_queues.begin(),
+			slice.active_queues.end(),
+			virtual_switch_id),
+		slice.active_queues.end());
+}
+
+bool PacketInScheduler::relay(
+		int slice_id,
+		const boost::shared_ptr<VirtualSwitch>& virtual_switch,
+		uint8_t* buffer,
+		size_t length) {
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		SliceState& slice = slices.at(slice_id);
+
+		// Slices without a limit only queue behind older PacketIns
+		// that were queued before the limit was lifted
+		if(
+			slice.bucket.rate != 0 ||
+			slice.switch_rate != 0 ||
+			!slice.active_queues.empty()
+		) {
+			clock::time_point now = clock::now();
+			slice.bucket.refill(now);
+			SwitchQueue& queue = get_queue(slice, virtual_switch->get_id(), now);
+			queue.bucket.refill(now);
+
+			// Queue if there are no tokens or if older PacketIns of
+			// this virtual switch are still waiting, the tokens of a
+			// limited slice go to its older PacketIns first
+			if(
+				!slice.bucket.has_tokens() ||
+				!queue.bucket.has_tokens() ||
+				!queue.messages.empty() ||
+				(slice.bucket.rate != 0 && !slice.active_queues.empty())
+			) {
+				if( queue.messages.size() >= max_queue_length ) {
+					++slice.dropped;
+					++slice.unreported_dropped;
+					return false;
+				}
+
+				if( queue.messages.empty() ) {
+					queue.virtual_switch = virtual_switch;
+					slice.active_queues.push_back(virtual_switch->get_id());
+				}
+				queue.messages.emplace_back(buffer, buffer+length);
+				schedule_drain();
+				return true;
+			}
+
+			slice.bucket.take_token();
+			queue.bucket.take_token();
+		}
+		++slice.relayed;
+	}
+
+	// Send outside of the lock, the message is still in the
+	// buffer of the caller
+	virtual_switch->send_raw_message(buffer, length);
+	return true;
+}
+
+void PacketInScheduler::schedule_drain() {
+	if( drain_scheduled ) return;
+	drain_scheduled = true;
+
+	drain_timer.expires_from_now(
+		boost::posix_time::milliseconds(drain_period));
+	drain_timer.async_wait(
+		boost::bind(
+			&PacketInScheduler::drain,
+			this,
+			boost::asio::placeholders::error));
+}
+
+void PacketInScheduler::drain(const boost::system::error_code& error) {
+	if( error == boost::asio::error::operation_aborted ) return;
+
+	// Collect the messages to send while locked, send them after
+	std::vector<std::pair<
+		boost::shared_ptr<VirtualSwitch>,
+		std::vector<uint8_t>>> to_send;
+
+	boost::mutex::scoped_lock lock(mutex);
+	drain_scheduled = false;
+
+	clock::time_point now = clock::now();
+	for( auto& slice_pair : slices ) {
+		SliceState& slice = slice_pair.second;
+		slice.bucket.refill(now);
+		for( int virtual_switch_id : slice.active_queues ) {
+			slice.queues.at(virtual_switch_id).bucket.refill(now);
+		}
+	}
+
+	// Deficit round robin over the slices, every round a slice may
+	// send its weight in PacketIns if it has the tokens for it. A
+	// slice without tokens doesn't earn a deficit, otherwise it
+	// would ignore the weights once its tokens come back.
+	unsigned int budget = drain_batch;
+	bool progress = true;
+	while( budget > 0 && progress ) {
+		progress = false;
+		for( auto& slice_pair : slices ) {
+			SliceState& slice = slice_pair.second;
+			if( slice.active_queues.empty() || !slice.bucket.has_tokens() ) continue;
+
+			// Every PacketIn costs the same, a deficit left over
+			// because the tokens ran out is not carried along
+			slice.deficit = slice.weight;
+
+			// The virtual switches without tokens are passed over,
+			// the slice is done once all of them are passed over
+			size_t passed = 0;
+			while(
+				budget > 0 &&
+				slice.deficit > 0 &&
+				slice.bucket.has_tokens() &&
+				passed < slice.active_queues.size()
+			) {
+				// Take the oldest PacketIn of the next virtual switch
+				int virtual_switch_id = slice.active_queues.front();
+				slice.active_queues.pop_front();
+				SwitchQueue& queue = slice.queues.at(virtual_switch_id);
+				if( !queue.bucket.has_tokens() ) {
+					slice.active_queues.push_back(virtual_switch_id);
+					++passed;
+					continue;
+				}
+				passed = 0;
+
+				to_send.emplace_back(
+					queue.virtual_switch,
+					std::move(queue.messages.front()));
+				queue.messages.pop_front();
+
+				// Put the virtual switch at the back if it has more
+				if( queue.messages.empty() ) {
+					queue.virtual_switch.reset();
+				}
+				else {
+					slice.active_queues.push_back(virtual_switch_id);
+				}
+
+				slice.bucket.take_token();
+				queue.bucket.take_token();
+				slice.deficit -= 1;
+				++slice.relayed;
+				--budget;
+				progress = true;
+			}
+
+			// An idle slice doesn't save up a deficit
+			if( slice.active_queues.empty() ) slice.deficit = 0;
+		}
+	}
+
+	// Report the drops since the last drain and see if there
+	// is still something left to drain
+	bool remaining = false;
+	for( auto& slice_pair : slices ) {
+		SliceState& slice = slice_pair.second;
+		if( slice.unreported_dropped != 0 ) {
+			BOOST_LOG_TRIVIAL(warning) << "Dropped "
+				<< slice.unreported_dropped << " PacketIns for slice "
+				<< slice_pair.first << ", " << slice.dropped << " in total";
+			slice.unreported_dropped = 0;
+		}
+		if( !slice.active_queues.empty() ) remaining = true;
+	}
+	if( remaining ) schedule_drain();
+
+	lock.unlock();
+
+	for( auto& send_pair : to_send ) {
+		send_pair.first->send_raw_message(
+			&send_pair.second[0],
+			send_pair.second.size());
+	}
+}
+
+void PacketInScheduler::stop() {
+	boost::mutex::scoped_lock lock(mutex);
+	drain_timer.cancel();
+	drain_scheduled = false;
+}
+
+uint64_t PacketInScheduler::get_relayed(int slice_id) {
+	boost::mutex::scoped_lock lock(mutex);
+	return slices.at(slice_id).relayed;
+}
+
+uint64_t PacketInScheduler::get_dropped(int slice_id) {
+	boost::mutex::scoped_lock lock(mutex);
+	return slices.at(slice_id).dropped;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+class VirtualSwitch;
+
+/// Limits the rate PacketIns are relayed to the controllers
+/**
+ * Every slice has a token bucket that limits the amount of
+ * PacketIns per second relayed to its controllers, every virtual
+ * switch of the slice has a bucket of its own as well so 1
+ * switch can't use up the tokens of the slice. PacketIns that
+ * arrive while a bucket is empty are queued per virtual
+ * switch in bounded queues, when a queue is full the PacketIn
+ * is dropped and counted. The queues are drained periodically,
+ * the slices are served with a weighted deficit round robin and
+ * the virtual switches within a slice round robin. This way a
+ * slice flooding its controller doesn't delay the PacketIns of
+ * other slices sharing the same physical switches.
+ *
+ * PacketIns are relayed from the strands of the physical
+ * switches, all state is protected by a mutex.
+ */
+class PacketInScheduler {
+private:
+	typedef std::chrono::steady_clock clock;
+
+	/// A token bucket limiting the PacketIns per second
+	struct TokenBucket {
+		/// The amount of PacketIns per second, 0 means unlimited
+		double rate;
+		/// The maximum amount of tokens in the bucket
+		double burst;
+		/// The current amount of tokens in the bucket
+		double tokens;
+		/// The last time tokens were added
+		clock::time_point last_refill;
+
+		/// Start with a full bucket
+		void reset(unsigned int new_rate, clock::time_point now);
+		/// Change the rate, the tokens are kept up to the new burst
+		void set_rate(unsigned int new_rate);
+		/// Add the tokens earned since the last refill
+		void refill(clock::time_point now);
+		/// Check if a PacketIn may be send, unlimited buckets always may
+		bool has_tokens() const;
+		/// Take the token of a PacketIn that is send
+		void take_token();
+	};
+
+	/// The PacketIns queued for 1 virtual switch
+	struct SwitchQueue {
+		/// The virtual switch to relay to
+		boost::shared_ptr<VirtualSwitch> virtual_switch;
+		/// The packed PacketIns waiting for tokens
+		std::deque<std::vector<uint8_t>> messages;
+		/// The limit of the virtual switch
+		TokenBucket bucket;
+	};
+
+	/// The scheduling state of 1 slice
+	struct SliceState {
+		/// The limit of the whole slice
+		TokenBucket bucket;
+		/// The amount of PacketIns per second per virtual switch, 0 means unlimited
+		unsigned int switch_rate;
+		/// The relative share of the drain capacity
+		unsigned int weight;
+		/// The amount of PacketIns this slice may still send this round
+		unsigned int deficit;
+		/// The queues of the virtual switches, virtual switch id -> queue
+		std::unordered_map<int,SwitchQueue> queues;
+		/// The virtual switch ids with queued PacketIns in round robin order
+		std::deque<int> active_queues;
+		/// The amount of PacketIns relayed
+		uint64_t relayed;
+		/// The amount of PacketIns dropped because the queue was full
+		uint64_t dropped;
+		/// The amount of dropped PacketIns that were not yet logged
+		uint64_t unreported_dropped;
+	};
+
+	/// The maximum amount of PacketIns queued per virtual switch
+	static constexpr size_t max_queue_length = 64;
+	/// The period in ms with which the queues are drained
+	static constexpr int drain_period = 10;
+
+	/// Protects everything below
+	boost::mutex mutex;
+	/// The state of every slice, slice id -> state
+	std::unordered_map<int,SliceState> slices;
+
+	/// The timer used to drain the queues
+	boost::asio::deadline_timer drain_timer;
+	/// If the drain timer is running
+	bool drain_scheduled;
+
+	/// Get the queue of a virtual switch, creating it with a full bucket
+	static SwitchQueue& get_queue(
+		SliceState& slice,
+		int virtual_switch_id,
+		clock::time_point now);
+	/// Start the drain timer if it isn't running, call with mutex locked
+	void schedule_drain();
+	/// Relay queued PacketIns for which tokens are available
+	void drain(const boost::system::error_code& error);
+
+public:
+	/// Create a scheduler without any slices
+	PacketInScheduler(boost::asio::io_service& io);
+
+	/// Add a slice to the scheduler
+	/**
+	 * \param rate The maximum PacketIns per second, 0 for unlimited
+	 * \param switch_rate The maximum PacketIns per second per virtual switch, 0 for unlimited
+	 * \param weight The share of the drain capacity between slices
+	 */
+	void add_slice(
+		int slice_id,
+		unsigned int rate,
+		unsigned int switch_rate,
+		unsigned int weight);
+	/// Change the limits of a slice, keeping its queues and counters
+	void update_slice(
+		int slice_id,
+		unsigned int rate,
+		unsigned int switch_rate,
+		unsigned int weight);
+
+	/// Remove the queue of a virtual switch that is removed
+	/**
+	 * The queued PacketIns are dropped, the queue keeps the
+	 * virtual switch alive otherwise.
+	 */
+	void remove_virtual_switch(int slice_id, int virtual_switch_id);
+
+	/// Relay a packed PacketIn to a virtual switch
+	/**
+	 * The PacketIn is send directly if the slice and the virtual
+	 * switch have tokens and nothing is queued before it, otherwise it is copied into the
+	 * queue of the virtual switch or dropped.
+	 * \return If the PacketIn was not dropped
+	 */
+	bool relay(
+		int slice_id,
+		const boost::shared_ptr<VirtualSwitch>& virtual_switch,
+		uint8_t* buffer,
+		size_t length);
+
+	/// Stop draining the queues
+	void stop();
+
+	/// Get the amount of PacketIns relayed for a slice
+	uint64_t get_relayed(int slice_id);
+	/// Get the amount of PacketIns dropped for a slice
+	uint64_t get_dropped(int slice_id);
+};
@@ -0,0 +1,115 @@
+#include "packet_in_view.hpp"
+#include "byte_order.hpp"
+
+#include <fluid/of13msg.hh>
+
+namespace {
+	// The offsets of the fields in a packed PacketIn message
+	constexpr size_t buffer_id_offset    = 8;
+	constexpr size_t cookie_offset       = 16;
+	constexpr size_t match_offset        = 24;
+	// The match header consists of a type and a length
+	constexpr size_t match_header_length = 4;
+	// Each OXM TLV starts with a class, field and length
+	constexpr size_t oxm_header_length   = 4;
+}
+
+PacketInView::PacketInView(uint8_t* buffer, size_t buffer_size) :
+	buffer(buffer),
+	length(0),
+	valid(false),
+	in_port_offset(0),
+	metadata_offset(0),
+	metadata_has_mask(false) {
+	// The message should at least contain the fixed header
+	// and the header of the match
+	if( buffer_size < match_offset+match_header_length ) return;
+	if( buffer[1] != fluid_msg::of13::OFPT_PACKET_IN ) return;
+
+	// The length in the header should fit in the buffer
+	length = read_uint16(buffer+2);
+	if( length < match_offset+match_header_length || length > buffer_size ) return;
+
+	// The match length includes the match header but not the padding
+	size_t match_length = read_uint16(buffer+match_offset+2);
+	size_t match_end    = match_offset + match_length;
+	if( match_length < match_header_length || match_end > length ) return;
+
+	// Walk over the OXM TLVs and remember where the values are
+	// that the hypervisor needs
+	size_t offset = match_offset + match_header_length;
+	while( offset+oxm_header_length <= match_end ) {
+		uint16_t oxm_class    = read_uint16(buffer+offset);
+		uint8_t  oxm_field    = buffer[offset+2] >> 1;
+		bool     oxm_has_mask = buffer[offset+2] & 1;
+		uint8_t  oxm_length   = buffer[offset+3];
+
+		size_t value_offset = offset + oxm_header_length;
+		if( value_offset+oxm_length > match_end ) return;
+
+		if( oxm_class == fluid_msg::of13::OFPXMC_OPENFLOW_BASIC ) {
+			if( oxm_field == fluid_msg::of13::OFPXMT_OFB_IN_PORT ) {
+				if( oxm_length != 4 ) return;
+				in_port_offset = value_offset;
+			}
+			else if( oxm_field == fluid_msg::of13::OFPXMT_OFB_METADATA ) {
+				if( oxm_length != (oxm_has_mask?16:8) ) return;
+				metadata_offset   = value_offset;
+				metadata_has_mask = oxm_has_mask;
+			}
+		}
+
+		offset = value_offset + oxm_length;
+	}
+
+	valid = true;
+}
+
+bool PacketInView::is_valid() const {
+	return valid;
+}
+
+uint32_t PacketInView::get_buffer_id() const {
+	return read_uint32(buffer+buffer_id_offset);
+}
+
+void PacketInView::set_buffer_id(uint32_t buffer_id) {
+	write_uint32(buffer+buffer_id_offset, buffer_id);
+}
+
+uint64_t PacketInView::get_cookie() const {
+	return read_uint64(buffer+cookie_offset);
+}
+
+bool PacketInView::has_in_port() const {
+	return in_port_offset != 0;
+}
+
+uint32_t PacketInView::get_in_port() const {
+	return read_uint32(buffer+in_port_offset);
+}
+
+void PacketInView::set_in_port(uint32_t in_port) {
+	write_uint32(buffer+in_port_offset, in_port);
+}
+
+bool PacketInView::has_metadata() const {
+	return metadata_offset != 0;
+}
+
+uint64_t PacketInView::get_metadata() const {
+	return read_uint64(buffer+metadata_offset);
+}
+
+uint64_t PacketInView::get_metadata_mask() const {
+	if( !metadata_has_mask ) return UINT64_MAX;
+	return read_uint64(buffer+metadata_offset+8);
+}
+
+uint8_t* PacketInView::data() const {
+	return buffer;
+}
+
+size_t PacketInView::size() const {
+	return length;
+}
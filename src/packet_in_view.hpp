@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/// A lightweight view on a packed PacketIn message
+/**
+ * The view reads the fixed header and the OXM TLVs of the
+ * match directly from the buffer the message was received
+ * in, without unpacking it into a libfluid object. The
+ * fields the hypervisor rewrites while relaying a PacketIn
+ * can be changed in place.
+ */
+class PacketInView {
+private:
+	/// The buffer containing the packed message
+	uint8_t* buffer;
+	/// The length of the message as given in the header
+	size_t length;
+
+	/// If the buffer contains a parsable PacketIn message
+	bool valid;
+
+	/// The offset of the in_port OXM value, 0 if not present
+	size_t in_port_offset;
+	/// The offset of the metadata OXM value, 0 if not present
+	size_t metadata_offset;
+	/// If the metadata OXM has a mask following the value
+	bool metadata_has_mask;
+
+public:
+	/// Parse the message in a buffer of buffer_size bytes
+	PacketInView(uint8_t* buffer, size_t buffer_size);
+
+	/// Returns if the message could be parsed
+	bool is_valid() const;
+
+	/// Get the buffer id
+	uint32_t get_buffer_id() const;
+	/// Set the buffer id in place
+	void set_buffer_id(uint32_t buffer_id);
+	/// Get the cookie of the rule that generated this message
+	uint64_t get_cookie() const;
+
+	/// Returns if the match contains an in_port field
+	bool has_in_port() const;
+	/// Get the in_port value
+	uint32_t get_in_port() const;
+	/// Set the in_port value in place
+	void set_in_port(uint32_t in_port);
+
+	/// Returns if the match contains a metadata field
+	bool has_metadata() const;
+	/// Get the metadata value
+	uint64_t get_metadata() const;
+	/// Get the metadata mask, all ones if no mask is present
+	uint64_t get_metadata_mask() const;
+
+	/// Get the packed message
+	uint8_t* data() const;
+	/// Get the length of the packed message
+	size_t size() const;
+};
@@ -5,24 +5,70 @@
 #include "slice.hpp"
 
 #include "tag.hpp"
+#include "log.hpp"
 
+#include <boost/bind.hpp>
 #include <boost/log/trivial.hpp>
+#include <boost/make_shared.hpp>
+
+namespace {
+	/// The maximum amount of requests of a kind waiting for a reply
+	constexpr size_t max_outstanding_requests = 1024;
+	/// The time a switch gets to answer a barrier in ms
+	constexpr int barrier_timeout = 30000;
+}
 
 PhysicalSwitch::PhysicalSwitch(
 		boost::asio::ip::tcp::socket& socket,
 		int id,
 		Hypervisor* hypervisor)
 	:
-		OpenflowConnection::OpenflowConnection(socket),
-		topology_discovery_timer(socket.get_io_service()),
-		topology_discovery_port(0),
+		OpenflowConnection::OpenflowConnection(
+			socket,
+			hypervisor->get_control_strand(),
+			get_dispatch_table(),
+			hypervisor->get_echo_configuration()),
 		id(id),
 		hypervisor(hypervisor),
-		state(unregistered) {
+		state(unregistered),
+		outstanding_barriers(max_outstanding_requests),
+		flow_stats_requests(max_outstanding_requests),
+		relay_table(boost::make_shared<RelayTable>()),
+		topology_discovery_timer(socket.get_io_service()),
+		installed_routes_version(0),
+		rules_initialized(false),
+		warm_restart_grace(false),
+		warm_restart_timer(socket.get_io_service()) {
 	// Set this one here already because the value is printed
 	features.datapath_id = 0;
 }
 
+const OpenflowConnection::DispatchTable& PhysicalSwitch::get_dispatch_table() {
+	static const DispatchTable table = [] {
+		DispatchTable table;
+		namespace of13 = fluid_msg::of13;
+		table.set_message<PhysicalSwitch, of13::Error,          &PhysicalSwitch::handle_error         >(of13::OFPT_ERROR);
+		table.set_message<PhysicalSwitch, of13::FeaturesReply,  &PhysicalSwitch::handle_features_reply>(of13::OFPT_FEATURES_REPLY);
+		table.set_message<PhysicalSwitch, of13::GetConfigReply, &PhysicalSwitch::handle_config_reply  >(of13::OFPT_GET_CONFIG_REPLY);
+		table.set_message<PhysicalSwitch, of13::BarrierReply,   &PhysicalSwitch::handle_barrier_reply >(of13::OFPT_BARRIER_REPLY);
+		table.set_message<PhysicalSwitch, of13::PacketIn,       &PhysicalSwitch::handle_packet_in     >(of13::OFPT_PACKET_IN);
+		table.set_message<PhysicalSwitch, of13::FlowRemoved,    &PhysicalSwitch::handle_flow_removed  >(of13::OFPT_FLOW_REMOVED);
+		table.set_message<PhysicalSwitch, of13::PortStatus,     &PhysicalSwitch::handle_port_status   >(of13::OFPT_PORT_STATUS);
+
+		// The table features reply is not handled since unpacking
+		// it segfaults in libfluid when a property is missing
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyFlow,            &PhysicalSwitch::handle_multipart_reply_flow          >(of13::OFPMP_FLOW);
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyPortStats,       &PhysicalSwitch::handle_multipart_reply_port_stats    >(of13::OFPMP_PORT_STATS);
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyGroup,           &PhysicalSwitch::handle_multipart_reply_group         >(of13::OFPMP_GROUP);
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyGroupDesc,       &PhysicalSwitch::handle_multipart_reply_group_desc    >(of13::OFPMP_GROUP_DESC);
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyGroupFeatures,   &PhysicalSwitch::handle_multipart_reply_group_features>(of13::OFPMP_GROUP_FEATURES);
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyMeterFeatures,   &PhysicalSwitch::handle_multipart_reply_meter_features>(of13::OFPMP_METER_FEATURES);
+		table.set_multipart_reply<PhysicalSwitch, of13::MultipartReplyPortDescription, &PhysicalSwitch::handle_multipart_reply_port_desc     >(of13::OFPMP_PORT_DESC);
+		return table;
+	}();
+	return table;
+}
+
 int PhysicalSwitch::get_id() const {
 	return id;
 }
@@ -43,57 +89,206 @@ const std::unordered_map<uint32_t,PhysicalSwitch::Port>& PhysicalSwitch::get_por
 	return ports;
 }
 
+RuleAccounting& PhysicalSwitch::get_rule_accounting() {
+	return rule_accounting;
+}
+
+const RuleAccounting& PhysicalSwitch::get_rule_accounting() const {
+	return rule_accounting;
+}
+
+void PhysicalSwitch::write_metrics(std::ostream& os, const std::string& labels) const {
+	OpenflowConnection::write_metrics(os, labels);
+	metrics::write_value(os,
+		"delftvisor_requests_expired_total",
+		labels,
+		expired_requests.get());
+	metrics::write_value(os,
+		"delftvisor_requests_evicted_total",
+		labels,
+		evicted_requests.get());
+}
+
+void PhysicalSwitch::expire_requests(std::chrono::steady_clock::time_point now) {
+	expire_stats_requests(now);
+
+	// The waiters of an overdue barrier can't be answered without
+	// breaking the ordering, the switch is considered dead
+	size_t expired_barriers = outstanding_barriers.expire(
+		now,
+		[](uint32_t, std::vector<BarrierWaiter>&) {});
+	if( expired_barriers == 0 ) return;
+	expired_requests.add(expired_barriers);
+
+	BOOST_LOG_TRIVIAL(error) << *this << " did not answer "
+		<< expired_barriers << " barriers, closing the connection";
+	// The sweep is iterating over the switches, stopping
+	// unregisters this switch so it is done afterwards
+	control_strand.post(
+		boost::bind(
+			&OpenflowConnection::stop,
+			shared_from_this()));
+}
+
+PhysicalSwitch::OutputGroupKey PhysicalSwitch::make_output_group_key(
+		const VirtualSwitch& virtual_switch,
+		uint32_t virtual_port) {
+	uint64_t datapath_id = virtual_switch.get_port_to_physical_switch().at(virtual_port);
+	return OutputGroupKey(
+		datapath_id,
+		virtual_switch.get_port_map(datapath_id).get_physical(virtual_port),
+		virtual_switch.get_slice()->get_id());
+}
+
+uint32_t PhysicalSwitch::acquire_output_group(
+		const OutputGroupKey& key,
+		uint32_t restored_group_id) {
+	auto it = output_group_ids.find(key);
+	if( it != output_group_ids.end() ) {
+		++shared_output_groups.at(it->second).references;
+		return it->second;
+	}
+
+	uint32_t group_id;
+	if( restored_group_id != 0 && group_id_allocator.reserve_id(restored_group_id) ) {
+		group_id = restored_group_id;
+	}
+	else {
+		group_id = group_id_allocator.new_id();
+	}
+	output_group_ids[key] = group_id;
+	shared_output_groups[group_id] = SharedOutputGroup{key, 1};
+	return group_id;
+}
+
+void PhysicalSwitch::release_group_id(uint32_t group_id) {
+	released_group_ids.push_back(group_id);
+}
+
+void PhysicalSwitch::free_released_group_ids() {
+	for( uint32_t group_id : released_group_ids ) {
+		group_id_allocator.free_id(group_id);
+	}
+	released_group_ids.clear();
+}
+
+void PhysicalSwitch::release_output_group(int virtual_switch_id, uint32_t group_id) {
+	auto it = shared_output_groups.find(group_id);
+	if( --it->second.references == 0 ) {
+		output_group_ids.erase(it->second.key);
+		shared_output_groups.erase(it);
+		release_group_id(group_id);
+		return;
+	}
+
+	// Another virtual switch still uses the group
+	delete_virtual_switch_rules(virtual_switch_id, group_id);
+}
+
+void PhysicalSwitch::delete_virtual_switch_rules(int virtual_switch_id, uint32_t out_group) {
+	// The rules are left for the next run when the hypervisor stops
+	if( hypervisor->is_stopping() ) return;
+
+	fluid_msg::of13::FlowMod flowmod;
+	flowmod.command(fluid_msg::of13::OFPFC_DELETE);
+	flowmod.table_id(fluid_msg::of13::OFPTT_ALL);
+	flowmod.cookie_mask(0);
+	flowmod.buffer_id(OFP_NO_BUFFER);
+	flowmod.out_port(fluid_msg::of13::OFPP_ANY);
+	flowmod.out_group(out_group);
+	MetadataTag metadata_tag(
+		uint64_t(virtual_switch_id)<<1,
+		uint64_t(MetadataTag::max_virtual_switch_id)<<1);
+	metadata_tag.add_to_match(flowmod);
+	send_message(flowmod);
+}
+
+void PhysicalSwitch::move_output_group(
+		int virtual_switch_id,
+		OutputGroup& output_group,
+		const OutputGroupKey& key) {
+	SharedOutputGroup& shared_output_group = shared_output_groups.at(output_group.group_id);
+	if( shared_output_group.references == 1 && output_group_ids.count(key) == 0 ) {
+		output_group_ids.erase(shared_output_group.key);
+		output_group_ids[key]   = output_group.group_id;
+		shared_output_group.key = key;
+	}
+	else {
+		release_output_group(virtual_switch_id, output_group.group_id);
+		output_group.group_id = acquire_output_group(key);
+	}
+	output_group.key   = key;
+	output_group.state = OutputGroup::State::no_rule;
+}
+
 void PhysicalSwitch::register_interest(boost::shared_ptr<VirtualSwitch> switch_pointer) {
 	BOOST_LOG_TRIVIAL(trace) << *switch_pointer << " registered interest at " << *this;
 
 	// Register the needed ports
 	for( auto& port_map_pair :
 			switch_pointer
-			->get_port_map(features.datapath_id)
-			.get_virtual_to_physical() ) {
+			->get_port_map(features.datapath_id) ) {
 		NeededPort needed_port;
-		needed_port.rule_installed = false;
 		needed_port.virtual_switch = switch_pointer;
 		needed_ports[port_map_pair.second][switch_pointer->get_id()] = needed_port;
 	}
 
-	// Create the rewrite entry
-	RewriteEntry& rewrite_entry  = rewrite_map[switch_pointer->get_id()];
-	rewrite_entry.flood_group_id = group_id_allocator.new_id();
-
-	// Create the flood group create message
-	fluid_msg::of13::GroupMod group_mod;
-	group_mod.command(fluid_msg::of13::OFPGC_ADD);
-	group_mod.group_type(fluid_msg::of13::OFPGT_ALL);
-	group_mod.group_id(rewrite_entry.flood_group_id);
+	// Create the rewrite entry, continue with the groups of the
+	// previous run if this switch was reconciled
+	RewriteEntry& rewrite_entry = rewrite_map[switch_pointer->get_id()];
+	auto restored_it = restored_rewrite_map.find(switch_pointer->get_id());
+	RewriteEntry* restored_entry = nullptr;
+	if( restored_it != restored_rewrite_map.end() ) {
+		restored_entry = &restored_it->second;
+		rewrite_entry.flood_group_id = restored_entry->flood_group_id;
+		rewrite_entry.group_id_map   = restored_entry->group_id_map;
+	}
+	else {
+		rewrite_entry.flood_group_id = group_id_allocator.new_id();
+	}
 
-	// Loop over all virtual ports and reserve group id's to output
-	// for them
+	// Loop over all virtual ports and take the groups to output
+	// for them, virtual switches outputting to the same place
+	// share the group
 	for( const auto& virtual_physical_pair :
 			switch_pointer->get_port_to_physical_switch() ) {
 		const uint32_t& virtual_port  = virtual_physical_pair.first;
 
 		// Create the output group and store that no rule has
 		// been pushed to the switch, on the next call to
-		// update_dynamic_rules will the group be created.
+		// update_dynamic_rules will the group and the flood group
+		// be created.
 		OutputGroup& output_group = rewrite_entry.output_groups[virtual_port];
-		output_group.group_id     = group_id_allocator.new_id();
 		output_group.state        = OutputGroup::State::no_rule;
+		output_group.key          = make_output_group_key(*switch_pointer, virtual_port);
+
+		// A restored group keeps its reference if it still
+		// outputs to the same place
+		if( restored_entry != nullptr ) {
+			auto restored_group_it = restored_entry->output_groups.find(virtual_port);
+			if(
+				restored_group_it != restored_entry->output_groups.end() &&
+				restored_group_it->second.key == output_group.key
+			) {
+				output_group.group_id = restored_group_it->second.group_id;
+				restored_entry->output_groups.erase(restored_group_it);
+				continue;
+			}
+		}
+		output_group.group_id = acquire_output_group(output_group.key);
+	}
 
-		// Create the bucket that forward to this virtual port
-		fluid_msg::of13::Bucket bucket;
-		bucket.weight(0);
-		bucket.watch_port(fluid_msg::of13::OFPP_ANY);
-		bucket.watch_group(fluid_msg::of13::OFPG_ANY);
-		fluid_msg::ActionSet action_set;
-		action_set.add_action(
-			new fluid_msg::of13::GroupAction(output_group.group_id));
-		bucket.actions(action_set);
-		group_mod.add_bucket(bucket);
+	// The restored groups of ports that no longer exist are removed
+	// on the next call to update_dynamic_rules
+	if( restored_entry != nullptr ) {
+		for( const auto& output_group_pair : restored_entry->output_groups ) {
+			release_output_group(switch_pointer->get_id(), output_group_pair.second.group_id);
+		}
+		restored_rewrite_map.erase(restored_it);
 	}
 
-	// Send the group create message
-	send_message(group_mod);
+	// Allow PacketIns to be relayed to this virtual switch
+	publish_relay_table();
 }
 
 void PhysicalSwitch::remove_interest(boost::shared_ptr<VirtualSwitch> switch_pointer) {
@@ -101,40 +296,113 @@ void PhysicalSwitch::remove_interest(boost::shared_ptr<VirtualSwitch> switch_poi
 
 	// Remove the needed ports
 	for( auto& port_map_pair : switch_pointer
-			->get_port_map(features.datapath_id)
-			.get_virtual_to_physical() ) {
+			->get_port_map(features.datapath_id) ) {
 		needed_ports.at(port_map_pair.second).erase(switch_pointer->get_id());
 		if( needed_ports.at(port_map_pair.second).size() == 0 ) {
 			needed_ports.erase(port_map_pair.second);
 		}
 	}
 
-	// Retrieve the rewrite_entry
+	// Return the group id's, the groups themselves are deleted
+	// from the switch on the next call to update_dynamic_rules
 	RewriteEntry& rewrite_entry = rewrite_map.at(switch_pointer->get_id());
-	// TODO Delete flood group and return id
-
-	// Loop over all virtual ports and reserve group id's to output
-	// for them
-	for( const auto& virtual_physical_pair :
-			switch_pointer->get_port_to_physical_switch() ) {
-		const uint32_t& virtual_port  = virtual_physical_pair.first;
+	release_group_id(rewrite_entry.flood_group_id);
+	for( const auto& output_group_pair : rewrite_entry.output_groups ) {
+		release_output_group(switch_pointer->get_id(), output_group_pair.second.group_id);
+	}
 
-		// TODO Delete output group id's and return id's, clear output_groups
+	// Delete the rules and groups the controller pushed, the
+	// controller starts with empty tables when it connects again
+	delete_virtual_switch_rules(switch_pointer->get_id(), fluid_msg::of13::OFPG_ANY);
+	rule_accounting.remove_virtual_switch(switch_pointer->get_id());
+	for( const auto& group_id_pair : rewrite_entry.group_id_map ) {
+		if( !hypervisor->is_stopping() ) {
+			fluid_msg::of13::GroupMod group_mod;
+			group_mod.command(fluid_msg::of13::OFPGC_DELETE);
+			group_mod.group_id(group_id_pair.second);
+			send_message(group_mod);
+		}
+		// The delete is send before any group reusing the id
+		group_id_allocator.free_id(group_id_pair.second);
 	}
 
 	rewrite_map.erase(switch_pointer->get_id());
 
-	// TODO Delete the used group id's and return id's
+	// Stop relaying PacketIns to this virtual switch
+	publish_relay_table();
+}
+
+void PhysicalSwitch::update_interest(boost::shared_ptr<VirtualSwitch> switch_pointer) {
+	BOOST_LOG_TRIVIAL(trace) << *switch_pointer << " updated interest at " << *this;
+
+	// Replace the needed ports of the virtual switch
+	for( auto it=needed_ports.begin(); it!=needed_ports.end(); ) {
+		it->second.erase(switch_pointer->get_id());
+		if( it->second.size() == 0 ) it = needed_ports.erase(it);
+		else                         ++it;
+	}
+	for( auto& port_map_pair :
+			switch_pointer
+			->get_port_map(features.datapath_id) ) {
+		NeededPort needed_port;
+		needed_port.virtual_switch = switch_pointer;
+		needed_ports[port_map_pair.second][switch_pointer->get_id()] = needed_port;
+	}
+
+	// Release the groups of the removed ports, the groups are
+	// deleted on the next call to update_dynamic_rules
+	RewriteEntry& rewrite_entry = rewrite_map.at(switch_pointer->get_id());
+	const std::map<uint32_t,uint64_t>& virtual_ports =
+		switch_pointer->get_port_to_physical_switch();
+	for( auto it=rewrite_entry.output_groups.begin(); it!=rewrite_entry.output_groups.end(); ) {
+		if( virtual_ports.count(it->first) == 0 ) {
+			release_output_group(switch_pointer->get_id(), it->second.group_id);
+			it = rewrite_entry.output_groups.erase(it);
+			continue;
+		}
+
+		// A port that outputs somewhere else now
+		OutputGroupKey key = make_output_group_key(*switch_pointer, it->first);
+		if( key != it->second.key ) {
+			move_output_group(switch_pointer->get_id(), it->second, key);
+		}
+		++it;
+	}
+
+	// Take the groups of the added ports
+	for( const auto& virtual_physical_pair : virtual_ports ) {
+		if( rewrite_entry.output_groups.count(virtual_physical_pair.first) ) continue;
+
+		OutputGroup& output_group = rewrite_entry.output_groups[virtual_physical_pair.first];
+		output_group.state        = OutputGroup::State::no_rule;
+		output_group.key          = make_output_group_key(*switch_pointer, virtual_physical_pair.first);
+		output_group.group_id     = acquire_output_group(output_group.key);
+	}
 
-	// TODO Delete the pushed flowmods
+	publish_relay_table();
 }
 
-void PhysicalSwitch::send_request_message(
-		fluid_msg::OFMsg& message,
-		boost::weak_ptr<VirtualSwitch> virtual_switch) {
-	uint32_t xid = send_message(message);
-	xid_map[xid].original_xid   = message.xid();
-	xid_map[xid].virtual_switch = virtual_switch;
+void PhysicalSwitch::publish_relay_table() {
+	boost::shared_ptr<RelayTable> new_relay_table =
+		boost::make_shared<RelayTable>();
+
+	// Every virtual switch with an interest in this switch
+	// has at least 1 needed port
+	for( const auto& needed_port_pair : needed_ports ) {
+		for( const auto& needed_port : needed_port_pair.second ) {
+			const auto& virtual_switch = needed_port.second.virtual_switch;
+			if( new_relay_table->count(virtual_switch->get_id()) ) continue;
+
+			RelayEntry& relay_entry    = (*new_relay_table)[virtual_switch->get_id()];
+			relay_entry.virtual_switch = virtual_switch;
+			relay_entry.port_map       =
+				virtual_switch->get_port_map(features.datapath_id);
+		}
+	}
+
+	boost::atomic_store(
+		&relay_table,
+		boost::shared_ptr<const RelayTable>(new_relay_table));
 }
 
 void PhysicalSwitch::start() {
@@ -171,30 +439,9 @@ void PhysicalSwitch::start() {
 		send_message( port_description_message );
 	}
 
-	// Delete all the flow rules already in the switch
-	{
-		fluid_msg::of13::FlowMod flowmod;
-		flowmod.command( fluid_msg::of13::OFPFC_DELETE );
-		flowmod.table_id( fluid_msg::of13::OFPTT_ALL );
-		flowmod.cookie_mask(0);
-		flowmod.buffer_id(OFP_NO_BUFFER);
-		send_message( flowmod );
-	}
-
-	// Send a barrier request to make sure the delete command
-	// is executed before any new rules are added
-	{
-		fluid_msg::of13::BarrierRequest barrier;
-		send_message(barrier);
-	}
-
-	// Create the rest of the initial rules
-	create_static_rules();
-	// Create the dynamic rules
-	update_dynamic_rules();
-
-	// Start sending topology discovery messages
-	schedule_topology_discovery_message();
+	// The tables are wiped or reconciled when the datapath id is
+	// known, until then no rules are pushed. Topology discovery
+	// messages are send as soon as the ports are known.
 
 	BOOST_LOG_TRIVIAL(info) << *this << " started";
 }
@@ -202,16 +449,37 @@ void PhysicalSwitch::start() {
 void PhysicalSwitch::stop() {
 	// Stop the topology discovery
 	topology_discovery_timer.cancel();
+	warm_restart_timer.cancel();
+
+	// Keep the groups for when this switch connects again
+	if( state == registered ) {
+		hypervisor->save_restart_state(features.datapath_id, get_restart_state());
+	}
 
 	// Stop all the discovered links
 	for( auto& port : ports ) {
 		auto link = port.second.link;
 		if( link != nullptr ) link->stop();
 	}
+	// Stopping the links queues probes to find them again
+	probe_queue.clear();
+	topology_discovery_timer.cancel();
 
 	// Stop the generic connection handling
 	OpenflowConnection::stop();
 
+	// The barriers will never be answered, the virtual switches
+	// depending on this switch go down as well
+	queued_barrier_waiters.clear();
+	outstanding_barriers.clear();
+
+	// The same goes for the statistics requests
+	port_stats_cache.waiters.clear();
+	port_stats_cache.polling = false;
+	group_stats_cache.waiters.clear();
+	group_stats_cache.polling = false;
+	flow_stats_requests.clear();
+
 	// Remove this switch from the registry
 	if( state == unregistered ) {
 		hypervisor->unregister_physical_switch(id);
@@ -244,8 +512,13 @@ void PhysicalSwitch::handle_port( fluid_msg::of13::Port& port, uint8_t reason )
 		// This is a new port we didn't know about
 		port_status_message.reason(fluid_msg::of13::OFPPR_ADD);
 		// Create the port structure
-		ports[port.port_no()].port_data = port;
-		ports[port.port_no()].state     = Port::State::no_rule;
+		Port& new_port     = ports[port.port_no()];
+		new_port.port_data = port;
+		new_port.state     = Port::State::no_rule;
+
+		// Look for a link on this port right away
+		make_probe_message(port.port_no(), new_port);
+		reset_probe(port.port_no(), new_port);
 	}
 	else {
 		if( reason == fluid_msg::of13::OFPPR_DELETE ) {
@@ -253,11 +526,28 @@ void PhysicalSwitch::handle_port( fluid_msg::of13::Port& port, uint8_t reason )
 			if( ports.at(port.port_no()).link != nullptr ) {
 				ports.at(port.port_no()).link->stop();
 			}
+			probe_queue.erase(std::make_pair(
+				ports.at(port.port_no()).next_probe,
+				port.port_no()));
 			ports.erase(port.port_no());
 			port_status_message.reason(fluid_msg::of13::OFPPR_DELETE);
 		}
 		else {
 			port_status_message.reason(fluid_msg::of13::OFPPR_MODIFY);
+			Port& changed_port = ports.at(port.port_no());
+			bool was_down = changed_port.port_data.state() & fluid_msg::of13::OFPPS_LINK_DOWN;
+			bool is_down  = port.state() & fluid_msg::of13::OFPPS_LINK_DOWN;
+			changed_port.port_data = port;
+
+			// Don't wait for the link to time out when the switch
+			// reports it down, and look for a link directly when
+			// it comes back up
+			if( is_down && changed_port.link != nullptr ) {
+				changed_port.link->stop();
+			}
+			else if( was_down && !is_down ) {
+				reset_probe(port.port_no(), changed_port);
+			}
 		}
 	}
 
@@ -270,6 +560,8 @@ void PhysicalSwitch::handle_port( fluid_msg::of13::Port& port, uint8_t reason )
 
 		for( auto& switch_pointer_pair : switch_pointers->second ) {
 			auto& switch_pointer = switch_pointer_pair.second.virtual_switch;
+			switch_pointer->invalidate_port_description();
+
 			// Skip if this virtual switch is not online
 			if( !switch_pointer->is_connected() ) continue;
 
@@ -292,45 +584,11 @@ void PhysicalSwitch::handle_port( fluid_msg::of13::Port& port, uint8_t reason )
 	}
 }
 
-void PhysicalSwitch::reset_distances() {
-	dist.clear();
-	next.clear();
-
-	set_distance(id,0);
-
-	// Loop over the links and fill the dist and next maps
-	for( const auto& port : ports ) {
-		if( port.second.link != nullptr ) {
-			int other_switch = port.second.link->get_other_switch_id(id);
-			set_distance(other_switch,1);
-			set_next(other_switch,port.first);
-		}
-	}
-}
 int PhysicalSwitch::get_distance(int switch_id) {
-	// If we have no stored distance to switch_id the
-	// distance is infinite
-	if( dist.find(switch_id) == dist.end() ) {
-		return topology::infinite;
-	}
-	else {
-		return dist.at(switch_id);
-	}
-}
-void PhysicalSwitch::set_distance(int switch_id, int distance) {
-	dist[switch_id] = distance;
+	return hypervisor->get_routing_engine().get_distance(id, switch_id);
 }
 uint32_t PhysicalSwitch::get_next(int switch_id) {
-	if( next.find(switch_id) == next.end() ) {
-		BOOST_LOG_TRIVIAL(error) << "Asked next switch while no route is found";
-		return UINT32_MAX;
-	}
-	else {
-		return next.at(switch_id);
-	}
-}
-void PhysicalSwitch::set_next(int switch_id, uint32_t port_number) {
-	next[switch_id] = port_number;
+	return hypervisor->get_routing_engine().get_next(id, switch_id);
 }
 
 PhysicalSwitch::pointer PhysicalSwitch::shared_from_this() {
@@ -366,6 +624,11 @@ void PhysicalSwitch::handle_error(fluid_msg::of13::Error& error_message) {
 	BOOST_LOG_TRIVIAL(info) << *this
 		<< " received error Type=" << error_message.err_type()
 		<< " Code=" << error_message.code();
+
+	// The error can be the answer to a statistics request
+	fail_stats_request(error_message.xid());
+	// or to reading back the tables after a restart
+	fail_warm_restart(error_message.xid());
 	// TODO
 }
 
@@ -374,6 +637,16 @@ void PhysicalSwitch::handle_features_reply(fluid_msg::of13::FeaturesReply& featu
 
 	if( state == registered ) {
 		BOOST_LOG_TRIVIAL(error) << *this << " received features_reply while already registered";
+		return;
+	}
+
+	// The switches of other shards are served by other hypervisors
+	if( !hypervisor->is_local_switch(features_reply_message.datapath_id()) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " datapath_id="
+			<< features_reply_message.datapath_id() << " is not in shard "
+			<< hypervisor->get_shard() << ", disconnecting";
+		stop();
+		return;
 	}
 
 	features.datapath_id  = features_reply_message.datapath_id();
@@ -385,6 +658,17 @@ void PhysicalSwitch::handle_features_reply(fluid_msg::of13::FeaturesReply& featu
 	hypervisor->register_physical_switch(features.datapath_id,id);
 	state = registered;
 
+	// Continue with the rules of a previous run if they are known,
+	// otherwise start with empty tables
+	const RestartSnapshot::SwitchState* restart_state =
+		hypervisor->get_restart_state(features.datapath_id);
+	if( restart_state != nullptr ) {
+		start_warm(*restart_state);
+	}
+	else {
+		start_cold();
+	}
+
 	// This can potentially allow a virtual switch that only depends
 	// on this switch to come online. Execute check_online for all
 	// virtual switches.
@@ -399,14 +683,115 @@ void PhysicalSwitch::handle_config_reply(fluid_msg::of13::GetConfigReply& config
 	features.miss_send_len = config_reply_message.miss_send_len();
 }
 
+void PhysicalSwitch::request_barrier(
+		boost::weak_ptr<VirtualSwitch> virtual_switch,
+		uint64_t barrier_id) {
+	// Only schedule a barrier if none is waiting to be send
+	if( queued_barrier_waiters.empty() ) {
+		control_strand.post(
+			boost::bind(
+				&PhysicalSwitch::send_queued_barrier,
+				shared_from_this()));
+	}
+
+	BarrierWaiter waiter;
+	waiter.virtual_switch = virtual_switch;
+	waiter.barrier_id     = barrier_id;
+	queued_barrier_waiters.push_back(waiter);
+}
+
+void PhysicalSwitch::send_queued_barrier() {
+	if( queued_barrier_waiters.empty() ) return;
+
+	fluid_msg::of13::BarrierRequest barrier_request;
+	uint32_t xid = send_message(barrier_request);
+	size_t num_waiters = queued_barrier_waiters.size();
+	outstanding_barriers.insert(
+		xid,
+		std::move(queued_barrier_waiters),
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(barrier_timeout),
+		[this](uint32_t evicted_xid, std::vector<BarrierWaiter>&) {
+			// The barriers after it still expire and close the connection
+			evicted_requests.add();
+			BOOST_LOG_TRIVIAL(warning) << *this << " has too many barriers outstanding, dropped barrier " << evicted_xid;
+		});
+	queued_barrier_waiters.clear();
+
+	BOOST_LOG_TRIVIAL(trace) << *this << " send barrier for "
+		<< num_waiters << " virtual barriers";
+}
+
 void PhysicalSwitch::handle_barrier_reply(fluid_msg::of13::BarrierReply& barrier_reply_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received barrier_reply";
 
-	// TODO
-	// Figure out who requested this
-	// Mark this switch as done
-	// If all physical switches are done
-	//   send BarrierReply
+	// Barriers send by the hypervisor itself have no waiters
+	std::vector<BarrierWaiter> waiters;
+	if( !outstanding_barriers.erase(barrier_reply_message.xid(), waiters) ) return;
+
+	// Tell all waiting virtual switches this switch is done
+	for( const BarrierWaiter& waiter : waiters ) {
+		auto virtual_switch = waiter.virtual_switch.lock();
+		if( virtual_switch != nullptr ) {
+			virtual_switch->barrier_completed(waiter.barrier_id);
+		}
+	}
+}
+
+bool PhysicalSwitch::handle_packet_in_view(PacketInView& packet_in) {
+	// PacketIns without metadata are generated by the hypervisor
+	// rules, these are rare and handled after a full unpack.
+	if( !packet_in.has_metadata() || !packet_in.has_in_port() ) {
+		return false;
+	}
+
+	metrics::ScopedTimer timer(hypervisor->get_metrics().packet_in_relay_time);
+
+	DELFTVISOR_LOG_EVERY_N(info, logging::packet_sample) << *this << " received packet_in on port " << packet_in.get_in_port();
+
+	// Figure out to what controller to forward this packet
+	MetadataTag metadata_tag(
+		packet_in.get_metadata(),
+		packet_in.get_metadata_mask());
+
+	// Get the switch to send the packet in to from the current
+	// snapshot, this runs outside the control strand.
+	boost::shared_ptr<const RelayTable> current_relay_table =
+		boost::atomic_load(&relay_table);
+	auto relay_entry = current_relay_table->find(metadata_tag.get_virtual_switch());
+	if( relay_entry == current_relay_table->end() ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " received packet_in for unknown virtual switch "
+			<< metadata_tag.get_virtual_switch();
+		return true;
+	}
+	const auto& virtual_switch = relay_entry->second.virtual_switch;
+
+	// Rewrite the in port to the virtual in port in place
+	boost::optional<uint32_t> virtual_in_port =
+		relay_entry->second.port_map.find_virtual(packet_in.get_in_port());
+	if( !virtual_in_port ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " received packet_in on port not in " << *virtual_switch;
+		return true;
+	}
+	packet_in.set_in_port(*virtual_in_port);
+	// Give the virtual switch a buffer id that can be traced back to
+	// this switch
+	if( packet_in.get_buffer_id() != OFP_NO_BUFFER ) {
+		packet_in.set_buffer_id(
+			hypervisor->get_buffer_table().add(
+				virtual_switch->get_id(),
+				features.datapath_id,
+				packet_in.get_buffer_id()));
+	}
+
+	// Relay the message straight from the receive buffer
+	hypervisor->get_packet_in_scheduler().relay(
+		virtual_switch->get_slice()->get_id(),
+		virtual_switch,
+		packet_in.data(),
+		packet_in.size());
+	return true;
 }
 
 void PhysicalSwitch::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_message) {
@@ -414,6 +799,11 @@ void PhysicalSwitch::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_messa
 	fluid_msg::of13::InPort* in_port_tlv =
 		(fluid_msg::of13::InPort*) packet_in_message
 			.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_IN_PORT);
+	if( in_port_tlv == nullptr ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " received packet_in without in_port";
+		return;
+	}
 	uint32_t in_port = in_port_tlv->value();
 
 	// Look at the metadata pipeline field to figure
@@ -422,71 +812,61 @@ void PhysicalSwitch::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_messa
 		(fluid_msg::of13::Metadata*) packet_in_message
 			.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_METADATA);
 
-	// If there is no metadata value wasn't set the packet doesn't originate
-	// from a slice. If this value is nullptr it originated
-	// from the Hypervisor reserved table.
-	if( metadata_tlv == nullptr ) {
-		if( packet_in_message.cookie() == 1 ) {
-			// This packet in was generated by the topology discovery rule
-			handle_topology_discovery_packet_in(packet_in_message);
-		}
-		else if( in_port == fluid_msg::of13::OFPP_CONTROLLER ) {
-			// TODO This is a stupid hack to get the control latency measurement
-			// to work. You currently can't distinguish between packets that have
-			// been sent to the controller directly from a packetout because the
-			// metadata fields haven't been set. If this switch only depends on
-			// 1 virtual switch though it has to have been that one, so sent it
-			// to that one.
-			bool only_one_virtual_switch = true;
-			VirtualSwitch* virtual_switch = nullptr;
-			for( auto& needed_port_pair : needed_ports ) {
-				for( auto& needed_port_pair_2 : needed_port_pair.second ) {
-					NeededPort& needed_port = needed_port_pair_2.second;
-					if( virtual_switch == nullptr ) {
-						virtual_switch = needed_port.virtual_switch.get();
-					}
-					else if( needed_port.virtual_switch.get() != virtual_switch ) {
-						only_one_virtual_switch = false;
-						break;
-					}
+	// The PacketIns of the slices carry metadata and are relayed
+	// straight from the receive buffer in handle_packet_in_view,
+	// the ones that get here originated from the Hypervisor
+	// reserved table.
+	if( metadata_tlv != nullptr ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " received packet_in with metadata that could not be parsed in place";
+		return;
+	}
+
+	if( packet_in_message.cookie() == 1 ) {
+		// This packet in was generated by the topology discovery rule
+		handle_topology_discovery_packet_in(packet_in_message);
+	}
+	else if( in_port == fluid_msg::of13::OFPP_CONTROLLER ) {
+		// TODO This is a stupid hack to get the control latency measurement
+		// to work. You currently can't distinguish between packets that have
+		// been sent to the controller directly from a packetout because the
+		// metadata fields haven't been set. If this switch only depends on
+		// 1 virtual switch though it has to have been that one, so sent it
+		// to that one.
+		bool only_one_virtual_switch = true;
+		VirtualSwitch* virtual_switch = nullptr;
+		for( auto& needed_port_pair : needed_ports ) {
+			for( auto& needed_port_pair_2 : needed_port_pair.second ) {
+				NeededPort& needed_port = needed_port_pair_2.second;
+				if( virtual_switch == nullptr ) {
+					virtual_switch = needed_port.virtual_switch.get();
+				}
+				else if( needed_port.virtual_switch.get() != virtual_switch ) {
+					only_one_virtual_switch = false;
+					break;
 				}
 			}
-			if( virtual_switch != nullptr && only_one_virtual_switch ) {
-				virtual_switch->send_message(packet_in_message);
-			}
-			else {
-				BOOST_LOG_TRIVIAL(error) << *this
-					<< " received packet in with in_port=controller while multiple virtual switches depend on this switch";
-			}
+		}
+		if( virtual_switch != nullptr && only_one_virtual_switch ) {
+			virtual_switch->send_message(packet_in_message);
 		}
 		else {
 			BOOST_LOG_TRIVIAL(error) << *this
-				<< " received packet in via error detection rule on port " << in_port;
+				<< " received packet in with in_port=controller while multiple virtual switches depend on this switch";
 		}
 	}
 	else {
-		BOOST_LOG_TRIVIAL(info) << *this << " received packet_in on port " << in_port;
-
-		// Figure out to what controller to forward this packet
-		MetadataTag metadata_tag(metadata_tlv->value(),metadata_tlv->mask());
-
-		// Get the switch to send the packet in to
-		VirtualSwitch* virtual_switch =
-			hypervisor->get_virtual_switch(metadata_tag.get_virtual_switch());
-		// Rewrite the in port to the virtual in port
-		const auto& port_map = virtual_switch->get_port_map(features.datapath_id);
-		in_port_tlv->value(port_map.get_virtual(in_port_tlv->value()));
-		// Always remove the buffer information, it becomes difficult to keep
-		// track on what physical switch the message is actually buffered.
-		packet_in_message.buffer_id(OFP_NO_BUFFER);
-		// Send the message
-		virtual_switch->send_message(packet_in_message);
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " received packet in via error detection rule on port " << in_port;
 	}
 }
 
 void PhysicalSwitch::handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received flow_removed";
-	// TODO
+
+	// Only the rules of the virtual switches are accounted
+	if( flow_removed_message.table_id() < 2 ) return;
+	rule_accounting.handle_flow_removed(flow_removed_message);
 }
 void PhysicalSwitch::handle_port_status(fluid_msg::of13::PortStatus& port_status_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received port_status";
@@ -1,29 +1,31 @@
 #pragma once
 
 #include <set>
+#include <map>
+#include <tuple>
+#include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <chrono>
 
 #include <boost/asio.hpp>
+#include <boost/function.hpp>
 
 #include "id_allocator.hpp"
 #include "bidirectional_map.hpp"
+#include "xid_table.hpp"
+#include "metrics.hpp"
 
 #include "openflow_connection.hpp"
+#include "routing_engine.hpp"
+#include "flow_table_shadow.hpp"
+#include "restart_snapshot.hpp"
+#include "rule_accounting.hpp"
 
 class DiscoveredLink;
 class VirtualSwitch;
 class Hypervisor;
 
-namespace topology {
-	/// The value used for infinite for floyd-warshall, this value should
-	/// be choosen such that it doesn't overflow when it get's added to
-	/// itself but is also longer than the longest possible path in the
-	/// network.
-	constexpr int infinite = 10000;
-	constexpr int period   = 500; // The period to send all topology messages in in ms
-}
-
 class PhysicalSwitch : public OpenflowConnection {
 private:
 	/// The internal id used for routing
@@ -54,24 +56,114 @@ private:
 	/// The group features
 	fluid_msg::of13::GroupFeatures group_features;
 
-	/// The information needed when forwarding a response
-	struct RequestSource {
-		uint32_t original_xid;
+	/// A virtual switch waiting for a barrier on this switch
+	struct BarrierWaiter {
 		boost::weak_ptr<VirtualSwitch> virtual_switch;
+		uint64_t barrier_id;
 	};
-	/// The xid translator
-	std::unordered_map<
-		uint32_t,
-		RequestSource> xid_map;
-	/// Send a message that needs a response
+	/// The waiters for the barrier that has not been send yet
+	std::vector<BarrierWaiter> queued_barrier_waiters;
+	/// The waiters for the barriers that have been send, xid -> waiters
+	XidTable<std::vector<BarrierWaiter>> outstanding_barriers;
+	/// Send 1 barrier for all queued barrier waiters
+	void send_queued_barrier();
+
+	/// Statistics of this switch shared by all virtual switches
+	/**
+	 * A poll always requests the statistics of all ports or
+	 * groups, the reply is kept for a short time so multiple
+	 * controllers polling the same switch result in 1 physical
+	 * poll. Requests arriving while a poll is running wait for
+	 * the reply of that poll.
+	 */
+	template<class Stats>
+	struct StatsCache {
+		typedef boost::function<void(const std::vector<Stats>&)> Callback;
+		/// The statistics of the last completed poll
+		std::vector<Stats> stats;
+		/// When the last poll completed
+		std::chrono::steady_clock::time_point updated;
+		/// If stats contains the result of a poll
+		bool valid;
+		/// If a poll is running
+		bool polling;
+		/// The xid of the running poll
+		uint32_t xid;
+		/// When the running poll is given up
+		std::chrono::steady_clock::time_point deadline;
+		/// The statistics received so far in the running poll
+		std::vector<Stats> partial;
+		/// The callbacks waiting for the running poll
+		std::vector<Callback> waiters;
+
+		StatsCache() : valid(false), polling(false), xid(0) {}
+	};
+	/// The cached port statistics
+	StatsCache<fluid_msg::of13::PortStats> port_stats_cache;
+	/// The cached group statistics
+	StatsCache<fluid_msg::of13::GroupStats> group_stats_cache;
+	/// Get cached statistics or start a poll if they are too old
+	template<class Stats, class Request>
+	void request_cached_stats(
+		StatsCache<Stats>& cache,
+		typename StatsCache<Stats>::Callback callback);
+	/// Add a reply chunk to a poll, completes the poll on the last chunk
+	template<class Stats>
+	void handle_cached_stats(
+		StatsCache<Stats>& cache,
+		uint32_t xid,
+		uint16_t flags,
+		const std::vector<Stats>& stats);
+	/// Complete or fail a poll and answer the waiting callbacks
+	template<class Stats>
+	void complete_cached_stats(
+		StatsCache<Stats>& cache,
+		bool success);
+
+	/// Fail the statistics request with this xid if there is one
+	void fail_stats_request(uint32_t xid);
+	/// Fail the statistics requests whose deadline passed
+	void expire_stats_requests(std::chrono::steady_clock::time_point now);
+
+	/// A running flow statistics request
+	/**
+	 * Flow statistics are filtered per virtual switch so they
+	 * are not cached.
+	 */
+	struct FlowStatsRequest {
+		/// The virtual switch the statistics are translated for
+		boost::shared_ptr<VirtualSwitch> virtual_switch;
+		/// The statistics received so far
+		std::vector<fluid_msg::of13::FlowStats> partial;
+		/// The function to call when all statistics are received
+		boost::function<void(const std::vector<fluid_msg::of13::FlowStats>&)> callback;
+	};
+	/// The running flow statistics requests, xid -> FlowStatsRequest
+	XidTable<FlowStatsRequest> flow_stats_requests;
+
+	/// The requests that got no reply before their deadline
+	metrics::Counter expired_requests;
+	/// The requests dropped because too many were waiting
+	metrics::Counter evicted_requests;
+
+	/// Translate port statistics to a virtual switch
+	void translate_port_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::PortStats>&)> callback,
+		const std::vector<fluid_msg::of13::PortStats>& stats);
+	/// Translate group statistics to a virtual switch
+	void translate_group_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::GroupStats>&)> callback,
+		const std::vector<fluid_msg::of13::GroupStats>& stats);
+	/// Translate flow statistics to a virtual switch
 	/**
-	 * This version stores the original xid this message was
-	 * send with so the response can be forwarded to the appropriate
-	 * virtual switch.
+	 * Only the flows of the virtual switch are kept, the table
+	 * id, metadata and in_port are translated back.
 	 */
-	void send_request_message(
-		fluid_msg::OFMsg& message,
-		boost::weak_ptr<VirtualSwitch> virtual_switch);
+	std::vector<fluid_msg::of13::FlowStats> translate_flow_stats(
+		const VirtualSwitch* virtual_switch,
+		const std::vector<fluid_msg::of13::FlowStats>& stats);
 
 	/// Represents a port on this switch as it is in the network below
 	struct Port {
@@ -90,6 +182,12 @@ private:
 		boost::shared_ptr<DiscoveredLink> link;
 		/// The data concerning this port
 		fluid_msg::of13::Port port_data;
+		/// The packed PacketOut with the topology discovery packet for this port
+		std::vector<uint8_t> probe_message;
+		/// The time in ms until the next topology discovery packet
+		int probe_interval;
+		/// When the next topology discovery packet is send over this port
+		std::chrono::steady_clock::time_point next_probe;
 	};
 	/// The ports attached to this switch, port_id -> port
 	std::unordered_map<
@@ -97,7 +195,6 @@ private:
 		Port> ports;
 
 	struct NeededPort {
-		bool rule_installed;
 		boost::shared_ptr<VirtualSwitch> virtual_switch;
 	};
 	/// The ports that are searched for on this switch, port_id -> set<VirtualSwitch*>
@@ -124,9 +221,30 @@ private:
 	/**
 	 * The group with id 0 is reserved to output to the controller.
 	 */
-	IdAllocator<1,UINT32_MAX> group_id_allocator;
+	IdAllocator<1,fluid_msg::of13::OFPG_MAX> group_id_allocator;
+	/// The id's of the released groups that are not deleted from the switch yet
+	/**
+	 * Until the next commit of the shadow deletes a released group
+	 * the rules of virtual switches can still point to it. The id
+	 * is only given back after the delete, so a new group never
+	 * takes over the id of a group that is still used by old rules.
+	 */
+	std::vector<uint32_t> released_group_ids;
+	/// Give a group id back once the group is deleted from the switch
+	void release_group_id(uint32_t group_id);
+	/// Give back the released group id's, called once their groups are deleted
+	void free_released_group_ids();
+	/// Where an output group outputs to
+	/**
+	 * The (datapath id, physical port, slice id) of the port
+	 * decide the actions in the group, every virtual switch that
+	 * outputs to the same place uses the same group.
+	 */
+	typedef std::tuple<uint64_t,uint32_t,int> OutputGroupKey;
 	/// A group created to be used as output port in a virtual switch
 	struct OutputGroup {
+		/// Where this group outputs to
+		OutputGroupKey key;
 		/// The group id of this OutputGroup
 		uint32_t group_id;
 		/// The state of the action in this group
@@ -141,6 +259,56 @@ private:
 		/// The physical port this rule currently outputs over
 		uint32_t output_port;
 	};
+	/// An output group shared by the virtual switches outputting to the same place
+	struct SharedOutputGroup {
+		/// Where this group outputs to
+		OutputGroupKey key;
+		/// The amount of OutputGroups using this group
+		size_t references;
+	};
+	/// The output groups in this switch, group id -> SharedOutputGroup
+	std::unordered_map<uint32_t,SharedOutputGroup> shared_output_groups;
+	/// The group id's of the output groups, OutputGroupKey -> group id
+	std::map<OutputGroupKey,uint32_t> output_group_ids;
+	/// Get where a virtual port of a virtual switch outputs to
+	static OutputGroupKey make_output_group_key(
+		const VirtualSwitch& virtual_switch,
+		uint32_t virtual_port);
+	/// Take a reference to the output group of a key
+	/**
+	 * The group is created when no other virtual switch outputs
+	 * to the same place, it gets the restored group id of a
+	 * previous run if that is given and still free.
+	 * \return The group id of the output group
+	 */
+	uint32_t acquire_output_group(
+		const OutputGroupKey& key,
+		uint32_t restored_group_id=0);
+	/// Drop the reference of a virtual switch to an output group
+	/**
+	 * The group id is given back when the last reference is
+	 * dropped, the group is deleted from the switch on the
+	 * next call to update_dynamic_rules. That also deletes the
+	 * rules outputting to it, when the group stays the rules
+	 * of the virtual switch outputting to it are deleted.
+	 */
+	void release_output_group(int virtual_switch_id, uint32_t group_id);
+	/// Delete the rules of a virtual switch from this switch
+	/**
+	 * \param out_group Only delete the rules outputting to this
+	 * group, OFPG_ANY deletes all rules of the virtual switch
+	 */
+	void delete_virtual_switch_rules(int virtual_switch_id, uint32_t out_group);
+	/// Point an output group of a virtual switch to another place
+	/**
+	 * The group moves along if no other virtual switch uses it,
+	 * otherwise the virtual switch gets another group.
+	 */
+	void move_output_group(
+		int virtual_switch_id,
+		OutputGroup& output_group,
+		const OutputGroupKey& key);
+
 	/// An entry with the rewrite information for 1 virtual switch
 	struct RewriteEntry {
 		/// The group id for the flood action
@@ -159,31 +327,131 @@ private:
 	 * created.
 	 */
 	std::unordered_map<int, RewriteEntry> rewrite_map;
+	/// The rewrite entries of a previous run, virtual switch id -> RewriteEntry
+	/**
+	 * The group id's are reserved when the switch connects, the
+	 * entry is moved into the rewrite_map when the virtual switch
+	 * registers its interest so it keeps using the same groups.
+	 */
+	std::unordered_map<int, RewriteEntry> restored_rewrite_map;
+
+	/// The information needed to relay a PacketIn to a virtual switch
+	struct RelayEntry {
+		/// The virtual switch to relay to
+		boost::shared_ptr<VirtualSwitch> virtual_switch;
+		/// The virtual port id <-> physical port id mapping on this switch
+		bidirectional_map<uint32_t,uint32_t> port_map;
+	};
+	/// A map from virtual switch id -> RelayEntry
+	typedef std::unordered_map<int,RelayEntry> RelayTable;
+	/// A snapshot of the virtual switches PacketIns can be relayed to
+	/**
+	 * PacketIns are relayed on the connection strand while the
+	 * interests are changed on the control strand. The table is
+	 * never changed after it is published, a new table is build
+	 * and atomically swapped in when the interests change.
+	 */
+	boost::shared_ptr<const RelayTable> relay_table;
+	/// Build and publish a new relay table from the needed ports
+	void publish_relay_table();
 
 
 	/// The timer that when fired sends a topology discovery packet
 	boost::asio::deadline_timer topology_discovery_timer;
 	/// Create the flowrule in this switch to forward topology discovery messages
 	void make_topology_discovery_rule();
-	/// The next port to send a topology discovery message over
-	int topology_discovery_port;
-	/// Schedule sending a topology discovery message
+	/// The ports ordered on when to send the next topology discovery packet
+	/**
+	 * A port that was just added or changed is probed directly,
+	 * after that the time between probes doubles each probe up to
+	 * topology::max_period. Ports that don't change cost little
+	 * traffic while new links are found right away.
+	 */
+	std::set<std::pair<std::chrono::steady_clock::time_point,uint32_t>> probe_queue;
+	/// Create the topology discovery PacketOut of a port
+	void make_probe_message(uint32_t port_no, Port& port);
+	/// Probe a port directly and restart its backoff
+	void reset_probe(uint32_t port_no, Port& port);
+	/// Put a port in the probe queue
+	void queue_probe(
+		uint32_t port_no,
+		Port& port,
+		std::chrono::steady_clock::time_point next_probe);
+	/// Set the timer to the first port in the probe queue
 	void schedule_topology_discovery_message();
-	/// Send the next topology discovery message
+	/// Send the topology discovery messages that are due
 	void send_topology_discovery_message(const boost::system::error_code& error);
 	/// Handle a packet in for topology discovery
 	void handle_topology_discovery_packet_in(
 		fluid_msg::of13::PacketIn& packet_in_message);
 
-	/// The distance from this switch to other switches (switch_id -> distance)
-	std::unordered_map<int,int> dist;
-	/// To what port to forward traffic to get to a switch (switch_id -> port_number)
-	std::unordered_map<int,uint32_t> next;
-	/// The currently set port to forward traffic to for each switch (switch id -> port number)
-	std::unordered_map<int,uint32_t> current_next;
+	/// The sections the rules are divided in
+	enum RuleSection {
+		static_rules,
+		port_rules,
+		shared_link_rules,
+		switch_rules,
+		group_rules
+	};
+	/// The rules and groups of the hypervisor as installed in the switch
+	FlowTableShadow flow_table_shadow;
+	/// The version of the routes the forwarding rules were made from
+	uint64_t installed_routes_version;
+	/// If rules can be pushed, false while the switch is wiped or reconciled
+	bool rules_initialized;
+	/// The rules of the virtual switches in this switch per slice
+	RuleAccounting rule_accounting;
 
 	/// Setup the flow table with the static initial rules
-	void create_static_rules();
+	/**
+	 * \param reconciled If the switch still has the rules of a previous run
+	 */
+	void create_static_rules(bool reconciled);
+
+	/// Wipe the switch and start with empty tables
+	void start_cold();
+	/// Reconcile the tables of the switch with the state of a previous run
+	/**
+	 * The group id's of the previous run are reserved and the
+	 * hypervisor tables and groups are read from the switch. The
+	 * rules of the virtual switches are left in place.
+	 */
+	void start_warm(const RestartSnapshot::SwitchState& restart_state);
+	/// The xid's of the running requests reading the tables back
+	std::unordered_set<uint32_t> warm_restart_xids;
+	/// The groups of a previous run, group id -> created by the hypervisor
+	std::unordered_map<uint32_t,bool> warm_restart_groups;
+	/// The groups of the hypervisor read back from the switch
+	std::vector<fluid_msg::of13::GroupMod> warm_restart_installed_groups;
+	/// Handle a part of the rules read back from the switch
+	void handle_warm_restart_flows(fluid_msg::of13::MultipartReplyFlow& multipart_reply_message);
+	/// Start pushing rules once everything is read back
+	void finish_warm_restart();
+	/// Start with empty tables after all if reading back failed
+	/**
+	 * \return If the xid belonged to a request reading the tables back
+	 */
+	bool fail_warm_restart(uint32_t xid);
+
+	/// If rules are only added, not changed or removed
+	/**
+	 * Right after a restart the links are not discovered yet, the
+	 * rules depending on them would be removed. Until the links of
+	 * the previous run are found again or the grace period is over
+	 * only the missing rules are added.
+	 */
+	bool warm_restart_grace;
+	/// The ports that had a link in the previous run that is not found yet
+	std::set<uint32_t> warm_restart_link_ports;
+	/// The timer that ends the grace period after a restart
+	boost::asio::deadline_timer warm_restart_timer;
+	/// The grace period timer fired
+	void handle_warm_restart_timer(const boost::system::error_code& error);
+	/// End the grace period and push all differences
+	void end_warm_restart_grace();
+
+	/// Get the handlers of the messages a physical switch sends
+	static const DispatchTable& get_dispatch_table();
 
 public:
 	typedef boost::shared_ptr<PhysicalSwitch> pointer;
@@ -207,10 +475,41 @@ public:
 	/// Get the ports on this switch
 	const std::unordered_map<uint32_t,Port>& get_ports() const;
 
+	/// Get the state to keep over a restart of the hypervisor
+	RestartSnapshot::SwitchState get_restart_state() const;
+
+	/// Get the accounting of the rules of the virtual switches
+	RuleAccounting& get_rule_accounting();
+	const RuleAccounting& get_rule_accounting() const;
+
+	/// Write the metrics of the connection and the requests
+	void write_metrics(std::ostream& os, const std::string& labels) const;
+
+	/// Give up on the requests whose reply is overdue
+	/**
+	 * Called on the control strand by the request sweep of the
+	 * hypervisor. Overdue statistics requests are answered with
+	 * no statistics, an overdue barrier means the switch stopped
+	 * processing messages and closes the connection.
+	 */
+	void expire_requests(std::chrono::steady_clock::time_point now);
+
 	/// Register a virtual switch interest
 	void register_interest(boost::shared_ptr<VirtualSwitch> virtual_switch);
 	/// Remove a virtual switch interest
+	/**
+	 * The rules and groups of the virtual switch are deleted and
+	 * their group id's are returned, unless the hypervisor is
+	 * stopping and keeps them for the next run.
+	 */
 	void remove_interest(boost::shared_ptr<VirtualSwitch> virtual_switch);
+	/// Follow the changed ports of a registered virtual switch
+	/**
+	 * The output groups of the ports that stay keep their group
+	 * id, so the rules of the virtual switch referring to them
+	 * stay valid.
+	 */
+	void update_interest(boost::shared_ptr<VirtualSwitch> virtual_switch);
 
 	/// Allow creating a shared pointer of this class
 	pointer shared_from_this();
@@ -225,16 +524,52 @@ public:
 	/// Reset a link involving this switch
 	void reset_link(boost::shared_ptr<DiscoveredLink> discovered_link);
 
-	/// Reset all the floyd-warshall data to begin state
-	void reset_distances();
+	/// Request a barrier for a virtual switch
+	/**
+	 * The barrier is send after the current handler on the control
+	 * strand is done, all barriers requested before that are
+	 * coalesced into 1 barrier on this switch. When its reply
+	 * arrives barrier_completed is called on all waiting virtual
+	 * switches.
+	 */
+	void request_barrier(
+		boost::weak_ptr<VirtualSwitch> virtual_switch,
+		uint64_t barrier_id);
+
+	/// Request the port statistics for a virtual switch
+	/**
+	 * The callback receives the statistics of the ports of the
+	 * virtual switch on this physical switch with virtual port
+	 * numbers. When the poll fails it receives no statistics.
+	 */
+	void request_port_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::PortStats>&)> callback);
+	/// Request the group statistics for a virtual switch
+	/**
+	 * The callback receives the statistics of the groups of the
+	 * virtual switch on this physical switch with virtual group
+	 * id's. When the poll fails it receives no statistics.
+	 */
+	void request_group_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::GroupStats>&)> callback);
+	/// Request the flow statistics for a virtual switch
+	/**
+	 * The request is in virtual id's, it is translated and only
+	 * matches the flows of the virtual switch. The callback receives
+	 * the translated statistics, when the request fails it receives
+	 * no statistics.
+	 */
+	void request_flow_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		fluid_msg::of13::MultipartRequestFlow& request,
+		boost::function<void(const std::vector<fluid_msg::of13::FlowStats>&)> callback);
+
 	/// Get the known distance to a switch
 	int get_distance(int switch_id);
-	/// Set a new distance to a switch
-	void set_distance(int switch_id, int distance);
 	/// Get the port to forward traffic over to get to a switch
 	uint32_t get_next(int switch_id);
-	/// Set the port to forward traffic over to get to a switch
-	void set_next(int switch_id, uint32_t port_number);
 
 	/// Update the dynamic rules and groups after the topology has changed
 	void update_dynamic_rules();
@@ -243,12 +578,28 @@ public:
 	uint32_t get_rewritten_group_id(
 		uint32_t virtual_group_id,
 		const VirtualSwitch* virtual_switch);
-	/// Rewrite an InstructionSet for this physical switch
-	bool rewrite_instruction_set(
+	/// Rewrite the switch independent parts of an InstructionSet
+	/**
+	 * The table id's and metadata are rewritten and unsupported
+	 * instructions and actions rejected, this is the same for every
+	 * physical switch so only has to be done once per FlowMod.
+	 * \param has_write_action_output Set if the write actions output
+	 * to a port, the rewritten instruction sets with and without the
+	 * outputs are the same if they don't.
+	 */
+	static bool prepare_instruction_set(
 		fluid_msg::of13::InstructionSet& old_instruction_set,
+		fluid_msg::of13::InstructionSet& prepared_instruction_set,
+		bool& has_write_action_group,
+		bool& has_write_action_output);
+	/// Rewrite a prepared InstructionSet for this physical switch
+	/**
+	 * Only the ports and groups in the actions are rewritten.
+	 */
+	bool rewrite_instruction_set(
+		fluid_msg::of13::InstructionSet& prepared_instruction_set,
 		fluid_msg::of13::InstructionSet& instruction_set_with_output,
 		fluid_msg::of13::InstructionSet& instruction_set_without_output,
-		bool& has_action_with_group,
 		const VirtualSwitch* virtual_switch);
 	/// Rewrite an action set for this physical switch
 	bool rewrite_action_set(
@@ -267,73 +618,29 @@ public:
 		fluid_msg::of13::Match& match,
 		const VirtualSwitch* virtual_switch);
 
-	/// The message handling functions
-	void handle_error(fluid_msg::of13::Error& error_message);
-	void handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message);
-	void handle_features_reply  (fluid_msg::of13::FeaturesReply& features_reply_message);
-
-	void handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message);
+	/// The message handling functions, the messages a physical
+	/// switch doesn't send are rejected before they are unpacked
+	void handle_error         (fluid_msg::of13::Error& error_message);
+	void handle_features_reply(fluid_msg::of13::FeaturesReply& features_reply_message);
 	void handle_config_reply  (fluid_msg::of13::GetConfigReply& config_reply_message);
-	void handle_set_config    (fluid_msg::of13::SetConfig& set_config_message);
-
-	void handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message);
-	void handle_barrier_reply  (fluid_msg::of13::BarrierReply& barrier_reply_message);
+	void handle_barrier_reply (fluid_msg::of13::BarrierReply& barrier_reply_message);
 
+	bool handle_packet_in_view(PacketInView& packet_in);
 	void handle_packet_in (fluid_msg::of13::PacketIn& packet_in_message);
-	void handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message);
 
 	void handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message);
 	void handle_port_status(fluid_msg::of13::PortStatus& port_status_message);
 
-	void handle_flow_mod (fluid_msg::of13::FlowMod& flow_mod_message);
-	void handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message);
-	void handle_port_mod (fluid_msg::of13::PortMod& port_mod_message);
-	void handle_table_mod(fluid_msg::of13::TableMod& table_mod_message);
-	void handle_meter_mod(fluid_msg::of13::MeterMod& meter_mod_message);
-
-	void handle_queue_config_request(fluid_msg::of13::QueueGetConfigRequest& queue_config_request);
-	void handle_queue_config_reply  (fluid_msg::of13::QueueGetConfigReply& queue_config_reply);
-
-	void handle_role_request(fluid_msg::of13::RoleRequest& role_request_message);
-	void handle_role_reply  (fluid_msg::of13::RoleReply& role_reply_message);
-
-	void handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message);
-	void handle_get_async_reply  (fluid_msg::of13::GetAsyncReply& async_reply_message);
-	void handle_set_async        (fluid_msg::of13::SetAsync& set_async_message);
-
 	/// Print a quick identifyable name for this physical switch
 	void print_to_stream(std::ostream& os) const;
 	/// Print almost complete debugging info about this physical switch
 	void print_detailed(std::ostream& os) const;
 
-	void handle_multipart_request_desc          (fluid_msg::of13::MultipartRequestDesc& multipart_request_message);
-	void handle_multipart_request_flow          (fluid_msg::of13::MultipartRequestFlow& multipart_request_message);
-	void handle_multipart_request_aggregate     (fluid_msg::of13::MultipartRequestAggregate& multipart_request_message);
-	void handle_multipart_request_table         (fluid_msg::of13::MultipartRequestTable& multipart_request_message);
-	void handle_multipart_request_port_stats    (fluid_msg::of13::MultipartRequestPortStats& multipart_request_message);
-	void handle_multipart_request_queue         (fluid_msg::of13::MultipartRequestQueue& multipart_request_message);
-	void handle_multipart_request_group         (fluid_msg::of13::MultipartRequestGroup& multipart_request_message);
-	void handle_multipart_request_group_desc    (fluid_msg::of13::MultipartRequestGroupDesc& multipart_request_message);
-	void handle_multipart_request_group_features(fluid_msg::of13::MultipartRequestGroupFeatures& multipart_request_message);
-	void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message);
-	void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message);
-	void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message);
-	void handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message);
-	void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message);
-	void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message);
-	void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message);
 	void handle_multipart_reply_flow          (fluid_msg::of13::MultipartReplyFlow& multipart_request_message);
-	void handle_multipart_reply_aggregate     (fluid_msg::of13::MultipartReplyAggregate& multipart_request_message);
-	void handle_multipart_reply_table         (fluid_msg::of13::MultipartReplyTable& multipart_request_message);
 	void handle_multipart_reply_port_stats    (fluid_msg::of13::MultipartReplyPortStats& multipart_request_message);
-	void handle_multipart_reply_queue         (fluid_msg::of13::MultipartReplyQueue& multipart_request_message);
 	void handle_multipart_reply_group         (fluid_msg::of13::MultipartReplyGroup& multipart_request_message);
 	void handle_multipart_reply_group_desc    (fluid_msg::of13::MultipartReplyGroupDesc& multipart_request_message);
 	void handle_multipart_reply_group_features(fluid_msg::of13::MultipartReplyGroupFeatures& multipart_request_message);
-	void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message);
-	void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message);
 	void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message);
-	void handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message);
 	void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message);
-	void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message);
 };
@@ -6,9 +6,11 @@
 
 #include <boost/log/trivial.hpp>
 
-#include <fstream>
+void PhysicalSwitch::create_static_rules(bool reconciled) {
+	// The static rules are in the shadow as well so they are
+	// reconciled like the dynamic rules after a restart
+	flow_table_shadow.clear_section(RuleSection::static_rules);
 
-void PhysicalSwitch::create_static_rules() {
 	// Create the topology discovery forward rule
 	make_topology_discovery_rule();
 
@@ -30,13 +32,13 @@ void PhysicalSwitch::create_static_rules() {
 				fluid_msg::of13::OFPCML_NO_BUFFER));
 		flowmod.add_instruction(write_actions);
 
-		// Send the message
-		send_message(flowmod);
+		// Add the rule
+		flow_table_shadow.add_flow(RuleSection::static_rules, flowmod);
 
 		// Change the table number and do it again
 		flowmod.table_id(1);
 		flowmod.cookie(3);
-		send_message(flowmod);
+		flow_table_shadow.add_flow(RuleSection::static_rules, flowmod);
 	}
 
 	// Create the rule forwarding packets that come from the
@@ -58,16 +60,21 @@ void PhysicalSwitch::create_static_rules() {
 		flowmod.add_instruction(
 			new fluid_msg::of13::GoToTable(1));
 
-		// Send the message
-		send_message(flowmod);
+		// Add the rule
+		flow_table_shadow.add_flow(RuleSection::static_rules, flowmod);
 	}
 
-	// Create the meters per slice
+	// Create the meters per slice, meters are not in the shadow so
+	// after a restart the existing meters are modified, deleting
+	// them would delete the rules using them
 	// TODO Doesn't work with slices created after this physical switch
 	if( hypervisor->get_use_meters() ) {
 		for( const Slice& slice : hypervisor->get_slices() ) {
 			fluid_msg::of13::MeterMod meter_mod;
-			meter_mod.command(fluid_msg::of13::OFPMC_ADD);
+			meter_mod.command(
+				reconciled ?
+					fluid_msg::of13::OFPMC_MODIFY :
+					fluid_msg::of13::OFPMC_ADD);
 			meter_mod.flags(fluid_msg::of13::OFPMF_PKTPS);
 			meter_mod.meter_id(slice.get_id()+1); // TODO Document this better, meter id's start at 1
 			meter_mod.add_band(
@@ -99,14 +106,16 @@ void PhysicalSwitch::create_static_rules() {
 				fluid_msg::of13::OFPCML_NO_BUFFER));
 		group_mod.add_bucket(bucket);
 
-		// Send the message
-		send_message(group_mod);
+		// Add the group before the dynamic groups
+		flow_table_shadow.add_group(RuleSection::static_rules, group_mod);
 	}
-
-	// TODO Send a barrierrequest
 }
 
 void PhysicalSwitch::update_dynamic_rules() {
+	// Nothing can be pushed while the switch is wiped or reconciled,
+	// while stopping the rules are kept for the next run
+	if( !rules_initialized || hypervisor->is_stopping() ) return;
+
 	BOOST_LOG_TRIVIAL(info) << *this << " updating dynamic flow rules";
 
 	// Update the port rules, there are 2 set of rules that are maintained
@@ -114,6 +123,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 	// with packets that arrive over a certain link and the rules in table 1
 	// with priority 10 determining what to do with packets that have
 	// arrived over a link and want to be send out over a port on this switch.
+	flow_table_shadow.clear_section(RuleSection::port_rules);
 	for( auto& port_pair : ports ) {
 		// Alias the values that are iterated over
 		const uint32_t& port_no = port_pair.first;
@@ -126,8 +136,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 		flowmod_0.table_id(0);
 		flowmod_0.buffer_id(OFP_NO_BUFFER);
 
-		// If there is no rule about this port add a rule
-		// in table 1
+		// Start building the message to update table 1
 		fluid_msg::of13::FlowMod flowmod_1;
 		flowmod_1.priority(10);
 		flowmod_1.cookie(port_no);
@@ -166,35 +175,15 @@ void PhysicalSwitch::update_dynamic_rules() {
 			}
 		}
 
-		// Look what state this port had previously
-		const Port::State prev_state = port.state;
-
 		BOOST_LOG_TRIVIAL(trace) << *this
 			<< " Looping over port " << port_no
-			<< " prev=" << Port::state_to_string(prev_state)
+			<< " prev=" << Port::state_to_string(port.state)
 			<< " curr=" << Port::state_to_string(current_state)
 			<< " for port " << port_no;
 
-		if( prev_state == Port::State::no_rule ) {
-			// There is no rule known about this port
-			flowmod_0.command(fluid_msg::of13::OFPFC_ADD);
-			flowmod_1.command(fluid_msg::of13::OFPFC_ADD);
-		}
-		else {
-			// If the state hasn't changed don't send any flowmod
-			if( prev_state == current_state ) {
-				continue;
-			}
-			flowmod_0.command(fluid_msg::of13::OFPFC_MODIFY_STRICT);
-			flowmod_1.command(fluid_msg::of13::OFPFC_MODIFY_STRICT);
-		}
-
 		// Save the updated state
 		port.state = current_state;
 
-		BOOST_LOG_TRIVIAL(trace) << *this << " Updating port rule for port "
-			<< port_no << " to " << Port::state_to_string(current_state);
-
 		// Add the in-port match to flowmod_0
 		flowmod_0.add_oxm_field(
 			new fluid_msg::of13::InPort(port_no));
@@ -224,8 +213,8 @@ void PhysicalSwitch::update_dynamic_rules() {
 			// If current_state==Port::State::drop_rule don't add any actions
 		}
 
-		// Send the first message
-		send_message(flowmod_0);
+		// Add the first rule
+		flow_table_shadow.add_flow(RuleSection::port_rules, flowmod_0);
 
 		// Flowmod 1 needs to be duplicated for each slice in the Hypervisor
 		for( const Slice& slice : hypervisor->get_slices() ) {
@@ -233,26 +222,25 @@ void PhysicalSwitch::update_dynamic_rules() {
 			fluid_msg::of13::FlowMod flowmod_1_copy(flowmod_1);
 
 			// Add the match to flowmod_1_copy
-			VLANTag vlan_tag;
-			vlan_tag.set_switch(id);
-			vlan_tag.set_port(port_no);
-			vlan_tag.set_slice(slice.get_id());
-			vlan_tag.add_to_match(flowmod_1_copy);
+			NetworkTag network_tag;
+			network_tag.set_switch(id);
+			network_tag.set_port(port_no);
+			network_tag.set_slice(slice.get_id());
+			network_tag.add_to_match(flowmod_1_copy);
 
 			// Set the actions for flowmod_1_copy
 			fluid_msg::of13::WriteActions write_actions;
 			if( current_state == Port::State::host_rule ) {
-				// Remove the VLAN Tag before forwarding to a host
-				write_actions.add_action(
-					new fluid_msg::of13::PopVLANAction());
+				// Remove the tag before forwarding to a host
+				NetworkTag::add_pop_to_actions(write_actions);
 			}
 			else if( current_state == Port::State::link_rule ) {
-				// Rewrite the port VLAN Tag to a shared link tag
-				VLANTag vlan_tag;
-				vlan_tag.set_switch(VLANTag::max_switch_id);
-				vlan_tag.set_port(VLANTag::max_port_id);
-				vlan_tag.set_slice(slice.get_id());
-				vlan_tag.add_to_actions(write_actions);
+				// Rewrite the port tag to a shared link tag
+				NetworkTag network_tag;
+				network_tag.set_switch(NetworkTag::max_switch_id);
+				network_tag.set_port(NetworkTag::max_port_id);
+				network_tag.set_slice(slice.get_id());
+				network_tag.add_to_actions(write_actions);
 			}
 			// TODO What about drop rule?
 			write_actions.add_action(
@@ -261,12 +249,13 @@ void PhysicalSwitch::update_dynamic_rules() {
 					fluid_msg::of13::OFPCML_NO_BUFFER));
 			flowmod_1_copy.add_instruction(write_actions);
 
-			// Send the flowmods
-			send_message(flowmod_1_copy);
+			// Add the rule for this slice
+			flow_table_shadow.add_flow(RuleSection::port_rules, flowmod_1_copy);
 		}
 	}
 
 	// Update shared link forwarding rules, the rules in table 1 with id 30
+	flow_table_shadow.clear_section(RuleSection::shared_link_rules);
 	for( auto& needed_port_pair : needed_ports ) {
 		const uint32_t& port_no = needed_port_pair.first;
 
@@ -277,6 +266,11 @@ void PhysicalSwitch::update_dynamic_rules() {
 		}
 		const Port& port = port_it->second;
 
+		// These rules only exist for ports with a link
+		if( port.state != Port::State::link_rule ) {
+			continue;
+		}
+
 		// Loop over all virtual switches that need this port
 		for( auto& needed_port_pair_2 : needed_port_pair.second ) {
 			NeededPort& needed_port = needed_port_pair_2.second;
@@ -287,37 +281,18 @@ void PhysicalSwitch::update_dynamic_rules() {
 			flowmod.priority(30);
 			flowmod.buffer_id(OFP_NO_BUFFER);
 
-			// Figure out if we need to create/delete the rule
-			if( !needed_port.rule_installed && port.state==Port::State::link_rule) {
-				flowmod.command(fluid_msg::of13::OFPFC_ADD);
-				needed_port.rule_installed = true;
-			}
-			else if( needed_port.rule_installed && port.state!=Port::State::link_rule ) {
-				flowmod.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
-				needed_port.rule_installed = false;
-			}
-			else {
-				continue;
-			}
-
-			BOOST_LOG_TRIVIAL(trace) << *this
-				<< " Update rule 1,30 with port state="
-				<< Port::state_to_string(port.state)
-				<< " for port " << port_no;
-
 			// Create the match
-			VLANTag vlan_tag;
-			vlan_tag.set_switch(VLANTag::max_switch_id);
-			vlan_tag.set_port(VLANTag::max_port_id);
-			vlan_tag.set_slice(needed_port.virtual_switch->get_slice()->get_id());
-			vlan_tag.add_to_match(flowmod);
+			NetworkTag network_tag;
+			network_tag.set_switch(NetworkTag::max_switch_id);
+			network_tag.set_port(NetworkTag::max_port_id);
+			network_tag.set_slice(needed_port.virtual_switch->get_slice()->get_id());
+			network_tag.add_to_match(flowmod);
 			flowmod.add_oxm_field(
 				new fluid_msg::of13::InPort(port_no));
 
 			// Add the actions
 			fluid_msg::of13::ApplyActions apply_actions;
-			apply_actions.add_action(
-				new fluid_msg::of13::PopVLANAction());
+			NetworkTag::add_pop_to_actions(apply_actions);
 			flowmod.add_instruction(apply_actions);
 			// Add the meter instruction
 			if( hypervisor->get_use_meters() ) {
@@ -332,70 +307,54 @@ void PhysicalSwitch::update_dynamic_rules() {
 			flowmod.add_instruction(
 				new fluid_msg::of13::GoToTable(2));
 
-			// Send the message
-			send_message(flowmod);
+			// Add the rule
+			flow_table_shadow.add_flow(RuleSection::shared_link_rules, flowmod);
 		}
 	}
 
-	// Figure out what to do with traffic meant for a different switch
-	for( const auto& switch_it : hypervisor->get_physical_switches() ) {
-		int other_id = switch_it.first;
-
-		// Forwarding to this switch makes no sense
-		if( other_id == id ) continue;
-
-		// If there is no path to this switch
-		const auto next_it    = next.find(other_id);
-		const auto current_it = current_next.find(other_id);
-		bool next_exists      = next_it!=next.end();
-		bool current_exists   = current_it!=current_next.end();
-
-		// If this switch was and is unreachable skip this switch
-		if( !next_exists && !current_exists ) continue;
-		// If this switch is reachable but that rule is already set
-		// in the switch
-		if(
-			next_exists && current_exists &&
-			next_it->second==current_it->second
-		) continue;
-
-		// If we arrived here we need to update something in the switch.
-		// Create the flowmod
-		fluid_msg::of13::FlowMod flowmod;
-		flowmod.table_id(1);
-		flowmod.priority(20);
-		flowmod.buffer_id(OFP_NO_BUFFER);
+	// Figure out what to do with traffic meant for a different switch,
+	// this only has to be done if the routes from this switch changed
+	// since the rules were last made.
+	const RoutingEngine& routing_engine = hypervisor->get_routing_engine();
+	if( installed_routes_version != routing_engine.get_row_version(id) ) {
+		installed_routes_version = routing_engine.get_row_version(id);
+		flow_table_shadow.clear_section(RuleSection::switch_rules);
 
-		if( !current_exists ) {
-			flowmod.command(fluid_msg::of13::OFPFC_ADD);
-		}
-		else if( current_exists && next_exists ) {
-			flowmod.command(fluid_msg::of13::OFPFC_MODIFY_STRICT);
-		}
-		else {
-			flowmod.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
-		}
+		for( int other_id=0; other_id<routing_engine.get_num_switches(); ++other_id ) {
+			// Forwarding to this switch makes no sense
+			if( other_id == id ) continue;
 
-		if( next_exists ) {
-			// Add the vlantag match field
-			VLANTag vlan_tag;
-			vlan_tag.set_switch(other_id);
-			vlan_tag.add_to_match(flowmod);
+			// If there is no path to this switch there is no rule
+			uint32_t next_port = routing_engine.get_next(id, other_id);
+			if( next_port == UINT32_MAX ) continue;
+
+			// Create the flowmod
+			fluid_msg::of13::FlowMod flowmod;
+			flowmod.table_id(1);
+			flowmod.priority(20);
+			flowmod.buffer_id(OFP_NO_BUFFER);
+
+			// Add the tag match field
+			NetworkTag network_tag;
+			network_tag.set_switch(other_id);
+			network_tag.add_to_match(flowmod);
 
 			// Tell the packet to output over the correct port
 			fluid_msg::of13::WriteActions write_actions;
 			write_actions.add_action(
 				new fluid_msg::of13::OutputAction(
-					next_it->second,
+					next_port,
 					fluid_msg::of13::OFPCML_NO_BUFFER));
 			flowmod.add_instruction(write_actions);
-		}
 
-		// Send the message
-		send_message(flowmod);
+			// Add the rule
+			flow_table_shadow.add_flow(RuleSection::switch_rules, flowmod);
+		}
 	}
 
 	// Loop over all virtual switches for which we have rewrite data
+	flow_table_shadow.clear_section(RuleSection::group_rules);
+	std::unordered_set<uint32_t> added_output_groups;
 	for( auto& rewrite_entry_pair : rewrite_map ) {
 		const int& virtual_switch_id        = rewrite_entry_pair.first;
 		auto& rewrite_entry                 = rewrite_entry_pair.second;
@@ -409,6 +368,11 @@ void PhysicalSwitch::update_dynamic_rules() {
 		// case no next port is found towards the needed ports of that switch.
 		if( virtual_switch->is_down() ) continue;
 
+		// The flood group outputs to all output groups
+		fluid_msg::of13::GroupMod flood_group_mod;
+		flood_group_mod.group_type(fluid_msg::of13::OFPGT_ALL);
+		flood_group_mod.group_id(rewrite_entry.flood_group_id);
+
 		// Loop over all ports on the virtual switch
 		for( auto& port_pair : virtual_switch->get_port_to_physical_switch() ) {
 			const uint32_t& virtual_port  = port_pair.first;
@@ -446,108 +410,108 @@ void PhysicalSwitch::update_dynamic_rules() {
 			// If it is a port on another switch
 			else {
 				new_state       = OutputGroup::State::switch_rule;
-				new_output_port = next.at(physical_switch->get_id());
+				new_output_port = get_next(physical_switch->get_id());
 			}
 
-			// If the states and output ports are the same the group doesn't
-			// need to be updated
-			if( output_group.state==new_state &&
-				output_group.output_port==new_output_port ) {
-				continue;
-			}
-
-			// Create the new group to
-			fluid_msg::of13::GroupMod group_mod;
-			// If this group doesn't exist it is an add command
-			if( output_group.state == OutputGroup::State::no_rule ) {
-				group_mod.command(fluid_msg::of13::OFPGC_ADD);
-			}
-			// Otherwise it is an edit command
-			else {
-				group_mod.command(fluid_msg::of13::OFPGC_MODIFY);
-			}
-			group_mod.group_type(fluid_msg::of13::OFPGT_INDIRECT);
-			group_mod.group_id(output_group.group_id);
-
-			// Update the state and output port in the output_group
+			// Store the state and output port in the output_group
 			output_group.state       = new_state;
 			output_group.output_port = new_output_port;
 
-			// Create the bucket to add to the group mod
-			fluid_msg::of13::Bucket bucket;
-			bucket.weight(0);
-			bucket.watch_port(fluid_msg::of13::OFPP_ANY);
-			bucket.watch_group(fluid_msg::of13::OFPG_ANY);
-
-			// Determine what actions to add to the bucket and do it
-			fluid_msg::ActionSet action_set;
-			if( new_state == OutputGroup::State::host_rule ) {
-				action_set.add_action(
-					new fluid_msg::of13::OutputAction(
-						new_output_port,
-						fluid_msg::of13::OFPCML_NO_BUFFER));
-			}
-			else if( new_state == OutputGroup::State::shared_link_rule ) {
-				// Push the VLAN Tag
-				action_set.add_action(
-					new fluid_msg::of13::PushVLANAction(0x8100));
-
-				// Set the data in the VLAN Tag
-				VLANTag vlan_tag;
-				vlan_tag.set_switch(VLANTag::max_switch_id);
-				vlan_tag.set_port(VLANTag::max_port_id);
-				vlan_tag.set_slice(virtual_switch->get_slice()->get_id());
-				vlan_tag.add_to_actions(action_set);
-
-				// Output the packet over the proper port
-				action_set.add_action(
-					new fluid_msg::of13::OutputAction(
-						new_output_port,
-						fluid_msg::of13::OFPCML_NO_BUFFER));
-			}
-			// Otherwise the state needs to be switch_rule
-			else {
-				// Push the VLAN Tag
-				action_set.add_action(
-					new fluid_msg::of13::PushVLANAction(0x8100));
-
-				// Get the port id on the foreign switch
-				uint32_t foreign_output_port =
-					virtual_switch
-						->get_port_map(physical_dpid)
-							.get_physical(virtual_port);
-
-				// Set the data in the VLAN Tag
-				VLANTag vlan_tag;
-				vlan_tag.set_switch(physical_switch->get_id());
-				vlan_tag.set_port(foreign_output_port);
-				vlan_tag.set_slice(virtual_switch->get_slice()->get_id());
-				vlan_tag.add_to_actions(action_set);
-
-				// Output the packet over the proper port
-				action_set.add_action(
-					new fluid_msg::of13::OutputAction(
-						new_output_port,
-						fluid_msg::of13::OFPCML_NO_BUFFER));
-			}
+			// The virtual switches outputting to the same place share
+			// the group, it is only created once
+			if( added_output_groups.insert(output_group.group_id).second ) {
+				// Create the group
+				fluid_msg::of13::GroupMod group_mod;
+				group_mod.group_type(fluid_msg::of13::OFPGT_INDIRECT);
+				group_mod.group_id(output_group.group_id);
+
+				// Create the bucket to add to the group mod
+				fluid_msg::of13::Bucket bucket;
+				bucket.weight(0);
+				bucket.watch_port(fluid_msg::of13::OFPP_ANY);
+				bucket.watch_group(fluid_msg::of13::OFPG_ANY);
+
+				// Determine what actions to add to the bucket and do it
+				fluid_msg::ActionSet action_set;
+				if( new_state == OutputGroup::State::host_rule ) {
+					action_set.add_action(
+						new fluid_msg::of13::OutputAction(
+							new_output_port,
+							fluid_msg::of13::OFPCML_NO_BUFFER));
+				}
+				else if( new_state == OutputGroup::State::shared_link_rule ) {
+					// Push the tag
+					NetworkTag::add_push_to_actions(action_set);
+
+					// Set the data in the tag
+					NetworkTag network_tag;
+					network_tag.set_switch(NetworkTag::max_switch_id);
+					network_tag.set_port(NetworkTag::max_port_id);
+					network_tag.set_slice(virtual_switch->get_slice()->get_id());
+					network_tag.add_to_actions(action_set);
+
+					// Output the packet over the proper port
+					action_set.add_action(
+						new fluid_msg::of13::OutputAction(
+							new_output_port,
+							fluid_msg::of13::OFPCML_NO_BUFFER));
+				}
+				// Otherwise the state needs to be switch_rule
+				else {
+					// Push the tag
+					NetworkTag::add_push_to_actions(action_set);
+
+					// Get the port id on the foreign switch
+					uint32_t foreign_output_port =
+						virtual_switch
+							->get_port_map(physical_dpid)
+								.get_physical(virtual_port);
+
+					// Set the data in the tag
+					NetworkTag network_tag;
+					network_tag.set_switch(physical_switch->get_id());
+					network_tag.set_port(foreign_output_port);
+					network_tag.set_slice(virtual_switch->get_slice()->get_id());
+					network_tag.add_to_actions(action_set);
+
+					// Output the packet over the proper port
+					action_set.add_action(
+						new fluid_msg::of13::OutputAction(
+							new_output_port,
+							fluid_msg::of13::OFPCML_NO_BUFFER));
+				}
 
-			// Add the bucket
-			bucket.actions(action_set);
-			group_mod.add_bucket(bucket);
+				// Add the bucket
+				bucket.actions(action_set);
+				group_mod.add_bucket(bucket);
 
-			// Send the message
-			send_message(group_mod);
+				// Add the group
+				flow_table_shadow.add_group(RuleSection::group_rules, group_mod);
+			}
+
+			// Create the bucket in the flood group that forwards to this
+			// virtual port
+			fluid_msg::of13::Bucket flood_bucket;
+			flood_bucket.weight(0);
+			flood_bucket.watch_port(fluid_msg::of13::OFPP_ANY);
+			flood_bucket.watch_group(fluid_msg::of13::OFPG_ANY);
+			fluid_msg::ActionSet flood_action_set;
+			flood_action_set.add_action(
+				new fluid_msg::of13::GroupAction(output_group.group_id));
+			flood_bucket.actions(flood_action_set);
+			flood_group_mod.add_bucket(flood_bucket);
 		}
-	}
 
-	// TODO Remove this section
-	if( state == registered ) {
-		std::ostringstream string_stream;
-		string_stream << "dpid_" << features.datapath_id << ".dat";
-		std::ofstream file(string_stream.str());
-		print_detailed(file);
-		BOOST_LOG_TRIVIAL(trace) << "Wrote to file " << string_stream.str();
+		// Add the flood group after the groups it points to
+		flow_table_shadow.add_group(RuleSection::group_rules, flood_group_mod);
 	}
+
+	// Send only the differences with what is in the switch, right
+	// after a restart nothing is removed until the links are found
+	flow_table_shadow.commit(*this, warm_restart_grace);
+
+	// The released groups are deleted now, their id's can be reused
+	if( !warm_restart_grace ) free_released_group_ids();
 }
 
 void PhysicalSwitch::print_detailed(std::ostream& os) const {
@@ -557,6 +521,7 @@ void PhysicalSwitch::print_detailed(std::ostream& os) const {
 		os << "\t\t{\n";
 		os << "\t\t\tid = " << port_pair.first << "\n";
 		os << "\t\t\tstate = " << Port::state_to_string(port_pair.second.state) << "\n";
+		os << "\t\t\tprobe-interval = " << port_pair.second.probe_interval << "\n";
 		os << "\t\t\tneeded-ports = { ";
 		auto needed_port_it = needed_ports.find(port_pair.first);
 		if( needed_port_it != needed_ports.end() ) {
@@ -574,7 +539,7 @@ void PhysicalSwitch::print_detailed(std::ostream& os) const {
 		os << "\t\t\tvirtual-switch-id = " << rewrite_map_pair.first << "\n";
 		os << "\t\t\tflood-group-id = " << rewrite_map_pair.second.flood_group_id << "\n";
 		os << "\t\t\tgroup-id-map = [\n";
-		for( auto group_id_pair : rewrite_map_pair.second.group_id_map.get_virtual_to_physical() ) {
+		for( auto group_id_pair : rewrite_map_pair.second.group_id_map ) {
 			os << "\t\t\t\t" << group_id_pair.first << " <=> " << group_id_pair.second << "\n";
 		}
 		os << "\t\t\t]\n";
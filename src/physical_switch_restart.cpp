@@ -0,0 +1,326 @@
+#include "physical_switch.hpp"
+#include "virtual_switch.hpp"
+#include "hypervisor.hpp"
+#include "discoveredlink.hpp"
+#include "slice.hpp"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// The longest time in ms only rules are added after a restart
+	constexpr int warm_restart_grace_period = 10*topology::period;
+}
+
+void PhysicalSwitch::start_cold() {
+	BOOST_LOG_TRIVIAL(info) << *this << " starting with empty tables";
+
+	// Delete all the flow rules already in the switch
+	{
+		fluid_msg::of13::FlowMod flowmod;
+		flowmod.command( fluid_msg::of13::OFPFC_DELETE );
+		flowmod.table_id( fluid_msg::of13::OFPTT_ALL );
+		flowmod.cookie_mask(0);
+		flowmod.buffer_id(OFP_NO_BUFFER);
+		send_message( flowmod );
+	}
+	rule_accounting.clear();
+
+	// Delete all the groups already in the switch
+	{
+		fluid_msg::of13::GroupMod group_mod;
+		group_mod.command( fluid_msg::of13::OFPGC_DELETE );
+		group_mod.group_id( fluid_msg::of13::OFPG_ALL );
+		send_message( group_mod );
+	}
+	free_released_group_ids();
+
+	// Send a barrier request to make sure the delete command
+	// is executed before any new rules are added
+	{
+		fluid_msg::of13::BarrierRequest barrier;
+		send_message(barrier);
+	}
+
+	// Create the initial rules, they are pushed together with the
+	// dynamic rules
+	rules_initialized = true;
+	create_static_rules(false);
+}
+
+void PhysicalSwitch::start_warm(const RestartSnapshot::SwitchState& restart_state) {
+	BOOST_LOG_TRIVIAL(info) << *this << " reconciling the tables with the previous run";
+
+	// Reserve the groups of the virtual switches that still exist,
+	// the group with id 0 outputs to the controller
+	warm_restart_groups.clear();
+	warm_restart_groups[0] = true;
+	for( const auto& state_pair : restart_state.virtual_switches ) {
+		const RestartSnapshot::VirtualSwitchState& virtual_switch_state = state_pair.second;
+		VirtualSwitch* virtual_switch = hypervisor->get_virtual_switch(state_pair.first);
+		if(
+			virtual_switch == nullptr ||
+			virtual_switch->get_slice()->get_id() != virtual_switch_state.slice_id ||
+			virtual_switch->get_datapath_id() != virtual_switch_state.datapath_id
+		) {
+			BOOST_LOG_TRIVIAL(warning) << *this << " virtual switch id=" << state_pair.first
+				<< " of the previous run is not configured anymore";
+			continue;
+		}
+		if( !group_id_allocator.reserve_id(virtual_switch_state.flood_group_id) ) {
+			BOOST_LOG_TRIVIAL(warning) << *this << " could not reserve flood group "
+				<< virtual_switch_state.flood_group_id << " of " << *virtual_switch;
+			continue;
+		}
+
+		RewriteEntry& rewrite_entry  = restored_rewrite_map[state_pair.first];
+		rewrite_entry.flood_group_id = virtual_switch_state.flood_group_id;
+		warm_restart_groups[virtual_switch_state.flood_group_id] = true;
+
+		// The output groups are shared between the virtual switches,
+		// a group is kept if it still outputs to the same place
+		const std::map<uint32_t,uint64_t>& virtual_ports =
+			virtual_switch->get_port_to_physical_switch();
+		for( const auto& output_group_pair : virtual_switch_state.output_groups ) {
+			if( virtual_ports.count(output_group_pair.first) == 0 ) continue;
+
+			OutputGroup& output_group = rewrite_entry.output_groups[output_group_pair.first];
+			output_group.key          = make_output_group_key(*virtual_switch, output_group_pair.first);
+			output_group.group_id     = acquire_output_group(output_group.key, output_group_pair.second);
+			output_group.state        = OutputGroup::State::no_rule;
+			if( output_group.group_id == output_group_pair.second ) {
+				warm_restart_groups[output_group_pair.second] = true;
+			}
+		}
+		for( const auto& group_id_pair : virtual_switch_state.group_ids ) {
+			if( !group_id_allocator.reserve_id(group_id_pair.second) ) continue;
+
+			rewrite_entry.group_id_map.insert(group_id_pair.first, group_id_pair.second);
+			warm_restart_groups[group_id_pair.second] = false;
+		}
+	}
+	warm_restart_link_ports = restart_state.link_ports;
+
+	// Read back the tables of the hypervisor and all groups, the
+	// tables of the virtual switches are left as they are
+	for( uint8_t table_id : {0, 1} ) {
+		fluid_msg::of13::MultipartRequestFlow flow_request(
+			0, // The xid will be set send_message
+			0,
+			table_id,
+			fluid_msg::of13::OFPP_ANY,
+			fluid_msg::of13::OFPG_ANY,
+			0,
+			0, // Match every cookie
+			fluid_msg::of13::Match());
+		warm_restart_xids.insert(send_message(flow_request));
+	}
+	{
+		fluid_msg::of13::MultipartRequestGroupDesc group_request(
+			0, // The xid will be set send_message
+			0);
+		warm_restart_xids.insert(send_message(group_request));
+	}
+}
+
+void PhysicalSwitch::handle_warm_restart_flows(fluid_msg::of13::MultipartReplyFlow& multipart_reply_message) {
+	for( fluid_msg::of13::FlowStats flow_stats : multipart_reply_message.flow_stats() ) {
+		fluid_msg::of13::FlowMod flowmod(
+			0,
+			flow_stats.cookie(),
+			0,
+			flow_stats.table_id(),
+			fluid_msg::of13::OFPFC_ADD,
+			flow_stats.idle_timeout(),
+			flow_stats.hard_timeout(),
+			flow_stats.priority(),
+			OFP_NO_BUFFER,
+			fluid_msg::of13::OFPP_ANY,
+			fluid_msg::of13::OFPG_ANY,
+			flow_stats.flags());
+		flowmod.match(flow_stats.match());
+		flowmod.instructions(flow_stats.instructions());
+		flow_table_shadow.add_installed_flow(flowmod);
+	}
+
+	// Wait for the other parts of the reply
+	if( multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE ) return;
+
+	warm_restart_xids.erase(multipart_reply_message.xid());
+	if( warm_restart_xids.empty() ) finish_warm_restart();
+}
+
+void PhysicalSwitch::handle_multipart_reply_group_desc(fluid_msg::of13::MultipartReplyGroupDesc& multipart_reply_message) {
+	if( warm_restart_xids.count(multipart_reply_message.xid()) == 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received group descriptions that were not requested";
+		return;
+	}
+
+	for( fluid_msg::of13::GroupDesc group_desc : multipart_reply_message.desc() ) {
+		auto it = warm_restart_groups.find(group_desc.group_id());
+
+		// A group no virtual switch knows about can't be used, it
+		// would collide with a group given out later
+		if( it == warm_restart_groups.end() ) {
+			fluid_msg::of13::GroupMod group_mod;
+			group_mod.command(fluid_msg::of13::OFPGC_DELETE);
+			group_mod.group_id(group_desc.group_id());
+			send_message(group_mod);
+			continue;
+		}
+
+		// The groups of the virtual switches are left alone
+		if( !it->second ) continue;
+
+		fluid_msg::of13::GroupMod group_mod(
+			0,
+			fluid_msg::of13::OFPGC_ADD,
+			group_desc.type(),
+			group_desc.group_id());
+		group_mod.buckets(group_desc.buckets());
+		warm_restart_installed_groups.push_back(group_mod);
+	}
+
+	// Wait for the other parts of the reply
+	if( multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE ) return;
+
+	warm_restart_xids.erase(multipart_reply_message.xid());
+	if( warm_restart_xids.empty() ) finish_warm_restart();
+}
+
+void PhysicalSwitch::finish_warm_restart() {
+	BOOST_LOG_TRIVIAL(info) << *this << " read back the tables, pushing the differences";
+
+	// The flood groups point to the output groups, they are added
+	// to the shadow last so they are deleted first
+	std::unordered_set<uint32_t> flood_group_ids;
+	for( const auto& rewrite_pair : rewrite_map ) {
+		flood_group_ids.insert(rewrite_pair.second.flood_group_id);
+	}
+	for( const auto& rewrite_pair : restored_rewrite_map ) {
+		flood_group_ids.insert(rewrite_pair.second.flood_group_id);
+	}
+	std::stable_partition(
+		warm_restart_installed_groups.begin(),
+		warm_restart_installed_groups.end(),
+		[&](fluid_msg::of13::GroupMod& group_mod) {
+			return flood_group_ids.count(group_mod.group_id()) == 0;
+		});
+	for( fluid_msg::of13::GroupMod& group_mod : warm_restart_installed_groups ) {
+		flow_table_shadow.add_installed_group(group_mod);
+	}
+	warm_restart_installed_groups.clear();
+	warm_restart_groups.clear();
+
+	rules_initialized  = true;
+	warm_restart_grace = true;
+	create_static_rules(true);
+
+	// Without links to wait for everything can be pushed directly
+	if( warm_restart_link_ports.empty() ) {
+		end_warm_restart_grace();
+		return;
+	}
+
+	update_dynamic_rules();
+
+	warm_restart_timer.expires_from_now(
+		boost::posix_time::milliseconds(warm_restart_grace_period));
+	warm_restart_timer.async_wait(
+		control_strand.wrap(boost::bind(
+			&PhysicalSwitch::handle_warm_restart_timer,
+			shared_from_this(),
+			boost::asio::placeholders::error)));
+}
+
+bool PhysicalSwitch::fail_warm_restart(uint32_t xid) {
+	if( warm_restart_xids.count(xid) == 0 ) return false;
+
+	BOOST_LOG_TRIVIAL(warning) << *this << " could not read back the tables";
+
+	// Nothing that was read back so far can be trusted
+	warm_restart_xids.clear();
+	warm_restart_groups.clear();
+	warm_restart_installed_groups.clear();
+	warm_restart_link_ports.clear();
+	flow_table_shadow.reset();
+
+	// The groups of the virtual switches that did not register
+	// yet are wiped, their id's can be used again
+	for( const auto& rewrite_pair : restored_rewrite_map ) {
+		const RewriteEntry& rewrite_entry = rewrite_pair.second;
+		group_id_allocator.free_id(rewrite_entry.flood_group_id);
+		for( const auto& output_group_pair : rewrite_entry.output_groups ) {
+			release_output_group(rewrite_pair.first, output_group_pair.second.group_id);
+		}
+		for( const auto& group_id_pair : rewrite_entry.group_id_map ) {
+			group_id_allocator.free_id(group_id_pair.second);
+		}
+	}
+	restored_rewrite_map.clear();
+
+	start_cold();
+	update_dynamic_rules();
+	return true;
+}
+
+void PhysicalSwitch::handle_warm_restart_timer(const boost::system::error_code& error) {
+	if( error == boost::asio::error::operation_aborted ) return;
+
+	BOOST_LOG_TRIVIAL(info) << *this << " not all links of the previous run were found again";
+	end_warm_restart_grace();
+}
+
+void PhysicalSwitch::end_warm_restart_grace() {
+	warm_restart_timer.cancel();
+	warm_restart_grace = false;
+	warm_restart_link_ports.clear();
+
+	// The restored groups of virtual switches that are not online
+	// are deleted now, they are added again if the virtual switch
+	// registers its interest with the same group id's
+	update_dynamic_rules();
+}
+
+RestartSnapshot::SwitchState PhysicalSwitch::get_restart_state() const {
+	RestartSnapshot::SwitchState restart_state;
+
+	auto add_rewrite_entry = [&](int virtual_switch_id, const RewriteEntry& rewrite_entry) {
+		const VirtualSwitch* virtual_switch = hypervisor->get_virtual_switch(virtual_switch_id);
+		if( virtual_switch == nullptr ) return;
+
+		RestartSnapshot::VirtualSwitchState& virtual_switch_state =
+			restart_state.virtual_switches[virtual_switch_id];
+		virtual_switch_state.slice_id       = virtual_switch->get_slice()->get_id();
+		virtual_switch_state.datapath_id    = virtual_switch->get_datapath_id();
+		virtual_switch_state.flood_group_id = rewrite_entry.flood_group_id;
+		for( const auto& output_group_pair : rewrite_entry.output_groups ) {
+			virtual_switch_state.output_groups[output_group_pair.first] =
+				output_group_pair.second.group_id;
+		}
+		for( const auto& group_id_pair : rewrite_entry.group_id_map ) {
+			virtual_switch_state.group_ids[group_id_pair.first] = group_id_pair.second;
+		}
+	};
+	for( const auto& rewrite_pair : rewrite_map ) {
+		add_rewrite_entry(rewrite_pair.first, rewrite_pair.second);
+	}
+	for( const auto& rewrite_pair : restored_rewrite_map ) {
+		add_rewrite_entry(rewrite_pair.first, rewrite_pair.second);
+	}
+
+	// The links themselves are found again by the topology
+	// discovery, the ports are kept to know when it is done
+	for( const auto& port_pair : ports ) {
+		if( port_pair.second.link != nullptr ) {
+			restart_state.link_ports.insert(port_pair.first);
+		}
+	}
+	restart_state.link_ports.insert(
+		warm_restart_link_ports.begin(),
+		warm_restart_link_ports.end());
+
+	return restart_state;
+}
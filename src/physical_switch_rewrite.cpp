@@ -5,15 +5,18 @@
 
 #include <boost/log/trivial.hpp>
 
-bool PhysicalSwitch::rewrite_instruction_set(
+bool PhysicalSwitch::prepare_instruction_set(
 		fluid_msg::of13::InstructionSet& old_instruction_set,
-		fluid_msg::of13::InstructionSet& instruction_set_with_output,
-		fluid_msg::of13::InstructionSet& instruction_set_without_output,
+		fluid_msg::of13::InstructionSet& prepared_instruction_set,
 		bool& has_write_action_group,
-		const VirtualSwitch* virtual_switch) {
+		bool& has_write_action_output) {
 	uint64_t metadata_tag  = 0;
 	uint64_t metadata_mask = 0;
 
+	// Initialize the variables tracking if a group or output action is written
+	has_write_action_group  = false;
+	has_write_action_output = false;
+
 	// Loop over all the instructions in the original set
 	for( fluid_msg::of13::Instruction* instruction : old_instruction_set.instruction_set() ) {
 		if( instruction->type() == fluid_msg::of13::OFPIT_GOTO_TABLE ) {
@@ -23,9 +26,7 @@ bool PhysicalSwitch::rewrite_instruction_set(
 			// TODO Check if goto_table->table_id()+2 is within physical
 			// switch capabilities
 
-			instruction_set_with_output.add_instruction(
-				new fluid_msg::of13::GoToTable(goto_table->table_id()+2));
-			instruction_set_without_output.add_instruction(
+			prepared_instruction_set.add_instruction(
 				new fluid_msg::of13::GoToTable(goto_table->table_id()+2));
 		}
 		else if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_METADATA ) {
@@ -38,8 +39,8 @@ bool PhysicalSwitch::rewrite_instruction_set(
 			constexpr uint64_t mask_check
 				= make_mask(total_bits) << (64-total_bits);
 			if( write_metadata->metadata_mask() & mask_check ) {
-				BOOST_LOG_TRIVIAL(warning) << *this
-					<< " metadata instruction uses reserved bits";
+				BOOST_LOG_TRIVIAL(warning)
+					<< "Metadata instruction uses reserved bits";
 				return false;
 			}
 
@@ -51,10 +52,107 @@ bool PhysicalSwitch::rewrite_instruction_set(
 			fluid_msg::of13::WriteActions* write_actions =
 				(fluid_msg::of13::WriteActions*) instruction;
 
+			// Look for actions that change how the instruction is rewritten
+			fluid_msg::ActionSet action_set = write_actions->actions();
+			for( fluid_msg::Action* action : action_set.action_set() ) {
+				if( action->type() == fluid_msg::of13::OFPAT_GROUP ) {
+					has_write_action_group = true;
+				}
+				else if( action->type() == fluid_msg::of13::OFPAT_OUTPUT ) {
+					has_write_action_output = true;
+				}
+				else if( action->type() == fluid_msg::of13::OFPAT_SET_QUEUE ) {
+					// Set queue actions are not supported yet
+					BOOST_LOG_TRIVIAL(warning)
+						<< "Received flowmod with set-queue in write-actions";
+					return false;
+				}
+			}
+
+			// If a group action was used set the metadata group bit
+			if( has_write_action_group ) {
+				metadata_tag  |= 1;
+				metadata_mask |= 1;
+			}
+
+			// The actions are rewritten per physical switch
+			prepared_instruction_set.add_instruction(instruction->clone());
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_APPLY_ACTIONS ) {
+			fluid_msg::of13::ApplyActions* apply_actions =
+				(fluid_msg::of13::ApplyActions*) instruction;
+
+			fluid_msg::ActionList action_list = apply_actions->actions();
+			for( fluid_msg::Action* action : action_list.action_list() ) {
+				if( action->type() == fluid_msg::of13::OFPAT_SET_QUEUE ) {
+					// Set queue actions are not supported yet
+					BOOST_LOG_TRIVIAL(warning)
+						<< "Received flowmod with set-queue in action list";
+					return false;
+				}
+			}
+
+			// The actions are rewritten per physical switch
+			prepared_instruction_set.add_instruction(instruction->clone());
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_CLEAR_ACTIONS ) {
+			// Copy the instruction
+			prepared_instruction_set.add_instruction(instruction->clone());
+
+			// Set the first bit in the metadata mask so the group bit gets
+			// overwritten with a 0. If there also is a write action instruction
+			// in this instruction set has the metadata_tag and metadata_mask
+			// value already been set, the clear-action instruction is executed
+			// before the write-action instruction. In that case the below statement
+			// doesn't actually change anything which is correct.
+			metadata_mask |= 1;
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_METER ) {
+			BOOST_LOG_TRIVIAL(warning)
+				<< "Received flowmod with meter instruction";
+			return false;
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_EXPERIMENTER ) {
+			BOOST_LOG_TRIVIAL(warning)
+				<< "Received flowmod with experimenter instruction";
+			return false;
+		}
+		else {
+			// TODO Remove this case
+			prepared_instruction_set.add_instruction(instruction->clone());
+		}
+	}
+
+	// If any information was set in the metadata mask we need to add
+	// the metadata instruction
+	if( metadata_mask != 0 ) {
+		prepared_instruction_set.add_instruction(
+			new fluid_msg::of13::WriteMetadata(
+				metadata_tag,
+				metadata_mask));
+	}
+
+	// Return that everything went ok
+	return true;
+}
+
+bool PhysicalSwitch::rewrite_instruction_set(
+		fluid_msg::of13::InstructionSet& prepared_instruction_set,
+		fluid_msg::of13::InstructionSet& instruction_set_with_output,
+		fluid_msg::of13::InstructionSet& instruction_set_without_output,
+		const VirtualSwitch* virtual_switch) {
+	// Loop over all the instructions in the prepared set
+	for( fluid_msg::of13::Instruction* instruction : prepared_instruction_set.instruction_set() ) {
+		if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_ACTIONS ) {
+			fluid_msg::of13::WriteActions* write_actions =
+				(fluid_msg::of13::WriteActions*) instruction;
+
 			fluid_msg::ActionSet old_action_set = write_actions->actions();
 			fluid_msg::ActionSet action_set_with_output, action_set_without_output;
 
-			// Rewrite the action sets
+			// Rewrite the action sets, if there is a group action
+			// is already known from preparing
+			bool has_write_action_group;
 			if( !rewrite_action_set(
 					old_action_set,
 					action_set_with_output,
@@ -64,12 +162,6 @@ bool PhysicalSwitch::rewrite_instruction_set(
 				return false;
 			}
 
-			// If a group action was used set the metadata group bit
-			if( has_write_action_group ) {
-				metadata_tag  |= 1;
-				metadata_mask |= 1;
-			}
-
 			// Create new instructions in the appropiate instruction sets
 			// TODO What happens if an action set has no actions in it?
 			instruction_set_with_output.add_instruction(
@@ -98,49 +190,13 @@ bool PhysicalSwitch::rewrite_instruction_set(
 			instruction_set_without_output.add_instruction(
 				new fluid_msg::of13::ApplyActions(new_action_list));
 		}
-		else if( instruction->type() == fluid_msg::of13::OFPIT_CLEAR_ACTIONS ) {
-			// Copy the instruction in the both action sets
-			instruction_set_with_output.add_instruction(instruction->clone());
-			instruction_set_without_output.add_instruction(instruction->clone());
-
-			// Set the first bit in the metadata mask so the group bit gets
-			// overwritten with a 0. If there also is a write action instruction
-			// in this instruction set has the metadata_tag and metadata_mask
-			// value already been set, the clear-action instruction is executed
-			// before the write-action instruction. In that case the below statement
-			// doesn't actually change anything which is correct.
-			metadata_mask |= 1;
-		}
-		else if( instruction->type() == fluid_msg::of13::OFPIT_METER ) {
-			BOOST_LOG_TRIVIAL(warning) << *this
-				<< " received flowmod with meter instruction";
-			return false;
-		}
-		else if( instruction->type() == fluid_msg::of13::OFPIT_EXPERIMENTER ) {
-			BOOST_LOG_TRIVIAL(warning) << *this
-				<< " received flowmod with experimenter instruction";
-			return false;
-		}
 		else {
-			// TODO Remove this case
+			// All other instructions are already rewritten
 			instruction_set_with_output.add_instruction(instruction->clone());
 			instruction_set_without_output.add_instruction(instruction->clone());
 		}
 	}
 
-	// If any information was set in the metadata mask we need to add
-	// the metadata instruction to both instruction sets
-	if( metadata_mask != 0 ) {
-		instruction_set_with_output.add_instruction(
-			new fluid_msg::of13::WriteMetadata(
-				metadata_tag,
-				metadata_mask));
-		instruction_set_without_output.add_instruction(
-			new fluid_msg::of13::WriteMetadata(
-				metadata_tag,
-				metadata_mask));
-	}
-
 	// Return that everything went ok
 	return true;
 }
@@ -154,17 +210,14 @@ uint32_t PhysicalSwitch::get_rewritten_group_id(
 			.group_id_map;
 
 	// Check if a new id needs to be allocated
-	uint32_t group_id;
-	if( !group_id_map.has_virtual(virtual_group_id) ) {
+	boost::optional<uint32_t> group_id = group_id_map.find_physical(virtual_group_id);
+	if( !group_id ) {
 		group_id = group_id_allocator.new_id();
-		group_id_map.insert( virtual_group_id, group_id );
-	}
-	else {
-		group_id = group_id_map.get_physical( virtual_group_id );
+		group_id_map.insert( virtual_group_id, *group_id );
 	}
 
 	// Return the found/created id
-	return group_id;
+	return *group_id;
 }
 
 bool PhysicalSwitch::rewrite_action_set(
@@ -316,12 +369,14 @@ bool PhysicalSwitch::rewrite_match(
 
 		// If this switch cannot rewrite to the physical port
 		// return that it failed
-		if( !port_map.has_virtual(in_port->value()) ) {
+		boost::optional<uint32_t> physical_in_port =
+			port_map.find_physical(in_port->value());
+		if( !physical_in_port ) {
 			return false;
 		}
 
 		// Do the rewriting on the in_port OXM in place
-		in_port->value(port_map.get_physical(in_port->value()));
+		in_port->value(*physical_in_port);
 	}
 	return true;
 }
@@ -0,0 +1,372 @@
+#include "physical_switch.hpp"
+#include "virtual_switch.hpp"
+
+#include "tag.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// How long cached statistics are used in milliseconds
+	constexpr int stats_cache_ttl = 500;
+	/// The time a switch gets to answer a statistics request in ms
+	constexpr int stats_timeout = 10000;
+
+	/// The deadline of a statistics request send now
+	std::chrono::steady_clock::time_point stats_deadline() {
+		return std::chrono::steady_clock::now() + std::chrono::milliseconds(stats_timeout);
+	}
+}
+
+template<class Stats, class Request>
+void PhysicalSwitch::request_cached_stats(
+		StatsCache<Stats>& cache,
+		typename StatsCache<Stats>::Callback callback) {
+	// Answer directly if the last poll is recent enough
+	if(
+		cache.valid &&
+		std::chrono::steady_clock::now() - cache.updated <
+			std::chrono::milliseconds(stats_cache_ttl)
+	) {
+		callback(cache.stats);
+		return;
+	}
+
+	cache.waiters.push_back(callback);
+
+	// Wait for the running poll if there is one
+	if( cache.polling ) return;
+
+	// Request the statistics of everything, the reply is
+	// filtered per virtual switch
+	Request request_message;
+	request_message.flags(0);
+	cache.partial.clear();
+	cache.polling  = true;
+	cache.xid      = send_message(request_message);
+	cache.deadline = stats_deadline();
+}
+
+template<class Stats>
+void PhysicalSwitch::handle_cached_stats(
+		StatsCache<Stats>& cache,
+		uint32_t xid,
+		uint16_t flags,
+		const std::vector<Stats>& stats) {
+	if( !cache.polling || cache.xid != xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received statistics reply that was not requested";
+		return;
+	}
+
+	cache.partial.insert(cache.partial.end(), stats.begin(), stats.end());
+
+	// Wait for the other parts of the reply
+	if( flags & fluid_msg::of13::OFPMPF_REPLY_MORE ) return;
+
+	complete_cached_stats(cache, true);
+}
+
+template<class Stats>
+void PhysicalSwitch::complete_cached_stats(
+		StatsCache<Stats>& cache,
+		bool success) {
+	if( success ) {
+		cache.stats.swap(cache.partial);
+		cache.updated = std::chrono::steady_clock::now();
+		cache.valid   = true;
+	}
+	cache.partial.clear();
+	cache.polling = false;
+
+	// A failed poll is answered with no statistics, the
+	// callbacks can start new polls so swap them out first
+	std::vector<typename StatsCache<Stats>::Callback> waiters;
+	waiters.swap(cache.waiters);
+	std::vector<Stats> no_stats;
+	for( const auto& callback : waiters ) {
+		callback(success ? cache.stats : no_stats);
+	}
+}
+
+void PhysicalSwitch::fail_stats_request(uint32_t xid) {
+	if( port_stats_cache.polling && port_stats_cache.xid == xid ) {
+		complete_cached_stats(port_stats_cache, false);
+	}
+	if( group_stats_cache.polling && group_stats_cache.xid == xid ) {
+		complete_cached_stats(group_stats_cache, false);
+	}
+
+	FlowStatsRequest failed;
+	if( flow_stats_requests.erase(xid, failed) ) {
+		failed.callback(std::vector<fluid_msg::of13::FlowStats>());
+	}
+}
+
+void PhysicalSwitch::expire_stats_requests(std::chrono::steady_clock::time_point now) {
+	if( port_stats_cache.polling && port_stats_cache.deadline <= now ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " did not answer a port statistics request";
+		expired_requests.add();
+		complete_cached_stats(port_stats_cache, false);
+	}
+	if( group_stats_cache.polling && group_stats_cache.deadline <= now ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " did not answer a group statistics request";
+		expired_requests.add();
+		complete_cached_stats(group_stats_cache, false);
+	}
+
+	size_t expired_flow_stats = flow_stats_requests.expire(
+		now,
+		[](uint32_t, FlowStatsRequest& expired) {
+			expired.callback(std::vector<fluid_msg::of13::FlowStats>());
+		});
+	if( expired_flow_stats != 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " did not answer "
+			<< expired_flow_stats << " flow statistics requests";
+		expired_requests.add(expired_flow_stats);
+	}
+}
+
+void PhysicalSwitch::request_port_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::PortStats>&)> callback) {
+	request_cached_stats<
+		fluid_msg::of13::PortStats,
+		fluid_msg::of13::MultipartRequestPortStats>(
+			port_stats_cache,
+			boost::bind(
+				&PhysicalSwitch::translate_port_stats,
+				this,
+				virtual_switch,
+				callback,
+				_1));
+}
+
+void PhysicalSwitch::request_group_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::GroupStats>&)> callback) {
+	request_cached_stats<
+		fluid_msg::of13::GroupStats,
+		fluid_msg::of13::MultipartRequestGroup>(
+			group_stats_cache,
+			boost::bind(
+				&PhysicalSwitch::translate_group_stats,
+				this,
+				virtual_switch,
+				callback,
+				_1));
+}
+
+void PhysicalSwitch::translate_port_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::PortStats>&)> callback,
+		const std::vector<fluid_msg::of13::PortStats>& stats) {
+	// The virtual switch can have lost its interest in this switch
+	// while the poll was running
+	std::vector<fluid_msg::of13::PortStats> translated;
+	if( rewrite_map.count(virtual_switch->get_id()) == 0 ) {
+		callback(translated);
+		return;
+	}
+	const bidirectional_map<uint32_t,uint32_t>& port_map =
+		virtual_switch->get_port_map(features.datapath_id);
+
+	// Only report the ports in the virtual switch
+	for( fluid_msg::of13::PortStats port_stats : stats ) {
+		boost::optional<uint32_t> virtual_port = port_map.find_virtual(port_stats.port_no());
+		if( !virtual_port ) continue;
+
+		port_stats.port_no(*virtual_port);
+		translated.push_back(port_stats);
+	}
+
+	callback(translated);
+}
+
+void PhysicalSwitch::translate_group_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		boost::function<void(const std::vector<fluid_msg::of13::GroupStats>&)> callback,
+		const std::vector<fluid_msg::of13::GroupStats>& stats) {
+	std::vector<fluid_msg::of13::GroupStats> translated;
+
+	// The virtual switch can have lost its interest in this switch
+	// while the poll was running
+	auto rewrite_it = rewrite_map.find(virtual_switch->get_id());
+	if( rewrite_it != rewrite_map.end() ) {
+		const bidirectional_map<uint32_t,uint32_t>& group_id_map =
+			rewrite_it->second.group_id_map;
+
+		// Only report groups created by this virtual switch, the
+		// groups created by the hypervisor are hidden
+		for( fluid_msg::of13::GroupStats group_stats : stats ) {
+			boost::optional<uint32_t> virtual_group_id =
+				group_id_map.find_virtual(group_stats.group_id());
+			if( !virtual_group_id ) continue;
+
+			group_stats.group_id(*virtual_group_id);
+			translated.push_back(group_stats);
+		}
+	}
+
+	callback(translated);
+}
+
+void PhysicalSwitch::request_flow_stats(
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		fluid_msg::of13::MultipartRequestFlow& request,
+		boost::function<void(const std::vector<fluid_msg::of13::FlowStats>&)> callback) {
+	// A virtual switch without interest in this switch has no flows on it
+	if( rewrite_map.count(virtual_switch->get_id()) == 0 ) {
+		callback(std::vector<fluid_msg::of13::FlowStats>());
+		return;
+	}
+
+	fluid_msg::of13::MultipartRequestFlow physical_request(request);
+	physical_request.flags(0);
+
+	// The tables of the virtual switch start after the tables
+	// of the hypervisor
+	if( request.table_id() != fluid_msg::of13::OFPTT_ALL ) {
+		physical_request.table_id(request.table_id()+2);
+	}
+
+	// The out_port and out_group can translate to several physical
+	// ports and groups, filter on them in the virtual switch
+	physical_request.out_port(fluid_msg::of13::OFPP_ANY);
+	physical_request.out_group(fluid_msg::of13::OFPG_ANY);
+
+	// Translate the in_port, when it is not on this switch no
+	// flow on this switch can match it
+	fluid_msg::of13::Match match = request.match();
+	fluid_msg::of13::InPort* in_port = match.in_port();
+	if( in_port != nullptr ) {
+		const bidirectional_map<uint32_t,uint32_t>& port_map =
+			virtual_switch->get_port_map(features.datapath_id);
+		boost::optional<uint32_t> physical_in_port =
+			port_map.find_physical(in_port->value());
+		if( !physical_in_port ) {
+			callback(std::vector<fluid_msg::of13::FlowStats>());
+			return;
+		}
+		in_port->value(*physical_in_port);
+		physical_request.match(match);
+	}
+
+	// Only match the flows of this virtual switch, regardless
+	// of the group bit
+	MetadataTag metadata_tag(
+		uint64_t(virtual_switch->get_id())<<1,
+		uint64_t(MetadataTag::max_virtual_switch_id)<<1);
+	if( !metadata_tag.add_to_match(physical_request) ) {
+		// The virtual switch rejects these requests before they get here
+		BOOST_LOG_TRIVIAL(error) << *this << " can't filter the flow stats of " << *virtual_switch;
+		callback(std::vector<fluid_msg::of13::FlowStats>());
+		return;
+	}
+
+	FlowStatsRequest flow_stats_request;
+	flow_stats_request.virtual_switch = virtual_switch;
+	flow_stats_request.callback       = callback;
+	uint32_t xid = send_message(physical_request);
+	flow_stats_requests.insert(
+		xid,
+		std::move(flow_stats_request),
+		stats_deadline(),
+		[this](uint32_t, FlowStatsRequest& evicted) {
+			evicted_requests.add();
+			evicted.callback(std::vector<fluid_msg::of13::FlowStats>());
+		});
+}
+
+std::vector<fluid_msg::of13::FlowStats> PhysicalSwitch::translate_flow_stats(
+		const VirtualSwitch* virtual_switch,
+		const std::vector<fluid_msg::of13::FlowStats>& stats) {
+	std::vector<fluid_msg::of13::FlowStats> translated;
+	if( rewrite_map.count(virtual_switch->get_id()) == 0 ) return translated;
+
+	const bidirectional_map<uint32_t,uint32_t>& port_map =
+		virtual_switch->get_port_map(features.datapath_id);
+
+	for( fluid_msg::of13::FlowStats flow_stats : stats ) {
+		// Skip the tables of the hypervisor
+		if( flow_stats.table_id() < 2 ) continue;
+
+		// Skip the flows of other virtual switches
+		fluid_msg::of13::Metadata* metadata = (fluid_msg::of13::Metadata*)
+			flow_stats.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_METADATA);
+		if( metadata == nullptr ) continue;
+		MetadataTag metadata_tag(
+			metadata->value(),
+			metadata->has_mask() ? metadata->mask() : ~uint64_t(0));
+		if( metadata_tag.get_virtual_switch() != virtual_switch->get_id() ) continue;
+
+		flow_stats.table_id(flow_stats.table_id()-2);
+		MetadataTag::remove_from_match(flow_stats);
+
+		// Translate the in_port back to the virtual port
+		fluid_msg::of13::Match match = flow_stats.match();
+		fluid_msg::of13::InPort* in_port = match.in_port();
+		if( in_port != nullptr ) {
+			boost::optional<uint32_t> virtual_in_port =
+				port_map.find_virtual(in_port->value());
+			if( !virtual_in_port ) continue;
+			in_port->value(*virtual_in_port);
+			flow_stats.match(match);
+		}
+
+		// The instructions are rewritten per physical switch and
+		// can not be translated back reliably
+		flow_stats.instructions(fluid_msg::of13::InstructionSet());
+
+		translated.push_back(flow_stats);
+	}
+
+	return translated;
+}
+
+void PhysicalSwitch::handle_multipart_reply_port_stats(fluid_msg::of13::MultipartReplyPortStats& multipart_reply_message) {
+	handle_cached_stats(
+		port_stats_cache,
+		multipart_reply_message.xid(),
+		multipart_reply_message.flags(),
+		multipart_reply_message.port_stats());
+}
+
+void PhysicalSwitch::handle_multipart_reply_group(fluid_msg::of13::MultipartReplyGroup& multipart_reply_message) {
+	handle_cached_stats(
+		group_stats_cache,
+		multipart_reply_message.xid(),
+		multipart_reply_message.flags(),
+		multipart_reply_message.group_stats());
+}
+
+void PhysicalSwitch::handle_multipart_reply_flow(fluid_msg::of13::MultipartReplyFlow& multipart_reply_message) {
+	// The rules read back after a restart are not statistics
+	if( warm_restart_xids.count(multipart_reply_message.xid()) ) {
+		handle_warm_restart_flows(multipart_reply_message);
+		return;
+	}
+
+	FlowStatsRequest* found = flow_stats_requests.find(multipart_reply_message.xid());
+	if( found == nullptr ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received flow statistics that were not requested";
+		return;
+	}
+
+	FlowStatsRequest& flow_stats_request = *found;
+	std::vector<fluid_msg::of13::FlowStats> translated = translate_flow_stats(
+		flow_stats_request.virtual_switch.get(),
+		multipart_reply_message.flow_stats());
+	flow_stats_request.partial.insert(
+		flow_stats_request.partial.end(),
+		translated.begin(),
+		translated.end());
+
+	// Wait for the other parts of the reply
+	if( multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE ) return;
+
+	// Remove the request before calling back since the
+	// callback can send a new request
+	FlowStatsRequest completed;
+	flow_stats_requests.erase(multipart_reply_message.xid(), completed);
+	completed.callback(completed.partial);
+}
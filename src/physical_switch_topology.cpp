@@ -3,9 +3,12 @@
 #include "hypervisor.hpp"
 
 #include "tag.hpp"
+#include "log.hpp"
 
 #include <vector>
+#include <algorithm>
 
+#include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/log/trivial.hpp>
 
@@ -19,9 +22,9 @@ void PhysicalSwitch::make_topology_discovery_rule() {
 	flowmod.buffer_id(OFP_NO_BUFFER);
 
 	// Create the match
-	VLANTag vlan_tag;
-	vlan_tag.set_slice(VLANTag::max_slice_id);
-	vlan_tag.add_to_match(flowmod);
+	NetworkTag network_tag;
+	network_tag.set_slice(NetworkTag::max_slice_id);
+	network_tag.add_to_match(flowmod);
 
 	// Create the action
 	fluid_msg::of13::WriteActions write_actions;
@@ -31,42 +34,96 @@ void PhysicalSwitch::make_topology_discovery_rule() {
 			fluid_msg::of13::OFPCML_NO_BUFFER));
 	flowmod.add_instruction(write_actions);
 
-	// Send the message
-	send_message(flowmod);
+	// Add the rule
+	flow_table_shadow.add_flow(RuleSection::static_rules, flowmod);
 }
 
-void PhysicalSwitch::schedule_topology_discovery_message() {
-	// If there are no ports registered yet wait 1 period
-	int wait_time;
-	if( ports.size() == 0 ) {
-		wait_time = topology::period;
+namespace {
+	// A random ARP packet with a VLAN tag, the switch, port and
+	// slice are tagged in front of the VLAN tag
+	const std::vector<uint8_t> topology_discovery_packet = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x05,
+		0x02, 0x71, 0xfc, 0xdb, 0x81, 0x00, 0x00, 0x10,
+		0x00, 0x24, 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00,
+		0x08, 0x06, 0x00, 0x01, 0x08, 0x00, 0x06, 0x04,
+		0x00, 0x01, 0x00, 0x05, 0x02, 0x71, 0xfc, 0xdb,
+		0x83, 0x97, 0x14, 0x48, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0x83, 0x97, 0x14, 0xfe, 0x55, 0x55,
+		0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55
+	};
+	/// The last byte of the source MAC address is the shard of the sender
+	constexpr size_t probe_shard_offset = 11;
+}
+
+void PhysicalSwitch::make_probe_message(uint32_t port_no, Port& port) {
+	// Create the data and mask with the slice/switch/port information
+	NetworkTag network_tag;
+	network_tag.set_switch(id);
+	network_tag.set_port(port_no);
+	network_tag.set_slice(NetworkTag::max_slice_id);
+
+	// Tag a copy of the packet, the switch id's are only unique
+	// within a shard so the shard is in the packet as well
+	std::vector<uint8_t> probe(topology_discovery_packet);
+	probe[probe_shard_offset] = hypervisor->get_shard();
+	std::vector<uint8_t> packet = network_tag.add_to_packet(probe);
+
+	// Create the packet out message, it is packed once and
+	// send as is for every probe
+	fluid_msg::of13::PacketOut packet_out;
+	packet_out.buffer_id( OFP_NO_BUFFER );
+	packet_out.data(
+		&packet[0],
+		packet.size());
+	packet_out.add_action(
+		new fluid_msg::of13::OutputAction(
+			port_no,
+			fluid_msg::of13::OFPCML_NO_BUFFER));
+
+	uint8_t* buffer = packet_out.pack();
+	port.probe_message.assign(buffer, buffer+packet_out.length());
+	fluid_msg::OFMsg::free_buffer(buffer);
+}
+
+void PhysicalSwitch::reset_probe(uint32_t port_no, Port& port) {
+	port.probe_interval = topology::period;
+	queue_probe(port_no, port, std::chrono::steady_clock::now());
+}
+
+void PhysicalSwitch::queue_probe(
+		uint32_t port_no,
+		Port& port,
+		std::chrono::steady_clock::time_point next_probe) {
+	probe_queue.erase(std::make_pair(port.next_probe, port_no));
+	port.next_probe = next_probe;
+	probe_queue.emplace(next_probe, port_no);
+
+	// Move the timer forward if this port is first now
+	if( probe_queue.begin()->second == port_no ) {
+		schedule_topology_discovery_message();
 	}
-	else {
-		wait_time = topology::period/ports.size();
+}
+
+void PhysicalSwitch::schedule_topology_discovery_message() {
+	// Without ports nothing has to be send until a port is added
+	if( probe_queue.empty() ) {
+		topology_discovery_timer.cancel();
+		return;
 	}
 
+	auto wait_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+		probe_queue.begin()->first - std::chrono::steady_clock::now());
+
 	// Schedule the topology message to be send
 	topology_discovery_timer.expires_from_now(
-		boost::posix_time::milliseconds(wait_time));
+		boost::posix_time::milliseconds(std::max<int64_t>(0,wait_time.count())));
 	topology_discovery_timer.async_wait(
-		boost::bind(
+		control_strand.wrap(boost::bind(
 			&PhysicalSwitch::send_topology_discovery_message,
 			shared_from_this(),
-			boost::asio::placeholders::error));
+			boost::asio::placeholders::error)));
 }
 
-// A random ARP packet with a VLAN tag. The VLAN id=0
-std::vector<uint8_t> topology_discovery_packet = {
-	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x05,
-	0x02, 0x71, 0xfc, 0xdb, 0x81, 0x00, 0x00, 0x10, 0x81, 0x00, 0x00, 0x10,
-	0x00, 0x24, 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00,
-	0x08, 0x06, 0x00, 0x01, 0x08, 0x00, 0x06, 0x04,
-	0x00, 0x01, 0x00, 0x05, 0x02, 0x71, 0xfc, 0xdb,
-	0x83, 0x97, 0x14, 0x48, 0xff, 0xff, 0xff, 0xff,
-	0xff, 0xff, 0x83, 0x97, 0x14, 0xfe, 0x55, 0x55,
-	0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55
-};
-
 void PhysicalSwitch::send_topology_discovery_message(
 		const boost::system::error_code& error) {
 	if( error.value() == boost::asio::error::operation_aborted ) {
@@ -80,40 +137,23 @@ void PhysicalSwitch::send_topology_discovery_message(
 		return;
 	}
 
-	// Figure out what port to send the packet over
-	// WONTFIX A port can be skipped right now if a port before
-	// it is deleted
-	topology_discovery_port = (topology_discovery_port+1)%ports.size();
-	auto it = ports.begin();
-	for( int i=0; i<topology_discovery_port; ++i ) ++it;
-	uint32_t port_number = it->first;
+	// Send the topology discovery packets of all ports that are due
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	while( !probe_queue.empty() && probe_queue.begin()->first <= now ) {
+		uint32_t port_number = probe_queue.begin()->second;
+		probe_queue.erase(probe_queue.begin());
+		Port& port = ports.at(port_number);
 
-	// Create the data and mask with the slice/switch/port information
-	VLANTag vlan_tag;
-	vlan_tag.set_switch(id);
-	vlan_tag.set_port(port_number);
-	vlan_tag.set_slice(VLANTag::max_slice_id);
-	uint16_t vlan_tag_raw = vlan_tag.make_raw();
-	// Set the vlan values in the packet
-	topology_discovery_packet[14] = (vlan_tag_raw>>8) & 0xff;
-	topology_discovery_packet[15] = vlan_tag_raw & 0xff;
-
-	// Create the packet out message
-	fluid_msg::of13::PacketOut packet_out;
-	packet_out.buffer_id( OFP_NO_BUFFER );
-	packet_out.data(
-		&topology_discovery_packet[0],
-		topology_discovery_packet.size());
-	packet_out.add_action(
-		new fluid_msg::of13::OutputAction(
-			port_number,
-			fluid_msg::of13::OFPCML_NO_BUFFER));
+		DELFTVISOR_LOG(trace) << *this <<
+			" sending topology discovery packet on port " << port_number;
 
-	BOOST_LOG_TRIVIAL(trace) << *this <<
-		" sending topology discovery packet on port " << port_number;
+		send_raw_message(&port.probe_message[0], port.probe_message.size());
 
-	// Send the message
-	send_message(packet_out);
+		// Back off while nothing changes on this port
+		port.next_probe     = now + std::chrono::milliseconds(port.probe_interval);
+		port.probe_interval = std::min(2*port.probe_interval, topology::max_period);
+		probe_queue.emplace(port.next_probe, port_number);
+	}
 
 	// Schedule the next message
 	schedule_topology_discovery_message();
@@ -127,26 +167,32 @@ void PhysicalSwitch::handle_topology_discovery_packet_in(
 			.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_IN_PORT);
 	uint32_t in_port = in_port_tlv->value();
 
-	// Try to parse the packet to see if it has a VLAN tag
-	struct EthernetHeader {
-		uint8_t mac_dst[6];
-		uint8_t mac_src[6];
-		uint8_t ether_type[2];
-		uint8_t vlan_tag[2];
-	};
-	EthernetHeader * packet = (EthernetHeader*) packet_in_message.data();
-	// Interpret the vlan tag disregarding endianness
-	uint16_t vlan_id_raw = packet->vlan_tag[0]*256+packet->vlan_tag[1];
-	VLANTag vlan_id(vlan_id_raw);
+	// Try to parse the packet to see if it has a tag
+	boost::optional<NetworkTag> network_tag = NetworkTag::from_packet(
+		(const uint8_t*) packet_in_message.data(),
+		packet_in_message.data_len());
+	if( !network_tag ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received topology discovery packet_in without a tag";
+		return;
+	}
+
+	// A link to a switch of another shard is not used
+	if(
+		packet_in_message.data_len() <= probe_shard_offset ||
+		((const uint8_t*) packet_in_message.data())[probe_shard_offset] != hypervisor->get_shard()
+	) {
+		DELFTVISOR_LOG(trace) << *this << " received topology discovery packet_in from another shard";
+		return;
+	}
 
-	// Extract the relevant information from the VLAN tag
-	uint32_t port  = vlan_id.get_port();
-	int switch_num = vlan_id.get_switch();
+	// Extract the relevant information from the tag
+	uint32_t port  = network_tag->get_port();
+	int switch_num = network_tag->get_switch();
 
 	// Extract the slice id to see if this is for topology discovery
-	BOOST_LOG_TRIVIAL(trace) << *this
+	DELFTVISOR_LOG(trace) << *this
 		<< " received topology discovery packet_in";
-	BOOST_LOG_TRIVIAL(trace) << *this
+	DELFTVISOR_LOG(trace) << *this
 		<< "\t sw=" << switch_num << " p=" << port;
 
 	// Determine if this link already exists
@@ -175,8 +221,8 @@ void PhysicalSwitch::handle_topology_discovery_packet_in(
 		// Start the timer on the link
 		discovered_link->reset_timer();
 
-		// Recalculate the routes with this extra link
-		hypervisor->calculate_routes();
+		// Update the routes that get shorter with this extra link
+		hypervisor->link_added(*discovered_link);
 
 		BOOST_LOG_TRIVIAL(info) << *this << " found link to " << *switch_2_pointer;
 	}
@@ -196,6 +242,13 @@ void PhysicalSwitch::add_link(boost::shared_ptr<DiscoveredLink> discovered_link)
 	}
 	else {
 		it->second.link = discovered_link;
+
+		// After a restart the rules can be cleaned up once all
+		// links of the previous run are found again
+		warm_restart_link_ports.erase(discovered_port);
+		if( warm_restart_grace && warm_restart_link_ports.empty() ) {
+			end_warm_restart_grace();
+		}
 	}
 }
 
@@ -208,6 +261,10 @@ void PhysicalSwitch::reset_link(boost::shared_ptr<DiscoveredLink> discovered_lin
 	}
 	else {
 		it->second.link.reset();
+
+		// Probe the port directly to find the link again quickly
+		// if it was lost for a short time
+		reset_probe(discovered_port, it->second);
 	}
 	// This function is called when a discovered link times out.
 	// Since both ends of that link has to be removed it doesn't
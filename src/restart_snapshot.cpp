@@ -0,0 +1,143 @@
+#include "restart_snapshot.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// The first line of a snapshot file
+	const std::string snapshot_header = "delftvisor-restart 1";
+}
+
+const RestartSnapshot::SwitchState* RestartSnapshot::get(uint64_t datapath_id) const {
+	auto it = switches.find(datapath_id);
+	if( it == switches.end() ) return nullptr;
+	return &it->second;
+}
+
+void RestartSnapshot::set(uint64_t datapath_id, const SwitchState& state) {
+	switches[datapath_id] = state;
+}
+
+bool RestartSnapshot::load(const std::string& filename) {
+	switches.clear();
+
+	std::ifstream file(filename);
+	if( !file ) {
+		BOOST_LOG_TRIVIAL(info) << "No restart snapshot in " << filename;
+		return false;
+	}
+
+	std::string line;
+	if( !std::getline(file, line) || line != snapshot_header ) {
+		BOOST_LOG_TRIVIAL(error) << "Restart snapshot " << filename << " has an unknown format";
+		return false;
+	}
+
+	SwitchState* switch_state               = nullptr;
+	VirtualSwitchState* virtual_switch_state = nullptr;
+	int line_number = 1;
+	while( std::getline(file, line) ) {
+		++line_number;
+		if( line.empty() ) continue;
+
+		std::istringstream line_stream(line);
+		std::string keyword;
+		line_stream >> keyword;
+
+		bool valid = false;
+		if( keyword == "switch" ) {
+			uint64_t datapath_id;
+			if( line_stream >> datapath_id ) {
+				switch_state         = &switches[datapath_id];
+				virtual_switch_state = nullptr;
+				valid = true;
+			}
+		}
+		else if( keyword == "link" && switch_state != nullptr ) {
+			uint32_t port;
+			if( line_stream >> port ) {
+				switch_state->link_ports.insert(port);
+				valid = true;
+			}
+		}
+		else if( keyword == "virtual_switch" && switch_state != nullptr ) {
+			int id;
+			VirtualSwitchState state;
+			if( line_stream >> id >> state.slice_id >> state.datapath_id >> state.flood_group_id ) {
+				virtual_switch_state  = &switch_state->virtual_switches[id];
+				*virtual_switch_state = state;
+				valid = true;
+			}
+		}
+		else if( (keyword == "output" || keyword == "group") && virtual_switch_state != nullptr ) {
+			uint32_t virtual_id, group_id;
+			if( line_stream >> virtual_id >> group_id ) {
+				if( keyword == "output" ) {
+					virtual_switch_state->output_groups[virtual_id] = group_id;
+				}
+				else {
+					virtual_switch_state->group_ids[virtual_id] = group_id;
+				}
+				valid = true;
+			}
+		}
+
+		// A partially understood snapshot is worse than none
+		if( !valid ) {
+			BOOST_LOG_TRIVIAL(error) << "Restart snapshot " << filename
+				<< " is invalid on line " << line_number;
+			switches.clear();
+			return false;
+		}
+	}
+
+	BOOST_LOG_TRIVIAL(info) << "Loaded restart snapshot of "
+		<< switches.size() << " switches from " << filename;
+	return true;
+}
+
+bool RestartSnapshot::save(const std::string& filename) const {
+	// Write to a temporary file first so a crash while writing
+	// never leaves a truncated snapshot behind
+	std::string temporary_filename = filename + ".tmp";
+	{
+		std::ofstream file(temporary_filename, std::ios::trunc);
+		file << snapshot_header << "\n";
+		for( const auto& switch_pair : switches ) {
+			file << "switch " << switch_pair.first << "\n";
+			for( uint32_t port : switch_pair.second.link_ports ) {
+				file << "link " << port << "\n";
+			}
+			for( const auto& virtual_switch_pair : switch_pair.second.virtual_switches ) {
+				const VirtualSwitchState& state = virtual_switch_pair.second;
+				file << "virtual_switch " << virtual_switch_pair.first
+					<< " " << state.slice_id
+					<< " " << state.datapath_id
+					<< " " << state.flood_group_id << "\n";
+				for( const auto& output_group_pair : state.output_groups ) {
+					file << "output " << output_group_pair.first
+						<< " " << output_group_pair.second << "\n";
+				}
+				for( const auto& group_id_pair : state.group_ids ) {
+					file << "group " << group_id_pair.first
+						<< " " << group_id_pair.second << "\n";
+				}
+			}
+		}
+
+		file.flush();
+		if( !file ) {
+			BOOST_LOG_TRIVIAL(error) << "Could not write restart snapshot to " << temporary_filename;
+			return false;
+		}
+	}
+
+	if( std::rename(temporary_filename.c_str(), filename.c_str()) != 0 ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not replace restart snapshot " << filename;
+		return false;
+	}
+	return true;
+}
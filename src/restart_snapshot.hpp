@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <set>
+
+/// The state of the physical switches kept over a restart
+/**
+ * When the hypervisor restarts the flow rules and groups in the
+ * physical switches are still there. To keep using them the
+ * group id's given out per virtual switch and the ports with a
+ * link are checkpointed to a file. When a switch connects again
+ * its tables are reconciled with this state instead of wiped.
+ *
+ * The file is a list of lines, each line a keyword followed by
+ * numbers, the lines after a switch or virtual_switch line
+ * belong to it:
+ *
+ *     delftvisor-restart 1
+ *     switch <datapath_id>
+ *     link <port>
+ *     virtual_switch <id> <slice id> <datapath_id> <flood group id>
+ *     output <virtual port> <group id>
+ *     group <virtual group id> <group id>
+ */
+class RestartSnapshot {
+public:
+	/// The groups a physical switch created for 1 virtual switch
+	struct VirtualSwitchState {
+		/// The slice of the virtual switch, to check it is still the same
+		int slice_id;
+		/// The datapath id of the virtual switch, to check it is still the same
+		uint64_t datapath_id;
+		/// The group id for the flood action
+		uint32_t flood_group_id;
+		/// A map from virtual port -> output group id
+		std::map<uint32_t,uint32_t> output_groups;
+		/// A map from virtual group id -> physical group id
+		std::map<uint32_t,uint32_t> group_ids;
+	};
+	/// The state of 1 physical switch
+	struct SwitchState {
+		/// A map from virtual switch id -> VirtualSwitchState
+		std::map<int,VirtualSwitchState> virtual_switches;
+		/// The ports a link was discovered on
+		std::set<uint32_t> link_ports;
+	};
+
+private:
+	/// The state per physical switch, datapath_id -> SwitchState
+	std::map<uint64_t,SwitchState> switches;
+
+public:
+	/// Get the state of a physical switch, nullptr if it is not known
+	const SwitchState* get(uint64_t datapath_id) const;
+	/// Replace the state of a physical switch
+	void set(uint64_t datapath_id, const SwitchState& state);
+
+	/// Read a snapshot, the current state is always cleared
+	/**
+	 * \return False if the file doesn't exist or is invalid
+	 */
+	bool load(const std::string& filename);
+	/// Write the snapshot, the file is replaced atomically
+	/**
+	 * \return False if the file could not be written
+	 */
+	bool save(const std::string& filename) const;
+};
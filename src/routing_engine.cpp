@@ -0,0 +1,178 @@
+#include "routing_engine.hpp"
+
+#include <algorithm>
+
+RoutingEngine::RoutingEngine(int num_switches) :
+	num_switches(num_switches),
+	active(num_switches, false),
+	adjacency(num_switches),
+	dist(num_switches*num_switches, topology::infinite),
+	next(num_switches*num_switches, UINT32_MAX),
+	parent(num_switches*num_switches, -1),
+	parent_port(num_switches*num_switches, UINT32_MAX),
+	version(0),
+	row_version(num_switches, 0) {
+}
+
+void RoutingEngine::set_active(int switch_id, bool is_active) {
+	active[switch_id] = is_active;
+}
+
+void RoutingEngine::rebuild_source(int source) {
+	// Forget the old tree
+	size_t row_begin = index(source, 0);
+	size_t row_end   = index(source+1, 0);
+	std::fill(dist.begin()+row_begin, dist.begin()+row_end, topology::infinite);
+	std::fill(next.begin()+row_begin, next.begin()+row_end, UINT32_MAX);
+	std::fill(parent.begin()+row_begin, parent.begin()+row_end, -1);
+	std::fill(parent_port.begin()+row_begin, parent_port.begin()+row_end, UINT32_MAX);
+
+	row_version[source] = version;
+
+	if( !active[source] ) return;
+
+	// Grow the tree again from the source
+	dist[index(source,source)] = 0;
+	std::vector<int> frontier = {source};
+	relax_from(source, frontier);
+}
+
+void RoutingEngine::relax_from(int source, std::vector<int>& frontier) {
+	// All links have the same weight, so visiting the switches in
+	// the order they are found visits them in order of distance.
+	for( size_t i=0; i<frontier.size(); ++i ) {
+		int current = frontier[i];
+		int current_dist = dist[index(source,current)];
+		for( const Edge& edge : adjacency[current] ) {
+			int other = edge.other_switch;
+			if( !active[other] ) continue;
+			if( current_dist+1 >= dist[index(source,other)] ) continue;
+
+			dist[index(source,other)]        = current_dist+1;
+			parent[index(source,other)]      = current;
+			parent_port[index(source,other)] = edge.port_number;
+			// The first hop is the port on the source itself
+			next[index(source,other)]        = (current==source) ?
+				edge.port_number :
+				next[index(source,current)];
+
+			frontier.push_back(other);
+		}
+	}
+}
+
+void RoutingEngine::recalculate_all() {
+	++version;
+	for( int source=0; source<num_switches; ++source ) {
+		rebuild_source(source);
+	}
+}
+
+std::set<int> RoutingEngine::add_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2) {
+	std::set<int> changed_sources;
+
+	adjacency[switch_id_1].push_back({switch_id_2, port_number_1});
+	adjacency[switch_id_2].push_back({switch_id_1, port_number_2});
+
+	// Links to switches that are not in use are picked up when
+	// the switch becomes active
+	if( !active[switch_id_1] || !active[switch_id_2] ) {
+		return changed_sources;
+	}
+
+	for( int source=0; source<num_switches; ++source ) {
+		if( !active[source] ) continue;
+
+		// Determine if the new link shortens the path to one of its
+		// sides, at most one side can get shorter.
+		int dist_1 = dist[index(source,switch_id_1)];
+		int dist_2 = dist[index(source,switch_id_2)];
+		std::vector<int> frontier;
+		if( dist_1+1 < dist_2 ) {
+			frontier.push_back(switch_id_1);
+		}
+		else if( dist_2+1 < dist_1 ) {
+			frontier.push_back(switch_id_2);
+		}
+		else {
+			continue;
+		}
+
+		// Only the switches that get a shorter path are visited
+		if( changed_sources.empty() ) ++version;
+		relax_from(source, frontier);
+		row_version[source] = version;
+		changed_sources.insert(source);
+	}
+
+	return changed_sources;
+}
+
+std::set<int> RoutingEngine::remove_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2) {
+	std::set<int> changed_sources;
+
+	// Remove the link from both switches, if it isn't
+	// known nothing changes
+	auto& edges_1 = adjacency[switch_id_1];
+	auto it_1 = std::find_if(edges_1.begin(), edges_1.end(),
+		[&](const Edge& e) {
+			return e.other_switch==switch_id_2 && e.port_number==port_number_1;
+		});
+	auto& edges_2 = adjacency[switch_id_2];
+	auto it_2 = std::find_if(edges_2.begin(), edges_2.end(),
+		[&](const Edge& e) {
+			return e.other_switch==switch_id_1 && e.port_number==port_number_2;
+		});
+	if( it_1==edges_1.end() || it_2==edges_2.end() ) {
+		return changed_sources;
+	}
+	edges_1.erase(it_1);
+	edges_2.erase(it_2);
+
+	// Only the trees that used this link have to be rebuild,
+	// all other trees are still valid shortest path trees.
+	for( int source=0; source<num_switches; ++source ) {
+		if( !active[source] ) continue;
+
+		bool uses_link =
+			( parent[index(source,switch_id_2)]==switch_id_1 &&
+			  parent_port[index(source,switch_id_2)]==port_number_1 ) ||
+			( parent[index(source,switch_id_1)]==switch_id_2 &&
+			  parent_port[index(source,switch_id_1)]==port_number_2 );
+		if( !uses_link ) continue;
+
+		if( changed_sources.empty() ) ++version;
+		rebuild_source(source);
+		changed_sources.insert(source);
+	}
+
+	return changed_sources;
+}
+
+int RoutingEngine::get_num_switches() const {
+	return num_switches;
+}
+
+int RoutingEngine::get_distance(int source, int destination) const {
+	return dist[index(source,destination)];
+}
+
+uint32_t RoutingEngine::get_next(int source, int destination) const {
+	return next[index(source,destination)];
+}
+
+uint64_t RoutingEngine::get_version() const {
+	return version;
+}
+
+uint64_t RoutingEngine::get_row_version(int source) const {
+	return row_version[source];
+}
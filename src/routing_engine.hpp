@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <set>
+
+namespace topology {
+	/// The value used for an infinite distance, this value should
+	/// be choosen such that it doesn't overflow when it get's added to
+	/// itself but is also longer than the longest possible path in the
+	/// network.
+	constexpr int infinite     = 10000;
+	constexpr int period       = 500;  // The time between topology messages over a port that just changed in ms
+	constexpr int max_period   = 4*period; // The time between topology messages over a stable port in ms
+	constexpr int link_timeout = 2*max_period+period; // The time a link lives without topology messages in ms
+}
+
+/// Keeps track of the shortest paths between physical switches
+/**
+ * Every physical switch is the source of a breadth first
+ * search tree over the discovered links. When a link is
+ * added only the trees that get shorter paths through that
+ * link are updated, when a link is removed only the trees
+ * that contain that link are rebuild. The routes are stored
+ * in flat row-major matrices indexed by [source][destination]
+ * switch id, a row is the tree of 1 source.
+ */
+class RoutingEngine {
+private:
+	/// A link as seen from one of its switches
+	struct Edge {
+		/// The switch on the other side of the link
+		int other_switch;
+		/// The port on this switch the link is connected to
+		uint32_t port_number;
+	};
+
+	/// The amount of switch id's that can exist
+	int num_switches;
+
+	/// If a switch id is currently in use
+	std::vector<bool> active;
+	/// The links leaving every switch
+	std::vector<std::vector<Edge>> adjacency;
+
+	/// The distance from source to destination
+	std::vector<int16_t> dist;
+	/// The port to forward over at the source
+	std::vector<uint32_t> next;
+	/// The switch before the destination in the tree
+	std::vector<int16_t> parent;
+	/// The port on the parent switch used to reach the destination
+	std::vector<uint32_t> parent_port;
+
+	/// The version of the routes, incremented on every change
+	uint64_t version;
+	/// The version at which each row last changed
+	std::vector<uint64_t> row_version;
+
+	/// The index of an entry in the matrices
+	size_t index(int source, int destination) const {
+		return source*num_switches + destination;
+	}
+
+	/// Rebuild the tree of a single source
+	void rebuild_source(int source);
+	/// Continue a breadth first search from the switches in frontier
+	void relax_from(int source, std::vector<int>& frontier);
+
+public:
+	/// Create a routing engine for switch id's [0,num_switches)
+	RoutingEngine(int num_switches);
+
+	/// Mark a switch id as in use or not
+	void set_active(int switch_id, bool is_active);
+
+	/// Rebuild all trees of the active switches
+	void recalculate_all();
+
+	/// Add a link between 2 switches
+	/**
+	 * \return The sources whose routes changed
+	 */
+	std::set<int> add_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2);
+	/// Remove a link between 2 switches
+	/**
+	 * \return The sources whose routes changed
+	 */
+	std::set<int> remove_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2);
+
+	/// Get the amount of switch id's that can exist
+	int get_num_switches() const;
+
+	/// Get the distance between 2 switches
+	int get_distance(int source, int destination) const;
+	/// Get the port to forward over at the source
+	/**
+	 * \return UINT32_MAX if the destination is unreachable
+	 */
+	uint32_t get_next(int source, int destination) const;
+
+	/// Get the current version of all routes
+	uint64_t get_version() const;
+	/// Get the version at which the routes from a source last changed
+	/**
+	 * A reader that remembers this version can check if the
+	 * row it used is still the same.
+	 */
+	uint64_t get_row_version(int source) const;
+};
@@ -0,0 +1,308 @@
+#include "rule_accounting.hpp"
+#include "byte_order.hpp"
+#include "tag.hpp"
+
+#include <algorithm>
+
+namespace {
+	/// The length of the header of a match and an oxm field
+	constexpr size_t match_header_length = 4;
+	constexpr size_t oxm_header_length   = 4;
+	/// The length of the table and priority at the start of a key
+	constexpr size_t key_header_length   = 3;
+
+	/// A packed oxm field, from its first byte until after its last
+	typedef std::pair<const uint8_t*,const uint8_t*> Field;
+
+	/// Split packed oxm fields
+	std::vector<Field> split_fields(const uint8_t* begin, const uint8_t* end) {
+		std::vector<Field> fields;
+		while( begin+oxm_header_length <= end ) {
+			const uint8_t* field_end = begin + oxm_header_length + begin[3];
+			fields.emplace_back(begin, field_end);
+			begin = field_end;
+		}
+		return fields;
+	}
+
+	/// Check if a field of a rule is at least as specific as a field of a delete
+	bool field_covers(const Field& pattern, const Field& rule) {
+		// The class and the field type have to be the same
+		if(
+			pattern.first[0]    != rule.first[0] ||
+			pattern.first[1]    != rule.first[1] ||
+			pattern.first[2]>>1 != rule.first[2]>>1
+		) return false;
+
+		bool pattern_has_mask = pattern.first[2] & 1;
+		bool rule_has_mask    = rule.first[2] & 1;
+		size_t value_length   = pattern.first[3] >> (pattern_has_mask?1:0);
+		if( value_length != size_t(rule.first[3] >> (rule_has_mask?1:0)) ) return false;
+
+		// Every bit the delete matches on has to be matched
+		// on by the rule with the same value
+		const uint8_t* pattern_value = pattern.first + oxm_header_length;
+		const uint8_t* rule_value    = rule.first + oxm_header_length;
+		for( size_t i=0; i<value_length; ++i ) {
+			uint8_t pattern_mask = pattern_has_mask ? pattern_value[value_length+i] : 0xff;
+			uint8_t rule_mask    = rule_has_mask    ? rule_value[value_length+i]    : 0xff;
+			if( (rule_mask & pattern_mask) != pattern_mask ) return false;
+			if( (rule_value[i] & pattern_mask) != (pattern_value[i] & pattern_mask) ) return false;
+		}
+		return true;
+	}
+
+	/// Check if the cookie of a rule passes the cookie filter of a flowmod
+	bool cookie_matches(uint64_t cookie, fluid_msg::of13::FlowMod& flow_mod) {
+		return (cookie & flow_mod.cookie_mask()) ==
+			(flow_mod.cookie() & flow_mod.cookie_mask());
+	}
+
+	/// Check if a non strict flowmod applies to a rule
+	bool non_strict_matches(
+			const std::vector<Field>& pattern_fields,
+			fluid_msg::of13::FlowMod& flow_mod,
+			const RuleAccounting::Key& key,
+			uint64_t cookie) {
+		// A non strict flowmod ignores the priority and can be on all tables
+		if(
+			flow_mod.table_id() != fluid_msg::of13::OFPTT_ALL &&
+			key[0] != flow_mod.table_id()
+		) return false;
+		if( !cookie_matches(cookie, flow_mod) ) return false;
+
+		std::vector<Field> fields = split_fields(
+			&key[key_header_length],
+			&key[0]+key.size());
+		for( const Field& pattern_field : pattern_fields ) {
+			bool covered = std::any_of(
+				fields.begin(),
+				fields.end(),
+				[&pattern_field](const Field& field) {
+					return field_covers(pattern_field, field);
+				});
+			if( !covered ) return false;
+		}
+		return true;
+	}
+
+	/// Split the match fields of a non strict flowmod
+	std::vector<Field> pattern_fields(const RuleAccounting::Key& pattern_key) {
+		return split_fields(
+			&pattern_key[key_header_length],
+			&pattern_key[0]+pattern_key.size());
+	}
+
+	/// Check if a rule matches both values of the group bit
+	bool is_merged(fluid_msg::of13::FlowMod& flow_mod) {
+		fluid_msg::of13::Metadata* metadata = (fluid_msg::of13::Metadata*)
+			flow_mod.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_METADATA);
+		return
+			metadata != nullptr &&
+			metadata->has_mask() &&
+			(metadata->mask() & 1) == 0;
+	}
+
+	/// Rebuild the match of a rule from its key
+	fluid_msg::of13::Match make_match(const RuleAccounting::Key& key) {
+		size_t match_length = match_header_length + key.size() - key_header_length;
+		std::vector<uint8_t> packed(match_length+8, 0);
+		packed[1] = fluid_msg::of13::OFPMT_OXM;
+		packed[2] = match_length >> 8;
+		packed[3] = match_length & 0xff;
+		std::copy(
+			key.begin()+key_header_length,
+			key.end(),
+			packed.begin()+match_header_length);
+
+		fluid_msg::of13::Match match;
+		match.unpack(&packed[0]);
+		return match;
+	}
+}
+
+RuleAccounting::Key RuleAccounting::make_key(
+		uint8_t table_id,
+		uint16_t priority,
+		fluid_msg::of13::Match match) {
+	// The match is packed with its padding
+	std::vector<uint8_t> packed(match.length()+8, 0);
+	match.pack(&packed[0]);
+	size_t match_length = std::min<size_t>(read_uint16(&packed[2]), packed.size());
+
+	// The fields are sorted since a switch doesn't have to
+	// report the match in the order it was installed
+	std::vector<Field> fields = split_fields(
+		&packed[match_header_length],
+		&packed[0]+match_length);
+	std::sort(
+		fields.begin(),
+		fields.end(),
+		[](const Field& a, const Field& b) {
+			return std::lexicographical_compare(
+				a.first, a.second,
+				b.first, b.second);
+		});
+
+	Key key;
+	key.reserve(key_header_length+match_length);
+	key.push_back(table_id);
+	key.push_back(priority>>8);
+	key.push_back(priority&0xff);
+	for( const Field& field : fields ) {
+		key.insert(key.end(), field.first, field.second);
+	}
+	return key;
+}
+
+std::map<RuleAccounting::Key,RuleAccounting::Rule>::iterator RuleAccounting::remove(
+		std::map<Key,Rule>& virtual_switch_rules,
+		std::map<Key,Rule>::iterator it) {
+	--slice_rules[it->second.slice_id];
+	return virtual_switch_rules.erase(it);
+}
+
+bool RuleAccounting::contains(int virtual_switch_id, const Key& key) const {
+	auto it = rules.find(virtual_switch_id);
+	return it != rules.end() && it->second.count(key) != 0;
+}
+
+size_t RuleAccounting::get_rules(int slice_id) const {
+	auto it = slice_rules.find(slice_id);
+	if( it == slice_rules.end() ) return 0;
+	return it->second;
+}
+
+const std::unordered_map<int,size_t>& RuleAccounting::get_slice_rules() const {
+	return slice_rules;
+}
+
+void RuleAccounting::handle_flow_mod(
+		int virtual_switch_id,
+		int slice_id,
+		fluid_msg::of13::FlowMod& flow_mod) {
+	std::map<Key,Rule>& virtual_switch_rules = rules[virtual_switch_id];
+	uint8_t command = flow_mod.command();
+
+	// An add replaces the rule with the same key, modifies
+	// never add rules in OpenFlow 1.3
+	if( command == fluid_msg::of13::OFPFC_ADD ) {
+		Key key = make_key(flow_mod.table_id(), flow_mod.priority(), flow_mod.match());
+		Rule rule{
+			slice_id,
+			flow_mod.cookie(),
+			flow_mod.idle_timeout(),
+			flow_mod.hard_timeout(),
+			flow_mod.flags(),
+			is_merged(flow_mod)};
+		auto it = virtual_switch_rules.find(key);
+		if( it == virtual_switch_rules.end() ) {
+			virtual_switch_rules.emplace(key, rule);
+			++slice_rules[slice_id];
+		}
+		else {
+			it->second = rule;
+		}
+		return;
+	}
+	if(
+		command != fluid_msg::of13::OFPFC_DELETE &&
+		command != fluid_msg::of13::OFPFC_DELETE_STRICT
+	) return;
+
+	// The actions of the rules are not kept
+	if(
+		flow_mod.out_port()  != fluid_msg::of13::OFPP_ANY ||
+		flow_mod.out_group() != fluid_msg::of13::OFPG_ANY
+	) return;
+
+	if( command == fluid_msg::of13::OFPFC_DELETE_STRICT ) {
+		auto it = virtual_switch_rules.find(
+			make_key(flow_mod.table_id(), flow_mod.priority(), flow_mod.match()));
+		if(
+			it != virtual_switch_rules.end() &&
+			cookie_matches(it->second.cookie, flow_mod)
+		) remove(virtual_switch_rules, it);
+		return;
+	}
+
+	Key pattern_key = make_key(flow_mod.table_id(), 0, flow_mod.match());
+	std::vector<Field> fields = pattern_fields(pattern_key);
+	for( auto it=virtual_switch_rules.begin(); it!=virtual_switch_rules.end(); ) {
+		if( non_strict_matches(fields, flow_mod, it->first, it->second.cookie) ) {
+			it = remove(virtual_switch_rules, it);
+		}
+		else ++it;
+	}
+}
+
+std::vector<RuleAccounting::MergedRule> RuleAccounting::find_merged(
+		int virtual_switch_id,
+		fluid_msg::of13::FlowMod& flow_mod) const {
+	std::vector<MergedRule> merged_rules;
+	auto rules_it = rules.find(virtual_switch_id);
+	if( rules_it == rules.end() ) return merged_rules;
+
+	auto add = [&merged_rules](const Key& key, const Rule& rule) {
+		merged_rules.push_back(MergedRule{
+			key[0],
+			uint16_t(key[1]<<8 | key[2]),
+			make_match(key),
+			rule});
+	};
+
+	if( flow_mod.command() == fluid_msg::of13::OFPFC_MODIFY_STRICT ) {
+		auto it = rules_it->second.find(
+			make_key(flow_mod.table_id(), flow_mod.priority(), flow_mod.match()));
+		if(
+			it != rules_it->second.end() &&
+			it->second.merged &&
+			cookie_matches(it->second.cookie, flow_mod)
+		) add(it->first, it->second);
+		return merged_rules;
+	}
+
+	Key pattern_key = make_key(flow_mod.table_id(), 0, flow_mod.match());
+	std::vector<Field> fields = pattern_fields(pattern_key);
+	for( const auto& rule_pair : rules_it->second ) {
+		if(
+			rule_pair.second.merged &&
+			non_strict_matches(fields, flow_mod, rule_pair.first, rule_pair.second.cookie)
+		) add(rule_pair.first, rule_pair.second);
+	}
+	return merged_rules;
+}
+
+void RuleAccounting::handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed) {
+	// The virtual switch is in the metadata of the match
+	fluid_msg::of13::Metadata* metadata = (fluid_msg::of13::Metadata*)
+		flow_removed.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_METADATA);
+	if( metadata == nullptr ) return;
+	MetadataTag metadata_tag(
+		metadata->value(),
+		metadata->has_mask() ? metadata->mask() : ~uint64_t(0));
+
+	auto rules_it = rules.find(metadata_tag.get_virtual_switch());
+	if( rules_it == rules.end() ) return;
+
+	auto it = rules_it->second.find(make_key(
+		flow_removed.table_id(),
+		flow_removed.priority(),
+		flow_removed.match()));
+	if( it != rules_it->second.end() ) remove(rules_it->second, it);
+}
+
+void RuleAccounting::remove_virtual_switch(int virtual_switch_id) {
+	auto rules_it = rules.find(virtual_switch_id);
+	if( rules_it == rules.end() ) return;
+
+	for( const auto& rule_pair : rules_it->second ) {
+		--slice_rules[rule_pair.second.slice_id];
+	}
+	rules.erase(rules_it);
+}
+
+void RuleAccounting::clear() {
+	rules.clear();
+	slice_rules.clear();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+#include <fluid/of13msg.hh>
+
+/// Keep track of the rules of the virtual switches in a physical switch
+/**
+ * Every rule of a virtual switch is pushed as 1 merged or 2 split
+ * rules to the physical switch, every one of them is counted
+ * against the slice of the virtual switch. The accounting follows the
+ * FlowMods send to the switch and the FlowRemoved messages it
+ * sends back, rules are identified by their
+ * (table, priority, match) in the physical switch.
+ *
+ * Non strict deletes remove the rules whose match is at least
+ * as specific as the match of the delete. Deletes filtering on
+ * an out_port or out_group can't be followed, the rules they
+ * remove stay counted until they expire.
+ */
+class RuleAccounting {
+public:
+	/// The table, priority and sorted match fields of a rule
+	typedef std::vector<uint8_t> Key;
+
+	/// A rule of a virtual switch
+	struct Rule {
+		/// The slice the rule is counted against
+		int slice_id;
+		/// The cookie of the rule, used to filter deletes
+		uint64_t cookie;
+		/// The timeouts and flags the rule was added with
+		uint16_t idle_timeout;
+		uint16_t hard_timeout;
+		uint16_t flags;
+		/// If the rule matches both values of the group bit
+		bool merged;
+	};
+	/// A rule matching both values of the group bit
+	struct MergedRule {
+		uint8_t table_id;
+		uint16_t priority;
+		fluid_msg::of13::Match match;
+		Rule rule;
+	};
+
+private:
+
+	/// The rules per virtual switch, virtual switch id -> key -> Rule
+	std::unordered_map<int,std::map<Key,Rule>> rules;
+	/// The amount of rules per slice, slice id -> amount
+	std::unordered_map<int,size_t> slice_rules;
+
+	/// Remove a rule and uncount it
+	std::map<Key,Rule>::iterator remove(
+		std::map<Key,Rule>& virtual_switch_rules,
+		std::map<Key,Rule>::iterator it);
+
+public:
+	/// Make the key of a rule in a physical table
+	static Key make_key(
+		uint8_t table_id,
+		uint16_t priority,
+		fluid_msg::of13::Match match);
+
+	/// Check if a rule is counted already
+	bool contains(int virtual_switch_id, const Key& key) const;
+	/// Find the merged rules a modify applies to
+	/**
+	 * A modify whose instructions differ per value of the group
+	 * bit can't be applied to a merged rule, the merged rule has
+	 * to be replaced by 2 rules.
+	 */
+	std::vector<MergedRule> find_merged(
+		int virtual_switch_id,
+		fluid_msg::of13::FlowMod& flow_mod) const;
+	/// Get the amount of rules a slice has in this switch
+	size_t get_rules(int slice_id) const;
+	/// Get the amount of rules per slice, slice id -> amount
+	const std::unordered_map<int,size_t>& get_slice_rules() const;
+
+	/// Follow a rewritten flowmod of a virtual switch send to the switch
+	void handle_flow_mod(
+		int virtual_switch_id,
+		int slice_id,
+		fluid_msg::of13::FlowMod& flow_mod);
+	/// Uncount a rule the switch reported as removed
+	void handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed);
+
+	/// Uncount all rules of a virtual switch, called when its rules are deleted
+	void remove_virtual_switch(int virtual_switch_id);
+	/// Forget all the rules, called when the switch is wiped
+	void clear();
+};
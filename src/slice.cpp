@@ -1,22 +1,43 @@
 #include "slice.hpp"
+#include "hypervisor.hpp"
 
 #include <string>
+#include <set>
+#include <algorithm>
 
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
 
+namespace {
+	/// The amount of virtual switches that start connecting per interval
+	constexpr int connects_per_interval = 8;
+	/// The interval between connecting virtual switches in milliseconds
+	constexpr int connect_interval = 50;
+	/// The backoff after the first failed attempt in milliseconds
+	constexpr int min_backoff = 500;
+	/// The maximum backoff in milliseconds
+	constexpr int max_backoff = 30000;
+}
+
 Slice::Slice(
+		boost::asio::io_service& io,
 		int id,
 		int max_rate,
+		unsigned int max_flow_rules,
 		std::string ip_address,
 		int port,
 		Hypervisor* hypervisor)
 	:
 		id(id),
 		max_rate(max_rate),
+		max_flow_rules(max_flow_rules),
 		controller_endpoint(boost::asio::ip::address_v4::from_string(ip_address), port),
 		hypervisor(hypervisor),
-		started(false) {
+		started(false),
+		connect_timer(io),
+		connect_timer_running(false),
+		backoff_random(id) {
 }
 
 int Slice::get_id() const {
@@ -27,6 +48,14 @@ int Slice::get_max_rate() const {
 	return max_rate;
 }
 
+unsigned int Slice::get_max_flow_rules() const {
+	return max_flow_rules;
+}
+
+void Slice::set_max_flow_rules(unsigned int new_max_flow_rules) {
+	max_flow_rules = new_max_flow_rules;
+}
+
 void Slice::add_new_virtual_switch(
 		boost::asio::io_service& io,
 		uint64_t datapath_id) {
@@ -37,15 +66,39 @@ void Slice::add_new_virtual_switch(
 			hypervisor,
 			this);
 
-	// Check directly if this switch could go online, this only
-	// makes sense if this slice has already been started but the
-	// check_online function itself checks that.
-	ptr->check_online();
-
 	// Store the new switch in the list
 	virtual_switches[datapath_id] = ptr;
 }
 
+void Slice::remove_virtual_switch(uint64_t datapath_id) {
+	auto it = virtual_switches.find(datapath_id);
+	if( it == virtual_switches.end() ) return;
+
+	VirtualSwitch::pointer virtual_switch = it->second;
+	virtual_switches.erase(it);
+	connect_queue.erase(
+		std::remove(
+			connect_queue.begin(),
+			connect_queue.end(),
+			virtual_switch),
+		connect_queue.end());
+
+	// Going down doesn't update the rules of the physical switches,
+	// normally the topology change that caused it does that
+	bool was_connected = virtual_switch->is_connected();
+	virtual_switch->go_down();
+	if( !was_connected ) return;
+
+	std::set<uint64_t> physical_dpids;
+	for( const auto& port_pair : virtual_switch->get_port_to_physical_switch() ) {
+		physical_dpids.insert(port_pair.second);
+	}
+	for( uint64_t physical_dpid : physical_dpids ) {
+		auto sw_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_dpid);
+		if( sw_ptr != nullptr ) sw_ptr->update_dynamic_rules();
+	}
+}
+
 VirtualSwitch::pointer Slice::get_virtual_switch_by_datapath_id(uint64_t datapath_id) {
 	auto it = virtual_switches.find(datapath_id);
 	if( it == virtual_switches.end() ) {
@@ -64,6 +117,56 @@ const boost::asio::ip::tcp::endpoint& Slice::get_controller_endpoint() {
 	return controller_endpoint;
 }
 
+void Slice::schedule_connect(VirtualSwitch::pointer virtual_switch) {
+	// A switch that went down and up again can still be waiting
+	if( std::find(
+			connect_queue.begin(),
+			connect_queue.end(),
+			virtual_switch) == connect_queue.end() ) {
+		connect_queue.push_back(virtual_switch);
+	}
+
+	// Connect directly if no connects were released recently
+	if( !connect_timer_running ) {
+		release_connects(boost::system::error_code());
+	}
+}
+
+void Slice::release_connects(const boost::system::error_code& error) {
+	// The timer is only cancelled when this slice stops
+	if( error == boost::asio::error::operation_aborted ) return;
+	connect_timer_running = false;
+
+	// An idle slice doesn't keep the timer running, the next
+	// scheduled connect is released directly
+	if( connect_queue.empty() ) return;
+
+	for( int i=0; i<connects_per_interval && !connect_queue.empty(); ++i ) {
+		connect_queue.front()->connect();
+		connect_queue.pop_front();
+	}
+
+	// Wait before releasing the next connects, this also limits
+	// the rate when connects keep being scheduled
+	connect_timer_running = true;
+	connect_timer.expires_from_now(
+		boost::posix_time::milliseconds(connect_interval));
+	connect_timer.async_wait(
+		hypervisor->get_control_strand().wrap(boost::bind(
+			&Slice::release_connects,
+			this,
+			boost::asio::placeholders::error)));
+}
+
+boost::posix_time::time_duration Slice::get_connect_backoff(int attempts) {
+	int backoff = min_backoff << std::min(attempts, 6);
+	backoff = std::min(backoff, max_backoff);
+
+	// Wait between half and the full backoff
+	std::uniform_int_distribution<int> jitter(backoff/2, backoff);
+	return boost::posix_time::milliseconds(jitter(backoff_random));
+}
+
 void Slice::start() {
 	started = true;
 
@@ -79,6 +182,11 @@ void Slice::start() {
 void Slice::stop() {
 	started = false;
 
+	// Stop waiting to connect
+	connect_queue.clear();
+	connect_timer.cancel();
+	connect_timer_running = false;
+
 	// Stop all virtual switches in this slice
 	for( auto& sw : virtual_switches ) {
 		sw.second->go_down();
@@ -89,12 +197,14 @@ bool Slice::is_started() {
 	return started;
 }
 
-void Slice::check_online() {
+bool Slice::check_online() {
 	// If this slice hasn't started this doesn't make sense
-	if( !started ) return;
+	if( !started ) return false;
 
 	// Let all virtual switches check if they should go online
+	bool changed = false;
 	for( auto& sw : virtual_switches ) {
-		sw.second->check_online();
+		changed |= sw.second->check_online();
 	}
+	return changed;
 }
@@ -2,6 +2,8 @@
 
 #include <unordered_map>
 #include <string>
+#include <deque>
+#include <random>
 
 #include <boost/asio.hpp>
 
@@ -13,6 +15,8 @@ private:
 	int id;
 	/// The maximum rate this slice has
 	int max_rate;
+	/// The maximum amount of rules per physical switch, 0 is no limit
+	unsigned int max_flow_rules;
 
 	/// The hypervisor this slice belongs to
 	Hypervisor* hypervisor;
@@ -26,20 +30,50 @@ private:
 	/// If this slice has been started
 	bool started;
 
+	/// The virtual switches waiting for their turn to connect
+	std::deque<VirtualSwitch::pointer> connect_queue;
+	/// The timer that releases the waiting connects
+	boost::asio::deadline_timer connect_timer;
+	/// If the connect timer is running
+	bool connect_timer_running;
+	/// The random generator used to jitter the backoff
+	std::minstd_rand backoff_random;
+	/// Let the next waiting virtual switches connect
+	void release_connects(const boost::system::error_code& error);
+
 public:
 	/// Construct a new slice
 	Slice(
+		boost::asio::io_service& io,
 		int id,
 		int max_rate,
+		unsigned int max_flow_rules,
 		std::string ip_address,
 		int port,
 		Hypervisor* hypervisor);
 
 	int get_id() const;
 	int get_max_rate() const;
+	/// Get the maximum amount of rules per physical switch, 0 is no limit
+	/**
+	 * Every rule of a virtual switch takes 1 or 2 rules in a physical switch.
+	 */
+	unsigned int get_max_flow_rules() const;
+	/// Change the maximum amount of rules per physical switch
+	/**
+	 * Rules that are already installed are kept, only new
+	 * rules are refused.
+	 */
+	void set_max_flow_rules(unsigned int max_flow_rules);
 
 	/// Add a new virtual switch to this slice
+	/**
+	 * The new switch stays down until check_online is called,
+	 * so its ports can be added first.
+	 */
 	void add_new_virtual_switch(boost::asio::io_service& io, uint64_t datapath_id);
+	/// Take a virtual switch down and remove it from this slice
+	void remove_virtual_switch(uint64_t datapath_id);
 	/// Retreive a virtual switch
 	VirtualSwitch::pointer get_virtual_switch_by_datapath_id(uint64_t datapath_id);
 
@@ -49,6 +83,21 @@ public:
 	 * their socket.
 	 */
 	const boost::asio::ip::tcp::endpoint& get_controller_endpoint();
+	/// Let a virtual switch connect to the controller when it is its turn
+	/**
+	 * A limited amount of virtual switches connects per interval,
+	 * so a slice with many virtual switches coming up at once
+	 * doesn't flood the controller and the io_service.
+	 */
+	void schedule_connect(VirtualSwitch::pointer virtual_switch);
+	/// Get the time to wait after a failed connection attempt
+	/**
+	 * The backoff grows exponentially with the amount of failed
+	 * attempts and is jittered so virtual switches that failed
+	 * at the same time don't retry at the same time.
+	 */
+	boost::posix_time::time_duration get_connect_backoff(int attempts);
+
 	/// Get the virtual switches
 	const std::unordered_map<uint64_t,VirtualSwitch::pointer>& get_virtual_switches() const;
 
@@ -60,5 +109,8 @@ public:
 	bool is_started();
 
 	/// For all the virtual switches in this slice check_online
-	void check_online();
+	/**
+	 * \return If any virtual switch changed state
+	 */
+	bool check_online();
 };
@@ -114,20 +114,168 @@ unsigned int VLANTag::get_slice() const {
 		VLANTag::num_switch_bits+VLANTag::num_port_bits>();
 }
 
+template<class ActionSet>
+void VLANTag::add_push_to_actions(ActionSet& action_set) {
+	action_set.add_action(
+		new fluid_msg::of13::PushVLANAction(0x8100));
+}
+
+template<class ActionSet>
+void VLANTag::add_pop_to_actions(ActionSet& action_set) {
+	action_set.add_action(
+		new fluid_msg::of13::PopVLANAction());
+}
+
+std::vector<uint8_t> VLANTag::add_to_packet(const std::vector<uint8_t>& frame) const {
+	uint16_t raw = make_raw();
+
+	// The VLAN header goes between the mac addresses and the ethertype
+	std::vector<uint8_t> packet(frame.begin(), frame.begin()+12);
+	packet.push_back(0x81);
+	packet.push_back(0x00);
+	packet.push_back((raw>>8) & 0xff);
+	packet.push_back(raw & 0xff);
+	packet.insert(packet.end(), frame.begin()+12, frame.end());
+	return packet;
+}
+
+boost::optional<VLANTag> VLANTag::from_packet(const uint8_t* data, size_t length) {
+	if( length < 16 || data[12] != 0x81 || data[13] != 0x00 ) return boost::none;
+	return VLANTag(uint16_t(data[14]*256+data[15]));
+}
+
+PBBTag::PBBTag() :
+	Tag<uint32_t>::Tag() {
+}
+
+PBBTag::PBBTag(uint32_t raw) {
+	mask = make_mask(num_isid_bits);
+	tag  = raw & make_mask(num_isid_bits);
+}
+
+uint32_t PBBTag::make_raw() const {
+	return tag & make_mask(num_isid_bits);
+}
+
+void PBBTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
+	// The I-SID can only be matched on frames with a PBB header
+	if( flowmod.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_ETH_TYPE) == nullptr ) {
+		flowmod.add_oxm_field(
+			new fluid_msg::of13::EthType(ether_type));
+	}
+
+	flowmod.add_oxm_field(
+		new fluid_msg::of13::PBBIsid(
+			tag  & make_mask(num_isid_bits),
+			mask & make_mask(num_isid_bits)));
+}
+
+template<class ActionSet>
+void PBBTag::add_to_actions(ActionSet& action_set) const {
+	action_set.add_action(
+		new fluid_msg::of13::SetFieldAction(
+			new fluid_msg::of13::PBBIsid(
+				tag & make_mask(num_isid_bits))));
+}
+
+void PBBTag::set_switch(unsigned int switch_id) {
+	set_value<
+		PBBTag::num_switch_bits,
+		0>(switch_id);
+}
+
+unsigned int PBBTag::get_switch() const {
+	return get_value<
+		PBBTag::num_switch_bits,
+		0>();
+}
+
+void PBBTag::set_port(unsigned int port_id) {
+	set_value<
+		PBBTag::num_port_bits,
+		PBBTag::num_switch_bits>(port_id);
+}
+
+unsigned int PBBTag::get_port() const {
+	return get_value<
+		PBBTag::num_port_bits,
+		PBBTag::num_switch_bits>();
+}
+
+void PBBTag::set_slice(unsigned int slice_id) {
+	set_value<
+		PBBTag::num_slice_bits,
+		PBBTag::num_switch_bits+PBBTag::num_port_bits>(slice_id);
+}
+
+unsigned int PBBTag::get_slice() const {
+	return get_value<
+		PBBTag::num_slice_bits,
+		PBBTag::num_switch_bits+PBBTag::num_port_bits>();
+}
+
+template<class ActionSet>
+void PBBTag::add_push_to_actions(ActionSet& action_set) {
+	action_set.add_action(
+		new fluid_msg::of13::PushPBBAction(ether_type));
+}
+
+template<class ActionSet>
+void PBBTag::add_pop_to_actions(ActionSet& action_set) {
+	action_set.add_action(
+		new fluid_msg::of13::PopPBBAction());
+}
+
+std::vector<uint8_t> PBBTag::add_to_packet(const std::vector<uint8_t>& frame) const {
+	uint32_t raw = make_raw();
+
+	// The outer mac addresses and the I-TAG are put in front of
+	// the frame, the priority and flag bits of the I-TAG are 0
+	std::vector<uint8_t> packet(frame.begin(), frame.begin()+12);
+	packet.push_back(ether_type>>8);
+	packet.push_back(ether_type & 0xff);
+	packet.push_back(0x00);
+	packet.push_back((raw>>16) & 0xff);
+	packet.push_back((raw>> 8) & 0xff);
+	packet.push_back(raw & 0xff);
+	packet.insert(packet.end(), frame.begin(), frame.end());
+	return packet;
+}
+
+boost::optional<PBBTag> PBBTag::from_packet(const uint8_t* data, size_t length) {
+	if(
+		length < 18 ||
+		data[12] != (ether_type>>8) ||
+		data[13] != (ether_type & 0xff)
+	) return boost::none;
+	return PBBTag((uint32_t(data[15])<<16) | (uint32_t(data[16])<<8) | data[17]);
+}
+
 namespace {
-	// Force versions of add_to_actions<> using write or apply
-	// actions to be available during linking
+	// Force versions of the action templates using write or
+	// apply actions to be available during linking
+	template<class TagType>
 	void ugly_hack() {
 		fluid_msg::of13::WriteActions w;
 		fluid_msg::of13::ApplyActions a;
 		fluid_msg::ActionList l;
 		fluid_msg::ActionSet s;
-		VLANTag t;
+		TagType t;
 		t.add_to_actions(w);
 		t.add_to_actions(a);
 		t.add_to_actions(l);
 		t.add_to_actions(s);
+		TagType::add_push_to_actions(w);
+		TagType::add_push_to_actions(a);
+		TagType::add_push_to_actions(l);
+		TagType::add_push_to_actions(s);
+		TagType::add_pop_to_actions(w);
+		TagType::add_pop_to_actions(a);
+		TagType::add_pop_to_actions(l);
+		TagType::add_pop_to_actions(s);
 	}
+	template void ugly_hack<VLANTag>();
+	template void ugly_hack<PBBTag>();
 }
 
 MetadataTag::MetadataTag() :
@@ -154,14 +302,12 @@ int MetadataTag::get_virtual_switch() const {
 	return get_value<num_virtual_switch_bits,1>();
 }
 
-bool MetadataTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
+template<class Message>
+bool MetadataTag::add_to_match(Message& flowmod) const {
 	// The variables to save the existing match values in
 	uint64_t existing_tag  = 0;
 	uint64_t existing_mask = 0;
 
-	// Retreive the match structure from the flowmod
-	fluid_msg::of13::Match old_match = flowmod.match();
-
 	// Create a new match structure
 	fluid_msg::of13::Match new_match;
 
@@ -220,6 +366,73 @@ bool MetadataTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
 	return true;
 }
 
+template<class Message>
+void MetadataTag::remove_from_match(Message& message) {
+	// Create a new match structure
+	fluid_msg::of13::Match new_match;
+
+	// Copy all fields except the metadata, the metadata
+	// of the virtual switch is shifted back
+	for( size_t i=0; i<OXM_NUM; ++i ) {
+		fluid_msg::of13::OXMTLV* oxm = message.get_oxm_field(i);
+		if( oxm == nullptr ) continue;
+
+		if( i == fluid_msg::of13::OFPXMT_OFB_METADATA ) {
+			fluid_msg::of13::Metadata* existing_metadata =
+				(fluid_msg::of13::Metadata*) oxm;
+
+			// The total amount of bits used by the hypervisor
+			constexpr int total_bits = num_virtual_switch_bits + 1;
+
+			uint64_t virtual_tag  = existing_metadata->value()>>total_bits;
+			uint64_t virtual_mask = existing_metadata->has_mask() ?
+				existing_metadata->mask()>>total_bits :
+				~uint64_t(0)>>total_bits;
+			if( virtual_mask != 0 ) {
+				new_match.add_oxm_field(
+					new fluid_msg::of13::Metadata(
+						virtual_tag,
+						virtual_mask));
+			}
+		}
+		else {
+			new_match.add_oxm_field(oxm->clone());
+		}
+	}
+
+	message.match(new_match);
+}
+
+void MetadataTag::set_group_in_match(fluid_msg::of13::FlowMod& flowmod, bool group) {
+	fluid_msg::of13::Match new_match;
+	for( size_t i=0; i<OXM_NUM; ++i ) {
+		fluid_msg::of13::OXMTLV* oxm = flowmod.get_oxm_field(i);
+		if( oxm == nullptr ) continue;
+
+		if( i == fluid_msg::of13::OFPXMT_OFB_METADATA ) {
+			fluid_msg::of13::Metadata* existing_metadata =
+				(fluid_msg::of13::Metadata*) oxm;
+			uint64_t mask = existing_metadata->has_mask() ?
+				existing_metadata->mask() :
+				~uint64_t(0);
+			new_match.add_oxm_field(
+				new fluid_msg::of13::Metadata(
+					(existing_metadata->value() & ~uint64_t(1)) | (group?1:0),
+					mask | 1));
+		}
+		else {
+			new_match.add_oxm_field(oxm->clone());
+		}
+	}
+
+	flowmod.match(new_match);
+}
+
+// The messages the metadata match is added to or removed from
+template bool MetadataTag::add_to_match(fluid_msg::of13::FlowMod&) const;
+template bool MetadataTag::add_to_match(fluid_msg::of13::MultipartRequestFlow&) const;
+template void MetadataTag::remove_from_match(fluid_msg::of13::FlowStats&);
+
 bool MetadataTag::add_to_instructions(fluid_msg::of13::FlowMod& flowmod) const {
 	// Look if there already is a write_metadata instruction
 	// in the flowmod message
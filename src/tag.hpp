@@ -1,12 +1,17 @@
 #pragma once
 
+#include <vector>
+
+#include <boost/optional.hpp>
+
 #include <fluid/of13msg.hh>
 
 /**
  * This header defines some helper functions to
- * build the VLAN tags used by the Hypervisor.
+ * build the tags used by the Hypervisor.
  * First is an id and id_mask built which is then
- * spread out over the VLAN VID and VLAN PCP bits.
+ * spread out over the fields of the tag, the VLAN VID
+ * and VLAN PCP bits or the PBB I-SID.
  */
 
 /// Create a mask consisting of a variable amount of bits
@@ -82,8 +87,108 @@ public:
 	void set_slice(unsigned int slice_id);
 	/// Get the slice value
 	unsigned int get_slice() const;
+
+	/// Add the action pushing an empty VLAN tag to an action set
+	template<class ActionSet>
+	static void add_push_to_actions(ActionSet& action_set);
+	/// Add the action popping the VLAN tag to an action set
+	template<class ActionSet>
+	static void add_pop_to_actions(ActionSet& action_set);
+
+	/// Insert this tag in an untagged ethernet frame
+	std::vector<uint8_t> add_to_packet(const std::vector<uint8_t>& frame) const;
+	/// Read the tag of a tagged ethernet frame
+	/**
+	 * \return boost::none if the frame has no VLAN tag
+	 */
+	static boost::optional<VLANTag> from_packet(const uint8_t* data, size_t length);
+};
+
+/// A tag in the I-SID of a PBB header
+/**
+ * The 24 bits of the I-SID give room to more switches, ports
+ * and slices than the 15 bits of a VLAN tag, the I-SID can be
+ * matched with a mask like the VLAN VID. It has the same
+ * interface as the VLANTag so either can be used as NetworkTag.
+ */
+class PBBTag : public Tag<uint32_t> {
+protected:
+	/// The amount of bits per field
+	static constexpr int num_switch_bits = 10;
+	static constexpr int num_slice_bits  = 6;
+	static constexpr int num_port_bits   = 8;
+	/// The amount of bits in the I-SID
+	static constexpr int num_isid_bits   = 24;
+
+	/// The ethertype of a frame with a PBB header
+	static constexpr uint16_t ether_type = 0x88e7;
+public:
+	static constexpr uint16_t max_slice_id  = make_mask(num_slice_bits);
+	static constexpr uint16_t max_switch_id = make_mask(num_switch_bits);
+	static constexpr uint16_t max_port_id   = make_mask(num_port_bits);
+
+	/// Create a pbb tag without a tag or mask set
+	PBBTag();
+	/// Initialize a pbb tag from the I-SID
+	PBBTag(uint32_t raw);
+	/// Make the I-SID as it goes over the wire
+	uint32_t make_raw() const;
+
+	/// Add the data set in this object to the match field
+	/**
+	 * The match on the PBB ethertype is added as well if the
+	 * flowmod doesn't match on the ethertype yet.
+	 */
+	void add_to_match(fluid_msg::of13::FlowMod& flowmod) const;
+
+	/// Add the data contained in this PBBTag to an action set
+	/**
+	 * This function works both for WriteActions and ApplyActions.
+	 */
+	template<class ActionSet>
+	void add_to_actions(ActionSet& action_set) const;
+
+	/// Set the switch value
+	void set_switch(unsigned int switch_id);
+	/// Get the switch value
+	unsigned int get_switch() const;
+	/// Set the port value
+	void set_port(unsigned int port_id);
+	/// Get the port value
+	unsigned int get_port() const;
+	/// Set the slice value
+	void set_slice(unsigned int slice_id);
+	/// Get the slice value
+	unsigned int get_slice() const;
+
+	/// Add the action pushing an empty PBB header to an action set
+	template<class ActionSet>
+	static void add_push_to_actions(ActionSet& action_set);
+	/// Add the action popping the PBB header to an action set
+	template<class ActionSet>
+	static void add_pop_to_actions(ActionSet& action_set);
+
+	/// Encapsulate an untagged ethernet frame with this tag
+	std::vector<uint8_t> add_to_packet(const std::vector<uint8_t>& frame) const;
+	/// Read the tag of an encapsulated ethernet frame
+	/**
+	 * \return boost::none if the frame has no PBB header
+	 */
+	static boost::optional<PBBTag> from_packet(const uint8_t* data, size_t length);
 };
 
+/// The tag used on the links between the physical switches
+/**
+ * The VLAN tag is the default, it is supported by every switch
+ * and costs the least. Building with DELFTVISOR_PBB_TAG uses the
+ * PBB tag for networks with more switches, ports or slices.
+ */
+#ifdef DELFTVISOR_PBB_TAG
+typedef PBBTag NetworkTag;
+#else
+typedef VLANTag NetworkTag;
+#endif
+
 class MetadataTag : public Tag<uint64_t> {
 public:
 	/// The amount of bits used to describe
@@ -115,7 +220,23 @@ public:
 	 * failed.
 	 * \return If adding the match was successful
 	 */
-	bool add_to_match(fluid_msg::of13::FlowMod& flowmod) const;
+	template<class Message>
+	bool add_to_match(Message& message) const;
+	/// Remove the hypervisor metadata from a match
+	/**
+	 * This is the inverse of add_to_match, the metadata bits
+	 * of the hypervisor are removed and an existing match on
+	 * metadata is shifted back to the right. This works for
+	 * all messages reporting on a rewritten flow.
+	 */
+	template<class Message>
+	static void remove_from_match(Message& message);
+	/// Set the group bit in the metadata match of a rewritten flow
+	/**
+	 * A merged rule matches both values of the group bit, this
+	 * makes it match only 1 of them.
+	 */
+	static void set_group_in_match(fluid_msg::of13::FlowMod& flowmod, bool group);
 
 	/// Add a metadata tag instruction to this flowmod
 	/**
@@ -1,9 +1,12 @@
+#include <set>
+
 #include <boost/bind.hpp>
 #include <boost/log/trivial.hpp>
 
 #include "slice.hpp"
 #include "hypervisor.hpp"
 #include "virtual_switch.hpp"
+#include "log.hpp"
 #include "physical_switch.hpp"
 
 // Start virtual switch id's at 1 so the metadata field
@@ -16,19 +19,55 @@ VirtualSwitch::VirtualSwitch(
 		Hypervisor* hypervisor,
 		Slice *slice)
 	:
-		OpenflowConnection::OpenflowConnection(io),
+		OpenflowConnection::OpenflowConnection(
+			io,
+			hypervisor->get_control_strand(),
+			get_dispatch_table(),
+			hypervisor->get_echo_configuration()),
 		connection_backoff_timer(io),
+		connection_attempts(0),
 		id(virtual_switch_id_allocator.new_id()),
 		datapath_id(datapath_id),
 		hypervisor(hypervisor),
 		slice(slice),
-		state(down) {
+		state(down),
+		next_barrier_id(0),
+		next_stats_id(0) {
+}
+
+const OpenflowConnection::DispatchTable& VirtualSwitch::get_dispatch_table() {
+	static const DispatchTable table = [] {
+		DispatchTable table;
+		namespace of13 = fluid_msg::of13;
+		table.set_message<VirtualSwitch, of13::Error,           &VirtualSwitch::handle_error           >(of13::OFPT_ERROR);
+		table.set_message<VirtualSwitch, of13::FeaturesRequest, &VirtualSwitch::handle_features_request>(of13::OFPT_FEATURES_REQUEST);
+		table.set_message<VirtualSwitch, of13::BarrierRequest,  &VirtualSwitch::handle_barrier_request >(of13::OFPT_BARRIER_REQUEST);
+		table.set_message<VirtualSwitch, of13::PacketOut,       &VirtualSwitch::handle_packet_out      >(of13::OFPT_PACKET_OUT);
+		table.set_message<VirtualSwitch, of13::FlowMod,         &VirtualSwitch::handle_flow_mod        >(of13::OFPT_FLOW_MOD);
+		table.set_message<VirtualSwitch, of13::GroupMod,        &VirtualSwitch::handle_group_mod       >(of13::OFPT_GROUP_MOD);
+		table.set_message<VirtualSwitch, of13::PortMod,         &VirtualSwitch::handle_port_mod        >(of13::OFPT_PORT_MOD);
+		table.set_message<VirtualSwitch, of13::TableMod,        &VirtualSwitch::handle_table_mod       >(of13::OFPT_TABLE_MOD);
+		table.set_message<VirtualSwitch, of13::MeterMod,        &VirtualSwitch::handle_meter_mod       >(of13::OFPT_METER_MOD);
+
+		table.set_multipart_request<VirtualSwitch, of13::MultipartRequestFlow,            &VirtualSwitch::handle_multipart_request_flow          >(of13::OFPMP_FLOW);
+		table.set_multipart_request<VirtualSwitch, of13::MultipartRequestPortStats,       &VirtualSwitch::handle_multipart_request_port_stats    >(of13::OFPMP_PORT_STATS);
+		table.set_multipart_request<VirtualSwitch, of13::MultipartRequestGroup,           &VirtualSwitch::handle_multipart_request_group         >(of13::OFPMP_GROUP);
+		table.set_multipart_request<VirtualSwitch, of13::MultipartRequestGroupFeatures,   &VirtualSwitch::handle_multipart_request_group_features>(of13::OFPMP_GROUP_FEATURES);
+		table.set_multipart_request<VirtualSwitch, of13::MultipartRequestMeterFeatures,   &VirtualSwitch::handle_multipart_request_meter_features>(of13::OFPMP_METER_FEATURES);
+		table.set_multipart_request<VirtualSwitch, of13::MultipartRequestPortDescription, &VirtualSwitch::handle_multipart_request_port_desc     >(of13::OFPMP_PORT_DESC);
+		return table;
+	}();
+	return table;
 }
 
 int VirtualSwitch::get_id() const {
 	return id;
 }
 
+uint64_t VirtualSwitch::get_datapath_id() const {
+	return datapath_id;
+}
+
 const Slice* VirtualSwitch::get_slice() const {
 	return slice;
 }
@@ -41,12 +80,18 @@ void VirtualSwitch::add_port(
 		uint32_t port_number,
 		uint64_t physical_datapath_id,
 		uint32_t physical_port_number) {
-	// Store the lookup link
+	// Store the lookup link, the features depend on the physical
+	// switches so they change with a new one
+	if( dependent_switches.count(physical_datapath_id) == 0 ) {
+		features_cache = boost::none;
+	}
 	port_to_dependent_switch
 		[port_number] = physical_datapath_id;
 	dependent_switches
 		[physical_datapath_id]
 		.port_map.insert(port_number, physical_port_number);
+
+	invalidate_port_description();
 }
 
 void VirtualSwitch::remove_port(uint32_t port_number) {
@@ -58,7 +103,118 @@ void VirtualSwitch::remove_port(uint32_t port_number) {
 	dependent_switches.at(physical_dpid).port_map.erase(port_number);
 	if( dependent_switches.at(physical_dpid).port_map.size() == 0 ) {
 		dependent_switches.erase(physical_dpid);
+		features_cache = boost::none;
+	}
+
+	invalidate_port_description();
+}
+
+void VirtualSwitch::reconfigure_ports(
+		const std::map<uint32_t,PortConfiguration>& ports) {
+	auto is_unchanged = [this](uint32_t port_number, const PortConfiguration& port) {
+		auto it = port_to_dependent_switch.find(port_number);
+		return
+			it != port_to_dependent_switch.end() &&
+			it->second == port.physical_datapath_id &&
+			get_port_map(it->second).get_physical(port_number) == port.physical_port_number;
+	};
+
+	// A port that moved is removed and added again
+	std::vector<uint32_t> removed_ports;
+	for( const auto& port_pair : port_to_dependent_switch ) {
+		auto it = ports.find(port_pair.first);
+		if( it == ports.end() || !is_unchanged(it->first, it->second) ) {
+			removed_ports.push_back(port_pair.first);
+		}
+	}
+	std::vector<uint32_t> added_ports;
+	for( const auto& port_pair : ports ) {
+		if( !is_unchanged(port_pair.first, port_pair.second) ) {
+			added_ports.push_back(port_pair.first);
+		}
+	}
+	if( removed_ports.empty() && added_ports.empty() ) return;
+
+	BOOST_LOG_TRIVIAL(info) << *this << " reconfiguring, "
+		<< removed_ports.size() << " ports removed, "
+		<< added_ports.size() << " ports added";
+
+	std::set<uint64_t> old_switches;
+	for( const auto& dep_sw : dependent_switches ) old_switches.insert(dep_sw.first);
+	std::set<uint64_t> new_switches;
+	for( const auto& port_pair : ports ) new_switches.insert(port_pair.second.physical_datapath_id);
+
+	// Only a connected switch is registered at the physical switches
+	bool registered = state==connected;
+
+	// Unregister before the port maps of the switches this
+	// switch no longer spans are removed
+	if( registered ) {
+		for( uint64_t physical_dpid : old_switches ) {
+			if( new_switches.count(physical_dpid) ) continue;
+			auto sw_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_dpid);
+			if( sw_ptr != nullptr ) sw_ptr->remove_interest(shared_from_this());
+		}
+	}
+
+	for( uint32_t port_number : removed_ports ) {
+		send_port_status(port_number, fluid_msg::of13::OFPPR_DELETE);
+		remove_port(port_number);
+	}
+	for( uint32_t port_number : added_ports ) {
+		const PortConfiguration& port = ports.at(port_number);
+		add_port(port_number, port.physical_datapath_id, port.physical_port_number);
+		send_port_status(port_number, fluid_msg::of13::OFPPR_ADD);
+	}
+
+	// Every spanned switch has an output group for every port
+	if( registered ) {
+		for( uint64_t physical_dpid : new_switches ) {
+			auto sw_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_dpid);
+			if( sw_ptr == nullptr ) continue;
+			if( old_switches.count(physical_dpid) ) sw_ptr->update_interest(shared_from_this());
+			else                                    sw_ptr->register_interest(shared_from_this());
+		}
+	}
+
+	// A new dependent switch can be offline or unreachable, this
+	// is handled like a change in the topology
+	check_online();
+
+	if( registered ) {
+		std::set<uint64_t> touched_switches(old_switches);
+		touched_switches.insert(new_switches.begin(), new_switches.end());
+		for( uint64_t physical_dpid : touched_switches ) {
+			auto sw_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_dpid);
+			if( sw_ptr != nullptr ) sw_ptr->update_dynamic_rules();
+		}
+	}
+}
+
+void VirtualSwitch::send_port_status(uint32_t port_number, uint8_t reason) {
+	if( state != connected ) return;
+
+	// Describe the port with the physical port if it is known
+	fluid_msg::of13::Port port;
+	uint64_t physical_dpid = port_to_dependent_switch.at(port_number);
+	auto sw_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_dpid);
+	if( sw_ptr != nullptr ) {
+		auto port_it = sw_ptr->get_ports().find(
+			get_port_map(physical_dpid).get_physical(port_number));
+		if( port_it != sw_ptr->get_ports().end() ) {
+			port = port_it->second.port_data;
+		}
 	}
+	port.port_no(port_number);
+
+	fluid_msg::of13::PortStatus port_status_message;
+	port_status_message.reason(reason);
+	port_status_message.desc(port);
+	send_message(port_status_message);
+}
+
+void VirtualSwitch::invalidate_port_description() {
+	port_description_cache = boost::none;
 }
 
 const bidirectional_map<uint32_t,uint32_t>& VirtualSwitch::get_port_map(
@@ -68,12 +224,30 @@ const bidirectional_map<uint32_t,uint32_t>& VirtualSwitch::get_port_map(
 
 void VirtualSwitch::try_connect() {
 	state = try_connecting;
+
+	// Wait for the turn of this switch
+	slice->schedule_connect(shared_from_this());
+}
+
+void VirtualSwitch::connect() {
+	// The switch could have gone down while waiting
+	if( state != try_connecting ) return;
+
+	// The socket is only touched on the connection strand, this
+	// also orders the connect after a close done by stop.
+	strand.post(
+		boost::bind(
+			&VirtualSwitch::connect_socket,
+			shared_from_this()));
+}
+
+void VirtualSwitch::connect_socket() {
 	socket.async_connect(
 		slice->get_controller_endpoint(),
-		boost::bind(
+		control_strand.wrap(boost::bind(
 			&VirtualSwitch::handle_connect,
 			shared_from_this(),
-			boost::asio::placeholders::error));
+			boost::asio::placeholders::error)));
 }
 
 void VirtualSwitch::handle_connect(const boost::system::error_code& error) {
@@ -84,12 +258,12 @@ void VirtualSwitch::handle_connect(const boost::system::error_code& error) {
 		// Try connecting again?
 		if( state==try_connecting ) {
 			connection_backoff_timer.expires_from_now(
-				boost::posix_time::milliseconds(500));
+				slice->get_connect_backoff(connection_attempts++));
 			connection_backoff_timer.async_wait(
-				boost::bind(
+				control_strand.wrap(boost::bind(
 					&VirtualSwitch::backoff_expired,
 					shared_from_this(),
-					boost::asio::placeholders::error));
+					boost::asio::placeholders::error)));
 		}
 	}
 }
@@ -110,6 +284,7 @@ void VirtualSwitch::start() {
 		// Connection maintenance
 		OpenflowConnection::start();
 		state = connected;
+		connection_attempts = 0;
 
 		// Register this virtual switch with the physical switches
 		for( const auto& dep_sw : dependent_switches ) {
@@ -135,6 +310,10 @@ void VirtualSwitch::stop() {
 	// Stop any work in the backoff timer
 	connection_backoff_timer.cancel();
 
+	// The controller will not receive these replies anymore
+	pending_barriers.clear();
+	pending_stats.clear();
+
 	// Remove registration of this virtual switch with the physical switches
 	for( const auto& dep_sw : dependent_switches ) {
 		auto sw_ptr =
@@ -172,6 +351,11 @@ void VirtualSwitch::go_down() {
 		BOOST_LOG_TRIVIAL(info) << *this << " going down";
 		state = down;
 		stop();
+
+		// The physical switches can change before this switch
+		// comes up again
+		features_cache = boost::none;
+		port_description_cache = boost::none;
 	}
 }
 
@@ -183,12 +367,13 @@ bool VirtualSwitch::is_connected() const {
 	return state==connected;
 }
 
-void VirtualSwitch::check_online() {
+bool VirtualSwitch::check_online() {
 	// If the slice hasn't been started don't do anything
-	if( !slice->is_started() ) return;
+	if( !slice->is_started() ) return false;
 
 	bool all_online_and_reachable = true;
 	PhysicalSwitch::pointer first_switch = nullptr;
+	const RoutingEngine& routing_engine = hypervisor->get_routing_engine();
 
 	for( auto& dep_sw : dependent_switches ) {
 		// Lookup the PhysicalSwitch via the hypervisor
@@ -210,7 +395,9 @@ void VirtualSwitch::check_online() {
 		else {
 			// Check connectivity between the current PhysicalSwitch
 			// and *first_switch
-			if( first_switch->get_distance(switch_ptr->get_id()) == topology::infinite ) {
+			if( routing_engine.get_distance(
+					first_switch->get_id(),
+					switch_ptr->get_id()) == topology::infinite ) {
 				all_online_and_reachable = false;
 				break;
 			}
@@ -222,10 +409,13 @@ void VirtualSwitch::check_online() {
 	// Update this virtual switch state if needed
 	if( all_online_and_reachable && state==down ) {
 		try_connect();
+		return true;
 	}
 	else if( !all_online_and_reachable && state!=down ) {
 		go_down();
+		return true;
 	}
+	return false;
 }
 
 VirtualSwitch::pointer VirtualSwitch::shared_from_this() {
@@ -243,11 +433,12 @@ void VirtualSwitch::handle_error(fluid_msg::of13::Error& error_message) {
 		<< " Code=" << error_message.code();
 }
 
-void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message) {
+VirtualSwitch::Features VirtualSwitch::calculate_features() const {
 	// Lookup the features of all switches below
-	uint32_t n_buffers    = UINT32_MAX;
-	uint8_t n_tables      = UINT8_MAX;
-	uint32_t capabilities = UINT32_MAX;
+	Features virtual_features;
+	virtual_features.n_buffers    = UINT32_MAX;
+	virtual_features.n_tables     = UINT8_MAX;
+	virtual_features.capabilities = UINT32_MAX;
 
 	for( auto& dep_sw : dependent_switches ) {
 		auto phy_sw = hypervisor
@@ -257,29 +448,41 @@ void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& fe
 		if( phy_sw == nullptr ) {
 			BOOST_LOG_TRIVIAL(error) << *this <<
 				" not all switches online?";
+			continue;
 		}
 
 		const auto& features = phy_sw->get_features();
-		n_buffers     = std::min( n_buffers, features.n_buffers );
-		n_tables      = std::min( n_tables, features.n_tables );
-		capabilities &= features.capabilities;
+		virtual_features.n_buffers     = std::min( virtual_features.n_buffers, features.n_buffers );
+		virtual_features.n_tables      = std::min( virtual_features.n_tables, features.n_tables );
+		virtual_features.capabilities &= features.capabilities;
 	}
 
 	// We reserve 2 tables for the hypervisor
-	n_tables -= 2;
+	virtual_features.n_tables -= 2;
 	// Statistics are not supported in this version of the hypervisor
-	capabilities &= fluid_msg::of13::OFPC_IP_REASM | fluid_msg::of13::OFPC_PORT_BLOCKED;
-	// Buffers are also not available
-	n_buffers = 0;
+	virtual_features.capabilities &= fluid_msg::of13::OFPC_IP_REASM | fluid_msg::of13::OFPC_PORT_BLOCKED;
+	// Buffers can only be used if all physical switches have them,
+	// the amount is limited by the buffer table
+	if( virtual_features.n_buffers != 0 ) {
+		virtual_features.n_buffers = hypervisor->get_buffer_table().get_size();
+	}
+
+	return virtual_features;
+}
+
+void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message) {
+	if( !features_cache ) {
+		features_cache = calculate_features();
+	}
 
 	// Create the response message
 	fluid_msg::of13::FeaturesReply features_reply(
 		features_request_message.xid(),
 		datapath_id,
-		n_buffers,
-		n_tables,
+		features_cache->n_buffers,
+		features_cache->n_tables,
 		0, // Auxiliary id
-		capabilities);
+		features_cache->capabilities);
 
 	// Send the message response
 	send_message_response(features_reply);
@@ -289,20 +492,142 @@ void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& fe
 
 void VirtualSwitch::handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received barrier_request";
-	// TODO
+
+	// Wait for a barrier on every physical switch this switch spans
+	uint64_t barrier_id = next_barrier_id++;
+	PendingBarrier& pending_barrier = pending_barriers[barrier_id];
+	pending_barrier.xid       = barrier_request_message.xid();
+	pending_barrier.remaining = 0;
+	for( const auto& dep_sw : dependent_switches ) {
+		auto sw_ptr =
+			hypervisor->
+				get_physical_switch_by_datapath_id(dep_sw.first);
+		if( sw_ptr == nullptr ) continue;
+
+		sw_ptr->request_barrier(shared_from_this(), barrier_id);
+		++pending_barrier.remaining;
+	}
+
+	// If there is nothing to wait for answer directly
+	send_barrier_replies();
+}
+
+void VirtualSwitch::barrier_completed(uint64_t barrier_id) {
+	auto it = pending_barriers.find(barrier_id);
+	if( it == pending_barriers.end() ) return;
+
+	--it->second.remaining;
+	send_barrier_replies();
+}
+
+void VirtualSwitch::send_barrier_replies() {
+	// Answer the barriers in the order they were received
+	while(
+		!pending_barriers.empty() &&
+		pending_barriers.begin()->second.remaining <= 0
+	) {
+		fluid_msg::of13::BarrierReply barrier_reply(
+			pending_barriers.begin()->second.xid);
+		send_message_response(barrier_reply);
+		pending_barriers.erase(pending_barriers.begin());
+	}
 }
 
 void VirtualSwitch::handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received packet_out";
+	DELFTVISOR_LOG_EVERY_N(info, logging::packet_sample) << *this << " received packet_out";
 
 	// The physicalswitch to send the packet to
 	PhysicalSwitch::pointer ps_ptr;
+	// The action lists per physical switch if the packet out is split
+	std::map<uint64_t,fluid_msg::ActionList> plan;
+
+	if( packet_out_message.buffer_id() != OFP_NO_BUFFER ) {
+		// The packet has to be send from the switch that buffered it
+		uint64_t physical_datapath_id;
+		uint32_t physical_buffer_id;
+		if( !hypervisor->get_buffer_table().take(
+				packet_out_message.buffer_id(),
+				id,
+				physical_datapath_id,
+				physical_buffer_id) ||
+			(ps_ptr=hypervisor->get_physical_switch_by_datapath_id(
+				physical_datapath_id)) == nullptr
+		) {
+			BOOST_LOG_TRIVIAL(warning) << *this
+				<< " received packet_out with unknown buffer id "
+				<< packet_out_message.buffer_id();
+			send_error_response(
+				fluid_msg::of13::OFPET_BAD_REQUEST,
+				fluid_msg::of13::OFPBRC_BUFFER_UNKNOWN,
+				packet_out_message);
+			return;
+		}
+		packet_out_message.buffer_id(physical_buffer_id);
 
-	if( packet_out_message.in_port() == fluid_msg::of13::OFPP_CONTROLLER ) {
-		// TODO Find a better switch to output over, scan action list to
-		// see what port it would be output to and send it to that switch
+		// Rewrite the in_port
+		if( packet_out_message.in_port() != fluid_msg::of13::OFPP_CONTROLLER ) {
+			boost::optional<uint32_t> physical_in_port =
+				dependent_switches.at(physical_datapath_id)
+					.port_map.find_physical(packet_out_message.in_port());
+			if( !physical_in_port ) {
+				send_error_response(
+					fluid_msg::of13::OFPET_BAD_REQUEST,
+					fluid_msg::of13::OFPBRC_BAD_PORT,
+					packet_out_message);
+				return;
+			}
+			packet_out_message.in_port(*physical_in_port);
+		}
+	}
+	else if(
+		packet_out_message.in_port() != fluid_msg::of13::OFPP_CONTROLLER &&
+		port_to_dependent_switch.count(packet_out_message.in_port()) == 0
+	) {
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_BAD_PORT,
+			packet_out_message);
+		return;
+	}
+	else if( plan_packet_out(packet_out_message, plan) ) {
+		// Send the packet directly from every switch it is output on
+		uint32_t in_port = packet_out_message.in_port();
+		for( auto& plan_pair : plan ) {
+			PhysicalSwitch::pointer physical_switch =
+				hypervisor->get_physical_switch_by_datapath_id(plan_pair.first);
+			if( physical_switch == nullptr ) continue;
+
+			fluid_msg::ActionList new_action_list;
+			if( !physical_switch->rewrite_action_list(
+					plan_pair.second,
+					new_action_list,
+					this) ) {
+				BOOST_LOG_TRIVIAL(warning) << *this
+					<< " found problematic action in packet out message";
+				return;
+			}
+
+			// The in_port only exists on its own switch, the other
+			// switches send the packet as if it came from the controller
+			uint32_t physical_in_port = fluid_msg::of13::OFPP_CONTROLLER;
+			if(
+				in_port != fluid_msg::of13::OFPP_CONTROLLER &&
+				port_to_dependent_switch.at(in_port) == plan_pair.first
+			) {
+				physical_in_port = dependent_switches
+					.at(plan_pair.first)
+					.port_map.get_physical(in_port);
+			}
 
-		// Send the packet to the first found switch
+			packet_out_message.in_port(physical_in_port);
+			packet_out_message.actions(new_action_list);
+			physical_switch->send_message(packet_out_message);
+		}
+		return;
+	}
+	else if( packet_out_message.in_port() == fluid_msg::of13::OFPP_CONTROLLER ) {
+		// Send the packet to the first found switch, it is forwarded
+		// through the network from there
 		ps_ptr = hypervisor->get_physical_switch_by_datapath_id(
 				dependent_switches.begin()->first);
 	}
@@ -339,57 +664,315 @@ void VirtualSwitch::handle_packet_out(fluid_msg::of13::PacketOut& packet_out_mes
 	ps_ptr->send_message(packet_out_message);
 }
 
+bool VirtualSwitch::plan_packet_out(
+		fluid_msg::of13::PacketOut& packet_out_message,
+		std::map<uint64_t,fluid_msg::ActionList>& plan) const {
+	uint32_t in_port = packet_out_message.in_port();
+	fluid_msg::ActionList action_list = packet_out_message.actions();
+	std::list<fluid_msg::Action*> actions = action_list.action_list();
+
+	// Find the physical switches with a port the packet is output on,
+	// like on a switch a flood doesn't output on the in_port
+	std::set<uint64_t> datapath_ids;
+	for( fluid_msg::Action* action : actions ) {
+		if( action->type() == fluid_msg::of13::OFPAT_GROUP ) return false;
+		if( action->type() != fluid_msg::of13::OFPAT_OUTPUT ) continue;
+
+		uint32_t port = ((fluid_msg::of13::OutputAction*) action)->port();
+		if( port == fluid_msg::of13::OFPP_FLOOD || port == fluid_msg::of13::OFPP_ALL ) {
+			for( const auto& port_pair : port_to_dependent_switch ) {
+				if( port_pair.first != in_port ) datapath_ids.insert(port_pair.second);
+			}
+		}
+		else if( port != fluid_msg::of13::OFPP_CONTROLLER ) {
+			auto it = port_to_dependent_switch.find(port);
+			if( it == port_to_dependent_switch.end() ) return false;
+			datapath_ids.insert(it->second);
+		}
+	}
+
+	// A packet only send to the controller is send from the in_port switch
+	if( datapath_ids.empty() ) {
+		datapath_ids.insert(
+			in_port != fluid_msg::of13::OFPP_CONTROLLER ?
+				port_to_dependent_switch.at(in_port) :
+				dependent_switches.begin()->first);
+	}
+
+	// Give every switch the actions with only its own outputs, an
+	// output to the controller is only done once
+	for( uint64_t datapath_id : datapath_ids ) {
+		fluid_msg::ActionList& switch_action_list = plan[datapath_id];
+		for( fluid_msg::Action* action : actions ) {
+			if( action->type() != fluid_msg::of13::OFPAT_OUTPUT ) {
+				switch_action_list.add_action(action->clone());
+				continue;
+			}
+
+			fluid_msg::of13::OutputAction* output = (fluid_msg::of13::OutputAction*) action;
+			if( output->port() == fluid_msg::of13::OFPP_FLOOD || output->port() == fluid_msg::of13::OFPP_ALL ) {
+				for( const auto& port_pair : port_to_dependent_switch ) {
+					if( port_pair.second != datapath_id || port_pair.first == in_port ) continue;
+					switch_action_list.add_action(
+						new fluid_msg::of13::OutputAction(
+							port_pair.first,
+							output->max_len()));
+				}
+			}
+			else if( output->port() == fluid_msg::of13::OFPP_CONTROLLER ) {
+				if( datapath_id == *datapath_ids.begin() ) {
+					switch_action_list.add_action(action->clone());
+				}
+			}
+			else if( port_to_dependent_switch.at(output->port()) == datapath_id ) {
+				switch_action_list.add_action(action->clone());
+			}
+		}
+	}
+
+	return true;
+}
+
 void VirtualSwitch::handle_flow_mod(fluid_msg::of13::FlowMod& flow_mod_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received flow_mod";
+	DELFTVISOR_LOG_EVERY_N(info, logging::packet_sample) << *this << " received flow_mod";
+
+	metrics::ScopedTimer timer(hypervisor->get_metrics().flow_mod_rewrite_time);
+
+	// The received flowmod is left as it is so the errors echo
+	// what the controller sent. The buffer is only taken once
+	// the flowmod is accepted, a rejected flowmod leaves it usable.
+	if( flow_mod_message.buffer_id() != OFP_NO_BUFFER &&
+		!hypervisor->get_buffer_table().contains(
+			flow_mod_message.buffer_id(),
+			id)
+	) {
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_BUFFER_UNKNOWN,
+			flow_mod_message);
+		return;
+	}
+
+	// Rewrite the parts of the instructions that are the same
+	// for every physical switch once
+	fluid_msg::of13::InstructionSet old_instruction_set =
+			flow_mod_message.instructions();
+	fluid_msg::of13::InstructionSet prepared_instruction_set;
+	bool has_write_action_group  = false;
+	bool has_write_action_output = false;
+	if( !PhysicalSwitch::prepare_instruction_set(
+			old_instruction_set,
+			prepared_instruction_set,
+			has_write_action_group,
+			has_write_action_output) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received flowmod with problematic instruction set";
+		return;
+	}
+
+	// The rules are accounted per physical switch, rules that
+	// expire are reported so they stop being counted
+	uint8_t command = flow_mod_message.command();
+
+	// A rule is pushed as 2 rules to the physical switches, the
+	// second one matches on packets with the group bit set. When
+	// the write actions contain a group, which overrides the outputs,
+	// or no outputs at all both get the same instructions and 1
+	// merged rule matching both values of the group bit is enough.
+	bool merge_variants = has_write_action_group || !has_write_action_output;
+
+	// A non strict delete of the merged match also deletes the split
+	// rules, the strict commands can't tell how the rule was added.
+	// Merged rules a modify can't be applied to are split below.
+	bool send_merged = merge_variants ||
+		command == fluid_msg::of13::OFPFC_DELETE ||
+		command == fluid_msg::of13::OFPFC_DELETE_STRICT;
+	bool send_split  =
+		command == fluid_msg::of13::OFPFC_DELETE_STRICT ||
+		command == fluid_msg::of13::OFPFC_MODIFY_STRICT ||
+		(!merge_variants && command != fluid_msg::of13::OFPFC_DELETE);
+	bool split_merged_rules = !merge_variants && (
+		command == fluid_msg::of13::OFPFC_MODIFY ||
+		command == fluid_msg::of13::OFPFC_MODIFY_STRICT);
+
+	// The first split rule is a copy of the received flowmod with
+	// the table id increased with 2, the instructions are set per
+	// physical switch so they are removed before the others are
+	// copied from it.
+	fluid_msg::of13::FlowMod flowmod_1(flow_mod_message);
+	flowmod_1.table_id(flowmod_1.table_id()+2);
+	flowmod_1.instructions(fluid_msg::of13::InstructionSet());
+	if(
+		command == fluid_msg::of13::OFPFC_ADD &&
+		(flowmod_1.idle_timeout() != 0 || flowmod_1.hard_timeout() != 0)
+	) {
+		flowmod_1.flags(
+			flowmod_1.flags() | fluid_msg::of13::OFPFF_SEND_FLOW_REM);
+	}
+	fluid_msg::of13::FlowMod flowmod_2(flowmod_1);
+	fluid_msg::of13::FlowMod flowmod_merged(flowmod_1);
+	flowmod_2.buffer_id(OFP_NO_BUFFER);
+
+	// Add the match to the flowmods, the merged rule only matches
+	// the virtual switch
+	MetadataTag metadata_tag;
+	metadata_tag.set_virtual_switch(id);
+	if( !metadata_tag.add_to_match(flowmod_merged) ) {
+		// TODO Handle case where metadata is already present
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received flowmod with problematic metadata match field";
+		return;
+	}
+	metadata_tag.set_group(false);
+	metadata_tag.add_to_match(flowmod_1);
+	metadata_tag.set_group(true);
+	metadata_tag.add_to_match(flowmod_2);
+
+	// The flowmods that are pushed as they are
+	std::vector<fluid_msg::of13::FlowMod*> flowmods;
+	if( send_merged ) flowmods.push_back(&flowmod_merged);
+	if( send_split  ) {
+		flowmods.push_back(&flowmod_1);
+		flowmods.push_back(&flowmod_2);
+	}
 
-	// Increase the table id with 2
-	flow_mod_message.table_id(flow_mod_message.table_id()+2);
+	// Only the in_port differs in the match per physical switch,
+	// keep the untranslated matches to rewrite them per switch
+	bool has_in_port = flowmod_1.match().in_port() != nullptr;
+	fluid_msg::of13::Match match_base_1, match_base_2, match_base_merged;
+	if( has_in_port ) {
+		match_base_1      = flowmod_1.match();
+		match_base_2      = flowmod_2.match();
+		match_base_merged = flowmod_merged.match();
+	}
+
+	// Set the matches of the flowmods for a physical switch, false
+	// if the in_port is not on the switch
+	auto rewrite_matches = [&](PhysicalSwitch::pointer ps_ptr) -> bool {
+		if( !has_in_port ) return true;
+
+		fluid_msg::of13::Match match_1(match_base_1);
+		if( !ps_ptr->rewrite_match(match_1,this) ) return false;
+		flowmod_1.match(match_1);
+
+		fluid_msg::of13::Match match_2(match_base_2);
+		ps_ptr->rewrite_match(match_2,this);
+		flowmod_2.match(match_2);
+
+		fluid_msg::of13::Match match_merged(match_base_merged);
+		ps_ptr->rewrite_match(match_merged,this);
+		flowmod_merged.match(match_merged);
+		return true;
+	};
+
+	// The rule an add replaces can have been added with the other
+	// variants, that one has to go or both would match
+	auto replaced_variants = [&](const RuleAccounting& rule_accounting) {
+		std::vector<fluid_msg::of13::FlowMod*> replaced;
+		if( command != fluid_msg::of13::OFPFC_ADD ) return replaced;
+
+		std::vector<fluid_msg::of13::FlowMod*> other_variants;
+		if( send_merged ) other_variants = {&flowmod_1, &flowmod_2};
+		else              other_variants = {&flowmod_merged};
+		for( fluid_msg::of13::FlowMod* flowmod : other_variants ) {
+			if( rule_accounting.contains(id, RuleAccounting::make_key(
+					flowmod->table_id(),
+					flowmod->priority(),
+					flowmod->match())) ) {
+				replaced.push_back(flowmod);
+			}
+		}
+		return replaced;
+	};
+
+	// Rules are only added if they fit in the quota of the slice
+	// on every physical switch they are pushed to
+	unsigned int max_flow_rules = slice->get_max_flow_rules();
+	if(
+		command == fluid_msg::of13::OFPFC_ADD &&
+		max_flow_rules != 0
+	) {
+		for( auto& ps_pair : dependent_switches ) {
+			auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
+			if( !rewrite_matches(ps_ptr) ) continue;
+
+			// Rules replacing an existing rule take no extra room
+			const RuleAccounting& rule_accounting = ps_ptr->get_rule_accounting();
+			size_t new_rules = 0;
+			for( fluid_msg::of13::FlowMod* flowmod : flowmods ) {
+				RuleAccounting::Key key = RuleAccounting::make_key(
+					flowmod->table_id(),
+					flowmod->priority(),
+					flowmod->match());
+				if( !rule_accounting.contains(id, key) ) ++new_rules;
+			}
+			size_t replaced_rules = replaced_variants(rule_accounting).size();
+			new_rules = new_rules > replaced_rules ? new_rules-replaced_rules : 0;
+
+			if( rule_accounting.get_rules(slice->get_id()) + new_rules > max_flow_rules ) {
+				BOOST_LOG_TRIVIAL(warning) << *this
+					<< " exceeded the rule quota of its slice on " << *ps_ptr;
+				send_error_response(
+					fluid_msg::of13::OFPET_FLOW_MOD_FAILED,
+					fluid_msg::of13::OFPFMFC_TABLE_FULL,
+					flow_mod_message);
+				return;
+			}
+		}
+	}
 
+	// Find the switch the referred buffer is in, only that switch
+	// gets the buffer id. The buffer can have been overwritten
+	// since it was checked.
+	uint64_t buffer_datapath_id = 0;
+	uint32_t buffer_id          = OFP_NO_BUFFER;
+	if( flow_mod_message.buffer_id() != OFP_NO_BUFFER &&
+		!hypervisor->get_buffer_table().take(
+			flow_mod_message.buffer_id(),
+			id,
+			buffer_datapath_id,
+			buffer_id)
+	) {
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_BUFFER_UNKNOWN,
+			flow_mod_message);
+		return;
+	}
+
+	// Only the first flowmod pushed gets the buffer
+	fluid_msg::of13::FlowMod& buffer_flowmod = *flowmods.front();
+	for( fluid_msg::of13::FlowMod* flowmod : flowmods ) {
+		flowmod->buffer_id(OFP_NO_BUFFER);
+	}
+
+	// The flowmods are reused for every physical switch, only
+	// the fields that differ per switch are overwritten
 	for( auto& ps_pair : dependent_switches ) {
 		// Fetch a shared pointer to the dependent switch
 		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
 
 		// Rewrite match in_port
-		fluid_msg::of13::Match match = flow_mod_message.match();
-		if( !ps_ptr->rewrite_match(match,this) ) {
+		if( !rewrite_matches(ps_ptr) ) {
 			// If the flowmod matches on an in_port that is not on this physical
 			// switch it can never trigger on this switch, so don't push it to
 			// the physical switch.
-			BOOST_LOG_TRIVIAL(trace) << *this
+			DELFTVISOR_LOG(trace) << *this
 				<< " in_port not on physical switch " << *ps_ptr;
 			continue;
 		}
-		flow_mod_message.match(match);
 
-		// 2 rules need to be pushed to the physical switch
-		fluid_msg::of13::FlowMod flowmod_copy_1(flow_mod_message);
-		fluid_msg::of13::FlowMod flowmod_copy_2(flow_mod_message);
+		buffer_flowmod.buffer_id(
+			ps_pair.first==buffer_datapath_id ? buffer_id : OFP_NO_BUFFER);
 
-		// Add the match to both flowmods
-		MetadataTag metadata_tag;
-		metadata_tag.set_group(false);
-		metadata_tag.set_virtual_switch(id);
-		if( !metadata_tag.add_to_match(flowmod_copy_1) ) {
-			// TODO Handle case where metadata is already present
-			BOOST_LOG_TRIVIAL(warning) << *this
-				<< " received flowmod with problematic metadata match field";
-			return;
-		}
-		metadata_tag.set_group(true);
-		metadata_tag.add_to_match(flowmod_copy_2);
-
-		// Rewrite the instructions
-		fluid_msg::of13::InstructionSet old_instruction_set =
-				flow_mod_message.instructions();
+		// Rewrite the ports and groups in the instructions
 		fluid_msg::of13::InstructionSet
 			output_instruction_set,
 			group_instruction_set;
-		bool has_write_action_group = false;
 		if( !ps_ptr->rewrite_instruction_set(
-				old_instruction_set,
+				prepared_instruction_set,
 				output_instruction_set,
 				group_instruction_set,
-				has_write_action_group,
 				this) ) {
 			BOOST_LOG_TRIVIAL(warning) << *this
 				<< " received flowmod with problematic instruction set";
@@ -398,17 +981,87 @@ void VirtualSwitch::handle_flow_mod(fluid_msg::of13::FlowMod& flow_mod_message)
 
 		// Add the rewritten instructions to the flowmods
 		if( has_write_action_group ) {
-			flowmod_copy_1.instructions(group_instruction_set);
+			flowmod_1.instructions(group_instruction_set);
 		}
 		else {
-			flowmod_copy_1.instructions(output_instruction_set);
+			flowmod_1.instructions(output_instruction_set);
 		}
-		flowmod_copy_2.instructions(group_instruction_set);
+		flowmod_2.instructions(group_instruction_set);
+		flowmod_merged.instructions(group_instruction_set);
 
-		// Send the message to the virtual switch
+		RuleAccounting& rule_accounting = ps_ptr->get_rule_accounting();
+		for( fluid_msg::of13::FlowMod* flowmod : replaced_variants(rule_accounting) ) {
+			delete_strict(*ps_ptr, *flowmod);
+		}
+
+		// Replace the merged rules a modify can't be applied to
+		// by split rules
+		if( split_merged_rules ) {
+			for( const RuleAccounting::MergedRule& merged_rule :
+					rule_accounting.find_merged(id, flowmod_merged) ) {
+				split_merged_rule(*ps_ptr, merged_rule, flowmod_1, flowmod_2);
+			}
+		}
+
+		// Send the messages to the physical switch
 		// TODO Use send_response function so xid is saved
-		ps_ptr->send_message(flowmod_copy_1);
-		ps_ptr->send_message(flowmod_copy_2);
+		for( fluid_msg::of13::FlowMod* flowmod : flowmods ) {
+			push_flow_mod(*ps_ptr, *flowmod);
+		}
+	}
+}
+
+void VirtualSwitch::push_flow_mod(
+		PhysicalSwitch& physical_switch,
+		fluid_msg::of13::FlowMod& flowmod) {
+	physical_switch.send_message(flowmod);
+	physical_switch.get_rule_accounting().handle_flow_mod(
+		id,
+		slice->get_id(),
+		flowmod);
+}
+
+void VirtualSwitch::delete_strict(
+		PhysicalSwitch& physical_switch,
+		fluid_msg::of13::FlowMod& rule) {
+	fluid_msg::of13::FlowMod delete_message(rule);
+	delete_message.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
+	delete_message.cookie_mask(0);
+	delete_message.buffer_id(OFP_NO_BUFFER);
+	delete_message.out_port(fluid_msg::of13::OFPP_ANY);
+	delete_message.out_group(fluid_msg::of13::OFPG_ANY);
+	delete_message.instructions(fluid_msg::of13::InstructionSet());
+	push_flow_mod(physical_switch, delete_message);
+}
+
+void VirtualSwitch::split_merged_rule(
+		PhysicalSwitch& physical_switch,
+		const RuleAccounting::MergedRule& merged_rule,
+		fluid_msg::of13::FlowMod& flowmod_1,
+		fluid_msg::of13::FlowMod& flowmod_2) {
+	fluid_msg::of13::FlowMod merged(
+		0,
+		merged_rule.rule.cookie,
+		0,
+		merged_rule.table_id,
+		fluid_msg::of13::OFPFC_ADD,
+		merged_rule.rule.idle_timeout,
+		merged_rule.rule.hard_timeout,
+		merged_rule.priority,
+		OFP_NO_BUFFER,
+		fluid_msg::of13::OFPP_ANY,
+		fluid_msg::of13::OFPG_ANY,
+		merged_rule.rule.flags);
+	merged.match(merged_rule.match);
+	delete_strict(physical_switch, merged);
+
+	// The split rules get the instructions of the modify, the
+	// timeouts of the merged rule start again
+	for( fluid_msg::of13::FlowMod* variant : {&flowmod_1, &flowmod_2} ) {
+		fluid_msg::of13::FlowMod split(merged);
+		MetadataTag::set_group_in_match(split, variant == &flowmod_2);
+		split.instructions(variant->instructions());
+		push_flow_mod(physical_switch, split);
 	}
 }
 
@@ -488,13 +1141,8 @@ void VirtualSwitch::handle_table_mod(fluid_msg::of13::TableMod& table_mod_messag
 	// TODO
 }
 
-void VirtualSwitch::handle_multipart_request_port_desc(fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received multipart_request_port_description";
-
-	// Create the message
-	fluid_msg::of13::MultipartReplyPortDescription port_description;
-	port_description.xid(multipart_request_message.xid());
-	port_description.flags(0);
+std::vector<fluid_msg::of13::Port> VirtualSwitch::build_port_description() const {
+	std::vector<fluid_msg::of13::Port> port_description;
 
 	// Add all the port descriptions
 	for( const auto& port_pair : port_to_dependent_switch ) {
@@ -505,10 +1153,11 @@ void VirtualSwitch::handle_multipart_request_port_desc(fluid_msg::of13::Multipar
 					.port_map.get_physical(port_no);
 
 		// Get the physical ports from the physical switch
-		auto& phy_ports =
+		auto phy_sw =
 			hypervisor->
-				get_physical_switch_by_datapath_id(port_pair.second)
-					->get_ports();
+				get_physical_switch_by_datapath_id(port_pair.second);
+		if( phy_sw == nullptr ) continue;
+		auto& phy_ports = phy_sw->get_ports();
 
 		// If the port we need exists in the physical switch add
 		// it to the port description message
@@ -521,10 +1170,28 @@ void VirtualSwitch::handle_multipart_request_port_desc(fluid_msg::of13::Multipar
 			port_desc.port_no(port_no);
 
 			// Add the port to the port description message
-			port_description.add_port(port_desc);
+			port_description.push_back(port_desc);
 		}
 	}
 
+	return port_description;
+}
+
+void VirtualSwitch::handle_multipart_request_port_desc(fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received multipart_request_port_description";
+
+	if( !port_description_cache ) {
+		port_description_cache = build_port_description();
+	}
+
+	// Create the message
+	fluid_msg::of13::MultipartReplyPortDescription port_description;
+	port_description.xid(multipart_request_message.xid());
+	port_description.flags(0);
+	for( const fluid_msg::of13::Port& port : *port_description_cache ) {
+		port_description.add_port(port);
+	}
+
 	// Send the message
 	send_message_response(port_description);
 }
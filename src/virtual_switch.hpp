@@ -1,13 +1,17 @@
 #pragma once
 
 #include <map>
+#include <vector>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
 
 #include "bidirectional_map.hpp"
 
 #include "openflow_connection.hpp"
+#include "rule_accounting.hpp"
 
 class PhysicalSwitch;
 class Hypervisor;
@@ -53,20 +57,158 @@ private:
 
 	/// The timer used to backoff between connection attempts
 	boost::asio::deadline_timer connection_backoff_timer;
+	/// The amount of failed connection attempts since the last connection
+	int connection_attempts;
 	/// The function called when the timer expires
 	void backoff_expired(const boost::system::error_code& error);
 	/// Try to connect to the controller
+	/**
+	 * The connect is scheduled by the slice, which limits how
+	 * many switches connect at the same time.
+	 */
 	void try_connect();
+	/// Start the connect on the connection strand
+	void connect_socket();
 	/// The callback when the connection succeeds
 	void handle_connect(const boost::system::error_code& error);
 
+	/// The features reported to the controller
+	struct Features {
+		uint32_t n_buffers;
+		uint8_t n_tables;
+		uint32_t capabilities;
+	};
+	/// The features, calculated on the first request
+	/**
+	 * The features of the physical switches don't change while
+	 * this switch is up, the cache is cleared when it goes down
+	 * and when a physical switch is added or removed.
+	 */
+	boost::optional<Features> features_cache;
+	/// The port descriptions, built on the first request
+	/**
+	 * Cleared when this switch goes down and when a port of a
+	 * physical switch changes.
+	 */
+	boost::optional<std::vector<fluid_msg::of13::Port>> port_description_cache;
+	/// Calculate the features from the dependent switches
+	Features calculate_features() const;
+	/// Build the port descriptions from the dependent switches
+	std::vector<fluid_msg::of13::Port> build_port_description() const;
+
+	/// A barrier request waiting for the physical switches
+	struct PendingBarrier {
+		/// The xid of the barrier request of the controller
+		uint32_t xid;
+		/// The amount of physical switches that still have to reply
+		int remaining;
+	};
+	/// The barriers waiting for replies, barrier id -> PendingBarrier
+	/**
+	 * The barrier id's increase so the barriers are ordered
+	 * in the order the controller sent them.
+	 */
+	std::map<uint64_t,PendingBarrier> pending_barriers;
+	/// The barrier id given to the next barrier request
+	uint64_t next_barrier_id;
+	/// Answer the barriers at the front that are completed
+	void send_barrier_replies();
+
+	/// A statistics request waiting for the physical switches
+	struct PendingStats {
+		/// The xid of the statistics request of the controller
+		uint32_t xid;
+		/// The multipart type of the request
+		uint16_t type;
+		/// The amount of physical switches that still have to reply
+		int remaining;
+		/// The statistics received so far, merged by virtual id
+		std::map<uint32_t,fluid_msg::of13::PortStats> port_stats;
+		std::map<uint32_t,fluid_msg::of13::GroupStats> group_stats;
+		/// The flow statistics, merged by table, priority, cookie and match
+		std::map<RuleAccounting::Key,fluid_msg::of13::FlowStats> flow_stats;
+	};
+	/// The statistics requests waiting for replies, stats id -> PendingStats
+	std::unordered_map<uint64_t,PendingStats> pending_stats;
+	/// The stats id given to the next statistics request
+	uint64_t next_stats_id;
+	/// Start a statistics request on every dependent switch
+	/**
+	 * The request function is called with the physical switch
+	 * and the stats id of the new request, it returns if the
+	 * switch is going to report back.
+	 */
+	void request_stats(
+		uint32_t xid,
+		uint16_t type,
+		boost::function<bool(PhysicalSwitch&,uint64_t)> request);
+	/// Merge the statistics of a physical switch into a request
+	void port_stats_received(
+		uint64_t stats_id,
+		uint32_t port_no,
+		const std::vector<fluid_msg::of13::PortStats>& stats);
+	void group_stats_received(
+		uint64_t stats_id,
+		uint32_t group_id,
+		const std::vector<fluid_msg::of13::GroupStats>& stats);
+	void flow_stats_received(
+		uint64_t stats_id,
+		const std::vector<fluid_msg::of13::FlowStats>& stats);
+	/// Answer a statistics request if all physical switches replied
+	void send_stats_reply(uint64_t stats_id);
+
+	/// Split a PacketOut over the physical switches with the output ports
+	/**
+	 * Every physical switch that has a port the packet is output
+	 * on gets its own PacketOut, so the packet doesn't have to be
+	 * forwarded through the network. The other actions are kept in
+	 * order in every PacketOut. Group actions and outputs to other
+	 * reserved ports can't be split.
+	 * \param plan Filled with the virtual action list per physical datapath id
+	 * \return False if the actions can't be split
+	 */
+	bool plan_packet_out(
+		fluid_msg::of13::PacketOut& packet_out_message,
+		std::map<uint64_t,fluid_msg::ActionList>& plan) const;
+
+	/// Send a rewritten flowmod to a physical switch and account it
+	void push_flow_mod(
+		PhysicalSwitch& physical_switch,
+		fluid_msg::of13::FlowMod& flowmod);
+	/// Delete exactly 1 rewritten rule from a physical switch
+	void delete_strict(
+		PhysicalSwitch& physical_switch,
+		fluid_msg::of13::FlowMod& rule);
+	/// Replace a merged rule by 2 rules with the instructions of a modify
+	/**
+	 * \param flowmod_1 The modify for packets without the group bit
+	 * \param flowmod_2 The modify for packets with the group bit
+	 */
+	void split_merged_rule(
+		PhysicalSwitch& physical_switch,
+		const RuleAccounting::MergedRule& merged_rule,
+		fluid_msg::of13::FlowMod& flowmod_1,
+		fluid_msg::of13::FlowMod& flowmod_2);
+
+	/// Tell the controller a port was added or is going to be removed
+	void send_port_status(uint32_t port_number, uint8_t reason);
+
 	/// Start this virtual switch, try to connect to the controller
 	void start();
 	/// Stop the controller connection of this virtual switch
 	void stop();
+
+	/// Get the handlers of the messages a controller sends
+	static const DispatchTable& get_dispatch_table();
 public:
 	typedef boost::shared_ptr<VirtualSwitch> pointer;
 
+	/// Where a virtual port is in the physical network
+	struct PortConfiguration {
+		uint64_t physical_datapath_id;
+		uint32_t physical_port_number;
+	};
+
 	/// Allow creating a shared pointer of this class
 	pointer shared_from_this();
 
@@ -79,6 +221,8 @@ public:
 
 	/// Get the unique id of this virtual switch
 	int get_id() const;
+	/// Get the datapath id the controller sees
+	uint64_t get_datapath_id() const;
 	/// Get the slice this virtual switch is in
 	const Slice* get_slice() const;
 	/// Get all the ports on this switch
@@ -95,6 +239,16 @@ public:
 		uint32_t physical_port_number);
 	/// Remove a port from this virtual switch
 	void remove_port(uint32_t port_number);
+	/// Change the ports of this virtual switch while it is running
+	/**
+	 * Only the ports that differ are removed and added. When this
+	 * switch is connected its registrations at the physical
+	 * switches are updated, the controller is told about the
+	 * changed ports and only the physical switches this switch
+	 * spans update their rules.
+	 * \param ports The new ports, virtual port number -> PortConfiguration
+	 */
+	void reconfigure_ports(const std::map<uint32_t,PortConfiguration>& ports);
 	/// Get the virtual -> physical port map for a dependent switch
 	const bidirectional_map<uint32_t,uint32_t>& get_port_map(
 		uint64_t physical_datapath_id) const;
@@ -105,8 +259,18 @@ public:
 	 * network has changed. It checks if all physical switches this
 	 * virtual switch depends on are online and if packets can be
 	 * routed between all of them.
+	 * \return If the state of this virtual switch changed
 	 */
-	void check_online();
+	bool check_online();
+
+	/// Connect to the controller, called by the slice when it is the turn of this switch
+	void connect();
+
+	/// Forget the cached port descriptions, a port of a physical switch changed
+	void invalidate_port_description();
+
+	/// Called by a physical switch when a requested barrier completed
+	void barrier_completed(uint64_t barrier_id);
 
 	/// Tell this virtual switch to go down
 	void go_down();
@@ -118,23 +282,12 @@ public:
 	/// Print this virtual switch to a stream
 	void print_to_stream(std::ostream& os) const;
 
-	/// Handle openflow messages
+	/// Handle openflow messages, the messages a controller
+	/// doesn't send are rejected before they are unpacked
 	void handle_error           (fluid_msg::of13::Error& error_message);
 	void handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message);
-	void handle_features_reply  (fluid_msg::of13::FeaturesReply& features_reply_message);
-
-	void handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message);
-	void handle_config_reply  (fluid_msg::of13::GetConfigReply& config_reply_message);
-	void handle_set_config    (fluid_msg::of13::SetConfig& set_config_message);
-
-	void handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message);
-	void handle_barrier_reply  (fluid_msg::of13::BarrierReply& barrier_reply_message);
-
-	void handle_packet_in (fluid_msg::of13::PacketIn& packet_in_message);
-	void handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message);
-
-	void handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message);
-	void handle_port_status (fluid_msg::of13::PortStatus& port_status_message);
+	void handle_barrier_request (fluid_msg::of13::BarrierRequest& barrier_request_message);
+	void handle_packet_out      (fluid_msg::of13::PacketOut& packet_out_message);
 
 	void handle_flow_mod (fluid_msg::of13::FlowMod& flow_mod_message);
 	void handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message);
@@ -142,44 +295,10 @@ public:
 	void handle_table_mod(fluid_msg::of13::TableMod& table_mod_message);
 	void handle_meter_mod(fluid_msg::of13::MeterMod& meter_mod_message);
 
-	void handle_queue_config_request(fluid_msg::of13::QueueGetConfigRequest& queue_config_request);
-	void handle_queue_config_reply  (fluid_msg::of13::QueueGetConfigReply& queue_config_reply);
-
-	void handle_role_request(fluid_msg::of13::RoleRequest& role_request_message);
-	void handle_role_reply  (fluid_msg::of13::RoleReply& role_reply_message);
-
-	void handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message);
-	void handle_get_async_reply  (fluid_msg::of13::GetAsyncReply& async_reply_message);
-	void handle_set_async        (fluid_msg::of13::SetAsync& set_async_message);
-
-	void handle_multipart_request_desc          (fluid_msg::of13::MultipartRequestDesc& multipart_request_message);
 	void handle_multipart_request_flow          (fluid_msg::of13::MultipartRequestFlow& multipart_request_message);
-	void handle_multipart_request_aggregate     (fluid_msg::of13::MultipartRequestAggregate& multipart_request_message);
-	void handle_multipart_request_table         (fluid_msg::of13::MultipartRequestTable& multipart_request_message);
 	void handle_multipart_request_port_stats    (fluid_msg::of13::MultipartRequestPortStats& multipart_request_message);
-	void handle_multipart_request_queue         (fluid_msg::of13::MultipartRequestQueue& multipart_request_message);
 	void handle_multipart_request_group         (fluid_msg::of13::MultipartRequestGroup& multipart_request_message);
-	void handle_multipart_request_group_desc    (fluid_msg::of13::MultipartRequestGroupDesc& multipart_request_message);
 	void handle_multipart_request_group_features(fluid_msg::of13::MultipartRequestGroupFeatures& multipart_request_message);
-	void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message);
-	void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message);
 	void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message);
-	void handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message);
 	void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message);
-	void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message);
-	void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message);
-	void handle_multipart_reply_flow          (fluid_msg::of13::MultipartReplyFlow& multipart_request_message);
-	void handle_multipart_reply_aggregate     (fluid_msg::of13::MultipartReplyAggregate& multipart_request_message);
-	void handle_multipart_reply_table         (fluid_msg::of13::MultipartReplyTable& multipart_request_message);
-	void handle_multipart_reply_port_stats    (fluid_msg::of13::MultipartReplyPortStats& multipart_request_message);
-	void handle_multipart_reply_queue         (fluid_msg::of13::MultipartReplyQueue& multipart_request_message);
-	void handle_multipart_reply_group         (fluid_msg::of13::MultipartReplyGroup& multipart_request_message);
-	void handle_multipart_reply_group_desc    (fluid_msg::of13::MultipartReplyGroupDesc& multipart_request_message);
-	void handle_multipart_reply_group_features(fluid_msg::of13::MultipartReplyGroupFeatures& multipart_request_message);
-	void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message);
-	void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message);
-	void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message);
-	void handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message);
-	void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message);
-	void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message);
 };
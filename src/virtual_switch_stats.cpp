@@ -0,0 +1,314 @@
+#include "virtual_switch.hpp"
+#include "physical_switch.hpp"
+#include "hypervisor.hpp"
+
+#include "tag.hpp"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// The maximum length of an OpenFlow message
+	constexpr size_t max_message_length = 65535;
+	/// The length of a multipart reply without its body
+	constexpr size_t multipart_reply_header_length = 16;
+	/// The length of the statistics of 1 port
+	constexpr size_t port_stats_length = 112;
+
+	/// The packed length of the statistics of 1 port, group or flow
+	size_t stats_length(fluid_msg::of13::PortStats&) {
+		return port_stats_length;
+	}
+	size_t stats_length(fluid_msg::of13::GroupStats& group_stats) {
+		return group_stats.length();
+	}
+	size_t stats_length(fluid_msg::of13::FlowStats& flow_stats) {
+		return flow_stats.length();
+	}
+
+	/// Make the key the flow statistics of several switches are merged by
+	/**
+	 * The key of the rule accounting is used since a switch can
+	 * report the fields of a match in any order, the cookie is
+	 * added after it.
+	 */
+	RuleAccounting::Key flow_stats_key(fluid_msg::of13::FlowStats& flow_stats) {
+		RuleAccounting::Key key = RuleAccounting::make_key(
+			flow_stats.table_id(),
+			flow_stats.priority(),
+			flow_stats.match());
+
+		uint64_t cookie = flow_stats.cookie();
+		for( int shift=56; shift>=0; shift-=8 ) {
+			key.push_back((cookie>>shift)&0xff);
+		}
+		return key;
+	}
+
+	/// Send statistics to the controller split over several replies
+	/**
+	 * The statistics are split on their packed length so every
+	 * reply fits in the 16 bit length of an OpenFlow message.
+	 */
+	template<class Reply, class Stats, class Map>
+	void send_chunked_reply(
+			VirtualSwitch& virtual_switch,
+			uint32_t xid,
+			Map& stats,
+			void (Reply::*add_stats)(Stats)) {
+		auto it = stats.begin();
+		do {
+			Reply reply(xid, 0);
+			size_t length = multipart_reply_header_length;
+			for( ; it != stats.end(); ++it ) {
+				size_t entry_length = stats_length(it->second);
+				// A reply holds at least 1 entry so it always progresses
+				if( length != multipart_reply_header_length &&
+					length+entry_length > max_message_length ) break;
+				(reply.*add_stats)(it->second);
+				length += entry_length;
+			}
+			if( it != stats.end() ) {
+				reply.flags(fluid_msg::of13::OFPMPF_REPLY_MORE);
+			}
+			virtual_switch.send_message_response(reply);
+		} while( it != stats.end() );
+	}
+}
+
+void VirtualSwitch::request_stats(
+		uint32_t xid,
+		uint16_t type,
+		boost::function<bool(PhysicalSwitch&,uint64_t)> request) {
+	uint64_t stats_id = next_stats_id++;
+	PendingStats& pending = pending_stats[stats_id];
+	pending.xid       = xid;
+	pending.type      = type;
+	pending.remaining = dependent_switches.size();
+
+	// Wait for every physical switch this virtual switch spans,
+	// the replies can arrive directly when they are cached
+	for( const auto& dep_sw : dependent_switches ) {
+		auto sw_ptr =
+			hypervisor->
+				get_physical_switch_by_datapath_id(dep_sw.first);
+		if( sw_ptr == nullptr || !request(*sw_ptr, stats_id) ) {
+			auto it = pending_stats.find(stats_id);
+			if( it != pending_stats.end() ) --it->second.remaining;
+		}
+	}
+
+	// If there is nothing to wait for answer directly
+	send_stats_reply(stats_id);
+}
+
+void VirtualSwitch::port_stats_received(
+		uint64_t stats_id,
+		uint32_t port_no,
+		const std::vector<fluid_msg::of13::PortStats>& stats) {
+	auto it = pending_stats.find(stats_id);
+	if( it == pending_stats.end() ) return;
+
+	// Every port is on exactly 1 physical switch so
+	// nothing has to be merged
+	for( fluid_msg::of13::PortStats port_stats : stats ) {
+		if( port_no != fluid_msg::of13::OFPP_ANY && port_stats.port_no() != port_no ) continue;
+		it->second.port_stats[port_stats.port_no()] = port_stats;
+	}
+
+	--it->second.remaining;
+	send_stats_reply(stats_id);
+}
+
+void VirtualSwitch::group_stats_received(
+		uint64_t stats_id,
+		uint32_t group_id,
+		const std::vector<fluid_msg::of13::GroupStats>& stats) {
+	auto it = pending_stats.find(stats_id);
+	if( it == pending_stats.end() ) return;
+
+	// A group exists on every physical switch that uses it,
+	// the counters are added together
+	for( fluid_msg::of13::GroupStats group_stats : stats ) {
+		if( group_id != fluid_msg::of13::OFPG_ALL && group_stats.group_id() != group_id ) continue;
+
+		auto group_it = it->second.group_stats.find(group_stats.group_id());
+		if( group_it == it->second.group_stats.end() ) {
+			it->second.group_stats[group_stats.group_id()] = group_stats;
+			continue;
+		}
+
+		fluid_msg::of13::GroupStats& merged = group_it->second;
+		merged.ref_count(std::max(merged.ref_count(), group_stats.ref_count()));
+		merged.packet_count(merged.packet_count() + group_stats.packet_count());
+		merged.byte_count(merged.byte_count() + group_stats.byte_count());
+	}
+
+	--it->second.remaining;
+	send_stats_reply(stats_id);
+}
+
+void VirtualSwitch::flow_stats_received(
+		uint64_t stats_id,
+		const std::vector<fluid_msg::of13::FlowStats>& stats) {
+	auto it = pending_stats.find(stats_id);
+	if( it == pending_stats.end() ) return;
+
+	// A flow is installed on every physical switch the virtual
+	// switch spans, with and without the group bit, the
+	// counters of the copies are added together
+	for( fluid_msg::of13::FlowStats flow_stats : stats ) {
+		RuleAccounting::Key key = flow_stats_key(flow_stats);
+
+		auto flow_it = it->second.flow_stats.find(key);
+		if( flow_it == it->second.flow_stats.end() ) {
+			it->second.flow_stats.emplace(key, flow_stats);
+			continue;
+		}
+
+		fluid_msg::of13::FlowStats& merged = flow_it->second;
+		merged.packet_count(merged.packet_count() + flow_stats.packet_count());
+		merged.byte_count(merged.byte_count() + flow_stats.byte_count());
+		if( flow_stats.duration_sec() > merged.duration_sec() ) {
+			merged.duration_sec(flow_stats.duration_sec());
+			merged.duration_nsec(flow_stats.duration_nsec());
+		}
+	}
+
+	--it->second.remaining;
+	send_stats_reply(stats_id);
+}
+
+void VirtualSwitch::send_stats_reply(uint64_t stats_id) {
+	auto it = pending_stats.find(stats_id);
+	if( it == pending_stats.end() || it->second.remaining > 0 ) return;
+
+	// Remove the request first, the controller could have gone
+	// away while the physical switches were polled
+	PendingStats pending = std::move(it->second);
+	pending_stats.erase(it);
+	if( !is_connected() ) return;
+
+	switch( pending.type ) {
+	case fluid_msg::of13::OFPMP_PORT_STATS:
+		send_chunked_reply(
+			*this,
+			pending.xid,
+			pending.port_stats,
+			&fluid_msg::of13::MultipartReplyPortStats::add_port_stat);
+		break;
+	case fluid_msg::of13::OFPMP_GROUP:
+		send_chunked_reply(
+			*this,
+			pending.xid,
+			pending.group_stats,
+			&fluid_msg::of13::MultipartReplyGroup::add_group_stat);
+		break;
+	case fluid_msg::of13::OFPMP_FLOW:
+		send_chunked_reply(
+			*this,
+			pending.xid,
+			pending.flow_stats,
+			&fluid_msg::of13::MultipartReplyFlow::add_flow_stats);
+		break;
+	}
+}
+
+void VirtualSwitch::handle_multipart_request_port_stats(fluid_msg::of13::MultipartRequestPortStats& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart request port stats";
+
+	uint32_t port_no = multipart_request_message.port_no();
+	if( port_no != fluid_msg::of13::OFPP_ANY && port_to_dependent_switch.count(port_no) == 0 ) {
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_BAD_PORT,
+			multipart_request_message);
+		return;
+	}
+
+	// Only the physical switch with the port has to be polled
+	// when a single port is requested
+	uint64_t port_datapath_id = port_no != fluid_msg::of13::OFPP_ANY ?
+		port_to_dependent_switch.at(port_no) : 0;
+	pointer self = shared_from_this();
+	request_stats(
+		multipart_request_message.xid(),
+		fluid_msg::of13::OFPMP_PORT_STATS,
+		[=](PhysicalSwitch& physical_switch, uint64_t stats_id) {
+			if(
+				port_no != fluid_msg::of13::OFPP_ANY &&
+				physical_switch.get_features().datapath_id != port_datapath_id
+			) {
+				return false;
+			}
+			physical_switch.request_port_stats(
+				self,
+				boost::bind(
+					&VirtualSwitch::port_stats_received,
+					self,
+					stats_id,
+					port_no,
+					_1));
+			return true;
+		});
+}
+
+void VirtualSwitch::handle_multipart_request_group(fluid_msg::of13::MultipartRequestGroup& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart request group stats";
+
+	uint32_t group_id = multipart_request_message.group_id();
+	pointer self = shared_from_this();
+	request_stats(
+		multipart_request_message.xid(),
+		fluid_msg::of13::OFPMP_GROUP,
+		[=](PhysicalSwitch& physical_switch, uint64_t stats_id) {
+			physical_switch.request_group_stats(
+				self,
+				boost::bind(
+					&VirtualSwitch::group_stats_received,
+					self,
+					stats_id,
+					group_id,
+					_1));
+			return true;
+		});
+}
+
+void VirtualSwitch::handle_multipart_request_flow(fluid_msg::of13::MultipartRequestFlow& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart request flow stats";
+
+	// The physical switches are asked for the flows with the
+	// metadata of this switch, a match on the metadata bits of
+	// the hypervisor can't be combined with that
+	fluid_msg::of13::MultipartRequestFlow tagged_request(multipart_request_message);
+	MetadataTag metadata_tag(
+		uint64_t(id)<<1,
+		uint64_t(MetadataTag::max_virtual_switch_id)<<1);
+	if( !metadata_tag.add_to_match(tagged_request) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " requested flow stats matching on the metadata of the hypervisor";
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_EPERM,
+			multipart_request_message);
+		return;
+	}
+
+	pointer self = shared_from_this();
+	fluid_msg::of13::MultipartRequestFlow* request = &multipart_request_message;
+	request_stats(
+		multipart_request_message.xid(),
+		fluid_msg::of13::OFPMP_FLOW,
+		[=](PhysicalSwitch& physical_switch, uint64_t stats_id) {
+			physical_switch.request_flow_stats(
+				self,
+				*request,
+				boost::bind(
+					&VirtualSwitch::flow_stats_received,
+					self,
+					stats_id,
+					_1));
+			return true;
+		});
+}
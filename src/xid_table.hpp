@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <utility>
+
+/// The requests send to a switch that wait for a reply, xid -> Value
+/**
+ * The entries are kept in a ring of a fixed capacity in the
+ * order they were inserted. Every entry in a table gets the same
+ * timeout so the ring is also ordered on the deadlines, expiring
+ * only looks at the oldest entries. When the ring is full the
+ * oldest entry is evicted to make room.
+ *
+ * Every insert gets the next sequence number, the slot of an
+ * entry is its sequence number modulo the capacity. The index
+ * maps an xid to the sequence number, an index entry is only
+ * valid if the slot still holds that sequence number. Lookups
+ * and inserts are O(1) and the memory is bounded by the capacity.
+ *
+ * Entries that are answered out of order leave an empty slot
+ * that is reused once the entries before it are gone.
+ *
+ * The callbacks get the xid and the value of the entry after it
+ * is removed, they may insert new entries in the table.
+ *
+ * An XidTable is not thread safe, all tables are only used on
+ * the control strand.
+ */
+template<class Value>
+class XidTable {
+public:
+	typedef std::chrono::steady_clock::time_point time_point;
+
+private:
+	struct Entry {
+		/// The sequence number of the insert, the generation of the slot
+		uint64_t sequence;
+		/// The xid of the request
+		uint32_t xid;
+		/// When the reply should have arrived
+		time_point deadline;
+		/// If the entry still waits for a reply
+		bool live;
+		Value value;
+
+		Entry() : sequence(0), xid(0), live(false) {}
+	};
+	/// The ring of entries
+	std::vector<Entry> entries;
+	/// The sequence number of the oldest entry in the ring
+	uint64_t first;
+	/// The sequence number of the next insert
+	uint64_t next;
+	/// The entries that wait for a reply, xid -> sequence number
+	std::unordered_map<uint32_t,uint64_t> index;
+
+	Entry& slot(uint64_t sequence) {
+		return entries[sequence % entries.size()];
+	}
+	/// Drop the empty slots at the front so the oldest entry is live
+	void pop_empty() {
+		while( first != next && !slot(first).live ) ++first;
+	}
+	/// Remove a live entry and give back its value
+	Value take(Entry& entry) {
+		entry.live = false;
+		index.erase(entry.xid);
+		Value value = std::move(entry.value);
+		entry.value = Value();
+		pop_empty();
+		return value;
+	}
+
+public:
+	/// Create a table holding at most capacity entries
+	explicit XidTable(size_t capacity) :
+		entries(capacity==0 ? 1 : capacity),
+		first(0),
+		next(0) {
+		index.reserve(entries.size());
+	}
+
+	/// Add an entry, evicts the oldest entry if the table is full
+	/**
+	 * An entry that is still waiting with the same xid is evicted
+	 * as well, that only happens if the xid's wrap around.
+	 */
+	template<class Callback>
+	void insert(uint32_t xid, Value value, time_point deadline, Callback evicted) {
+		auto it = index.find(xid);
+		if( it != index.end() ) {
+			Value old_value = take(slot(it->second));
+			evicted(xid, old_value);
+		}
+		if( next - first == entries.size() ) {
+			Entry& oldest = slot(first);
+			uint32_t oldest_xid = oldest.xid;
+			Value old_value = take(oldest);
+			evicted(oldest_xid, old_value);
+		}
+
+		Entry& entry   = slot(next);
+		entry.sequence = next;
+		entry.xid      = xid;
+		entry.deadline = deadline;
+		entry.live     = true;
+		entry.value    = std::move(value);
+		index[xid]     = next;
+		++next;
+	}
+
+	/// Get the value of an entry, nullptr if there is none
+	Value* find(uint32_t xid) {
+		auto it = index.find(xid);
+		if( it == index.end() ) return nullptr;
+		Entry& entry = slot(it->second);
+		if( !entry.live || entry.sequence != it->second ) return nullptr;
+		return &entry.value;
+	}
+
+	/// Remove an entry and give back its value
+	/**
+	 * \return If there was an entry with this xid
+	 */
+	bool erase(uint32_t xid, Value& value) {
+		if( find(xid) == nullptr ) return false;
+		value = take(slot(index[xid]));
+		return true;
+	}
+
+	/// Remove the entries whose deadline passed
+	/**
+	 * \return The amount of expired entries
+	 */
+	template<class Callback>
+	size_t expire(time_point now, Callback expired) {
+		size_t num_expired = 0;
+		while( first != next && slot(first).deadline <= now ) {
+			Entry& oldest = slot(first);
+			uint32_t oldest_xid = oldest.xid;
+			Value old_value = take(oldest);
+			++num_expired;
+			expired(oldest_xid, old_value);
+		}
+		return num_expired;
+	}
+
+	/// Remove all entries without calling back
+	void clear() {
+		for( Entry& entry : entries ) {
+			entry.live  = false;
+			entry.value = Value();
+		}
+		index.clear();
+		first = next;
+	}
+
+	/// The amount of entries waiting for a reply
+	size_t size() const {
+		return index.size();
+	}
+	/// The maximum amount of entries in the ring
+	size_t capacity() const {
+		return entries.size();
+	}
+};